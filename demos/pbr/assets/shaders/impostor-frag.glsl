@@ -0,0 +1,40 @@
+#version 330 core
+
+#define LIGHT_DIRECTION u_shared_data[5].xyz
+#define LIGHT_INTENSITY u_shared_data[5].w
+
+#define ALBEDO_ATLAS    u_tex[0]
+#define NORMAL_ATLAS    u_tex[1]
+#define IRRADIANCE_MAP  u_common_cube[0]
+
+uniform vec4 u_shared_data[6];
+uniform sampler2D u_tex[2];
+uniform samplerCube u_common_cube[1];
+
+in vec2 v_uv;
+in vec3 v_position;
+in vec3 v_depth_axis;
+flat in mat3 v_rotation;
+
+out vec4 FragColor;
+
+void main()
+{
+    vec4 albedo = texture(ALBEDO_ATLAS, v_uv);
+    if (albedo.a < 0.5) {
+        discard;
+    }
+    vec4 normal_depth = texture(NORMAL_ATLAS, v_uv);
+
+    // Diffuse only: the irradiance the full shader would use, plus the sun.
+    vec3 n = normalize(v_rotation * (normal_depth.xyz * 2.0 - 1.0));
+    vec3 light = texture(IRRADIANCE_MAP, n).rgb;
+    light += max(dot(n, -LIGHT_DIRECTION), 0.0) * LIGHT_INTENSITY;
+    FragColor = vec4(albedo.rgb * light, 1.0);
+
+    // Depth of the baked surface, not of the quad: impostors intersect the scene correctly.
+    mat4 vp = mat4(u_shared_data[0], u_shared_data[1],
+                    u_shared_data[2], u_shared_data[3]);
+    vec4 clip = vp * vec4(v_position + v_depth_axis * (normal_depth.a * 2.0 - 1.0), 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+}
@@ -0,0 +1,64 @@
+#version 330 core
+
+#define SPHERE u_data[0]
+#define FRAMES u_data[1].x
+
+#define CAMERA_POSITION u_shared_data[4].xyz
+
+uniform vec4 u_data[2];
+uniform vec4 u_shared_data[6];
+
+layout(location=0) in vec3 a_position;
+layout(location=8) in vec4 a_instance0; // Rows of the world matrix.
+layout(location=9) in vec4 a_instance1;
+layout(location=10) in vec4 a_instance2;
+
+out vec2 v_uv;
+out vec3 v_position;
+out vec3 v_depth_axis;
+flat out mat3 v_rotation;
+
+// Direction of view (x, y) of the octahedral grid, as the_impostor_dir.
+vec3 ViewDir(vec2 cell)
+{
+    vec2 e = (cell + 0.5) / FRAMES * 2.0 - 1.0;
+    vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+    if (n.y < 0.0) {
+        n.xz = (1.0 - abs(e.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+// Cell of the view nearest to an object space direction.
+vec2 ViewCell(vec3 d)
+{
+    d /= abs(d.x) + abs(d.y) + abs(d.z);
+    vec2 e = d.xz;
+    if (d.y < 0.0) {
+        e = (1.0 - abs(d.zx)) * vec2(d.x >= 0.0 ? 1.0 : -1.0, d.z >= 0.0 ? 1.0 : -1.0);
+    }
+    return clamp(floor((e * 0.5 + 0.5) * FRAMES), 0.0, FRAMES - 1.0);
+}
+
+void main()
+{
+    mat4 model = transpose(mat4(a_instance0, a_instance1, a_instance2, vec4(0.0, 0.0, 0.0, 1.0)));
+    mat4 vp = mat4(u_shared_data[0], u_shared_data[1],
+                    u_shared_data[2], u_shared_data[3]);
+
+    // View picked in object space, the quad lies in its plane: the atlas cell maps onto it.
+    vec3 center = (model * vec4(SPHERE.xyz, 1.0)).xyz;
+    vec3 to_eye = transpose(mat3(model)) * (CAMERA_POSITION - center);
+    vec2 cell = ViewCell(normalize(to_eye));
+    vec3 dir = ViewDir(cell);
+    vec3 ref = abs(dir.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(ref, dir));
+    vec3 up = cross(dir, right);
+
+    vec3 corner = SPHERE.xyz + (right * a_position.x + up * a_position.y) * SPHERE.w;
+    v_position = (model * vec4(corner, 1.0)).xyz;
+    v_depth_axis = mat3(model) * dir * SPHERE.w;
+    v_rotation = mat3(model);
+    v_uv = (cell + a_position.xy * 0.5 + 0.5) / FRAMES;
+    gl_Position = vp * vec4(v_position, 1.0);
+}
@@ -0,0 +1,14 @@
+#version 330 core
+
+in vec2 v_uv;
+in vec4 v_color;
+
+out vec4 FragColor;
+
+void main()
+{
+    // Soft disc, premultiplied for additive blending.
+    float d = length(v_uv * 2.0 - 1.0);
+    float alpha = v_color.a * (1.0 - smoothstep(0.5, 1.0, d));
+    FragColor = vec4(v_color.rgb * alpha, alpha);
+}
@@ -0,0 +1,34 @@
+#version 330 core
+
+#define SIZE_BEGIN   u_data[2].x
+#define SIZE_END     u_data[2].y
+#define COLOR_BEGIN  u_data[0]
+#define COLOR_END    u_data[1]
+
+#define CAMERA_RIGHT u_shared_data[4].xyz
+#define CAMERA_UP    u_shared_data[5].xyz
+
+uniform vec4 u_data[3];
+uniform vec4 u_shared_data[6];
+
+layout(location=0) in vec3 a_position;
+layout(location=2) in vec2 a_uv;
+layout(location=8) in vec4 a_instance0; // xyz position, w normalized age.
+
+out vec2 v_uv;
+out vec4 v_color;
+
+void main()
+{
+    mat4 vp = mat4(u_shared_data[0], u_shared_data[1],
+                    u_shared_data[2], u_shared_data[3]);
+
+    // Camera facing quad around the particle, growing or shrinking with age.
+    float age = clamp(a_instance0.w, 0.0, 1.0);
+    float size = mix(SIZE_BEGIN, SIZE_END, age);
+    vec3 position = a_instance0.xyz + (CAMERA_RIGHT * a_position.x + CAMERA_UP * a_position.y) * size;
+
+    v_uv = a_uv;
+    v_color = mix(COLOR_BEGIN, COLOR_END, age);
+    gl_Position = vp * vec4(position, 1.0);
+}
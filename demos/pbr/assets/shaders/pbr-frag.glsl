@@ -38,7 +38,7 @@ uniform vec4        u_data[7];
 uniform vec4        u_shared_data[6];
 
 uniform sampler2D   u_tex[4];
-uniform sampler2D   u_common_tex[1];
+uniform sampler2D   u_common_tex[2];
 uniform samplerCube u_common_cube[2];
 
 // Normal distribution function (from filament documentation)
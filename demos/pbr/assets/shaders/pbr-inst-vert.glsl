@@ -0,0 +1,65 @@
+#version 330 core
+
+// Instanced variant of pbr: the unit data of every instance comes in a_data.
+#define TILING_X a_data[5].y
+#define TILING_Y a_data[5].z
+#define PALETTE_ROW a_data[6].w
+
+#define PALETTE_MAP u_common_tex[1]
+
+uniform vec4 u_shared_data[6];
+uniform sampler2D u_common_tex[2];
+
+layout(location=0) in vec3 a_position;
+layout(location=1) in vec3 a_normal;
+layout(location=2) in vec3 a_tangent;
+layout(location=3) in vec3 a_bitangent;
+layout(location=4) in vec2 a_uv;
+layout(location=5) in vec4 a_joints;
+layout(location=6) in vec4 a_weights;
+layout(location=8) in vec4 a_data[7];
+
+out Vertex
+{
+    mat3 tbn;
+    vec3 position;
+    vec2 uv;
+} v_out;
+
+flat out vec4 v_material[3]; // a_data[4] to a_data[6], read by the fragment shader.
+
+// Skinning matrix of a joint: three texels (rows of an affine 3x4) of the palette row.
+mat4 Joint(float joint)
+{
+    ivec2 p = ivec2(int(joint) * 3, int(PALETTE_ROW));
+    vec4 r0 = texelFetch(PALETTE_MAP, p, 0);
+    vec4 r1 = texelFetch(PALETTE_MAP, p + ivec2(1, 0), 0);
+    vec4 r2 = texelFetch(PALETTE_MAP, p + ivec2(2, 0), 0);
+    return transpose(mat4(r0, r1, r2, vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+void main()
+{
+    mat4 model = mat4(a_data[0], a_data[1],
+                        a_data[2], a_data[3]);
+    mat4 vp = mat4(u_shared_data[0], u_shared_data[1],
+                    u_shared_data[2], u_shared_data[3]);
+
+    // Static meshes have no palette row (and no joint attributes).
+    if (PALETTE_ROW >= 0.0) {
+        model = model * (Joint(a_joints.x) * a_weights.x + Joint(a_joints.y) * a_weights.y +
+                         Joint(a_joints.z) * a_weights.z + Joint(a_joints.w) * a_weights.w);
+    }
+
+    v_material[0] = a_data[4];
+    v_material[1] = a_data[5];
+    v_material[2] = a_data[6];
+
+    v_out.position = vec3(model * vec4(a_position, 1.0));
+    v_out.uv = vec2(a_uv.x * TILING_X, a_uv.y * TILING_Y);
+
+    // Pass tangent space basis vectors (for normal mapping).
+    v_out.tbn = mat3(model) * mat3(normalize(a_tangent), normalize(a_bitangent), normalize(a_normal));
+
+    gl_Position = vp * model * vec4(a_position, 1.0);
+}
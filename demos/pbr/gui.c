@@ -7,6 +7,8 @@
 #include "render/pixels_internal.h"
 
 #include <glad/glad.h>
+#include <mathc.h>
+#include <string.h>
 
 #define NK_INCLUDE_FIXED_TYPES
 #define NK_INCLUDE_STANDARD_IO
@@ -36,17 +38,92 @@ nuklear_init(void)
 	nk_glfw3_font_stash_end(&glfw);
 }
 
+/* Quaternion to Euler angles in degrees: x (roll), y (pitch) and z (yaw), applied in that order. */
+static void
+quat_to_euler(float *deg, const struct the_vec4 *q)
+{
+	float s = 2.0f * (q->w * q->y - q->z * q->x);
+	s = s > 1.0f ? 1.0f : (s < -1.0f ? -1.0f : s);
+	deg[0] = to_degrees(atan2f(2.0f * (q->w * q->x + q->y * q->z), 1.0f - 2.0f * (q->x * q->x + q->y * q->y)));
+	deg[1] = to_degrees(asinf(s));
+	deg[2] = to_degrees(atan2f(2.0f * (q->w * q->z + q->x * q->y), 1.0f - 2.0f * (q->y * q->y + q->z * q->z)));
+}
+
+static void
+euler_to_quat(struct the_vec4 *q, const float *deg)
+{
+	float cr = cosf(to_radians(deg[0]) * 0.5f), sr = sinf(to_radians(deg[0]) * 0.5f);
+	float cp = cosf(to_radians(deg[1]) * 0.5f), sp = sinf(to_radians(deg[1]) * 0.5f);
+	float cy = cosf(to_radians(deg[2]) * 0.5f), sy = sinf(to_radians(deg[2]) * 0.5f);
+	q->x = sr * cp * cy - cr * sp * sy;
+	q->y = cr * sp * cy + sr * cp * sy;
+	q->z = cr * cp * sy - sr * sp * cy;
+	q->w = cr * cp * cy + sr * sp * sy;
+}
+
+/* Edits a copy of the local transform, the node is only marked dirty when a value changes. */
+static void
+entity_transform(struct the_entity *e)
+{
+	struct the_trs trs = scene_graph.local[scene_graph.slot[e->node]];
+	float euler[3], edited[3];
+	quat_to_euler(euler, &trs.rot);
+	memcpy(edited, euler, sizeof(euler));
+
+	nk_layout_row_dynamic(ctx, 30, 1);
+	nk_label(ctx, "Position", NK_TEXT_LEFT);
+	nk_layout_row_dynamic(ctx, 30, 3);
+	nk_property_float(ctx, "#X", -100.0f, &trs.pos.x, 100.0f, 0.5f, 0.1f);
+	nk_property_float(ctx, "#Y", -100.0f, &trs.pos.y, 100.0f, 0.5f, 0.1f);
+	nk_property_float(ctx, "#Z", -100.0f, &trs.pos.z, 100.0f, 0.5f, 0.1f);
+	nk_layout_row_dynamic(ctx, 30, 1);
+	nk_label(ctx, "Rotation", NK_TEXT_LEFT);
+	nk_layout_row_dynamic(ctx, 30, 3);
+	nk_property_float(ctx, "#X", -180.0f, &edited[0], 180.0f, 5.0f, 1.0f);
+	nk_property_float(ctx, "#Y", -90.0f, &edited[1], 90.0f, 5.0f, 1.0f);
+	nk_property_float(ctx, "#Z", -180.0f, &edited[2], 180.0f, 5.0f, 1.0f);
+	nk_layout_row_dynamic(ctx, 30, 1);
+	nk_label(ctx, "Scale", NK_TEXT_LEFT);
+	nk_layout_row_dynamic(ctx, 30, 3);
+	nk_property_float(ctx, "#X", 0.01f, &trs.scale.x, 100.0f, 0.5f, 0.1f);
+	nk_property_float(ctx, "#Y", 0.01f, &trs.scale.y, 100.0f, 0.5f, 0.1f);
+	nk_property_float(ctx, "#Z", 0.01f, &trs.scale.z, 100.0f, 0.5f, 0.1f);
+
+	/* Rebuilt only when edited, the round trip through the angles is not exact. */
+	if (memcmp(euler, edited, sizeof(euler))) {
+		euler_to_quat(&trs.rot, edited);
+	}
+	if (memcmp(&trs, &scene_graph.local[scene_graph.slot[e->node]], sizeof(trs))) {
+		*the_graph_local(&scene_graph, e->node) = trs;
+	}
+}
+
 void
 nuklear_draw(void)
 {
 	static char mesh_path[512] = { 0 };
+	static int picked = -1;
 	nk_glfw3_new_frame(&glfw);
 
+	// Click on the scene (not on a window) picks the entity under the cursor.
+	if (the_io->mouse_button[THE_MOUSE_LEFT] == THE_KEYSTATE_DOWN && !nk_window_is_any_hovered(ctx)) {
+		picked = the_entity_pick(&camera, the_io->mouse_pos, NULL);
+	}
+
 	if (nk_begin(ctx, "Demo", nk_rect(50, 50, 230, 250),
 	             NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE |
 	               NK_WINDOW_MINIMIZABLE | NK_WINDOW_TITLE)) {
 
 		if (nk_tree_push(ctx, NK_TREE_TAB, "Entities", NK_MINIMIZED)) {
+			nk_layout_row_dynamic(ctx, 30, 1);
+			nk_property_float(ctx, "#Spin speed", -10.0f, &g_spin_speed, 10.0f, 0.1f, 0.01f);
+			nk_property_float(ctx, "#Walk", 0.0f, &g_walk, 1.0f, 0.1f, 0.01f);
+			nk_property_float(ctx, "#Anim speed", 0.0f, &g_anim_speed, 4.0f, 0.1f, 0.01f);
+			if (picked >= 0 && picked < entity_pool.count) {
+				nk_layout_row_dynamic(ctx, 30, 1);
+				nk_labelf(ctx, NK_TEXT_LEFT, "Picked: Entity %d", picked);
+				entity_transform(entity_pool.buf->at + picked);
+			}
 			for (int i = 0; i < entity_pool.count; ++i) {
 				struct the_entity *e = entity_pool.buf->at + i;
 				char entity_name[64];
@@ -54,42 +131,7 @@ nuklear_draw(void)
 				if (nk_tree_push_id(ctx, NK_TREE_TAB, entity_name, NK_MINIMIZED, i)) {
 					// Transform
 					if (nk_tree_push_id(ctx, NK_TREE_TAB, "Transform", NK_MINIMIZED, i)) {
-						nk_layout_row_dynamic(ctx, 30, 4);
-						nk_property_float(
-						  ctx, "00", -100.0f, &e->transform[0], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "10", -100.0f, &e->transform[1], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "20", -100.0f, &e->transform[2], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "30", -100.0f, &e->transform[3], 100.0f, 0.5f, 0.1f);
-						nk_layout_row_dynamic(ctx, 30, 4);
-						nk_property_float(
-						  ctx, "01", -100.0f, &e->transform[4], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "11", -100.0f, &e->transform[5], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "21", -100.0f, &e->transform[6], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "31", -100.0f, &e->transform[7], 100.0f, 0.5f, 0.1f);
-						nk_layout_row_dynamic(ctx, 30, 4);
-						nk_property_float(
-						  ctx, "02", -100.0f, &e->transform[8], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "12", -100.0f, &e->transform[9], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "22", -100.0f, &e->transform[10], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "32", -100.0f, &e->transform[11], 100.0f, 0.5f, 0.1f);
-						nk_layout_row_dynamic(ctx, 30, 4);
-						nk_property_float(
-						  ctx, "03", -100.0f, &e->transform[12], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "13", -100.0f, &e->transform[13], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "23", -100.0f, &e->transform[14], 100.0f, 0.5f, 0.1f);
-						nk_property_float(
-						  ctx, "33", -100.0f, &e->transform[15], 100.0f, 0.5f, 0.1f);
+						entity_transform(e);
 						nk_tree_pop(ctx);
 					}
 
@@ -202,7 +244,40 @@ nuklear_draw(void)
 			nk_tree_pop(ctx);
 		}
 
+		if (nk_tree_push(ctx, NK_TREE_TAB, "Display", NK_MINIMIZED)) {
+			static const char *modes[] = { "Vsync", "Adaptive vsync", "Off" };
+			nk_layout_row_dynamic(ctx, 25, 1);
+			g_display.present = nk_combo(ctx, modes, 3, g_display.present, 25, nk_vec2(200, 200));
+			if (g_display.present == THE_PRESENT_OFF) {
+				nk_property_float(ctx, "#FPS limit", 0.0f, &g_display.fps_limit, 1000.0f, 10.0f, 1.0f);
+			}
+			nk_bool latch = g_display.late_latch;
+			nk_checkbox_label(ctx, "Late latch camera", &latch);
+			g_display.late_latch = latch;
+			nk_bool on_demand = g_display.idle_timeout > 0.0f;
+			nk_checkbox_label(ctx, "Redraw on demand", &on_demand);
+			g_display.idle_timeout = on_demand ? 0.5f : 0.0f;
+			nk_tree_pop(ctx);
+		}
+
 		if (nk_tree_push(ctx, NK_TREE_TAB, "Resources", NK_MINIMIZED)) {
+			nk_labelf(ctx, NK_TEXT_LEFT, "Entities: %d visible / %d", g_visible_count,
+			          entity_pool.count);
+			nk_labelf(ctx, NK_TEXT_LEFT, "Triangles: %d", g_triangle_count);
+			nk_labelf(ctx, NK_TEXT_LEFT, "Particles: %d", g_particle_count);
+			nk_labelf(ctx, NK_TEXT_LEFT, "Static props: %d in %d batches", g_prop_count, g_prop_batches);
+			nk_labelf(ctx, NK_TEXT_LEFT, "Impostors: %d", g_impostor_count);
+			nk_bool probe = g_probe_sky;
+			nk_checkbox_label(ctx, "Probe as sky", &probe);
+			g_probe_sky = probe;
+			nk_labelf(ctx, NK_TEXT_LEFT, "Probe draws: %d (6 faces, one cull)", g_probe_count);
+			nk_labelf(ctx, NK_TEXT_LEFT, "World cells: %d (%zu MB textures, %zu MB meshes)",
+			          g_world.active_count, g_world.resident[THE_WORLD_TEX] >> 20,
+			          g_world.resident[THE_WORLD_MESH] >> 20);
+			nk_property_float(ctx, "#Particle rate", 0.0f, &g_particle_rate, 500000.0f, 1000.0f, 100.0f);
+			nk_property_float(ctx, "#LOD pixel error", 0.1f, &g_lod.pixel_error, 32.0f, 0.1f, 0.05f);
+			nk_property_float(ctx, "#LOD bias", 0.1f, &g_lod.bias, 16.0f, 0.1f, 0.05f);
+			nk_property_float(ctx, "#Impostor pixels", 0.0f, &g_impostor_pixels, 512.0f, 1.0f, 0.5f);
 			nk_labelf(ctx, NK_TEXT_LEFT, "Textures: %d / %ld (%lu Bytes)", tex_pool.count,
 			          tex_pool.buf->count, sizeof(struct the_texture_internal));
 			nk_labelf(ctx, NK_TEXT_LEFT, "Meshes: %d / %ld (%lu Bytes)", mesh_pool.count,
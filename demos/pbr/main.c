@@ -19,6 +19,9 @@ struct {
 	the_shader fullscreen_img;
 	the_shader skybox;
 	the_shader pbr;
+	the_shader pbr_inst;
+	the_shader particle;
+	the_shader impostor;
 } g_shaders;
 
 struct {
@@ -38,6 +41,418 @@ struct {
 the_framebuffer g_fb;
 the_tex fb_tex;
 the_mesh g_mesh;
+the_node g_root;
+#define SCENE_PATH "assets/pbr.scn"
+struct the_scene g_scene;
+
+/* Copies of the material balls around the demo area, one cell each, streamed by distance. */
+#define WORLD_CELLS 16
+#define WORLD_CELL_SIZE 10.0f
+#define WORLD_CLEAR 15.0f // Cells with their center this close to the origin are left empty.
+struct the_world g_world;
+int g_world_assets[1 + 9 * 4]; // The matball, then the four maps of every ball.
+
+/* Far balls of the world cells are drawn as octahedral impostors, one per ball, baked at load. */
+#define IMPOSTOR_FRAMES 8
+#define IMPOSTOR_FRAME_SIZE 64
+float g_impostor_pixels = 48.0f;
+int g_impostor_count;
+struct ball_impostor {
+	struct the_impostor_bake desc;
+	struct the_impostor_atlas atlas;
+	int tex_asset; // World asset of the albedo, the key of the entities it replaces.
+	the_mat mat;
+	bool ready;
+};
+struct ball_impostor g_ball_impostors[9];
+struct the_impostor g_impostors[9];
+int g_visible_count;
+float g_spin_speed = 0.0f;
+struct the_lod_config g_lod = { .pixel_error = 1.0f, .bias = 1.0f, .hysteresis = 0.2f };
+int g_triangle_count;
+float g_walk = 0.5f;
+float g_anim_speed = 1.0f;
+
+/* Skinned characters, one row of the palette texture each. */
+#define CHARACTER_COUNT 8
+enum { CLIP_IDLE, CLIP_WALK, CLIP_COUNT };
+the_mesh g_character_mesh;
+the_tex g_palette;
+struct the_skeleton g_skeleton;
+struct the_clip g_clips[CLIP_COUNT];
+struct the_animator g_anims[CHARACTER_COUNT];
+int g_character_count; // 0 if the skeleton could not be loaded.
+
+/* Pebbles scattered around the demo area, static: merged into a few batches once placed. */
+#define PROP_SIDE 24
+#define PROP_SPACING 1.0f
+int g_prop_count;
+int g_prop_batches;
+
+/* One fountain, drawn as a single instanced draw of camera facing quads. */
+#define PARTICLE_CAP (1 << 20)
+float g_particle_rate = 0.0f; // Off by default: it would keep the demo redrawing.
+int g_particle_count;
+struct the_emitter g_fountain;
+the_mat g_particle_mat;
+
+/* Cubemap captured from a point of the demo area: the six faces are culled in one pass. */
+#define PROBE_SIZE 256
+static const struct the_vec3 g_probe_pos = { 0.0f, 3.0f, -2.0f };
+bool g_probe_sky; // Captures the probe every frame and shows it as the sky.
+int g_probe_count;
+the_tex g_probe;
+the_framebuffer g_probe_fb[6];
+
+/* Gameplay data lives in archetype tables, the scene graph holds the transforms. */
+struct spin {
+	struct the_vec3 axis;
+	float speed; // Radians per second, scaled by g_spin_speed.
+};
+
+struct the_ecs g_ecs;
+static struct {
+	int node; // the_node
+	int spin; // struct spin
+} g_cmp;
+
+struct pbr_display g_display = {
+	.present = THE_PRESENT_VSYNC,
+	.fps_limit = 240.0f,
+	.late_latch = true,
+#ifdef THE_HEADLESS
+	.idle_timeout = 0.0f // Offscreen runs draw every frame.
+#else
+	.idle_timeout = 0.5f
+#endif
+};
+
+static const struct the_control_config g_control = { 10.0f, 0.001f, 1.0f, 0.0f };
+
+static void
+AddSpin(the_node node)
+{
+	the_ent ent = the_ecs_create(&g_ecs, THE_ECS_BIT(g_cmp.node) | THE_ECS_BIT(g_cmp.spin));
+	*(the_node *)the_ecs_get(&g_ecs, ent, g_cmp.node) = node;
+	*(struct spin *)the_ecs_get(&g_ecs, ent, g_cmp.spin) =
+	  (struct spin){ .axis = { 0.0f, 1.0f, 0.0f }, .speed = 1.0f };
+}
+
+/* Rotates the nodes with a spin component, runs on the scheduler workers chunk by chunk. */
+static void
+SpinSystem(void *args, const struct the_ecs_view *view)
+{
+	float dt = *(float *)args * g_spin_speed;
+	const the_node *node = the_ecs_column(view, g_cmp.node);
+	const struct spin *spin = the_ecs_column(view, g_cmp.spin);
+	for (int i = 0; i < view->count; ++i) {
+		struct the_trs *trs = the_graph_local(&scene_graph, node[i]);
+		float q[4];
+		quat_from_axis_angle(q, (float *)&spin[i].axis, spin[i].speed * dt);
+		quat_multiply((float *)&trs->rot, (float *)&trs->rot, q);
+		quat_normalize((float *)&trs->rot, (float *)&trs->rot); // No drift into scale.
+	}
+}
+
+static int
+Joint(const char *name)
+{
+	for (int j = 0; j < g_skeleton.joint_count; ++j) {
+		if (!strcmp(g_skeleton.name[j], name)) {
+			return j;
+		}
+	}
+	THE_ASSERT(!"Joint not in the skeleton");
+	return 0;
+}
+
+static void
+RotateJoint(struct the_clip *clip, int frame, const char *name, float x, float y, float z, float angle)
+{
+	float axis[3] = { x, y, z };
+	quat_from_axis_angle((float *)&clip->samples[frame * clip->joint_count + Joint(name)].rot, axis, angle);
+}
+
+/* The demo has no animation assets: idle and walk cycles are keyed procedurally. */
+static void
+BuildClips(void)
+{
+	const int idle_frames = 60;
+	struct the_clip *idle = &g_clips[CLIP_IDLE];
+	the_clip_init(idle, &g_skeleton, idle_frames, 30.0f, true);
+	for (int f = 0; f < idle_frames; ++f) {
+		float s = sinf((float)f / idle_frames * 2.0f * MPI);
+		RotateJoint(idle, f, "spine", 0.0f, 0.0f, 1.0f, 0.04f * s);
+		RotateJoint(idle, f, "neck", 1.0f, 0.0f, 0.0f, 0.05f * s);
+		RotateJoint(idle, f, "shoulder.L", 0.0f, 0.0f, 1.0f, 0.05f * s);
+		RotateJoint(idle, f, "shoulder.R", 0.0f, 0.0f, 1.0f, 0.05f * s);
+	}
+
+	const int walk_frames = 30;
+	struct the_clip *walk = &g_clips[CLIP_WALK];
+	the_clip_init(walk, &g_skeleton, walk_frames, 30.0f, true);
+	for (int f = 0; f < walk_frames; ++f) {
+		float phase = (float)f / walk_frames * 2.0f * MPI;
+		float s = sinf(phase);
+		RotateJoint(walk, f, "thigh.L", 1.0f, 0.0f, 0.0f, -0.5f * s);
+		RotateJoint(walk, f, "thigh.R", 1.0f, 0.0f, 0.0f, 0.5f * s);
+		RotateJoint(walk, f, "knee.L", 1.0f, 0.0f, 0.0f, 0.7f * fmaxf(0.0f, sinf(phase - 1.0f)));
+		RotateJoint(walk, f, "knee.R", 1.0f, 0.0f, 0.0f, 0.7f * fmaxf(0.0f, -sinf(phase - 1.0f)));
+		RotateJoint(walk, f, "shoulder.L", 1.0f, 0.0f, 0.0f, 0.4f * s);
+		RotateJoint(walk, f, "shoulder.R", 1.0f, 0.0f, 0.0f, -0.4f * s);
+		RotateJoint(walk, f, "elbow.L", 1.0f, 0.0f, 0.0f, -0.3f);
+		RotateJoint(walk, f, "elbow.R", 1.0f, 0.0f, 0.0f, -0.3f);
+		RotateJoint(walk, f, "spine", 0.0f, 1.0f, 0.0f, 0.1f * s);
+	}
+}
+
+/* A row of characters behind the material balls, all with idle and walk blended. */
+static void
+AddCharacters(struct pbr_desc_unit pbr, const struct pbr_maps *maps)
+{
+	struct the_texture_desc desc = tut_texture_desc_default(
+	  THE_TEX_2D, THE_TEX_FMT_RGBA32F, 3 * THE_ANIM_MAX_JOINTS, CHARACTER_COUNT);
+	desc.min_filter = THE_TEX_FLTR_NEAR;
+	desc.mag_filter = THE_TEX_FLTR_NEAR;
+	desc.wrap_s = THE_TEX_WRAP_CLAMP;
+	desc.wrap_t = THE_TEX_WRAP_CLAMP;
+	g_palette = the_tex_create();
+	the_tex_set(g_palette, &desc);
+	the_shader_tex(g_shaders.pbr)[1] = g_palette; // Bound even without characters.
+
+	if (the_skeleton_load(&g_skeleton, "assets/obj/slender.skl") != THE_OK) {
+		return;
+	}
+	BuildClips();
+
+	for (int i = 0; i < CHARACTER_COUNT; ++i) {
+		struct the_animator *a = &g_anims[i];
+		a->skeleton = &g_skeleton;
+		float offset = (float)i / CHARACTER_COUNT; // Out of step with each other.
+		int idle = the_anim_clip(a, &g_clips[CLIP_IDLE], offset * the_clip_duration(&g_clips[CLIP_IDLE]), 1.0f);
+		int walk = the_anim_clip(a, &g_clips[CLIP_WALK], offset * the_clip_duration(&g_clips[CLIP_WALK]), 1.0f);
+		the_anim_blend(a, idle, walk, g_walk);
+
+		int eidx = thepool_theent_add(&entity_pool);
+		struct the_entity *e = &entity_pool.buf->at[eidx];
+		e->node = the_graph_add(&scene_graph, g_root);
+		struct the_trs *trs = the_graph_local(&scene_graph, e->node);
+		trs->pos = (struct the_vec3){ -3.5f + i, -1.0f, 3.0f };
+		trs->scale = (struct the_vec3){ 0.5f, 0.5f, 0.5f };
+		e->mesh = g_character_mesh;
+		e->mat = the_mat_create(g_shaders.pbr);
+		pbr.palette_row = (float)i;
+		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
+		the_tex *t = the_mat_tex(e->mat);
+		t[0] = maps->a;
+		t[1] = maps->m;
+		t[2] = maps->r;
+		t[3] = maps->n;
+	}
+	g_character_count = CHARACTER_COUNT;
+}
+
+/* Material balls: x and z position, texture tiling, normal map intensity and maps. */
+static const struct {
+	float x, z;
+	float tiling;
+	float normal_map_intensity;
+	const struct pbr_maps *maps;
+} g_balls[] = {
+	{ -2.0f, 0.0f, 4.0f, 1.0f, &g_tex.gold },
+	{ 0.0f, 0.0f, 2.0f, 0.5f, &g_tex.shore },
+	{ 2.0f, 0.0f, 1.0f, 0.7f, &g_tex.peeled },
+	{ -2.0f, -2.0f, 1.0f, 0.2f, &g_tex.rusted },
+	{ 0.0f, -2.0f, 4.0f, 1.0f, &g_tex.tiles },
+	{ 2.0f, -2.0f, 1.0f, 1.0f, &g_tex.plastic },
+	{ -2.0f, -4.0f, 8.0f, 1.0f, &g_tex.cliff },
+	{ 0.0f, -4.0f, 2.0f, 1.0f, &g_tex.granite },
+	{ 2.0f, -4.0f, 2.0f, 0.5f, &g_tex.foam },
+};
+
+static void
+AddBalls(struct pbr_desc_unit pbr)
+{
+	for (int i = 0; i < (int)(sizeof(g_balls) / sizeof(*g_balls)); ++i) {
+		int eidx = thepool_theent_add(&entity_pool);
+		struct the_entity *e = &entity_pool.buf->at[eidx];
+		e->node = the_graph_add(&scene_graph, g_root);
+		the_graph_local(&scene_graph, e->node)->pos = (struct the_vec3){ g_balls[i].x, 0.0f, g_balls[i].z };
+		e->mesh = g_mesh;
+		e->mat = the_mat_create(g_shaders.pbr);
+		pbr.tiling_x = g_balls[i].tiling;
+		pbr.tiling_y = g_balls[i].tiling;
+		pbr.normal_map_intensity = g_balls[i].normal_map_intensity;
+		/* The graph has not run yet: the model saved with the scene is the ball placement. */
+		memset(pbr.model, 0, sizeof(pbr.model));
+		pbr.model[0] = pbr.model[5] = pbr.model[10] = pbr.model[15] = 1.0f;
+		pbr.model[12] = g_balls[i].x;
+		pbr.model[14] = g_balls[i].z;
+		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
+		the_tex *t = the_mat_tex(e->mat);
+		t[0] = g_balls[i].maps->a;
+		t[1] = g_balls[i].maps->m;
+		t[2] = g_balls[i].maps->r;
+		t[3] = g_balls[i].maps->n;
+	}
+}
+
+static void
+InitProbe(void)
+{
+	struct the_texture_desc desc =
+	  tut_texture_desc_default(THE_TEX_CUBEMAP, THE_TEX_FMT_RGB16F, PROBE_SIZE, PROBE_SIZE);
+	desc.wrap_s = THE_TEX_WRAP_CLAMP;
+	desc.wrap_t = THE_TEX_WRAP_CLAMP;
+	desc.wrap_r = THE_TEX_WRAP_CLAMP;
+	g_probe = the_tex_create();
+	the_tex_set(g_probe, &desc);
+	struct the_texture_desc depth_desc =
+	  tut_texture_desc_default(THE_TEX_2D, THE_TEX_FMT_DEPTH, PROBE_SIZE, PROBE_SIZE);
+	the_tex depth = the_tex_create();
+	the_tex_set(depth, &depth_desc);
+	for (int face = 0; face < 6; ++face) {
+		g_probe_fb[face] = the_fb_create();
+		the_fb_set_target(g_probe_fb[face], 0,
+		                  (struct the_texture_target){
+		                    .tex = g_probe, .attach = THE_ATTACH_COLOR, .face = THE_FACE_POS_X + face, .lod_level = 0 });
+		the_fb_set_target(g_probe_fb[face], 1,
+		                  (struct the_texture_target){
+		                    .tex = depth, .attach = THE_ATTACH_DEPTH, .face = THE_FACE_2D, .lod_level = 0 });
+	}
+}
+
+static void
+BakeImpostor(void *args)
+{
+	struct ball_impostor *b = args;
+	if (the_impostor_bake("assets/obj/matball.msh", &b->desc, &b->atlas) != THE_OK) {
+		b->atlas.size = 0;
+	}
+}
+
+/* On the main thread: atlases to textures, the material replaces the entities from now on. */
+static void
+ImpostorBaked(void *args)
+{
+	struct ball_impostor *b = args;
+	if (!b->atlas.size) {
+		return;
+	}
+
+	/* No mipmaps: they would bleed between the views. */
+	struct the_texture_desc desc =
+	  tut_texture_desc_default(THE_TEX_2D, THE_TEX_FMT_SRGBA, b->atlas.size, b->atlas.size);
+	desc.wrap_s = THE_TEX_WRAP_CLAMP;
+	desc.wrap_t = THE_TEX_WRAP_CLAMP;
+	size_t bytes = (size_t)b->atlas.size * b->atlas.size * 4;
+	the_tex albedo = the_tex_create();
+	the_tex_set(albedo, &desc);
+	memcpy(the_tex_map(albedo), b->atlas.albedo, bytes);
+	desc.fmt = THE_TEX_FMT_RGBA8;
+	the_tex normal = the_tex_create();
+	the_tex_set(normal, &desc);
+	memcpy(the_tex_map(normal), b->atlas.normal, bytes);
+
+	b->mat = the_mat_create(g_shaders.impostor);
+	float *data = b->mat.ptr;
+	memcpy(data, &b->atlas.sphere, sizeof(b->atlas.sphere));
+	data[4] = (float)IMPOSTOR_FRAMES;
+	the_mat_tex(b->mat)[0] = albedo;
+	the_mat_tex(b->mat)[1] = normal;
+	the_impostor_atlas_release(&b->atlas);
+	b->ready = true;
+}
+
+/* One impostor per ball: its albedo and tiling, baked on the loader workers. */
+static void
+AddImpostors(const char **texpaths)
+{
+	for (int i = 0; i < (int)(sizeof(g_balls) / sizeof(*g_balls)); ++i) {
+		int maps = (int)(g_balls[i].maps - &g_tex.gold); // Same order as texpaths.
+		struct ball_impostor *b = &g_ball_impostors[i];
+		b->desc = (struct the_impostor_bake){
+			.frames = IMPOSTOR_FRAMES,
+			.frame_size = IMPOSTOR_FRAME_SIZE,
+			.albedo = texpaths[maps * 4],
+			.tiling = { g_balls[i].tiling, g_balls[i].tiling },
+			.color = { 1.0f, 1.0f, 1.0f },
+		};
+		b->tex_asset = g_world_assets[1 + maps * 4];
+		the_impostor_init(&g_impostors[i], THE_NONE, THE_NONE, g_impostor_pixels);
+		the_load_async(BakeImpostor, ImpostorBaked, b);
+	}
+}
+
+/* Jittered grid of cubes and spheres around the balls and the characters, then batched. */
+static void
+AddProps(struct pbr_desc_unit pbr, const struct pbr_maps *maps)
+{
+	const the_mesh meshes[2] = { THE_UTILS_CUBE, THE_UTILS_SPHERE };
+	size_t mat_size = the_mat_size(g_shaders.pbr);
+	char *mats = the_alloc(PROP_SIDE * PROP_SIDE * mat_size); // Backs every prop material.
+	the_node *nodes = the_alloc(PROP_SIDE * PROP_SIDE * sizeof(*nodes));
+	uint32_t seed = 0x2545F491u;
+	pbr.use_albedo_map = 0.0f;
+	pbr.use_pbr_maps = 0.0f;
+	pbr.normal_map_intensity = 0.0f;
+	pbr.roughness = 0.8f;
+	pbr.metallic = 0.0f;
+
+	int first = entity_pool.count;
+	g_prop_count = 0;
+	for (int z = 0; z < PROP_SIDE; ++z) {
+		for (int x = 0; x < PROP_SIDE; ++x) {
+			float r[4];
+			for (int i = 0; i < 4; ++i) {
+				seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+				r[i] = (seed >> 8) * (1.0f / 16777216.0f);
+			}
+			float px = (x - PROP_SIDE * 0.5f + r[0]) * PROP_SPACING;
+			float pz = (z - PROP_SIDE * 0.5f + r[1]) * PROP_SPACING;
+			if (fabsf(px) < 4.5f && fabsf(pz) < 8.0f) {
+				continue; // Keep the balls, the characters and the fountain clear.
+			}
+
+			int eidx = thepool_theent_add(&entity_pool);
+			struct the_entity *e = &entity_pool.buf->at[eidx];
+			e->node = the_graph_add(&scene_graph, g_root);
+			nodes[g_prop_count] = e->node;
+			struct the_trs *trs = the_graph_local(&scene_graph, e->node);
+			float size = 0.1f + 0.15f * r[2];
+			trs->pos = (struct the_vec3){ px, -1.0f + size * 0.5f, pz };
+			trs->scale = (struct the_vec3){ size, size * (0.5f + r[3]), size };
+			e->mesh = meshes[(x + z) & 1];
+			e->mat = (the_mat){ mats + g_prop_count * mat_size, g_shaders.pbr };
+			e->lod = 0;
+			*(struct pbr_desc_unit *)e->mat.ptr = pbr;
+			the_tex *t = the_mat_tex(e->mat);
+			t[0] = maps->a;
+			t[1] = maps->m;
+			t[2] = maps->r;
+			t[3] = maps->n;
+			++g_prop_count;
+		}
+	}
+
+	/* Their world matrices are baked into the batches. */
+	the_graph_update(&scene_graph, NULL);
+	struct the_batch_config batch = { .cluster_size = 8.0f, .model_offset = 0 };
+	g_prop_batches = the_entity_batch(first, g_prop_count, &batch, g_root);
+
+	/* The merged props left their nodes behind, the graph would keep updating them. */
+	uint8_t *used = the_calloc(scene_graph.handles, 1);
+	for (int i = 0; i < entity_pool.count; ++i) {
+		used[entity_pool.buf->at[i].node] = 1;
+	}
+	for (int i = 0; i < g_prop_count; ++i) {
+		if (!used[nodes[i]]) {
+			the_graph_remove(&scene_graph, nodes[i]);
+		}
+	}
+	the_free(used);
+	the_free(nodes);
+}
 
 void
 Init(void)
@@ -57,16 +472,36 @@ Init(void)
 		.shader = &g_shaders.skybox
 	};
 
+	struct tut_shad_ldargs impostorargs = {
+		.desc = g_shader_descriptors.impostor,
+		.shader = &g_shaders.impostor
+	};
+
+	struct tut_shad_ldargs particleargs = {
+		.desc = g_shader_descriptors.particle,
+		.shader = &g_shaders.particle
+	};
+
 	struct tut_shad_ldargs pbrargs = {
 		.desc = g_shader_descriptors.pbr,
 		.shader = &g_shaders.pbr
 	};
 
+	struct tut_shad_ldargs pbrinstargs = {
+		.desc = g_shader_descriptors.pbr_inst,
+		.shader = &g_shaders.pbr_inst
+	};
+
 	struct tut_mesh_ldargs mesh = {
 		.path = "assets/obj/matball.msh",
 		.mesh = &g_mesh
 	};
 
+	struct tut_mesh_ldargs character_mesh = {
+		.path = "assets/obj/slender.msh",
+		.mesh = &g_character_mesh
+	};
+
 	struct tut_env_ldargs envargs = {
 		.path = "assets/env/canyon.env",
 		.sky = &g_tex.sky,
@@ -79,7 +514,11 @@ Init(void)
 	tut_assets_add_shader(ldr, &fsimgargs);
 	tut_assets_add_shader(ldr, &skyargs);
 	tut_assets_add_shader(ldr, &pbrargs);
+	tut_assets_add_shader(ldr, &pbrinstargs);
+	tut_assets_add_shader(ldr, &particleargs);
+	tut_assets_add_shader(ldr, &impostorargs);
 	tut_assets_add_mesh(ldr, &mesh);
+	tut_assets_add_mesh(ldr, &character_mesh);
 	tut_assets_add_env(ldr, &envargs);
 
 	struct the_texture_desc texdesc[] = {
@@ -141,7 +580,8 @@ Init(void)
 		tut_assets_add_tex(ldr, &loadtexargs[i]);
 	}
 
-	tut_assets_load(ldr, 24);
+	tut_assets_stream(ldr);
+	the_shader_instanced(g_shaders.pbr, g_shaders.pbr_inst); // Characters: one draw.
 
 	struct pbr_desc_scene *common_pbr = the_shader_data(g_shaders.pbr);
 	common_pbr->sunlight[0] = 0.0f;
@@ -151,8 +591,9 @@ Init(void)
 
 	the_tex *pbr_scene_tex = the_shader_tex(g_shaders.pbr);
 	pbr_scene_tex[0] = lut;
-	pbr_scene_tex[1] = irradiance;
-	pbr_scene_tex[2] = prefilter;
+	pbr_scene_tex[2] = irradiance; // [1]: skinning palettes, see AddCharacters.
+	pbr_scene_tex[3] = prefilter;
+	*the_shader_cubemap(g_shaders.impostor) = irradiance;
 
 	g_fb = the_fb_create();
 	struct the_point *vp = &the_io->window_size;
@@ -175,7 +616,7 @@ Init(void)
 	the_fb_set_target(g_fb, 0, color);
 	the_fb_set_target(g_fb, 1, depth);
 
-	struct pbr_desc_unit pbr;
+	struct pbr_desc_unit pbr = { 0 };
 	pbr.color[0] = 1.0f;
 	pbr.color[1] = 1.0f;
 	pbr.color[2] = 1.0f;
@@ -187,201 +628,127 @@ Init(void)
 	pbr.metallic = 0.5f;
 	pbr.roughness = 0.5f;
 	pbr.normal_map_intensity = 1.0f;
+	pbr.palette_row = -1.0f;
 
-	float position[3] = { -2.0f, 0.0f, 0.0f };
+	the_ecs_init(&g_ecs);
+	g_cmp.node = the_ecs_component(&g_ecs, sizeof(the_node));
+	g_cmp.spin = the_ecs_component(&g_ecs, sizeof(struct spin));
 
-	// CelticGold
-	{
-		int eidx = thepool_theent_add(&entity_pool);
-		struct the_entity *e = &entity_pool.buf->at[eidx];
-		mat4_identity(e->transform);
-		mat4_translation(e->transform, e->transform, position);
-		e->mesh = g_mesh;
-		e->mat = the_mat_create(g_shaders.pbr);
-		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
-		the_tex *t = the_mat_tex(e->mat);
-		t[0] = g_tex.gold.a;
-		t[1] = g_tex.gold.m;
-		t[2] = g_tex.gold.r;
-		t[3] = g_tex.gold.n;
+	g_root = the_graph_add(&scene_graph, THE_NODE_NONE);
+
+	/* The material balls come from the scene file, written from g_balls the first time. */
+	struct the_scene_ref mesh_refs[] = { { mesh.path, g_mesh } };
+	struct the_scene_ref tex_refs[9 * 4];
+	for (int i = 0; i < 9 * 4; ++i) {
+		tex_refs[i] = (struct the_scene_ref){ texpaths[i], loadtexargs[i].tex };
+	}
+	struct the_scene_refs refs = { mesh_refs, 1, tex_refs, 9 * 4 };
+	int first = entity_pool.count;
+	if (the_scene_load(&g_scene, SCENE_PATH, g_root, &refs) != THE_OK) {
+		AddBalls(pbr);
+		the_scene_save(SCENE_PATH, &refs);
+	}
+	for (int i = first; i < entity_pool.count; ++i) {
+		AddSpin(entity_pool.buf->at[i].node);
 	}
 
-	// Shore
-	{
-		pbr.tiling_x = 2.0f;
-		pbr.tiling_y = 2.0f;
-		pbr.normal_map_intensity = 0.5f;
-		int eidx = thepool_theent_add(&entity_pool);
-		struct the_entity *e = &entity_pool.buf->at[eidx];
-		mat4_identity(e->transform);
-		position[0] = 0.0f;
-		mat4_translation(e->transform, e->transform, position);
-		e->mesh = g_mesh;
-		e->mat = the_mat_create(g_shaders.pbr);
-		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
-		the_tex *t = the_mat_tex(e->mat);
-		t[0] = g_tex.shore.a;
-		t[1] = g_tex.shore.m;
-		t[2] = g_tex.shore.r;
-		t[3] = g_tex.shore.n;
-	}
-
-	// Peeling
-	{
-		pbr.tiling_x = 1.0f;
-		pbr.tiling_y = 1.0f;
-		pbr.normal_map_intensity = 0.7f;
-		position[0] = 2.0f;
-		int eidx = thepool_theent_add(&entity_pool);
-		struct the_entity *e = &entity_pool.buf->at[eidx];
-		mat4_identity(e->transform);
-		mat4_translation(e->transform, e->transform, position);
-		e->mesh = g_mesh;
-		e->mat = the_mat_create(g_shaders.pbr);
-		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
-		the_tex *t = the_mat_tex(e->mat);
-		t[0] = g_tex.peeled.a;
-		t[1] = g_tex.peeled.m;
-		t[2] = g_tex.peeled.r;
-		t[3] = g_tex.peeled.n;
-	}
-
-	// Rusted
-	{
-		pbr.tiling_x = 1.0f;
-		pbr.tiling_y = 1.0f;
-		pbr.normal_map_intensity = 0.2f;
-		position[0] = -2.0f;
-		position[2] = -2.0f;
-		int eidx = thepool_theent_add(&entity_pool);
-		struct the_entity *e = &entity_pool.buf->at[eidx];
-		mat4_identity(e->transform);
-		mat4_translation(e->transform, e->transform, position);
-		e->mesh = g_mesh;
-		e->mat = the_mat_create(g_shaders.pbr);
-		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
-		the_tex *t = the_mat_tex(e->mat);
-		t[0] = g_tex.rusted.a;
-		t[1] = g_tex.rusted.m;
-		t[2] = g_tex.rusted.r;
-		t[3] = g_tex.rusted.n;
-	}
-
-	// Tiles
-	{
-		pbr.tiling_x = 4.0f;
-		pbr.tiling_y = 4.0f;
-		pbr.normal_map_intensity = 1.0f;
-		position[0] = 0.0f;
-		int eidx = thepool_theent_add(&entity_pool);
-		struct the_entity *e = &entity_pool.buf->at[eidx];
-		mat4_identity(e->transform);
-		mat4_translation(e->transform, e->transform, position);
-		e->mesh = g_mesh;
-		e->mat = the_mat_create(g_shaders.pbr);
-		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
-		the_tex *t = the_mat_tex(e->mat);
-		t[0] = g_tex.tiles.a;
-		t[1] = g_tex.tiles.m;
-		t[2] = g_tex.tiles.r;
-		t[3] = g_tex.tiles.n;
-	}
-
-	// Ship Panels
-	{
-		pbr.tiling_x = 1.0f;
-		pbr.tiling_y = 1.0f;
-		pbr.normal_map_intensity = 1.0f;
-		position[0] = 2.0f;
-		int eidx = thepool_theent_add(&entity_pool);
-		struct the_entity *e = &entity_pool.buf->at[eidx];
-		mat4_identity(e->transform);
-		mat4_translation(e->transform, e->transform, position);
-		e->mesh = g_mesh;
-		e->mat = the_mat_create(g_shaders.pbr);
-		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
-		the_tex *t = the_mat_tex(e->mat);
-		t[0] = g_tex.plastic.a;
-		t[1] = g_tex.plastic.m;
-		t[2] = g_tex.plastic.r;
-		t[3] = g_tex.plastic.n;
-	}
-
-	// Cliff
-	{
-		pbr.tiling_x = 8.0f;
-		pbr.tiling_y = 8.0f;
-		pbr.normal_map_intensity = 1.0f;
-		position[0] = -2.0f;
-		position[2] = -4.0f;
-		int eidx = thepool_theent_add(&entity_pool);
-		struct the_entity *e = &entity_pool.buf->at[eidx];
-		mat4_identity(e->transform);
-		mat4_translation(e->transform, e->transform, position);
-		e->mesh = g_mesh;
-		e->mat = the_mat_create(g_shaders.pbr);
-		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
-		the_tex *t = the_mat_tex(e->mat);
-		t[0] = g_tex.cliff.a;
-		t[1] = g_tex.cliff.m;
-		t[2] = g_tex.cliff.r;
-		t[3] = g_tex.cliff.n;
-	}
-
-	// Granite
-	{
-		pbr.tiling_x = 2.0f;
-		pbr.tiling_y = 2.0f;
-		pbr.normal_map_intensity = 1.0f;
-		position[0] = 0.0f;
-		int eidx = thepool_theent_add(&entity_pool);
-		struct the_entity *e = &entity_pool.buf->at[eidx];
-		mat4_identity(e->transform);
-		mat4_translation(e->transform, e->transform, position);
-		e->mesh = g_mesh;
-		e->mat = the_mat_create(g_shaders.pbr);
-		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
-		the_tex *t = the_mat_tex(e->mat);
-		t[0] = g_tex.granite.a;
-		t[1] = g_tex.granite.m;
-		t[2] = g_tex.granite.r;
-		t[3] = g_tex.granite.n;
-	}
-
-	// Foam
-	{
-		pbr.tiling_x = 2.0f;
-		pbr.tiling_y = 2.0f;
-		pbr.normal_map_intensity = 0.5f;
-		position[0] = 2.0f;
-		int eidx = thepool_theent_add(&entity_pool);
-		struct the_entity *e = &entity_pool.buf->at[eidx];
-		mat4_identity(e->transform);
-		mat4_translation(e->transform, e->transform, position);
-		e->mesh = g_mesh;
-		e->mat = the_mat_create(g_shaders.pbr);
-		*(struct pbr_desc_unit *)e->mat.ptr = pbr;
-		the_tex *t = the_mat_tex(e->mat);
-		t[0] = g_tex.foam.a;
-		t[1] = g_tex.foam.m;
-		t[2] = g_tex.foam.r;
-		t[3] = g_tex.foam.n;
+	struct the_world_desc world = {
+		.origin = { -WORLD_CELLS * WORLD_CELL_SIZE * 0.5f, 0.0f, -WORLD_CELLS * WORLD_CELL_SIZE * 0.5f },
+		.cell_size = WORLD_CELL_SIZE,
+		.cells_x = WORLD_CELLS,
+		.cells_z = WORLD_CELLS,
+		.load_radius = 30.0f,
+		.unload_radius = 40.0f,
+		.budget = { [THE_WORLD_MESH] = THE_MB(64), [THE_WORLD_TEX] = THE_MB(768) },
+		.max_loads = 2
+	};
+	the_world_init(&g_world, &world, g_root);
+	g_world_assets[0] = the_world_asset(&g_world, THE_WORLD_MESH, mesh.path, NULL, 0);
+	for (int i = 0; i < 9 * 4; ++i) {
+		g_world_assets[1 + i] = the_world_asset(&g_world, THE_WORLD_TEX, texpaths[i], &texdesc[i & 3], 0);
+	}
+	for (int z = 0; z < WORLD_CELLS; ++z) {
+		for (int x = 0; x < WORLD_CELLS; ++x) {
+			float cx = world.origin.x + (x + 0.5f) * WORLD_CELL_SIZE;
+			float cz = world.origin.z + (z + 0.5f) * WORLD_CELL_SIZE;
+			if (fabsf(cx) > WORLD_CLEAR || fabsf(cz) > WORLD_CLEAR) {
+				the_world_cell(&g_world, x, z, SCENE_PATH, g_world_assets, 1 + 9 * 4);
+			}
+		}
 	}
+	AddImpostors(texpaths);
+
+	pbr.tiling_x = 1.0f;
+	pbr.tiling_y = 1.0f;
+	pbr.normal_map_intensity = 1.0f;
+	AddCharacters(pbr, &g_tex.rusted);
+	AddProps(pbr, &g_tex.granite);
+
+	struct the_emitter_desc fountain = {
+		.pos = { 0.0f, -1.0f, -7.0f },
+		.radius = 0.1f,
+		.vel = { 0.0f, 6.0f, 0.0f },
+		.vel_jitter = 1.5f,
+		.gravity = { 0.0f, -4.9f, 0.0f },
+		.drag = 0.1f,
+		.rate = g_particle_rate,
+		.life = 2.0f,
+		.life_jitter = 1.0f
+	};
+	the_emitter_init(&g_fountain, &fountain, PARTICLE_CAP);
+	g_particle_mat = the_mat_create(g_shaders.particle);
+	*(struct particle_desc_unit *)g_particle_mat.ptr = (struct particle_desc_unit){
+		.color_begin = { 1.0f, 0.6f, 0.2f, 0.8f },
+		.color_end = { 0.2f, 0.3f, 1.0f, 0.0f },
+		.size_begin = 0.03f,
+		.size_end = 0.01f
+	};
 
 	*the_shader_tex(g_shaders.skybox) = g_tex.sky;
+	InitProbe();
 	*the_shader_tex(g_shaders.fullscreen_img) = fb_tex;
 }
 
+static void
+ParticleCamera(struct particle_desc_scene *scene, const float *view_projection)
+{
+	memcpy(scene->view_projection, view_projection, sizeof(scene->view_projection));
+	const float *view = camera.view;
+	scene->camera_right[0] = view[0], scene->camera_right[1] = view[4], scene->camera_right[2] = view[8];
+	scene->camera_up[0] = view[1], scene->camera_up[1] = view[5], scene->camera_up[2] = view[9];
+}
+
+/* Whether the bounds of the live particles (kept by the emitter update) touch the view. */
+static bool
+FountainVisible(const union the_mat4 *vp)
+{
+	if (!g_fountain.count) {
+		return false;
+	}
+	struct the_vec3 lo = g_fountain.lo;
+	struct the_vec3 hi = g_fountain.hi;
+	struct the_vec3 e = { (hi.x - lo.x) * 0.5f, (hi.y - lo.y) * 0.5f, (hi.z - lo.z) * 0.5f };
+	const struct particle_desc_unit *unit = g_particle_mat.ptr;
+	float size = fmaxf(unit->size_begin, unit->size_end);
+	struct the_vec4 sphere = { lo.x + e.x, lo.y + e.y, lo.z + e.z, sqrtf(e.x * e.x + e.y * e.y + e.z * e.z) + size };
+	struct the_frustum f;
+	the_frustum_from_vp(&f, vp);
+	uint8_t visible;
+	return the_frustum_cull_spheres(&f, &sphere, 1, &visible) > 0;
+}
+
 void
 BuildFrame(struct thearr_thedraw **new_frame, float delta_time)
 {
 	the_io_poll();
 	struct the_point *vp = &the_io->window_size;
-	the_camera_control(&camera, (struct the_control_config){ 10.0f, 0.001f, 1.0f, delta_time });
+	struct the_control_config control = g_control;
+	control.deltatime = delta_time;
+	the_camera_control(&camera, control);
 
 	/* PBR common shader data. */
 	struct pbr_desc_scene *common_pbr = the_shader_data(g_shaders.pbr);
-	mat4_multiply(common_pbr->view_projection, camera.proj, camera.view);
+	the_mat4_mul((union the_mat4 *)common_pbr->view_projection, (union the_mat4 *)camera.proj, (union the_mat4 *)camera.view);
 	common_pbr->camera_position = the_camera_eye(&camera);
 	struct the_point fb_size = the_tex_size(fb_tex);
 
@@ -400,18 +767,72 @@ BuildFrame(struct thearr_thedraw **new_frame, float delta_time)
 	dl->state.ops.blend_dst = THE_BLEND_ZERO;
 	dl->state.ops.depth_fun = THE_DEPTH_LESS;
 	dl->state.ops.cull_face = THE_CULL_BACK;
+	dl->state.ops.enable |= (1 << THE_DRAW_SORT);
+
+	if (g_spin_speed != 0.0f) {
+		the_ecs_each(&g_ecs, THE_ECS_BIT(g_cmp.node) | THE_ECS_BIT(g_cmp.spin), 0, SpinSystem,
+		             &delta_time, the_sched_shared());
+		the_invalidate(); // Animated, keep drawing.
+	}
+	if (g_character_count && g_anim_speed != 0.0f) {
+		for (int i = 0; i < g_character_count; ++i) {
+			g_anims[i].nodes[g_anims[i].node_count - 1].as.blend.weight = g_walk;
+		}
+		the_anim_update(g_anims, g_character_count, delta_time * g_anim_speed,
+		                the_tex_map(g_palette), the_sched_shared());
+	}
+	the_world_update(&g_world, the_camera_eye(&camera));
+	the_graph_update(&scene_graph, the_sched_shared());
+	the_entity_bvh_update();
+
+	/* Materials keep the model matrix, copied again only for the nodes that moved. */
+	for (int i = 0; i < entity_pool.count; ++i) {
+		const struct the_entity *e = &entity_pool.buf->at[i];
+		if (scene_graph.moved[e->node]) {
+			memcpy(e->mat.ptr, the_graph_world(&scene_graph, e->node), 16 * sizeof(float));
+		}
+	}
+	uint8_t *visible = the_falloc(entity_pool.count + 1);
+	g_visible_count = the_entity_cull((union the_mat4 *)common_pbr->view_projection, visible);
+	for (int i = 0; g_character_count && g_anim_speed != 0.0f && i < entity_pool.count; ++i) {
+		if (visible[i] && entity_pool.buf->at[i].mesh == g_character_mesh) {
+			the_invalidate(); // Animated on screen, keep drawing.
+			break;
+		}
+	}
 
+	/* The streamed balls are keyed by their current handles, which change as cells reload. */
+	int impostor_count = (int)(sizeof(g_impostors) / sizeof(*g_impostors));
+	the_mesh ball_mesh = g_world.assets[g_world_assets[0]].handle;
+	for (int i = 0; i < impostor_count; ++i) {
+		the_tex albedo = g_world.assets[g_ball_impostors[i].tex_asset].handle;
+		bool ready = g_ball_impostors[i].ready && albedo != THE_NONE;
+		g_impostors[i].mesh = ready ? ball_mesh : THE_NONE;
+		g_impostors[i].tex = albedo;
+		g_impostors[i].pixels = g_impostor_pixels;
+	}
+	g_impostor_count = the_entity_impostors(&camera, fb_size.y, g_impostors, impostor_count, visible);
+	g_triangle_count = the_entity_lod(&camera, fb_size.y, &g_lod, visible);
 	for (int i = 0; i < entity_pool.count; ++i) {
+		if (!visible[i]) {
+			continue;
+		}
+		const struct the_entity *e = &entity_pool.buf->at[i];
+		const float *w = the_graph_world(&scene_graph, e->node);
+		float depth = -(camera.view[2] * w[12] + camera.view[6] * w[13] + camera.view[10] * w[14] + camera.view[14]);
 		struct the_draw_cmd *cmd = thearr_thedrawcmd_push(&dl->cmds);
-		mat4_assign(entity_pool.buf->at[i].mat.ptr, entity_pool.buf->at[i].transform);
-		cmd->material = the_mat_copy(entity_pool.buf->at[i].mat);
-		cmd->mesh = entity_pool.buf->at[i].mesh;
+		cmd->material = the_mat_copy(e->mat);
+		cmd->mesh = e->mesh;
+		cmd->lod = e->lod;
+		cmd->instance_count = 0;
+		cmd->key = the_draw_key(0, e->mat, e->mesh, depth, false);
 	}
 
 	thearr_thedraw_push_value(new_frame, tut_draw_default());
 	dl = &(*new_frame)->at[(*new_frame)->count - 1];
 	the_camera_static_vp(&camera, the_shader_data(g_shaders.skybox));
 	dl->state.pipeline.shader_mat = the_mat_copy_shader(g_shaders.skybox);
+	*((the_tex *)dl->state.pipeline.shader_mat.ptr + 16) = g_probe_sky ? g_probe : g_tex.sky;
 
 	dl->state.ops.disable |= (1 << THE_DRAW_CULL);
 	dl->state.ops.depth_fun = THE_DEPTH_LEQUAL;
@@ -419,6 +840,58 @@ BuildFrame(struct thearr_thedraw **new_frame, float delta_time)
 	struct the_draw_cmd *cmd = thearr_thedrawcmd_push(&dl->cmds);
 	cmd->material.shader = g_shaders.skybox;
 	cmd->mesh = THE_UTILS_CUBE;
+	cmd->lod = 0;
+	cmd->instance_count = 0;
+
+	/* Impostors: one instanced quad per baked ball, depth from the atlas. */
+	if (g_impostor_count) {
+		memcpy(the_shader_data(g_shaders.impostor), common_pbr, sizeof(*common_pbr));
+		thearr_thedraw_push_value(new_frame, tut_draw_default());
+		dl = &(*new_frame)->at[(*new_frame)->count - 1];
+		dl->state.pipeline.shader_mat = the_mat_copy_shader(g_shaders.impostor);
+		dl->state.ops.disable |= (1 << THE_DRAW_CULL);
+		for (int i = 0; i < impostor_count; ++i) {
+			if (!g_impostors[i].count) {
+				continue;
+			}
+			cmd = thearr_thedrawcmd_push(&dl->cmds);
+			cmd->material = the_mat_copy(g_ball_impostors[i].mat);
+			cmd->mesh = THE_UTILS_QUAD;
+			cmd->lod = 0;
+			cmd->instance_count = g_impostors[i].count;
+			cmd->instance_floats = THE_IMPOSTOR_FLOATS;
+			cmd->instances = g_impostors[i].instances;
+		}
+	}
+
+	/* Particles: additive, depth tested against the scene but not written. */
+	if (g_particle_rate > 0.0f || g_fountain.count) {
+		g_fountain.desc.rate = g_particle_rate;
+		g_particle_count = the_emitter_update(&g_fountain, delta_time, the_sched_shared());
+		if (FountainVisible((union the_mat4 *)common_pbr->view_projection)) {
+			the_invalidate(); // Animated on screen, keep drawing.
+		}
+	}
+	if (g_fountain.count) {
+		ParticleCamera(the_shader_data(g_shaders.particle), common_pbr->view_projection);
+		thearr_thedraw_push_value(new_frame, tut_draw_default());
+		dl = &(*new_frame)->at[(*new_frame)->count - 1];
+		dl->state.pipeline.shader_mat = the_mat_copy_shader(g_shaders.particle);
+		dl->state.ops.enable |= (1 << THE_DRAW_BLEND);
+		dl->state.ops.disable |= (1 << THE_DRAW_WRITE_DEPTH);
+		dl->state.ops.disable |= (1 << THE_DRAW_CULL);
+		dl->state.ops.blend_src = THE_BLEND_ONE;
+		dl->state.ops.blend_dst = THE_BLEND_ONE;
+		dl->state.ops.depth_fun = THE_DEPTH_LESS;
+
+		cmd = thearr_thedrawcmd_push(&dl->cmds);
+		cmd->material = the_mat_copy(g_particle_mat);
+		cmd->mesh = THE_UTILS_QUAD;
+		cmd->lod = 0;
+		cmd->instance_count = g_fountain.count;
+		cmd->instance_floats = 4;
+		cmd->instances = &g_fountain.instances[0].x;
+	}
 
 	thearr_thedraw_push_value(new_frame, tut_draw_default());
 	dl = &(*new_frame)->at[(*new_frame)->count - 1];
@@ -427,32 +900,184 @@ BuildFrame(struct thearr_thedraw **new_frame, float delta_time)
 	dl->state.pipeline.shader_mat = the_mat_copy_shader(g_shaders.fullscreen_img);
 	dl->state.ops.viewport = (struct the_rect){ 0, 0, vp->x, vp->y };
 	dl->state.ops.disable |= (1 << THE_DRAW_TEST_DEPTH);
+	dl->state.ops.disable |= (1 << THE_DRAW_BLEND);
 
 	cmd = thearr_thedrawcmd_push(&dl->cmds);
 	cmd->material.shader = g_shaders.fullscreen_img;
 	cmd->mesh = THE_UTILS_QUAD;
+	cmd->lod = 0;
+	cmd->instance_count = 0;
+}
+
+/*
+ * Probe capture: one pbr and one sky list per cubemap face, the entities of every face from
+ * a single multi view cull. Run after BuildFrame, which updates the bounds and materials.
+ */
+void
+BuildProbe(struct thearr_thedraw **lists)
+{
+	g_probe_count = 0;
+	if (!g_probe_sky) {
+		return;
+	}
+
+	static const struct the_vec3 dirs[6] = { { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+		                                     { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f } };
+	static const struct the_vec3 ups[6] = { { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f },
+		                                    { 0.0f, 0.0f, -1.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f } };
+	struct the_cam faces[6];
+	union the_mat4 vps[6];
+	for (int f = 0; f < 6; ++f) {
+		struct the_vec3 eye = g_probe_pos;
+		struct the_vec3 target = { eye.x + dirs[f].x, eye.y + dirs[f].y, eye.z + dirs[f].z };
+		struct the_vec3 up = ups[f];
+		mat4_look_at(faces[f].view, &eye.x, &target.x, &up.x);
+		mat4_perspective(faces[f].proj, to_radians(90.0f), 1.0f, 0.1f, camera.far);
+		the_mat4_mul(&vps[f], (union the_mat4 *)faces[f].proj, (union the_mat4 *)faces[f].view);
+	}
+	uint32_t *masks = the_falloc((entity_pool.count + 1) * sizeof(*masks));
+	the_entity_cull_views(vps, 6, masks);
+
+	struct pbr_desc_scene *common_pbr = the_shader_data(g_shaders.pbr);
+	for (int f = 0; f < 6; ++f) {
+		thearr_thedraw_push_value(lists, tut_draw_default());
+		struct the_draw *dl = &(*lists)->at[(*lists)->count - 1];
+		dl->state.target.bgcolor = (struct the_color){ 0.2f, 0.2f, 0.2f, 1.0f };
+		dl->state.target.fb = g_probe_fb[f];
+		dl->state.pipeline.shader_mat = the_mat_copy_shader(g_shaders.pbr);
+		dl->state.ops.viewport = (struct the_rect){ 0, 0, PROBE_SIZE, PROBE_SIZE };
+		dl->state.ops.enable |= (1 << THE_DRAW_CLEAR_COLOR);
+		dl->state.ops.enable |= (1 << THE_DRAW_CLEAR_DEPTH);
+		dl->state.ops.enable |= (1 << THE_DRAW_TEST_DEPTH);
+		dl->state.ops.enable |= (1 << THE_DRAW_WRITE_DEPTH);
+		dl->state.ops.enable |= (1 << THE_DRAW_CULL);
+		dl->state.ops.enable |= (1 << THE_DRAW_SORT);
+		dl->state.ops.disable |= (1 << THE_DRAW_BLEND);
+		dl->state.ops.depth_fun = THE_DEPTH_LESS;
+		dl->state.ops.cull_face = THE_CULL_BACK;
+		struct pbr_desc_scene *scene = dl->state.pipeline.shader_mat.ptr;
+		*scene = *common_pbr;
+		memcpy(scene->view_projection, vps[f].v, sizeof(scene->view_projection));
+		scene->camera_position = g_probe_pos;
+
+		for (int i = 0; i < entity_pool.count; ++i) {
+			if (!(masks[i] & (1u << f))) {
+				continue;
+			}
+			const struct the_entity *e = &entity_pool.buf->at[i];
+			const float *w = the_graph_world(&scene_graph, e->node);
+			float depth = -(faces[f].view[2] * w[12] + faces[f].view[6] * w[13] + faces[f].view[10] * w[14] +
+			                faces[f].view[14]);
+			struct the_draw_cmd *cmd = thearr_thedrawcmd_push(&dl->cmds);
+			cmd->material = the_mat_copy(e->mat);
+			cmd->mesh = e->mesh;
+			cmd->lod = e->lod;
+			cmd->instance_count = 0;
+			cmd->key = the_draw_key(0, e->mat, e->mesh, depth, false);
+			++g_probe_count;
+		}
+
+		/* The environment sky behind, the probe itself is only shown in the main view. */
+		thearr_thedraw_push_value(lists, tut_draw_default());
+		dl = &(*lists)->at[(*lists)->count - 1];
+		dl->state.pipeline.shader_mat = the_mat_copy_shader(g_shaders.skybox);
+		the_camera_static_vp(&faces[f], dl->state.pipeline.shader_mat.ptr);
+		*((the_tex *)dl->state.pipeline.shader_mat.ptr + 16) = g_tex.sky;
+		dl->state.ops.disable |= (1 << THE_DRAW_CULL);
+		dl->state.ops.depth_fun = THE_DEPTH_LEQUAL;
+		struct the_draw_cmd *cmd = thearr_thedrawcmd_push(&dl->cmds);
+		cmd->material.shader = g_shaders.skybox;
+		cmd->mesh = THE_UTILS_CUBE;
+		cmd->lod = 0;
+		cmd->instance_count = 0;
+	}
+	the_invalidate(); // Captured every frame while shown.
+}
+
+/* Patches the camera matrices of the already built frame with fresh mouse input. */
+void
+LateLatch(struct thearr_thedraw *frame)
+{
+	the_camera_latch(&camera, g_control);
+	float view_projection[16];
+	the_mat4_mul((union the_mat4 *)view_projection, (union the_mat4 *)camera.proj, (union the_mat4 *)camera.view);
+	struct the_vec3 eye = the_camera_eye(&camera);
+
+	/* Lists are found by shader, BuildFrame is free to reorder or add them. */
+	for (int i = 0; i < frame->count; ++i) {
+		the_mat pipe = frame->at[i].state.pipeline.shader_mat;
+		if (pipe.shader == g_shaders.pbr || pipe.shader == g_shaders.impostor) {
+			struct pbr_desc_scene *scene = pipe.ptr;
+			memcpy(scene->view_projection, view_projection, sizeof(view_projection));
+			scene->camera_position = eye;
+		} else if (pipe.shader == g_shaders.skybox) {
+			the_camera_static_vp(&camera, pipe.ptr);
+		} else if (pipe.shader == g_shaders.particle) {
+			ParticleCamera(pipe.ptr, view_projection);
+		}
+	}
+}
+
+static void
+ApplyDisplay(struct the_pacer *pacer)
+{
+	static struct pbr_display applied = { .present = -1 };
+	if (applied.present != g_display.present) {
+		g_display.present = the_present_set(g_display.present);
+	}
+	if (applied.present != g_display.present || applied.fps_limit != g_display.fps_limit) {
+		the_pacer_set_fps(pacer, g_display.present == THE_PRESENT_OFF ? g_display.fps_limit : 0.0f);
+	}
+	applied = g_display;
 }
 
 int
 main(int argc, char **argv)
 {
-	(void)argc, (void)argv;
+	/* Optional frame limit (e.g. headless benchmark runs): ./pbr [frames] */
+	int frames = argc > 1 ? atoi(argv[1]) : -1;
+	the_log_init();
 	void *mem_chunk = malloc(THE_MB(256));
 	the_mem_init(mem_chunk, THE_MB(256));
 	the_falloc_set_buffer(the_palloc(THE_MB(16)), THE_MB(16));
-	the_io_init("THE PBR Material Demo", (struct the_point){ 1600, 900 });
+	if (!the_io_init("THE PBR Material Demo", (struct the_point){ 1600, 900 })) {
+		THE_LOG_ERR("Could not create the window or the offscreen context.");
+		return 1;
+	}
+	the_prefetch_begin("the_prefetch.log");
 	the_camera_init_default(&camera);
 	nuklear_init();
+	the_hotreload_init(8); // Also streams the startup assets.
 	Init();
-	the_chrono frame_chrono = the_time();
-	while (!the_io->window_closed) {
-		float delta_time = the_time_sec(the_elapsed(frame_chrono));
-		frame_chrono = the_time();
+	struct the_pacer pacer;
+	the_pacer_init(&pacer, 0.0f); // Paced by vsync unless the present mode is off.
+	while (!the_io->window_closed && frames) {
+		the_hotreload_poll();
+		if (!the_load_pending()) {
+			the_prefetch_end(); // Startup assets are in, stop recording.
+		}
+
+		if (!the_io_wait(g_display.idle_timeout)) {
+			continue; // Nothing changed, skip the frame.
+		}
 
+		if (frames > 0) {
+			--frames;
+		}
+		ApplyDisplay(&pacer);
+		float delta_time = the_pacer_frame(&pacer);
 		struct thearr_thedraw *frame = NULL;
 		BuildFrame(&frame, delta_time);
+		struct thearr_thedraw *probe = NULL;
+		BuildProbe(&probe);
+		if (g_display.late_latch) {
+			LateLatch(frame);
+		}
 
 		// Render
+		for (int i = 0; probe && i < probe->count; ++i) {
+			the_draw(&probe->at[i]);
+		}
 		for (int i = 0; i < frame->count; ++i) {
 			the_draw(&frame->at[i]);
 		}
@@ -461,5 +1086,8 @@ main(int argc, char **argv)
 		// End render
 	}
 
+	the_hotreload_shutdown();
+	the_prefetch_end();
+	the_log_shutdown();
 	return 0;
 }
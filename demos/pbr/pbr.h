@@ -11,7 +11,7 @@ struct pbr_desc_unit {
 	float roughness;
 	float metallic;
 	float normal_map_intensity;
-	float paddingg;
+	float palette_row; // Row of the skinning palette texture, -1 for static meshes.
 };
 
 struct pbr_desc_scene {
@@ -21,14 +21,55 @@ struct pbr_desc_scene {
 	float sunlight[4];
 };
 
+struct particle_desc_unit {
+	float color_begin[4];
+	float color_end[4];
+	float size_begin;
+	float size_end;
+	float padding[2];
+};
+
+struct particle_desc_scene {
+	float view_projection[16];
+	float camera_right[4];
+	float camera_up[4];
+};
+
 struct pbr_maps {
 	the_tex a, n, r, m;
 };
 
+struct pbr_display {
+	enum the_present_mode present;
+	float fps_limit; // Used with THE_PRESENT_OFF.
+	bool late_latch; // Re-sample the camera right before submission.
+	float idle_timeout; // Redraw on demand, blocks up to this many seconds (0: always draw).
+};
+
+extern struct pbr_display g_display;
+extern int g_visible_count; // Entities that passed frustum culling last frame.
+extern float g_spin_speed; // Scales the spin of every entity, 0 stops them.
+extern struct the_lod_config g_lod;
+extern int g_triangle_count; // Triangles of the levels of detail drawn last frame.
+extern float g_walk; // Blend between the idle and the walk clips of the characters.
+extern float g_anim_speed; // Scales the clip playback of every character, 0 stops them.
+extern float g_particle_rate; // Particles spawned per second by the fountain.
+extern int g_particle_count; // Live particles after the last update.
+extern struct the_world g_world; // Streamed cells around the demo area.
+extern int g_prop_count; // Static pebbles placed.
+extern int g_prop_batches; // Batches they were merged into.
+extern float g_impostor_pixels; // Balls smaller than this on screen are drawn as impostors.
+extern int g_impostor_count; // Drawn as impostors last frame.
+extern bool g_probe_sky; // Captures the cubemap probe every frame and shows it as the sky.
+extern int g_probe_count; // Draws of the six probe faces last frame.
+
 static const struct {
 	const struct the_shader_desc pbr;
+	const struct the_shader_desc pbr_inst;
 	const struct the_shader_desc fullscreen_img;
 	const struct the_shader_desc sky;
+	const struct the_shader_desc particle;
+	const struct the_shader_desc impostor;
 } g_shader_descriptors = {
 	.pbr = {
 		.name = "pbr",
@@ -36,7 +77,16 @@ static const struct {
 		.tex_count = 4,
 		.cubemap_count = 0,
 		.shared_data_count = 6 * 4, // 6 vec4
-		.common_tex_count = 1,
+		.common_tex_count = 2, // BRDF LUT, skinning palettes
+		.common_cubemap_count = 2
+	},
+	.pbr_inst = {
+		.name = "pbr-inst", // pbr with the unit data per instance
+		.data_count = 7 * 4, // 7 vec4 instance attributes
+		.tex_count = 4,
+		.cubemap_count = 0,
+		.shared_data_count = 6 * 4, // 6 vec4
+		.common_tex_count = 2, // BRDF LUT, skinning palettes
 		.common_cubemap_count = 2
 	},
 	.fullscreen_img = {
@@ -56,5 +106,23 @@ static const struct {
 		.shared_data_count = 4 * 4, // mat4
 		.common_tex_count = 0,
 		.common_cubemap_count = 1
+	},
+	.particle = {
+		.name = "particle", // instanced billboards
+		.data_count = 3 * 4, // 3 vec4
+		.tex_count = 0,
+		.cubemap_count = 0,
+		.shared_data_count = 6 * 4, // mat4 + camera right and up
+		.common_tex_count = 0,
+		.common_cubemap_count = 0
+	},
+	.impostor = {
+		.name = "impostor", // instanced octahedral impostors
+		.data_count = 2 * 4, // bounding sphere, frames
+		.tex_count = 2, // albedo and normal atlases
+		.cubemap_count = 0,
+		.shared_data_count = 6 * 4, // 6 vec4, as pbr
+		.common_tex_count = 0,
+		.common_cubemap_count = 1 // irradiance
 	}
 };
@@ -0,0 +1,227 @@
+#include "anim.h"
+
+#include "common.h"
+#include "io.h"
+#include "log.h"
+#include "mem.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ANIM_GRAIN 8 // Animators per scheduler job.
+
+int
+the_skeleton_load(struct the_skeleton *s, const char *path)
+{
+	char *text;
+	size_t size;
+	if (the_file_read(path, &text, &size) != THE_OK) {
+		THE_LOG_ERR("Problem reading skeleton %s", path);
+		return THE_ERR_FILE;
+	}
+
+	memset(s, 0, sizeof(*s));
+	float pos[THE_ANIM_MAX_JOINTS][3];
+	int ret = THE_OK;
+	int line = 0;
+	for (char *l = strtok(text, "\n"); l; l = strtok(NULL, "\n")) {
+		++line;
+		if (*l == '#' || *l == '\r' || *l == '\0') {
+			continue;
+		}
+		int j = s->joint_count;
+		if (j == THE_ANIM_MAX_JOINTS) {
+			THE_LOG_ERR("%s: more than %d joints", path, THE_ANIM_MAX_JOINTS);
+			ret = THE_ERR;
+			break;
+		}
+		if (sscanf(l, "%31s %d %f %f %f", s->name[j], &s->parent[j], &pos[j][0], &pos[j][1], &pos[j][2]) != 5 ||
+		    s->parent[j] < -1 || s->parent[j] >= j) {
+			THE_LOG_ERR("%s:%d: expected 'name parent x y z' with the parent before the joint", path, line);
+			ret = THE_ERR;
+			break;
+		}
+
+		int p = s->parent[j];
+		s->bind[j] = (struct the_trs){
+			.pos = { pos[j][0], pos[j][1], pos[j][2] },
+			.rot = { 0.0f, 0.0f, 0.0f, 1.0f },
+			.scale = { 1.0f, 1.0f, 1.0f },
+		};
+		if (p >= 0) {
+			s->bind[j].pos.x -= pos[p][0];
+			s->bind[j].pos.y -= pos[p][1];
+			s->bind[j].pos.z -= pos[p][2];
+		}
+		s->joint_count++;
+	}
+	the_free(text);
+
+	if (ret == THE_OK) {
+		the_skeleton_bind(s);
+	}
+	return ret;
+}
+
+void
+the_skeleton_bind(struct the_skeleton *s)
+{
+	union the_mat4 model[THE_ANIM_MAX_JOINTS];
+	the_trs_matrix_batch(model, s->bind, s->joint_count);
+	for (int j = 0; j < s->joint_count; ++j) {
+		if (s->parent[j] >= 0) {
+			the_mat4_mul(&model[j], &model[s->parent[j]], &model[j]);
+		}
+		the_mat4_inverse_affine(&s->inverse_bind[j], &model[j]);
+	}
+}
+
+void
+the_clip_init(struct the_clip *c, const struct the_skeleton *s, int frame_count, float rate, bool loop)
+{
+	THE_ASSERT(frame_count > 0 && rate > 0.0f && "Empty clip");
+	c->samples = the_alloc(frame_count * s->joint_count * sizeof(*c->samples));
+	c->frame_count = frame_count;
+	c->joint_count = s->joint_count;
+	c->rate = rate;
+	c->loop = loop;
+	for (int f = 0; f < frame_count; ++f) {
+		memcpy(c->samples + f * s->joint_count, s->bind, s->joint_count * sizeof(*c->samples));
+	}
+}
+
+void
+the_clip_release(struct the_clip *c)
+{
+	the_free(c->samples);
+	memset(c, 0, sizeof(*c));
+}
+
+float
+the_clip_duration(const struct the_clip *c)
+{
+	/* Looping clips blend the last frame back into the first one. */
+	return (c->loop ? c->frame_count : c->frame_count - 1) / c->rate;
+}
+
+static int
+the__anim_node(struct the_animator *a)
+{
+	THE_ASSERT(a->node_count < THE_ANIM_MAX_NODES && "Blend tree too big");
+	return a->node_count++;
+}
+
+int
+the_anim_clip(struct the_animator *a, const struct the_clip *clip, float time, float speed)
+{
+	THE_ASSERT(clip->joint_count == a->skeleton->joint_count && "Clip of another skeleton");
+	int n = the__anim_node(a);
+	a->nodes[n].type = THE_ANIM_CLIP;
+	a->nodes[n].as.clip.clip = clip;
+	a->nodes[n].as.clip.time = time;
+	a->nodes[n].as.clip.speed = speed;
+	return n;
+}
+
+int
+the_anim_blend(struct the_animator *a, int node_a, int node_b, float weight)
+{
+	int n = the__anim_node(a);
+	THE_ASSERT(node_a < n && node_b < n && "Children go before their parents");
+	a->nodes[n].type = THE_ANIM_BLEND;
+	a->nodes[n].as.blend.a = node_a;
+	a->nodes[n].as.blend.b = node_b;
+	a->nodes[n].as.blend.weight = weight;
+	return n;
+}
+
+/* Pose at time: the two frames around it blended. */
+static void
+the__anim_sample(struct the_trs *out, const struct the_clip *c, float time)
+{
+	float f = time * c->rate;
+	int f0 = (int)floorf(f);
+	float t = f - (float)f0;
+	int f1 = f0 + 1;
+	if (c->loop) {
+		f0 = ((f0 % c->frame_count) + c->frame_count) % c->frame_count;
+		f1 = (f0 + 1) % c->frame_count;
+	} else if (f0 >= c->frame_count - 1 || f0 < 0) {
+		f0 = f1 = f0 < 0 ? 0 : c->frame_count - 1;
+		t = 0.0f;
+	}
+	the_trs_blend_batch(out, c->samples + f0 * c->joint_count, c->samples + f1 * c->joint_count, t, c->joint_count);
+}
+
+static void
+the__anim_eval(struct the_animator *a, float dt, float *palette)
+{
+	struct the_trs pose[THE_ANIM_MAX_NODES][THE_ANIM_MAX_JOINTS];
+	const struct the_skeleton *s = a->skeleton;
+	int joints = s->joint_count;
+	for (int n = 0; n < a->node_count; ++n) {
+		struct the_anim_node *node = &a->nodes[n];
+		if (node->type == THE_ANIM_CLIP) {
+			float duration = the_clip_duration(node->as.clip.clip);
+			float time = node->as.clip.time + dt * node->as.clip.speed;
+			if (node->as.clip.clip->loop && duration > 0.0f) {
+				time = fmodf(time, duration);
+				time = time < 0.0f ? time + duration : time;
+			} else {
+				time = time < 0.0f ? 0.0f : (time > duration ? duration : time);
+			}
+			node->as.clip.time = time;
+			the__anim_sample(pose[n], node->as.clip.clip, time);
+		} else {
+			the_trs_blend_batch(pose[n], pose[node->as.blend.a], pose[node->as.blend.b],
+			                    node->as.blend.weight, joints);
+		}
+	}
+
+	/* Root pose to model space, then skinning matrices. */
+	union the_mat4 model[THE_ANIM_MAX_JOINTS];
+	the_trs_matrix_batch(model, a->node_count ? pose[a->node_count - 1] : s->bind, joints);
+	for (int j = 0; j < joints; ++j) {
+		if (s->parent[j] >= 0) {
+			the_mat4_mul(&model[j], &model[s->parent[j]], &model[j]);
+		}
+	}
+	union the_mat4 skin[THE_ANIM_MAX_JOINTS];
+	the_mat4_mul_pairs(skin, model, s->inverse_bind, joints);
+	for (int j = 0; j < joints; ++j) {
+		float *row = palette + j * 12;
+		for (int r = 0; r < 3; ++r) {
+			row[r * 4 + 0] = skin[j].v[r];
+			row[r * 4 + 1] = skin[j].v[4 + r];
+			row[r * 4 + 2] = skin[j].v[8 + r];
+			row[r * 4 + 3] = skin[j].v[12 + r];
+		}
+	}
+}
+
+struct the__anim_batch {
+	struct the_animator *anims;
+	float dt;
+	float *palettes;
+};
+
+static void
+the__anim_run(void *args, int begin, int end)
+{
+	struct the__anim_batch *b = args;
+	for (int i = begin; i < end; ++i) {
+		the__anim_eval(&b->anims[i], b->dt, b->palettes + i * THE_ANIM_PALETTE_FLOATS);
+	}
+}
+
+void
+the_anim_update(struct the_animator *anims, int count, float dt, float *palettes, thesched *sched)
+{
+	struct the__anim_batch b = { .anims = anims, .dt = dt, .palettes = palettes };
+	if (sched && count > ANIM_GRAIN) {
+		the_sched_for(sched, count, ANIM_GRAIN, the__anim_run, &b);
+	} else {
+		the__anim_run(&b, 0, count);
+	}
+}
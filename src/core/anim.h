@@ -0,0 +1,91 @@
+#ifndef THE_CORE_ANIM_H
+#define THE_CORE_ANIM_H
+
+#include "sched.h"
+#include "simd.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Skeletal animation. Clips are local joint poses sampled at a fixed rate, animators
+ * blend clips through a small tree and write skinning matrices for the vertex shader.
+ * - Joints are ordered parents first. Skinning matrices take model space bind positions
+ *     to the animated pose: skin = model pose * inverse bind.
+ * - the_anim_update evaluates many animators in parallel on a scheduler. Every pose
+ *     blend (clip sampling included) goes through the_trs_blend_batch, four joints at a time.
+ * - Palettes are THE_ANIM_PALETTE_FLOATS floats per animator: 3 rows of the affine skinning
+ *     matrix per joint (row major 3x4), one RGBA32F texel per row, so one texture row of
+ *     3 * THE_ANIM_MAX_JOINTS texels holds the palette of one animator.
+ */
+#define THE_ANIM_MAX_JOINTS 64
+#define THE_ANIM_MAX_NODES 8
+#define THE_ANIM_PALETTE_FLOATS (THE_ANIM_MAX_JOINTS * 12)
+
+struct the_skeleton {
+	int joint_count;
+	int parent[THE_ANIM_MAX_JOINTS]; // Index of the parent joint, -1 for roots.
+	char name[THE_ANIM_MAX_JOINTS][32];
+	struct the_trs bind[THE_ANIM_MAX_JOINTS]; // Rest pose, local to the parent.
+	union the_mat4 inverse_bind[THE_ANIM_MAX_JOINTS]; // Model space to joint space at rest.
+};
+
+/* Local poses, frame major: samples[frame * joint_count + joint]. */
+struct the_clip {
+	struct the_trs *samples;
+	int frame_count;
+	int joint_count;
+	float rate; // Frames per second.
+	bool loop;
+};
+
+enum the_anim_node_type { THE_ANIM_CLIP, THE_ANIM_BLEND };
+
+/* Blend tree node. Children come before their parents, the last node is the root. */
+struct the_anim_node {
+	enum the_anim_node_type type;
+	union {
+		struct {
+			const struct the_clip *clip;
+			float time; // Seconds, advanced by the_anim_update.
+			float speed;
+		} clip;
+		struct {
+			int a;
+			int b;
+			float weight; // 0: pose of a, 1: pose of b.
+		} blend;
+	} as;
+};
+
+struct the_animator {
+	const struct the_skeleton *skeleton;
+	struct the_anim_node nodes[THE_ANIM_MAX_NODES];
+	int node_count;
+};
+
+/*
+ * Text skeleton, one joint per line: name, parent index (-1 for roots, parents first) and
+ * model space position at rest. Lines starting with '#' are comments. Rest rotations are
+ * the identity. Returns THE_OK or an error.
+ */
+int the_skeleton_load(struct the_skeleton *s, const char *path);
+/* Computes the inverse bind matrices from the rest pose. */
+void the_skeleton_bind(struct the_skeleton *s);
+
+/* Clip of frame_count rest poses of s, for the caller to animate. */
+void the_clip_init(struct the_clip *c, const struct the_skeleton *s, int frame_count, float rate, bool loop);
+void the_clip_release(struct the_clip *c);
+float the_clip_duration(const struct the_clip *c);
+
+int the_anim_clip(struct the_animator *a, const struct the_clip *clip, float time, float speed);
+int the_anim_blend(struct the_animator *a, int node_a, int node_b, float weight);
+
+/*
+ * Advances the clips of count animators by dt seconds, evaluates their trees and writes
+ * the palette of animator i at palettes + i * THE_ANIM_PALETTE_FLOATS. Animators are split
+ * across the workers of sched (NULL: inline).
+ */
+void the_anim_update(struct the_animator *anims, int count, float dt, float *palettes, thesched *sched);
+
+#endif // THE_CORE_ANIM_H
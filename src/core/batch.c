@@ -0,0 +1,299 @@
+#include "batch.h"
+
+#include "common.h"
+#include "mem.h"
+#include "render/pixels_internal.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_MAX_VERTICES ((int64_t)1 << (sizeof(the_idx) * 8))
+
+static const int batch_attrib_floats[THE_VA_COUNT] = { 3, 3, 3, 3, 2, 4, 4 };
+
+struct the__batch_item {
+	int entity;
+	int cell[3];
+	int64_t vertices; // Referenced by the finest level.
+};
+
+static int batch_model_offset; // Of the running the_entity_batch, read by the sort.
+
+static int
+the__batch_stride(the_vertex_attrib attrib)
+{
+	int stride = 0;
+	for (int i = 0; i < THE_VA_COUNT; ++i) {
+		if (attrib & (1 << i)) {
+			stride += batch_attrib_floats[i];
+		}
+	}
+	return stride;
+}
+
+/* Index range of the finest level of detail. */
+static void
+the__batch_range(const mesh *m, int64_t *first, int64_t *count)
+{
+	*first = m->lod_count ? m->lods[0].first : 0;
+	*count = m->lod_count ? m->lods[0].count : m->elem_count;
+}
+
+/* Compares the materials of two entities of the same shader, skipping the model matrix. */
+static int
+the__batch_mat_cmp(the_mat a, the_mat b)
+{
+	size_t size = the_mat_size(a.shader);
+	if (batch_model_offset < 0) {
+		return memcmp(a.ptr, b.ptr, size);
+	}
+	size_t model = batch_model_offset * sizeof(float);
+	size_t after = model + 16 * sizeof(float);
+	int d = memcmp(a.ptr, b.ptr, model);
+	return d ? d : memcmp((char *)a.ptr + after, (char *)b.ptr + after, size - after);
+}
+
+/* Batch key: shader, vertex attributes, material, cluster. */
+static int
+the__batch_key_cmp(const struct the__batch_item *a, const struct the__batch_item *b)
+{
+	const struct the_entity *ea = &entity_pool.buf->at[a->entity];
+	const struct the_entity *eb = &entity_pool.buf->at[b->entity];
+	if (ea->mat.shader != eb->mat.shader) {
+		return ea->mat.shader < eb->mat.shader ? -1 : 1;
+	}
+	the_vertex_attrib va = mesh_pool.buf->at[ea->mesh].attrib;
+	the_vertex_attrib vb = mesh_pool.buf->at[eb->mesh].attrib;
+	if (va != vb) {
+		return va < vb ? -1 : 1;
+	}
+	int d = the__batch_mat_cmp(ea->mat, eb->mat);
+	if (d) {
+		return d;
+	}
+	for (int i = 0; i < 3; ++i) {
+		if (a->cell[i] != b->cell[i]) {
+			return a->cell[i] < b->cell[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+static int
+the__batch_item_cmp(const void *pa, const void *pb)
+{
+	const struct the__batch_item *a = pa;
+	const struct the__batch_item *b = pb;
+	int d = the__batch_key_cmp(a, b);
+	return d ? d : a->entity - b->entity;
+}
+
+/* out = cols * in, normalized. cols: three column vectors. */
+static void
+the__batch_dir(float *out, const float *in, const float cols[9])
+{
+	float v[3];
+	for (int i = 0; i < 3; ++i) {
+		v[i] = cols[i] * in[0] + cols[3 + i] * in[1] + cols[6 + i] * in[2];
+	}
+	float len = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	float inv = len > 0.0f ? 1.0f / len : 0.0f;
+	out[0] = v[0] * inv;
+	out[1] = v[1] * inv;
+	out[2] = v[2] * inv;
+}
+
+static void
+the__batch_cross(float *out, const float *a, const float *b)
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/*
+ * Copies vertices to dst transformed by the world matrix m. Returns false if m mirrors the
+ * geometry, the triangles have to be flipped to keep their winding.
+ */
+static bool
+the__batch_bake(float *dst, const float *src, int64_t vertices, the_vertex_attrib attrib, const float *m)
+{
+	/* Normals go through the cofactor matrix: the inverse transpose scaled by the determinant. */
+	float cols[9] = { m[0], m[1], m[2], m[4], m[5], m[6], m[8], m[9], m[10] };
+	float cof[9];
+	the__batch_cross(cof, cols + 3, cols + 6);
+	the__batch_cross(cof + 3, cols + 6, cols);
+	the__batch_cross(cof + 6, cols, cols + 3);
+	bool mirrored = cols[0] * cof[0] + cols[1] * cof[1] + cols[2] * cof[2] < 0.0f;
+	if (mirrored) {
+		for (int i = 0; i < 9; ++i) {
+			cof[i] = -cof[i];
+		}
+	}
+
+	int stride = the__batch_stride(attrib);
+	for (int64_t v = 0; v < vertices; ++v, src += stride, dst += stride) {
+		int o = 0;
+		for (int a = 0; a < THE_VA_COUNT; ++a) {
+			if (!(attrib & (1 << a))) {
+				continue;
+			}
+			const float *s = src + o;
+			float *d = dst + o;
+			switch (a) {
+			case THE_VA_POS:
+				for (int i = 0; i < 3; ++i) {
+					d[i] = m[12 + i] + m[i] * s[0] + m[4 + i] * s[1] + m[8 + i] * s[2];
+				}
+				break;
+			case THE_VA_NORMAL: the__batch_dir(d, s, cof); break;
+			case THE_VA_TAN:
+			case THE_VA_BITAN: the__batch_dir(d, s, cols); break;
+			default: memcpy(d, s, batch_attrib_floats[a] * sizeof(float)); break;
+			}
+			o += batch_attrib_floats[a];
+		}
+	}
+	return !mirrored;
+}
+
+/* Merges the entities of items into a new mesh and entity under root. */
+static void
+the__batch_build(const struct the__batch_item *items, int count, int64_t vertices, the_node root)
+{
+	const struct the_entity *proto = &entity_pool.buf->at[items[0].entity];
+	the_mat proto_mat = proto->mat;
+	the_vertex_attrib attrib = mesh_pool.buf->at[proto->mesh].attrib;
+	int stride = the__batch_stride(attrib);
+
+	int64_t elems = 0;
+	for (int i = 0; i < count; ++i) {
+		int64_t first, n;
+		the__batch_range(&mesh_pool.buf->at[entity_pool.buf->at[items[i].entity].mesh], &first, &n);
+		elems += n;
+	}
+
+	the_mesh msh = the_mesh_create();
+	mesh *m = &mesh_pool.buf->at[msh];
+	m->attrib = attrib;
+	m->vtx_size = vertices * stride * sizeof(float);
+	m->vtx = the_alloc(m->vtx_size);
+	m->idx = the_alloc(elems * sizeof(the_idx));
+	m->elem_count = elems;
+
+	int64_t base = 0;
+	the_idx *idx = m->idx;
+	for (int i = 0; i < count; ++i) {
+		const struct the_entity *e = &entity_pool.buf->at[items[i].entity];
+		const mesh *s = &mesh_pool.buf->at[e->mesh];
+		const float *world = the_graph_world(&scene_graph, e->node);
+		bool keep = the__batch_bake(m->vtx + base * stride, s->vtx, items[i].vertices, attrib, world);
+		int64_t first, n;
+		the__batch_range(s, &first, &n);
+		for (int64_t t = 0; t + 2 < n; t += 3) {
+			const the_idx *tri = s->idx + first + t;
+			idx[0] = (the_idx)(base + tri[0]);
+			idx[1] = (the_idx)(base + tri[keep ? 1 : 2]);
+			idx[2] = (the_idx)(base + tri[keep ? 2 : 1]);
+			idx += 3;
+		}
+		base += items[i].vertices;
+	}
+	the_mesh_calc_bounds(m);
+	m->res.flags |= THE_IRF_DIRTY;
+
+	int eidx = thepool_theent_add(&entity_pool);
+	struct the_entity *e = &entity_pool.buf->at[eidx];
+	e->node = the_graph_add(&scene_graph, root);
+	e->mesh = msh;
+	e->lod = 0;
+	e->mat = the_mat_create(proto_mat.shader);
+	memcpy(e->mat.ptr, proto_mat.ptr, the_mat_size(proto_mat.shader));
+	if (batch_model_offset >= 0) {
+		float *model = (float *)e->mat.ptr + batch_model_offset;
+		memset(model, 0, 16 * sizeof(float));
+		model[0] = model[5] = model[10] = model[15] = 1.0f;
+	}
+}
+
+static int
+the__batch_desc(const void *a, const void *b)
+{
+	return *(const int *)b - *(const int *)a;
+}
+
+int
+the_entity_batch(int first, int count, const struct the_batch_config *cfg, the_node root)
+{
+	THE_ASSERT(first >= 0 && first + count <= entity_pool.count && "Entities out of the pool");
+	THE_ASSERT(cfg->cluster_size > 0.0f && "Empty clusters");
+	batch_model_offset = cfg->model_offset;
+
+	struct the__batch_item *items = the_alloc((count ? count : 1) * sizeof(*items));
+	int item_count = 0;
+	for (int i = first; i < first + count; ++i) {
+		const struct the_entity *e = &entity_pool.buf->at[i];
+		const mesh *m = &mesh_pool.buf->at[e->mesh];
+		if (m->loading || !m->vtx || !m->idx || !(m->attrib & (1 << THE_VA_POS)) ||
+		    (m->attrib & (1 << THE_VA_JOINTS))) {
+			continue;
+		}
+
+		/* Vertices up to the last one the finest level uses: loaders may over-allocate. */
+		int64_t range_first, n;
+		the__batch_range(m, &range_first, &n);
+		int64_t vertices = 0;
+		for (int64_t j = range_first; j < range_first + n; ++j) {
+			vertices = m->idx[j] >= vertices ? (int64_t)m->idx[j] + 1 : vertices;
+		}
+		if (!n || vertices > BATCH_MAX_VERTICES) {
+			continue;
+		}
+
+		const float *w = the_graph_world(&scene_graph, e->node);
+		float c[3] = { (m->bounds.min.x + m->bounds.max.x) * 0.5f, (m->bounds.min.y + m->bounds.max.y) * 0.5f,
+			           (m->bounds.min.z + m->bounds.max.z) * 0.5f };
+		struct the__batch_item *it = &items[item_count++];
+		it->entity = i;
+		it->vertices = vertices;
+		for (int j = 0; j < 3; ++j) {
+			float wc = w[12 + j] + w[j] * c[0] + w[4 + j] * c[1] + w[8 + j] * c[2];
+			it->cell[j] = (int)floorf(wc / cfg->cluster_size);
+		}
+	}
+	qsort(items, item_count, sizeof(*items), the__batch_item_cmp);
+
+	/* Runs of equal keys, split where they would overflow the indices. */
+	int *merged = the_alloc((item_count ? item_count : 1) * sizeof(*merged));
+	int merged_count = 0;
+	int batches = 0;
+	for (int begin = 0; begin < item_count;) {
+		int end = begin + 1;
+		int64_t vertices = items[begin].vertices;
+		while (end < item_count && !the__batch_key_cmp(&items[begin], &items[end]) &&
+		       vertices + items[end].vertices <= BATCH_MAX_VERTICES) {
+			vertices += items[end++].vertices;
+		}
+		if (end - begin > 1) {
+			the__batch_build(items + begin, end - begin, vertices, root);
+			for (int i = begin; i < end; ++i) {
+				merged[merged_count++] = items[i].entity;
+			}
+			++batches;
+		}
+		begin = end;
+	}
+
+	/* Highest first: the last entity filling a hole is never one still to remove. */
+	qsort(merged, merged_count, sizeof(*merged), the__batch_desc);
+	for (int i = 0; i < merged_count; ++i) {
+		int last = entity_pool.count - 1;
+		entity_pool.buf->at[merged[i]] = entity_pool.buf->at[last];
+		thepool_theent_rm(&entity_pool, last);
+		the_bvh_remove(&scene_bvh, merged[i]);
+	}
+	the_free(merged);
+	the_free(items);
+	return batches;
+}
@@ -0,0 +1,31 @@
+#ifndef THE_CORE_BATCH_H
+#define THE_CORE_BATCH_H
+
+#include "scene.h"
+
+/*
+ * Static batching: merges entities that never move and share a material into one mesh per
+ * spatial cluster, with their world transforms baked into the vertices.
+ * - Entities are merged if their meshes have the same vertex attributes and their materials
+ *     the same shader, textures and unit data (but the model matrix, see model_offset).
+ * - Clusters are the cubic cells of cluster_size the entity bounds centers fall in. Each
+ *     batch is a new entity: scene_bvh keeps its bounds, so batches are culled per cluster.
+ * - Batches stop growing at the vertices an index can address (65536 with 16 bit indices),
+ *     a new one is started for the rest of the cluster.
+ * - The finest level of detail of the meshes is merged, batches have a single level.
+ */
+struct the_batch_config {
+	float cluster_size; // Edge of the cluster cells, in world units.
+	int model_offset; // Floats before the model matrix in the unit data, -1 if it has none.
+};
+
+/*
+ * Replaces the entities [first, first + count) of entity_pool that can be merged with
+ * their batches, added under root with an identity transform. Skinned meshes, meshes
+ * still loading and entities without a partner are kept. Call it after the_graph_update.
+ * Removed entities leave their node, material and mesh to the caller; entity indices
+ * change. Returns the batches created.
+ */
+int the_entity_batch(int first, int count, const struct the_batch_config *cfg, the_node root);
+
+#endif // THE_CORE_BATCH_H
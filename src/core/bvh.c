@@ -0,0 +1,705 @@
+#include "bvh.h"
+
+#include "mem.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#define BVH_BINS 16
+#define BVH_SAH_DEPTH 32 // Deeper builds split at the median, the depth stays logarithmic.
+#define BVH_MAX_DEPTH 64 // Inserts that make the tree taller than this rebuild it.
+#define BVH_STACK (BVH_MAX_DEPTH * 2)
+#define BVH_INSIDE (1 << 30) // Frustum traversal: subtree fully inside, no more plane tests.
+
+static inline float
+the__minf(float a, float b)
+{
+	return a < b ? a : b;
+}
+
+static inline float
+the__maxf(float a, float b)
+{
+	return a > b ? a : b;
+}
+
+static inline struct the_aabb
+the__aabb_union(struct the_aabb a, struct the_aabb b)
+{
+	return (struct the_aabb){
+		{ the__minf(a.min.x, b.min.x), the__minf(a.min.y, b.min.y), the__minf(a.min.z, b.min.z) },
+		{ the__maxf(a.max.x, b.max.x), the__maxf(a.max.y, b.max.y), the__maxf(a.max.z, b.max.z) },
+	};
+}
+
+static inline bool
+the__aabb_contains(struct the_aabb outer, struct the_aabb inner)
+{
+	return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+	  outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+static inline float
+the__aabb_area(struct the_aabb a)
+{
+	float dx = a.max.x - a.min.x, dy = a.max.y - a.min.y, dz = a.max.z - a.min.z;
+	return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline float
+the__aabb_center(struct the_aabb a, int axis)
+{
+	return ((&a.min.x)[axis] + (&a.max.x)[axis]) * 0.5f;
+}
+
+static inline struct the_aabb
+the__aabb_clamp(struct the_aabb a)
+{
+	for (int i = 0; i < 3; ++i) {
+		float lo = (&a.min.x)[i], hi = (&a.max.x)[i];
+		lo = lo != lo ? -THE_BVH_LIMIT : the__minf(the__maxf(lo, -THE_BVH_LIMIT), THE_BVH_LIMIT);
+		hi = hi != hi ? THE_BVH_LIMIT : the__minf(the__maxf(hi, -THE_BVH_LIMIT), THE_BVH_LIMIT);
+		if (lo > hi) {
+			lo = hi = (lo + hi) * 0.5f;
+		}
+		(&a.min.x)[i] = lo;
+		(&a.max.x)[i] = hi;
+	}
+	return a;
+}
+
+static inline struct the_aabb
+the__aabb_grow(struct the_aabb a, float margin)
+{
+	a.min.x -= margin, a.min.y -= margin, a.min.z -= margin;
+	a.max.x += margin, a.max.y += margin, a.max.z += margin;
+	return a;
+}
+
+static const struct the_aabb empty_box = {
+	{ FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX }
+};
+
+void
+the_bvh_init(struct the_bvh *b, float margin)
+{
+	memset(b, 0, sizeof(*b));
+	b->free = -1;
+	b->root = -1;
+	b->margin = margin;
+}
+
+void
+the_bvh_release(struct the_bvh *b)
+{
+	the_free(b->nodes);
+	the_free(b->item_box);
+	the_free(b->leaf);
+	the_bvh_init(b, b->margin);
+}
+
+static int
+the__bvh_alloc(struct the_bvh *b)
+{
+	int n = b->free;
+	if (n >= 0) {
+		b->free = b->nodes[n].parent;
+	} else {
+		if (b->node_count == b->node_cap) {
+			b->node_cap = b->node_cap ? b->node_cap * 2 : 64;
+			b->nodes = the_realloc(b->nodes, b->node_cap * sizeof(*b->nodes));
+		}
+		n = b->node_count++;
+	}
+	b->nodes[n].parent = -1;
+	b->nodes[n].child[0] = -1;
+	b->nodes[n].child[1] = -1;
+	b->nodes[n].item = -1;
+	b->nodes[n].height = 0;
+	return n;
+}
+
+static void
+the__bvh_free(struct the_bvh *b, int n)
+{
+	b->nodes[n].parent = b->free;
+	b->free = n;
+}
+
+static void
+the__bvh_reserve_items(struct the_bvh *b, int item)
+{
+	if (item < b->item_cap) {
+		return;
+	}
+
+	int cap = b->item_cap ? b->item_cap : 64;
+	while (cap <= item) {
+		cap *= 2;
+	}
+	b->item_box = the_realloc(b->item_box, cap * sizeof(*b->item_box));
+	b->leaf = the_realloc(b->leaf, cap * sizeof(*b->leaf));
+	for (int i = b->item_cap; i < cap; ++i) {
+		b->leaf[i] = -1;
+	}
+	b->item_cap = cap;
+}
+
+/* Recomputes the boxes and heights from node n up to the root. */
+static void
+the__bvh_refit(struct the_bvh *b, int n)
+{
+	for (; n >= 0; n = b->nodes[n].parent) {
+		struct the_bvh_node *node = &b->nodes[n];
+		const struct the_bvh_node *c0 = &b->nodes[node->child[0]];
+		const struct the_bvh_node *c1 = &b->nodes[node->child[1]];
+		node->box = the__aabb_union(c0->box, c1->box);
+		node->height = 1 + (c0->height > c1->height ? c0->height : c1->height);
+	}
+}
+
+bool
+the_bvh_contains(const struct the_bvh *b, int item)
+{
+	return item >= 0 && item < b->item_cap && b->leaf[item] >= 0;
+}
+
+void
+the_bvh_insert(struct the_bvh *b, int item, struct the_aabb box)
+{
+	THE_ASSERT(item >= 0 && !the_bvh_contains(b, item) && "Invalid or repeated item");
+	the__bvh_reserve_items(b, item);
+	box = the__aabb_clamp(box);
+	b->item_box[item] = box;
+
+	int leaf = the__bvh_alloc(b);
+	b->nodes[leaf].box = the__aabb_grow(box, b->margin);
+	b->nodes[leaf].item = item;
+	b->leaf[item] = leaf;
+	b->leaf_count++;
+	b->changes++;
+	if (b->root < 0) {
+		b->root = leaf;
+		return;
+	}
+
+	/* Descend while pushing the leaf down is cheaper than pairing it here (Box2D heuristic). */
+	struct the_aabb leaf_box = b->nodes[leaf].box;
+	int sibling = b->root;
+	while (b->nodes[sibling].child[0] >= 0) {
+		const struct the_bvh_node *n = &b->nodes[sibling];
+		float area = the__aabb_area(n->box);
+		float combined = the__aabb_area(the__aabb_union(n->box, leaf_box));
+		float cost_here = 2.0f * combined;
+		float inherited = 2.0f * (combined - area);
+
+		float cost[2];
+		for (int c = 0; c < 2; ++c) {
+			const struct the_bvh_node *child = &b->nodes[n->child[c]];
+			float grown = the__aabb_area(the__aabb_union(child->box, leaf_box));
+			cost[c] = inherited + (child->child[0] < 0 ? grown : grown - the__aabb_area(child->box));
+		}
+
+		if (cost_here < cost[0] && cost_here < cost[1]) {
+			break;
+		}
+		sibling = n->child[cost[1] < cost[0]];
+	}
+
+	int old_parent = b->nodes[sibling].parent;
+	int parent = the__bvh_alloc(b);
+	b->nodes[parent].parent = old_parent;
+	b->nodes[parent].child[0] = sibling;
+	b->nodes[parent].child[1] = leaf;
+	b->nodes[sibling].parent = parent;
+	b->nodes[leaf].parent = parent;
+	if (old_parent < 0) {
+		b->root = parent;
+	} else {
+		struct the_bvh_node *op = &b->nodes[old_parent];
+		op->child[op->child[1] == sibling] = parent;
+	}
+	the__bvh_refit(b, parent);
+
+	/* The new parent pushes the whole sibling subtree down, so check the height of the tree. */
+	if (b->nodes[b->root].height >= BVH_MAX_DEPTH) {
+		the_bvh_rebuild(b);
+	}
+}
+
+void
+the_bvh_remove(struct the_bvh *b, int item)
+{
+	if (!the_bvh_contains(b, item)) {
+		return;
+	}
+
+	int leaf = b->leaf[item];
+	b->leaf[item] = -1;
+	b->leaf_count--;
+	if (leaf == b->root) {
+		b->root = -1;
+		the__bvh_free(b, leaf);
+		return;
+	}
+
+	/* The sibling takes the place of the parent. */
+	int parent = b->nodes[leaf].parent;
+	int grand = b->nodes[parent].parent;
+	int sibling = b->nodes[parent].child[b->nodes[parent].child[0] == leaf];
+	b->nodes[sibling].parent = grand;
+	if (grand < 0) {
+		b->root = sibling;
+	} else {
+		struct the_bvh_node *g = &b->nodes[grand];
+		g->child[g->child[1] == parent] = sibling;
+		the__bvh_refit(b, grand);
+	}
+	the__bvh_free(b, parent);
+	the__bvh_free(b, leaf);
+}
+
+void
+the_bvh_update(struct the_bvh *b, int item, struct the_aabb box)
+{
+	if (!the_bvh_contains(b, item)) {
+		the_bvh_insert(b, item, box);
+		return;
+	}
+
+	box = the__aabb_clamp(box);
+	b->item_box[item] = box;
+	struct the_bvh_node *leaf = &b->nodes[b->leaf[item]];
+	if (the__aabb_contains(leaf->box, box)) {
+		return;
+	}
+
+	leaf->box = the__aabb_grow(box, b->margin);
+	the__bvh_refit(b, leaf->parent);
+	b->changes++;
+}
+
+/* Items with a centroid on `axis` below the k-th smallest go first (quickselect). */
+static void
+the__bvh_select(const struct the_aabb *boxes, int *items, int n, int k, int axis)
+{
+	int lo = 0, hi = n - 1;
+	while (lo < hi) {
+		float pivot = the__aabb_center(boxes[items[(lo + hi) / 2]], axis);
+		int i = lo, j = hi;
+		while (i <= j) {
+			while (the__aabb_center(boxes[items[i]], axis) < pivot) {
+				++i;
+			}
+			while (the__aabb_center(boxes[items[j]], axis) > pivot) {
+				--j;
+			}
+			if (i <= j) {
+				int tmp = items[i];
+				items[i++] = items[j];
+				items[j--] = tmp;
+			}
+		}
+		if (k <= j) {
+			hi = j;
+		} else if (k >= i) {
+			lo = i;
+		} else {
+			break;
+		}
+	}
+}
+
+/* Binned SAH split of items. Returns the size of the first half, 0 if no split is better. */
+static int
+the__bvh_split_sah(const struct the_aabb *boxes, int *items, int n, struct the_aabb centroids)
+{
+	int axis = 0;
+	float extent = 0.0f;
+	for (int a = 0; a < 3; ++a) {
+		float e = (&centroids.max.x)[a] - (&centroids.min.x)[a];
+		if (e > extent) {
+			extent = e;
+			axis = a;
+		}
+	}
+	if (extent <= 0.0f) {
+		return 0;
+	}
+
+	struct {
+		struct the_aabb box;
+		int count;
+	} bins[BVH_BINS];
+	for (int i = 0; i < BVH_BINS; ++i) {
+		bins[i].box = empty_box;
+		bins[i].count = 0;
+	}
+
+	float lo = (&centroids.min.x)[axis];
+	float scale = (float)BVH_BINS / extent;
+	for (int i = 0; i < n; ++i) {
+		int bin = (int)((the__aabb_center(boxes[items[i]], axis) - lo) * scale);
+		bin = bin < BVH_BINS ? bin : BVH_BINS - 1;
+		bins[bin].box = the__aabb_union(bins[bin].box, boxes[items[i]]);
+		bins[bin].count++;
+	}
+
+	/* Right to left sweep of the areas, then pick the cheapest plane left to right. */
+	float right_cost[BVH_BINS];
+	struct the_aabb acc = empty_box;
+	int count = 0;
+	for (int i = BVH_BINS - 1; i > 0; --i) {
+		acc = the__aabb_union(acc, bins[i].box);
+		count += bins[i].count;
+		right_cost[i] = count ? the__aabb_area(acc) * count : 0.0f;
+	}
+
+	float best = FLT_MAX;
+	int best_plane = -1;
+	acc = empty_box;
+	count = 0;
+	for (int i = 0; i < BVH_BINS - 1; ++i) {
+		acc = the__aabb_union(acc, bins[i].box);
+		count += bins[i].count;
+		float cost = (count ? the__aabb_area(acc) * count : 0.0f) + right_cost[i + 1];
+		if (count && count < n && cost < best) {
+			best = cost;
+			best_plane = i;
+		}
+	}
+	if (best_plane < 0) {
+		return 0;
+	}
+
+	int left = 0;
+	for (int i = 0; i < n; ++i) {
+		int bin = (int)((the__aabb_center(boxes[items[i]], axis) - lo) * scale);
+		if (bin <= best_plane) {
+			int tmp = items[left];
+			items[left++] = items[i];
+			items[i] = tmp;
+		}
+	}
+	return left;
+}
+
+static int
+the__bvh_build(struct the_bvh *b, int *items, int n, int depth)
+{
+	int node = the__bvh_alloc(b);
+	if (n == 1) {
+		b->nodes[node].box = the__aabb_grow(b->item_box[items[0]], b->margin);
+		b->nodes[node].item = items[0];
+		b->leaf[items[0]] = node;
+		return node;
+	}
+
+	struct the_aabb centroids = empty_box;
+	for (int i = 0; i < n; ++i) {
+		struct the_aabb ib = b->item_box[items[i]];
+		struct the_vec3 c = { the__aabb_center(ib, 0), the__aabb_center(ib, 1), the__aabb_center(ib, 2) };
+		centroids = the__aabb_union(centroids, (struct the_aabb){ c, c });
+	}
+
+	int left = depth < BVH_SAH_DEPTH ? the__bvh_split_sah(b->item_box, items, n, centroids) : 0;
+	if (!left) {
+		int axis = 0;
+		float extent = -1.0f;
+		for (int a = 0; a < 3; ++a) {
+			float e = (&centroids.max.x)[a] - (&centroids.min.x)[a];
+			axis = e > extent ? a : axis;
+			extent = e > extent ? e : extent;
+		}
+		left = n / 2;
+		the__bvh_select(b->item_box, items, n, left, axis);
+	}
+
+	/* Children first: the node array may move while they are built. */
+	int c0 = the__bvh_build(b, items, left, depth + 1);
+	int c1 = the__bvh_build(b, items + left, n - left, depth + 1);
+	b->nodes[node].child[0] = c0;
+	b->nodes[node].child[1] = c1;
+	b->nodes[c0].parent = node;
+	b->nodes[c1].parent = node;
+	b->nodes[node].box = the__aabb_union(b->nodes[c0].box, b->nodes[c1].box);
+	b->nodes[node].height = 1 + (b->nodes[c0].height > b->nodes[c1].height ? b->nodes[c0].height : b->nodes[c1].height);
+	return node;
+}
+
+void
+the_bvh_rebuild(struct the_bvh *b)
+{
+	int *items = the_alloc((b->leaf_count ? b->leaf_count : 1) * sizeof(*items));
+	int n = 0;
+	for (int i = 0; i < b->item_cap; ++i) {
+		if (b->leaf[i] >= 0) {
+			items[n++] = i;
+		}
+	}
+	THE_ASSERT(n == b->leaf_count && "Leaf count out of sync");
+
+	b->node_count = 0;
+	b->free = -1;
+	b->root = n ? the__bvh_build(b, items, n, 0) : -1;
+	b->changes = 0;
+	the_free(items);
+}
+
+void
+the_bvh_maintain(struct the_bvh *b)
+{
+	if (b->changes > 16 && b->changes * 4 > b->leaf_count) {
+		the_bvh_rebuild(b);
+	}
+}
+
+/*
+ * Box against the frustum planes: farthest corner along a normal outside, culled; nearest
+ * corner inside every plane, contained. Returns false if culled.
+ */
+static inline bool
+the__frustum_box(const struct the_frustum *f, const struct the_aabb *box, bool *inside)
+{
+	*inside = true;
+	for (int p = 0; p < 6; ++p) {
+		const struct the_vec4 *pl = &f->planes[p];
+		float far = pl->w + pl->x * (pl->x > 0.0f ? box->max.x : box->min.x) +
+		  pl->y * (pl->y > 0.0f ? box->max.y : box->min.y) +
+		  pl->z * (pl->z > 0.0f ? box->max.z : box->min.z);
+		if (far < 0.0f) {
+			return false;
+		}
+		float near = pl->w + pl->x * (pl->x > 0.0f ? box->min.x : box->max.x) +
+		  pl->y * (pl->y > 0.0f ? box->min.y : box->max.y) +
+		  pl->z * (pl->z > 0.0f ? box->min.z : box->max.z);
+		*inside = *inside && near >= 0.0f;
+	}
+	return true;
+}
+
+int
+the_bvh_frustum(const struct the_bvh *b, const struct the_frustum *f, uint8_t *visible)
+{
+	if (b->root < 0) {
+		return 0;
+	}
+
+	int stack[BVH_STACK];
+	int top = 0;
+	int count = 0;
+	stack[top++] = b->root;
+	while (top) {
+		int entry = stack[--top];
+		int n = entry & ~BVH_INSIDE;
+		const struct the_bvh_node *node = &b->nodes[n];
+		bool leaf = node->child[0] < 0;
+		const struct the_aabb *box = leaf ? &b->item_box[node->item] : &node->box;
+
+		bool inside = entry & BVH_INSIDE; // Leaf boxes are inside their ancestors too.
+		if (!inside && !the__frustum_box(f, box, &inside)) {
+			continue;
+		}
+
+		if (leaf) {
+			visible[node->item] = 1;
+			++count;
+			continue;
+		}
+
+		THE_ASSERT(top + 2 <= BVH_STACK && "BVH too deep");
+		stack[top++] = node->child[0] | (inside ? BVH_INSIDE : 0);
+		stack[top++] = node->child[1] | (inside ? BVH_INSIDE : 0);
+	}
+	return count;
+}
+
+/* Multi view traversal entry: views still to test against the node, views containing it. */
+struct the__bvh_views {
+	int node;
+	uint32_t test;
+	uint32_t inside;
+};
+
+int
+the_bvh_frustums(const struct the_bvh *b, const struct the_frustum *f, int view_count, uint32_t *masks)
+{
+	THE_ASSERT(view_count > 0 && view_count <= THE_BVH_MAX_VIEWS && "Invalid view count");
+	if (b->root < 0) {
+		return 0;
+	}
+
+	struct the_frustum4 groups[THE_BVH_MAX_VIEWS / 4];
+	int group_count = (view_count + 3) / 4;
+	for (int g = 0; g < group_count; ++g) {
+		the_frustum4_set(&groups[g], f + g * 4, view_count - g * 4 < 4 ? view_count - g * 4 : 4);
+	}
+
+	struct the__bvh_views stack[BVH_STACK];
+	int top = 0;
+	int count = 0;
+	uint32_t all = view_count == 32 ? ~0u : (1u << view_count) - 1u;
+	stack[top++] = (struct the__bvh_views){ .node = b->root, .test = all, .inside = 0 };
+	while (top) {
+		struct the__bvh_views e = stack[--top];
+		const struct the_bvh_node *node = &b->nodes[e.node];
+		bool leaf = node->child[0] < 0;
+		const struct the_aabb *box = leaf ? &b->item_box[node->item] : &node->box;
+
+		/*
+		 * One box load, tested four views at a time against the views that neither culled
+		 * nor fully contained an ancestor.
+		 */
+		if (e.test) {
+			struct the_vec3 center = {
+				(box->min.x + box->max.x) * 0.5f, (box->min.y + box->max.y) * 0.5f, (box->min.z + box->max.z) * 0.5f
+			};
+			struct the_vec3 extent = {
+				(box->max.x - box->min.x) * 0.5f, (box->max.y - box->min.y) * 0.5f, (box->max.z - box->min.z) * 0.5f
+			};
+			for (int g = 0; g < group_count; ++g) {
+				uint32_t test = (e.test >> (g * 4)) & 0xFu;
+				if (!test) {
+					continue;
+				}
+				uint32_t inside;
+				uint32_t touch = the_frustum4_box(&groups[g], center, extent, &inside) & test;
+				e.test &= ~(test << (g * 4));
+				e.test |= (touch & ~inside) << (g * 4);
+				e.inside |= (inside & test) << (g * 4);
+			}
+		}
+		if (!(e.test | e.inside)) {
+			continue;
+		}
+
+		if (leaf) {
+			masks[node->item] = e.test | e.inside;
+			++count;
+			continue;
+		}
+
+		THE_ASSERT(top + 2 <= BVH_STACK && "BVH too deep");
+		stack[top++] = (struct the__bvh_views){ .node = node->child[0], .test = e.test, .inside = e.inside };
+		stack[top++] = (struct the__bvh_views){ .node = node->child[1], .test = e.test, .inside = e.inside };
+	}
+	return count;
+}
+
+/* Entry distance of the ray into box, or FLT_MAX if it misses within [0, max_t]. */
+static inline float
+the__ray_box(struct the_aabb box, const float *o, const float *inv, float max_t)
+{
+	float t0 = 0.0f, t1 = max_t;
+	for (int a = 0; a < 3; ++a) {
+		float ta = ((&box.min.x)[a] - o[a]) * inv[a];
+		float tb = ((&box.max.x)[a] - o[a]) * inv[a];
+		t0 = the__maxf(t0, the__minf(ta, tb));
+		t1 = the__minf(t1, the__maxf(ta, tb));
+	}
+	return t0 <= t1 ? t0 : FLT_MAX;
+}
+
+int
+the_bvh_raycast(const struct the_bvh *b, struct the_vec3 origin, struct the_vec3 dir, float max_t, float *t)
+{
+	if (b->root < 0) {
+		return -1;
+	}
+
+	const float o[3] = { origin.x, origin.y, origin.z };
+	float inv[3];
+	for (int a = 0; a < 3; ++a) {
+		float d = (&dir.x)[a];
+		inv[a] = 1.0f / (fabsf(d) > 1e-20f ? d : copysignf(1e-20f, d));
+	}
+
+	int hit = -1;
+	float best = max_t;
+	int stack[BVH_STACK];
+	int top = 0;
+	stack[top++] = b->root;
+	while (top) {
+		const struct the_bvh_node *node = &b->nodes[stack[--top]];
+		if (node->child[0] < 0) {
+			float th = the__ray_box(b->item_box[node->item], o, inv, best);
+			if (th != FLT_MAX && (th < best || hit < 0)) {
+				best = th;
+				hit = node->item;
+			}
+			continue;
+		}
+
+		/* Nearest child is pushed last so it is visited first and tightens `best` early. */
+		float t0 = the__ray_box(b->nodes[node->child[0]].box, o, inv, best);
+		float t1 = the__ray_box(b->nodes[node->child[1]].box, o, inv, best);
+		int first = t1 < t0;
+		float tf = first ? t1 : t0, ts = first ? t0 : t1;
+		THE_ASSERT(top + 2 <= BVH_STACK && "BVH too deep");
+		if (ts != FLT_MAX) {
+			stack[top++] = node->child[!first];
+		}
+		if (tf != FLT_MAX) {
+			stack[top++] = node->child[first];
+		}
+	}
+
+	if (hit >= 0 && t) {
+		*t = best;
+	}
+	return hit;
+}
+
+static inline float
+the__point_box_dist2(struct the_aabb box, struct the_vec3 p)
+{
+	float d2 = 0.0f;
+	for (int a = 0; a < 3; ++a) {
+		float v = (&p.x)[a];
+		float d = the__maxf(the__maxf((&box.min.x)[a] - v, v - (&box.max.x)[a]), 0.0f);
+		d2 += d * d;
+	}
+	return d2;
+}
+
+int
+the_bvh_nearest(const struct the_bvh *b, struct the_vec3 point, float max_dist, float *dist)
+{
+	if (b->root < 0) {
+		return -1;
+	}
+
+	int hit = -1;
+	float best = max_dist * max_dist;
+	int stack[BVH_STACK];
+	int top = 0;
+	stack[top++] = b->root;
+	while (top) {
+		const struct the_bvh_node *node = &b->nodes[stack[--top]];
+		if (node->child[0] < 0) {
+			float d2 = the__point_box_dist2(b->item_box[node->item], point);
+			if (d2 <= best) {
+				best = d2;
+				hit = node->item;
+			}
+			continue;
+		}
+
+		float d0 = the__point_box_dist2(b->nodes[node->child[0]].box, point);
+		float d1 = the__point_box_dist2(b->nodes[node->child[1]].box, point);
+		int first = d1 < d0;
+		THE_ASSERT(top + 2 <= BVH_STACK && "BVH too deep");
+		if ((first ? d0 : d1) <= best) {
+			stack[top++] = node->child[!first];
+		}
+		if ((first ? d1 : d0) <= best) {
+			stack[top++] = node->child[first];
+		}
+	}
+
+	if (hit >= 0 && dist) {
+		*dist = sqrtf(best);
+	}
+	return hit;
+}
@@ -0,0 +1,87 @@
+#ifndef THE_CORE_BVH_H
+#define THE_CORE_BVH_H
+
+#include "simd.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Dynamic bounding volume hierarchy of axis aligned boxes. Items are small non negative
+ * ints chosen by the caller (e.g. entity indices), one item per leaf.
+ * - Leaves store the item box grown by `margin`: moves that stay inside it cost nothing,
+ *     bigger ones refit the leaf and its ancestors. Inserts descend by surface area cost.
+ * - Refits slowly degrade the tree. the_bvh_rebuild rebuilds it top down with binned SAH
+ *     and the_bvh_maintain does so once enough leaves changed since the last build.
+ * - Queries test the exact item boxes at the leaves, they only read the tree.
+ * Boxes are clamped to +-THE_BVH_LIMIT so unbounded items do not break the cost math. NaN
+ * bounds count as unbounded, and inverted axes (e.g. an empty +inf / -inf box) collapse to
+ * their middle.
+ */
+#define THE_BVH_LIMIT 1e15f
+
+struct the_aabb {
+	struct the_vec3 min;
+	struct the_vec3 max;
+};
+
+struct the_bvh_node {
+	struct the_aabb box;
+	int parent; // Next free node while unused.
+	int child[2]; // -1 in leaves.
+	int item; // Leaves only.
+	int height; // Longest path down to a leaf, 0 in leaves.
+};
+
+struct the_bvh {
+	struct the_bvh_node *nodes;
+	int node_count;
+	int node_cap;
+	int free;
+	int root;
+
+	struct the_aabb *item_box; // Exact boxes by item.
+	int *leaf; // Leaf node by item, -1 if the item is not in the tree.
+	int item_cap;
+	int leaf_count;
+
+	int changes; // Inserts and refits since the last rebuild.
+	float margin;
+};
+
+void the_bvh_init(struct the_bvh *b, float margin);
+void the_bvh_release(struct the_bvh *b);
+
+void the_bvh_insert(struct the_bvh *b, int item, struct the_aabb box);
+void the_bvh_remove(struct the_bvh *b, int item);
+/* New box of an item, inserted if it is not in the tree yet. */
+void the_bvh_update(struct the_bvh *b, int item, struct the_aabb box);
+bool the_bvh_contains(const struct the_bvh *b, int item);
+
+void the_bvh_rebuild(struct the_bvh *b);
+/* Rebuilds if more than a quarter of the leaves were inserted or refitted since the last build. */
+void the_bvh_maintain(struct the_bvh *b);
+
+/*
+ * Sets visible[item] for the items touching the frustum, entries of the other items are
+ * left as they are (clear them first). Returns the number of items set.
+ */
+int the_bvh_frustum(const struct the_bvh *b, const struct the_frustum *f, uint8_t *visible);
+
+#define THE_BVH_MAX_VIEWS 32
+
+/*
+ * Several frusta in one traversal: bit v of masks[item] is set if the item touches f[v].
+ * Every node box is loaded once and tested, four views at a time (the_frustum4_box), only
+ * against the views that neither culled nor fully contained its parent. Items touching no frustum are left as they are (clear
+ * them first). Returns the number of items touching at least one frustum.
+ */
+int the_bvh_frustums(const struct the_bvh *b, const struct the_frustum *f, int view_count, uint32_t *masks);
+
+/* Closest item hit by origin + t * dir, t in [0, max_t]. Returns the item (and t) or -1. */
+int the_bvh_raycast(const struct the_bvh *b, struct the_vec3 origin, struct the_vec3 dir, float max_t, float *t);
+
+/* Item whose box is closest to point, within max_dist. Returns the item (and distance) or -1. */
+int the_bvh_nearest(const struct the_bvh *b, struct the_vec3 point, float max_dist, float *dist);
+
+#endif // THE_CORE_BVH_H
@@ -0,0 +1,277 @@
+#include "ecs.h"
+
+#include "common.h"
+#include "mem.h"
+
+#include <string.h>
+
+#define ECS_ALIGN 16 // Columns start 16 byte aligned, ready for SIMD loads.
+
+static inline int
+the__align(int offset)
+{
+	return (offset + ECS_ALIGN - 1) & ~(ECS_ALIGN - 1);
+}
+
+void
+the_ecs_init(struct the_ecs *w)
+{
+	memset(w, 0, sizeof(*w));
+	w->free = -1;
+}
+
+void
+the_ecs_release(struct the_ecs *w)
+{
+	for (int a = 0; a < w->arch_count; ++a) {
+		for (int c = 0; c < w->archs[a].chunk_count; ++c) {
+			the_free(w->archs[a].chunks[c].data);
+		}
+		the_free(w->archs[a].chunks);
+	}
+	the_free(w->archs);
+	the_free(w->rec);
+	the_ecs_init(w);
+}
+
+int
+the_ecs_component(struct the_ecs *w, size_t size)
+{
+	THE_ASSERT(w->component_count < THE_ECS_MAX_COMPONENTS && "Too many components");
+	THE_ASSERT(!w->arch_count && "Register the components before creating entities");
+	w->size[w->component_count] = size;
+	return w->component_count++;
+}
+
+static int
+the__ecs_archetype(struct the_ecs *w, the_ecs_mask mask)
+{
+	for (int a = 0; a < w->arch_count; ++a) {
+		if (w->archs[a].mask == mask) {
+			return a;
+		}
+	}
+
+	if (w->arch_count == w->arch_cap) {
+		w->arch_cap = w->arch_cap ? w->arch_cap * 2 : 16;
+		w->archs = the_realloc(w->archs, w->arch_cap * sizeof(*w->archs));
+	}
+
+	struct the_ecs_archetype *arch = &w->archs[w->arch_count];
+	memset(arch, 0, sizeof(*arch));
+	arch->mask = mask;
+
+	/* Biggest row count whose aligned columns fit in a chunk. */
+	size_t row = sizeof(the_ent);
+	for (int c = 0; c < w->component_count; ++c) {
+		row += (mask & THE_ECS_BIT(c)) ? w->size[c] : 0;
+	}
+	int cap = THE_ECS_CHUNK_SIZE / row;
+	for (;; --cap) {
+		THE_ASSERT(cap > 0 && "Row bigger than a chunk");
+		int offset = the__align(cap * sizeof(the_ent));
+		for (int c = 0; c < THE_ECS_MAX_COMPONENTS; ++c) {
+			arch->offset[c] = -1;
+			if (c < w->component_count && (mask & THE_ECS_BIT(c))) {
+				arch->offset[c] = offset;
+				offset = the__align(offset + cap * w->size[c]);
+			}
+		}
+		if (offset <= THE_ECS_CHUNK_SIZE) {
+			break;
+		}
+	}
+	arch->cap = cap;
+	return w->arch_count++;
+}
+
+/* Appends a zeroed row to the archetype, returns the chunk and row through the record. */
+static void
+the__ecs_push_row(struct the_ecs *w, int a, the_ent e)
+{
+	struct the_ecs_archetype *arch = &w->archs[a];
+	struct the_ecs_chunk *last = arch->chunk_count ? &arch->chunks[arch->chunk_count - 1] : NULL;
+	if (!last || last->count == arch->cap) {
+		if (arch->chunk_count == arch->chunk_cap) {
+			arch->chunk_cap = arch->chunk_cap ? arch->chunk_cap * 2 : 4;
+			arch->chunks = the_realloc(arch->chunks, arch->chunk_cap * sizeof(*arch->chunks));
+		}
+		last = &arch->chunks[arch->chunk_count++];
+		last->data = the_alloc(THE_ECS_CHUNK_SIZE);
+		last->count = 0;
+	}
+
+	int row = last->count++;
+	((the_ent *)last->data)[row] = e;
+	for (int c = 0; c < w->component_count; ++c) {
+		if (arch->offset[c] >= 0) {
+			memset(last->data + arch->offset[c] + row * w->size[c], 0, w->size[c]);
+		}
+	}
+	w->rec[e] = (struct the_ecs_record){ .arch = a, .chunk = arch->chunk_count - 1, .row = row };
+}
+
+/* Fills the hole of a row with the last row of the archetype, so chunks stay packed. */
+static void
+the__ecs_remove_row(struct the_ecs *w, int a, int chunk, int row)
+{
+	struct the_ecs_archetype *arch = &w->archs[a];
+	struct the_ecs_chunk *last = &arch->chunks[arch->chunk_count - 1];
+	struct the_ecs_chunk *hole = &arch->chunks[chunk];
+	int last_row = last->count - 1;
+	if (last != hole || last_row != row) {
+		the_ent moved = ((the_ent *)last->data)[last_row];
+		((the_ent *)hole->data)[row] = moved;
+		for (int c = 0; c < w->component_count; ++c) {
+			if (arch->offset[c] >= 0) {
+				memcpy(hole->data + arch->offset[c] + row * w->size[c],
+				       last->data + arch->offset[c] + last_row * w->size[c], w->size[c]);
+			}
+		}
+		w->rec[moved].chunk = chunk;
+		w->rec[moved].row = row;
+	}
+
+	if (--last->count == 0) {
+		the_free(last->data);
+		arch->chunk_count--;
+	}
+}
+
+the_ent
+the_ecs_create(struct the_ecs *w, the_ecs_mask mask)
+{
+	the_ent e = w->free;
+	if (e >= 0) {
+		w->free = w->rec[e].chunk;
+	} else {
+		if (w->rec_count == w->rec_cap) {
+			w->rec_cap = w->rec_cap ? w->rec_cap * 2 : 64;
+			w->rec = the_realloc(w->rec, w->rec_cap * sizeof(*w->rec));
+		}
+		e = w->rec_count++;
+	}
+
+	the__ecs_push_row(w, the__ecs_archetype(w, mask), e);
+	w->count++;
+	return e;
+}
+
+void
+the_ecs_destroy(struct the_ecs *w, the_ent e)
+{
+	THE_ASSERT(e >= 0 && e < w->rec_count && w->rec[e].arch >= 0 && "Invalid entity");
+	struct the_ecs_record r = w->rec[e];
+	the__ecs_remove_row(w, r.arch, r.chunk, r.row);
+	w->rec[e] = (struct the_ecs_record){ .arch = -1, .chunk = w->free, .row = -1 };
+	w->free = e;
+	w->count--;
+}
+
+void
+the_ecs_set_mask(struct the_ecs *w, the_ent e, the_ecs_mask mask)
+{
+	THE_ASSERT(e >= 0 && e < w->rec_count && w->rec[e].arch >= 0 && "Invalid entity");
+	struct the_ecs_record old = w->rec[e];
+	if (w->archs[old.arch].mask == mask) {
+		return;
+	}
+
+	int a = the__ecs_archetype(w, mask); // May move w->archs.
+	the__ecs_push_row(w, a, e);
+	struct the_ecs_record r = w->rec[e];
+	const struct the_ecs_archetype *src = &w->archs[old.arch];
+	const struct the_ecs_archetype *dst = &w->archs[a];
+	for (int c = 0; c < w->component_count; ++c) {
+		if (src->offset[c] >= 0 && dst->offset[c] >= 0) {
+			memcpy(dst->chunks[r.chunk].data + dst->offset[c] + r.row * w->size[c],
+			       src->chunks[old.chunk].data + src->offset[c] + old.row * w->size[c], w->size[c]);
+		}
+	}
+	the__ecs_remove_row(w, old.arch, old.chunk, old.row);
+}
+
+the_ecs_mask
+the_ecs_mask_of(const struct the_ecs *w, the_ent e)
+{
+	THE_ASSERT(e >= 0 && e < w->rec_count && w->rec[e].arch >= 0 && "Invalid entity");
+	return w->archs[w->rec[e].arch].mask;
+}
+
+void *
+the_ecs_get(struct the_ecs *w, the_ent e, int component)
+{
+	THE_ASSERT(e >= 0 && e < w->rec_count && w->rec[e].arch >= 0 && "Invalid entity");
+	struct the_ecs_record r = w->rec[e];
+	const struct the_ecs_archetype *arch = &w->archs[r.arch];
+	if (arch->offset[component] < 0) {
+		return NULL;
+	}
+	return arch->chunks[r.chunk].data + arch->offset[component] + r.row * w->size[component];
+}
+
+void *
+the_ecs_column(const struct the_ecs_view *view, int component)
+{
+	THE_ASSERT(view->arch->offset[component] >= 0 && "Component not in the view");
+	return view->data + view->arch->offset[component];
+}
+
+struct the__ecs_query {
+	struct the_ecs_view *views;
+	the_ecs_fn fn;
+	void *args;
+};
+
+static void
+the__ecs_run(void *args, int begin, int end)
+{
+	struct the__ecs_query *q = args;
+	for (int i = begin; i < end; ++i) {
+		q->fn(q->args, &q->views[i]);
+	}
+}
+
+int
+the_ecs_each(struct the_ecs *w, the_ecs_mask all, the_ecs_mask none, the_ecs_fn fn, void *args, thesched *sched)
+{
+	int view_count = 0;
+	for (int a = 0; a < w->arch_count; ++a) {
+		const struct the_ecs_archetype *arch = &w->archs[a];
+		if ((arch->mask & all) == all && !(arch->mask & none)) {
+			view_count += arch->chunk_count;
+		}
+	}
+	if (!view_count) {
+		return 0;
+	}
+
+	struct the__ecs_query q = {
+		.views = the_alloc(view_count * sizeof(*q.views)), .fn = fn, .args = args
+	};
+	int n = 0;
+	int entities = 0;
+	for (int a = 0; a < w->arch_count; ++a) {
+		const struct the_ecs_archetype *arch = &w->archs[a];
+		if ((arch->mask & all) != all || (arch->mask & none)) {
+			continue;
+		}
+		for (int c = 0; c < arch->chunk_count; ++c) {
+			q.views[n++] = (struct the_ecs_view){
+				.arch = arch,
+				.data = arch->chunks[c].data,
+				.ent = (const the_ent *)arch->chunks[c].data,
+				.count = arch->chunks[c].count,
+			};
+			entities += arch->chunks[c].count;
+		}
+	}
+
+	if (sched && view_count > 1) {
+		the_sched_for(sched, view_count, 1, the__ecs_run, &q);
+	} else {
+		the__ecs_run(&q, 0, view_count);
+	}
+	the_free(q.views);
+	return entities;
+}
@@ -0,0 +1,95 @@
+#ifndef THE_CORE_ECS_H
+#define THE_CORE_ECS_H
+
+#include "sched.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Archetype tables. Entities with the same set of components share an archetype, whose
+ * rows are stored in fixed size chunks, column by column: a system that reads two
+ * components walks two packed arrays and nothing else.
+ * - Components are registered with their size and get an id in [0, THE_ECS_MAX_COMPONENTS).
+ *     Sets of components are bit masks (THE_ECS_BIT).
+ * - Entity handles are stable. Rows move when entities are destroyed or change their
+ *     set, so component pointers are only valid until the next structural change.
+ * - the_ecs_each runs a function on every chunk that matches a query, one job per chunk
+ *     on the scheduler if one is given. No structural changes while it runs.
+ */
+#define THE_ECS_MAX_COMPONENTS 64
+#define THE_ECS_CHUNK_SIZE (16 * 1024)
+#define THE_ECS_BIT(COMPONENT) ((the_ecs_mask)1 << (COMPONENT))
+
+typedef int the_ent;
+typedef uint64_t the_ecs_mask;
+
+struct the_ecs_chunk {
+	char *data; // cap entity handles, then the columns.
+	int count;
+};
+
+struct the_ecs_archetype {
+	the_ecs_mask mask;
+	int cap; // Rows per chunk.
+	int offset[THE_ECS_MAX_COMPONENTS]; // Column offset in the chunk data, -1 if absent.
+	struct the_ecs_chunk *chunks; // Every chunk but the last one is full.
+	int chunk_count;
+	int chunk_cap;
+};
+
+struct the_ecs_record {
+	int arch; // -1 if the handle is free.
+	int chunk; // Next free handle while free.
+	int row;
+};
+
+struct the_ecs {
+	size_t size[THE_ECS_MAX_COMPONENTS];
+	int component_count;
+
+	struct the_ecs_archetype *archs;
+	int arch_count;
+	int arch_cap;
+
+	struct the_ecs_record *rec;
+	int rec_count;
+	int rec_cap;
+	the_ent free;
+	int count; // Live entities.
+};
+
+/* Rows of one chunk, handed to the query functions. */
+struct the_ecs_view {
+	const struct the_ecs_archetype *arch;
+	char *data;
+	const the_ent *ent;
+	int count;
+};
+
+typedef void (*the_ecs_fn)(void *args, const struct the_ecs_view *view);
+
+void the_ecs_init(struct the_ecs *w);
+void the_ecs_release(struct the_ecs *w);
+int the_ecs_component(struct the_ecs *w, size_t size);
+
+/* New entity with the components of mask, zero initialized. */
+the_ent the_ecs_create(struct the_ecs *w, the_ecs_mask mask);
+void the_ecs_destroy(struct the_ecs *w, the_ent e);
+/* Adds and removes components, the values of the ones kept are preserved. */
+void the_ecs_set_mask(struct the_ecs *w, the_ent e, the_ecs_mask mask);
+the_ecs_mask the_ecs_mask_of(const struct the_ecs *w, the_ent e);
+/* Component of an entity or NULL if it does not have it. */
+void *the_ecs_get(struct the_ecs *w, the_ent e, int component);
+
+/* First element of a column of the view (the component must be part of the query). */
+void *the_ecs_column(const struct the_ecs_view *view, int component);
+
+/*
+ * Calls fn on every chunk of the archetypes having all the components of `all` and none
+ * of `none`. Chunks are split across the workers of sched (NULL: inline, in order).
+ * Returns the number of entities visited.
+ */
+int the_ecs_each(struct the_ecs *w, the_ecs_mask all, the_ecs_mask none, the_ecs_fn fn, void *args, thesched *sched);
+
+#endif // THE_CORE_ECS_H
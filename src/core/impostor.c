@@ -0,0 +1,338 @@
+#include "impostor.h"
+
+#include "common.h"
+#include "log.h"
+#include "mem.h"
+#include "render/pixels_internal.h"
+
+#include <stb_image.h>
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+static const int impostor_attrib_floats[THE_VA_COUNT] = { 3, 3, 3, 3, 2, 4, 4 };
+
+struct the_vec3
+the_impostor_dir(int x, int y, int frames)
+{
+	/* Octahedral map: the upper half of the sphere in the diamond, the lower one folded out. */
+	float ex = ((float)x + 0.5f) / (float)frames * 2.0f - 1.0f;
+	float ez = ((float)y + 0.5f) / (float)frames * 2.0f - 1.0f;
+	float n[3] = { ex, 1.0f - fabsf(ex) - fabsf(ez), ez };
+	if (n[1] < 0.0f) {
+		n[0] = (1.0f - fabsf(ez)) * (ex >= 0.0f ? 1.0f : -1.0f);
+		n[2] = (1.0f - fabsf(ex)) * (ez >= 0.0f ? 1.0f : -1.0f);
+	}
+	float inv = 1.0f / sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	return (struct the_vec3){ n[0] * inv, n[1] * inv, n[2] * inv };
+}
+
+void
+the_impostor_basis(struct the_vec3 dir, struct the_vec3 *right, struct the_vec3 *up)
+{
+	struct the_vec3 ref = fabsf(dir.y) > 0.999f ? (struct the_vec3){ 0.0f, 0.0f, 1.0f } :
+	                                             (struct the_vec3){ 0.0f, 1.0f, 0.0f };
+	struct the_vec3 r = { ref.y * dir.z - ref.z * dir.y, ref.z * dir.x - ref.x * dir.z, ref.x * dir.y - ref.y * dir.x };
+	float inv = 1.0f / sqrtf(r.x * r.x + r.y * r.y + r.z * r.z);
+	*right = (struct the_vec3){ r.x * inv, r.y * inv, r.z * inv };
+	*up = (struct the_vec3){
+		dir.y * right->z - dir.z * right->y,
+		dir.z * right->x - dir.x * right->z,
+		dir.x * right->y - dir.y * right->x,
+	};
+}
+
+/* Box filtered halvings of an RGBA8 image until it is no bigger than target texels a side. */
+static uint8_t *
+the__impostor_shrink(uint8_t *img, int *w, int *h, int target)
+{
+	while (*w > target && *h > target && *w > 1 && *h > 1) {
+		int nw = *w / 2, nh = *h / 2;
+		uint8_t *half = the_alloc((size_t)nw * nh * 4);
+		for (int y = 0; y < nh; ++y) {
+			for (int x = 0; x < nw; ++x) {
+				const uint8_t *a = img + ((size_t)(2 * y) * *w + 2 * x) * 4;
+				const uint8_t *b = a + (size_t)*w * 4;
+				for (int c = 0; c < 4; ++c) {
+					half[((size_t)y * nw + x) * 4 + c] = (uint8_t)((a[c] + a[4 + c] + b[c] + b[4 + c] + 2) / 4);
+				}
+			}
+		}
+		the_free(img);
+		img = half;
+		*w = nw;
+		*h = nh;
+	}
+	return img;
+}
+
+/* Background texels of a view take the color of an opaque neighbour: no dark fringe when filtered. */
+static void
+the__impostor_dilate(uint8_t *albedo, int size, int x0, int y0, int frame_size)
+{
+	static const int off[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	for (int y = y0; y < y0 + frame_size; ++y) {
+		for (int x = x0; x < x0 + frame_size; ++x) {
+			uint8_t *t = albedo + ((size_t)y * size + x) * 4;
+			for (int k = 0; !t[3] && k < 4; ++k) {
+				int nx = x + off[k][0], ny = y + off[k][1];
+				if (nx < x0 || ny < y0 || nx >= x0 + frame_size || ny >= y0 + frame_size) {
+					continue;
+				}
+				const uint8_t *n = albedo + ((size_t)ny * size + nx) * 4;
+				if (n[3] == 255) {
+					memcpy(t, n, 3);
+				}
+			}
+		}
+	}
+}
+
+struct the__impostor_img {
+	const uint8_t *pix;
+	int w, h;
+};
+
+static void
+the__impostor_sample(const struct the__impostor_img *img, float u, float v, uint8_t *out)
+{
+	if (!img->pix) {
+		out[0] = out[1] = out[2] = 255;
+		return;
+	}
+	u -= floorf(u);
+	v -= floorf(v);
+	int x = (int)(u * img->w), y = (int)(v * img->h);
+	x = x < img->w ? x : img->w - 1;
+	y = y < img->h ? y : img->h - 1;
+	memcpy(out, img->pix + ((size_t)y * img->w + x) * 4, 3);
+}
+
+int
+the_impostor_bake(const char *mesh_path, const struct the_impostor_bake *desc, struct the_impostor_atlas *out)
+{
+	THE_ASSERT(desc->frames > 0 && desc->frame_size > 0 && "Empty atlas");
+	memset(out, 0, sizeof(*out));
+	struct the_mesh_internal m;
+	memset(&m, 0, sizeof(m));
+	the_mesh_decode(&m, mesh_path);
+	if (!m.vtx || !m.idx || !m.elem_count || !(m.attrib & (1 << THE_VA_POS))) {
+		THE_LOG_ERR("The impostor mesh %s couldn't be loaded", mesh_path);
+		the_free(m.vtx);
+		the_free(m.idx);
+		return THE_ERR_FILE;
+	}
+
+	/* Albedo reduced close to the texels a view can show, nearest sampling then stays stable. */
+	struct the__impostor_img img = { NULL, 0, 0 };
+	if (desc->albedo) {
+		int channels;
+		stbi_set_flip_vertically_on_load_thread(0); // Texture decodes on other threads set their own.
+		uint8_t *pix = stbi_load(desc->albedo, &img.w, &img.h, &channels, 4);
+		if (!pix) {
+			THE_LOG_ERR("The image '%s' couldn't be loaded", desc->albedo);
+			the_free(m.vtx);
+			the_free(m.idx);
+			return THE_ERR_FILE;
+		}
+		float tiling = desc->tiling[0] > desc->tiling[1] ? desc->tiling[0] : desc->tiling[1];
+		img.pix = the__impostor_shrink(pix, &img.w, &img.h, (int)((float)desc->frame_size / (tiling > 1.0f ? tiling : 1.0f)));
+	}
+
+	int stride = 0, normal = -1, uv = -1;
+	for (int a = 0; a < THE_VA_COUNT; ++a) {
+		if (m.attrib & (1 << a)) {
+			normal = a == THE_VA_NORMAL ? stride : normal;
+			uv = a == THE_VA_UV ? stride : uv;
+			stride += impostor_attrib_floats[a];
+		}
+	}
+	int64_t first = m.lod_count ? m.lods[0].first : 0;
+	int64_t count = m.lod_count ? m.lods[0].count : m.elem_count;
+	int64_t vertices = 0;
+	for (int64_t i = first; i < first + count; ++i) {
+		vertices = m.idx[i] >= vertices ? (int64_t)m.idx[i] + 1 : vertices;
+	}
+
+	const int fs = desc->frame_size;
+	const int size = desc->frames * fs;
+	const struct the_vec4 s = m.bounds.sphere;
+	out->size = size;
+	out->sphere = s;
+	out->albedo = the_calloc((size_t)size * size, 4);
+	out->normal = the_calloc((size_t)size * size, 4);
+	float *proj = the_alloc(vertices * 3 * sizeof(float)); // View space xyz, in radii.
+	float *depth = the_alloc((size_t)fs * fs * sizeof(float));
+
+	for (int fy = 0; fy < desc->frames; ++fy) {
+		for (int fx = 0; fx < desc->frames; ++fx) {
+			struct the_vec3 d = the_impostor_dir(fx, fy, desc->frames);
+			struct the_vec3 r, u;
+			the_impostor_basis(d, &r, &u);
+			for (int64_t v = 0; v < vertices; ++v) {
+				const float *p = m.vtx + v * stride;
+				float l[3] = { (p[0] - s.x) / s.w, (p[1] - s.y) / s.w, (p[2] - s.z) / s.w };
+				proj[v * 3 + 0] = ((l[0] * r.x + l[1] * r.y + l[2] * r.z) * 0.5f + 0.5f) * fs;
+				proj[v * 3 + 1] = ((l[0] * u.x + l[1] * u.y + l[2] * u.z) * 0.5f + 0.5f) * fs;
+				proj[v * 3 + 2] = l[0] * d.x + l[1] * d.y + l[2] * d.z;
+			}
+			for (int i = 0; i < fs * fs; ++i) {
+				depth[i] = -FLT_MAX;
+			}
+
+			/* Both windings, the nearest surface wins. */
+			for (int64_t t = first; t + 2 < first + count; t += 3) {
+				const the_idx *tri = m.idx + t;
+				const float *a = proj + tri[0] * 3, *b = proj + tri[1] * 3, *c = proj + tri[2] * 3;
+				float area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+				if (fabsf(area) < 1e-12f) {
+					continue;
+				}
+				int x0 = (int)fmaxf(floorf(fminf(a[0], fminf(b[0], c[0]))), 0.0f);
+				int y0 = (int)fmaxf(floorf(fminf(a[1], fminf(b[1], c[1]))), 0.0f);
+				int x1 = (int)fminf(ceilf(fmaxf(a[0], fmaxf(b[0], c[0]))), (float)fs - 1.0f);
+				int y1 = (int)fminf(ceilf(fmaxf(a[1], fmaxf(b[1], c[1]))), (float)fs - 1.0f);
+				for (int py = y0; py <= y1; ++py) {
+					for (int px = x0; px <= x1; ++px) {
+						float qx = px + 0.5f, qy = py + 0.5f;
+						float w0 = ((b[0] - qx) * (c[1] - qy) - (b[1] - qy) * (c[0] - qx)) / area;
+						float w1 = ((c[0] - qx) * (a[1] - qy) - (c[1] - qy) * (a[0] - qx)) / area;
+						float w2 = 1.0f - w0 - w1;
+						float z = w0 * a[2] + w1 * b[2] + w2 * c[2];
+						if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f || z <= depth[py * fs + px]) {
+							continue;
+						}
+						depth[py * fs + px] = z;
+
+						const float *va = m.vtx + tri[0] * stride;
+						const float *vb = m.vtx + tri[1] * stride;
+						const float *vc = m.vtx + tri[2] * stride;
+						size_t texel = ((size_t)(fy * fs + py) * size + fx * fs + px) * 4;
+						uint8_t *al = out->albedo + texel;
+						uint8_t *nm = out->normal + texel;
+						if (uv >= 0) {
+							float tu = w0 * va[uv] + w1 * vb[uv] + w2 * vc[uv];
+							float tv = w0 * va[uv + 1] + w1 * vb[uv + 1] + w2 * vc[uv + 1];
+							the__impostor_sample(&img, tu * desc->tiling[0], tv * desc->tiling[1], al);
+						} else {
+							the__impostor_sample(&img, 0.0f, 0.0f, al);
+						}
+						for (int k = 0; k < 3; ++k) {
+							al[k] = (uint8_t)(al[k] * fminf(fmaxf(desc->color[k], 0.0f), 1.0f) + 0.5f);
+						}
+						al[3] = 255;
+
+						float n[3] = { d.x, d.y, d.z };
+						if (normal >= 0) {
+							for (int k = 0; k < 3; ++k) {
+								n[k] = w0 * va[normal + k] + w1 * vb[normal + k] + w2 * vc[normal + k];
+							}
+							float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+							for (int k = 0; k < 3; ++k) {
+								n[k] = len > 0.0f ? n[k] / len : 0.0f;
+							}
+						}
+						for (int k = 0; k < 3; ++k) {
+							nm[k] = (uint8_t)((n[k] * 0.5f + 0.5f) * 255.0f + 0.5f);
+						}
+						nm[3] = (uint8_t)(fminf(fmaxf(z * 0.5f + 0.5f, 1.0f / 255.0f), 1.0f) * 255.0f + 0.5f);
+					}
+				}
+			}
+			the__impostor_dilate(out->albedo, size, fx * fs, fy * fs, fs);
+		}
+	}
+
+	the_free(depth);
+	the_free(proj);
+	if (img.pix) {
+		the_free((void *)img.pix);
+	}
+	the_free(m.vtx);
+	the_free(m.idx);
+	return THE_OK;
+}
+
+void
+the_impostor_atlas_release(struct the_impostor_atlas *atlas)
+{
+	the_free(atlas->albedo);
+	the_free(atlas->normal);
+	memset(atlas, 0, sizeof(*atlas));
+}
+
+void
+the_impostor_init(struct the_impostor *imp, the_mesh mesh, the_tex tex, float pixels)
+{
+	memset(imp, 0, sizeof(*imp));
+	imp->mesh = mesh;
+	imp->tex = tex;
+	imp->pixels = pixels;
+}
+
+void
+the_impostor_release(struct the_impostor *imp)
+{
+	the_free(imp->instances);
+	memset(imp, 0, sizeof(*imp));
+}
+
+int
+the_entity_impostors(struct the_cam *cam, float viewport_h, struct the_impostor *imps, int imp_count, uint8_t *visible)
+{
+	for (int k = 0; k < imp_count; ++k) {
+		imps[k].count = 0;
+	}
+
+	struct the_vec3 eye = the_camera_eye(cam);
+	float ppu = cam->proj[5] * viewport_h * 0.5f; // Pixels of one world unit at distance 1.
+	int swapped = 0;
+	for (int i = 0; i < entity_pool.count; ++i) {
+		if (!visible[i]) {
+			continue;
+		}
+		const struct the_entity *e = &entity_pool.buf->at[i];
+		struct the_impostor *imp = NULL;
+		for (int k = 0; k < imp_count && !imp; ++k) {
+			if (imps[k].mesh == e->mesh && (imps[k].tex == THE_NONE || *the_mat_tex(e->mat) == imps[k].tex)) {
+				imp = &imps[k];
+			}
+		}
+		if (!imp) {
+			continue;
+		}
+
+		/* Diameter of the world bounding sphere, scaled by the biggest axis scale. */
+		struct the_vec4 s = the_mesh_bounds(e->mesh).sphere;
+		const float *m = the_graph_world(&scene_graph, e->node);
+		float scale2 = 0.0f;
+		float c[3];
+		for (int j = 0; j < 3; ++j) {
+			float l2 = m[j * 4] * m[j * 4] + m[j * 4 + 1] * m[j * 4 + 1] + m[j * 4 + 2] * m[j * 4 + 2];
+			scale2 = l2 > scale2 ? l2 : scale2;
+			c[j] = m[12 + j] + m[j] * s.x + m[4 + j] * s.y + m[8 + j] * s.z;
+		}
+		float radius = s.w * sqrtf(scale2);
+		float d[3] = { c[0] - eye.x, c[1] - eye.y, c[2] - eye.z };
+		float dist = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		if (dist <= radius || 2.0f * radius * ppu / dist >= imp->pixels) {
+			continue;
+		}
+
+		if (imp->count == imp->cap) {
+			imp->cap = imp->cap ? imp->cap * 2 : 64;
+			imp->instances = the_realloc(imp->instances, imp->cap * THE_IMPOSTOR_FLOATS * sizeof(float));
+		}
+		float *rec = imp->instances + imp->count++ * THE_IMPOSTOR_FLOATS;
+		for (int j = 0; j < 3; ++j) {
+			rec[j * 4 + 0] = m[j];
+			rec[j * 4 + 1] = m[4 + j];
+			rec[j * 4 + 2] = m[8 + j];
+			rec[j * 4 + 3] = m[12 + j];
+		}
+		visible[i] = 0;
+		++swapped;
+	}
+	return swapped;
+}
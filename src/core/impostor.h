@@ -0,0 +1,74 @@
+#ifndef THE_CORE_IMPOSTOR_H
+#define THE_CORE_IMPOSTOR_H
+
+#include "scene.h"
+
+#include <stdint.h>
+
+/*
+ * Octahedral impostors: a mesh seen from frames * frames directions spread over the
+ * sphere, baked into atlases and drawn as one quad per entity once it is small on screen.
+ * - View (x, y) of the grid looks at the mesh from the_impostor_dir(x, y, frames), an
+ *     octahedral map of the sphere (+y at the center of the grid, -y at its corners). Its
+ *     frame_size square cell in the atlases is an orthographic view of the bounding sphere
+ *     of the mesh: right and up from the_impostor_basis, atlas rows from v = 0.
+ * - Albedo atlas: RGB color, A coverage. Normal atlas: RGB object space normal (n * 0.5 +
+ *     0.5), A depth toward the viewer in sphere radii (d * 0.5 + 0.5, 0: background).
+ * - At runtime the view nearest to the eye direction (in object space) is picked, and a
+ *     quad in its plane covers the sphere: the atlas cell matches the quad exactly.
+ */
+#define THE_IMPOSTOR_FLOATS 12 // Instance record: rows 0 to 2 of the world matrix.
+
+struct the_impostor_bake {
+	int frames; // Views per side of the atlas.
+	int frame_size; // Pixels per side of a view.
+	const char *albedo; // Image sampled with the mesh uvs, like a texture loaded unflipped. NULL: white.
+	float tiling[2]; // Multiplies the uvs.
+	float color[3]; // Multiplies the albedo.
+};
+
+struct the_impostor_atlas {
+	int size; // Pixels per side, frames * frame_size.
+	struct the_vec4 sphere; // Object space bounds the views frame, the_mesh_bounds of the mesh.
+	uint8_t *albedo; // RGBA8, size * size.
+	uint8_t *normal; // RGBA8, size * size.
+};
+
+/*
+ * Rasterizes the finest level of detail of the mesh file (.obj or .msh, rest pose for
+ * skinned ones) on the CPU. Any thread can call it. Returns THE_OK or an error.
+ */
+int the_impostor_bake(const char *mesh_path, const struct the_impostor_bake *desc, struct the_impostor_atlas *out);
+void the_impostor_atlas_release(struct the_impostor_atlas *atlas);
+
+/* Object space direction toward the viewer of view (x, y). */
+struct the_vec3 the_impostor_dir(int x, int y, int frames);
+/* Right and up of the view looking along -dir, as the shaders build them. */
+void the_impostor_basis(struct the_vec3 dir, struct the_vec3 *right, struct the_vec3 *up);
+
+/*
+ * Entities drawn as impostors: the ones with mesh whose first material texture is tex (the
+ * albedo the atlas was baked with, THE_NONE: any material). Records of the last
+ * the_entity_impostors, to stream as per instance data of a quad draw.
+ */
+struct the_impostor {
+	the_mesh mesh;
+	the_tex tex;
+	float pixels; // Swapped in below this projected diameter of the bounding sphere.
+	float *instances; // count records of THE_IMPOSTOR_FLOATS.
+	int count;
+	int cap;
+};
+
+void the_impostor_init(struct the_impostor *imp, the_mesh mesh, the_tex tex, float pixels);
+void the_impostor_release(struct the_impostor *imp);
+
+/*
+ * Swaps the visible entities of entity_pool that have an impostor and cover fewer than its
+ * pixels on a viewport viewport_h pixels tall: clears visible[i] and adds their record to
+ * the impostor. Call it after the_entity_cull and before the_entity_lod. Returns the
+ * entities swapped.
+ */
+int the_entity_impostors(struct the_cam *cam, float viewport_h, struct the_impostor *imps, int imp_count, uint8_t *visible);
+
+#endif // THE_CORE_IMPOSTOR_H
@@ -1,12 +1,20 @@
 #include "io.h"
 #include "mem.h"
+#include "prefetch.h"
 
 #ifndef __EMSCRIPTEN__
 #include <glad/glad.h>
 #endif
 #include <GLFW/glfw3.h>
+#include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #define THE_MOUSE_BUTTON_UPDATE(MBTN) \
 	io.mouse_button[(MBTN)] =          \
@@ -17,6 +25,8 @@
 
 struct the_io io = { .internal_window = NULL };
 struct the_io *the_io = &io;
+static struct the_vec2 scroll = { 0.0f, 0.0f }; // Accumulated until the next the_io_poll.
+static int invalidated = 1;
 
 static inline void
 the_input_update(void)
@@ -156,8 +166,8 @@ static void
 the__scrollcallback(GLFWwindow *window, double x_offset, double y_offset)
 {
 	(void)window; // Unused
-	io.mouse_scroll.x = (float)x_offset;
-	io.mouse_scroll.y = (float)y_offset;
+	scroll.x += (float)x_offset;
+	scroll.y += (float)y_offset;
 }
 
 static void
@@ -182,6 +192,14 @@ the_io_init(const char *title, struct the_point window_size)
 		return false;
 	}
 
+#ifdef THE_HEADLESS
+	/* GLFW null platform: window_size is the size of the offscreen OSMesa framebuffer. */
+	glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#endif
+
 	io.internal_window = glfwCreateWindow(window_size.x, window_size.y, title, NULL, NULL);
 	if (!io.internal_window) {
 		glfwTerminate();
@@ -193,7 +211,7 @@ the_io_init(const char *title, struct the_point window_size)
 	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
 #endif
 
-	glfwSwapInterval(1);
+	the_present_set(THE_PRESENT_VSYNC);
 	glfwSetScrollCallback(io.internal_window, the__scrollcallback);
 	glfwSetCursorEnterCallback(io.internal_window, the__cursor_enter_callback);
 	glfwSetWindowFocusCallback(io.internal_window, the__window_focus_callback);
@@ -203,6 +221,10 @@ the_io_init(const char *title, struct the_point window_size)
 	io.show_cursor = true;
 	io.capture_mouse = true;
 	io.capture_keyboard = true;
+#ifdef THE_HEADLESS
+	/* No events will ever come from the null platform, input stays zeroed. */
+	io.window_focused = true;
+#endif
 
 	the_io_poll();
 	return true;
@@ -237,6 +259,7 @@ the_file_read(const char *path, char **dst, size_t *size)
 
 	fclose(f);
 	(*dst)[*size - 1] = '\0';
+	the_prefetch_record(path, 0, *size - 1);
 	return THE_OK;
 }
 
@@ -244,8 +267,9 @@ void
 the_io_poll(void)
 {
 	THE_ASSERT(io.internal_window && "The IO system is uninitalized");
-	io.mouse_scroll = (struct the_vec2){ 0.0f, 0.0f };
 	glfwPollEvents();
+	io.mouse_scroll = scroll;
+	scroll = (struct the_vec2){ 0.0f, 0.0f };
 	the_input_update();
 	io.window_closed = glfwWindowShouldClose(io.internal_window);
 	glfwGetWindowSize(io.internal_window, &io.window_size.x, &io.window_size.y);
@@ -257,6 +281,79 @@ the_io_poll(void)
 	}
 }
 
+void
+the_io_latch(void)
+{
+	THE_ASSERT(io.internal_window && "The IO system is uninitalized");
+	glfwPollEvents();
+	double x, y;
+	glfwGetCursorPos(io.internal_window, &x, &y);
+	io.mouse_pos = (struct the_vec2){ (float)x, (float)y };
+}
+
+void
+the_invalidate(void)
+{
+	__atomic_store_n(&invalidated, 1, __ATOMIC_RELEASE);
+	if (io.internal_window) {
+		glfwPostEmptyEvent(); // Thread safe, wakes up the_io_wait.
+	}
+}
+
+static bool
+the__input_active(void)
+{
+	for (int i = 0; i <= THE_KEY_MENU; ++i) {
+		if (io.keys[i] != THE_KEYSTATE_RELEASED) {
+			return true;
+		}
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		if (io.mouse_button[i] != THE_KEYSTATE_RELEASED) {
+			return true;
+		}
+	}
+	return io.mouse_scroll.x != 0.0f || io.mouse_scroll.y != 0.0f;
+}
+
+bool
+the_io_wait(double timeout)
+{
+	THE_ASSERT(io.internal_window && "The IO system is uninitalized");
+	if (timeout <= 0.0 || __atomic_exchange_n(&invalidated, 0, __ATOMIC_ACQ_REL) ||
+	    the__input_active()) {
+		return true;
+	}
+
+	the_chrono start = the_time();
+	glfwWaitEventsTimeout(timeout);
+	if (__atomic_exchange_n(&invalidated, 0, __ATOMIC_ACQ_REL)) {
+		return true;
+	}
+
+	/* Woken up before the timeout: some window or input event arrived. */
+	return the_time() - start < (the_chrono)(timeout * 1000000000.0);
+}
+
+enum the_present_mode
+the_present_set(enum the_present_mode mode)
+{
+	THE_ASSERT(io.internal_window && "The IO system is uninitalized");
+	if (mode == THE_PRESENT_ADAPTIVE && !glfwExtensionSupported("GLX_EXT_swap_control_tear") &&
+	    !glfwExtensionSupported("WGL_EXT_swap_control_tear")) {
+		THE_LOG_WARN("Adaptive vsync not supported, using vsync.");
+		mode = THE_PRESENT_VSYNC;
+	}
+
+	switch (mode) {
+	case THE_PRESENT_VSYNC: glfwSwapInterval(1); break;
+	case THE_PRESENT_ADAPTIVE: glfwSwapInterval(-1); break;
+	case THE_PRESENT_OFF: glfwSwapInterval(0); break;
+	}
+	return mode;
+}
+
 void
 the_window_swap(void)
 {
@@ -268,6 +365,144 @@ the_chrono
 the_time(void)
 {
 	struct timespec time;
-	clock_gettime(2, &time);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
 	return time.tv_nsec + time.tv_sec * 1000000000;
 }
+
+void
+the_sleep_until(the_chrono deadline)
+{
+	/* Sleep is coarse, wake up early and spin the last stretch. */
+	static const the_chrono spin = 1000000;
+	the_chrono remaining = deadline - the_time();
+	if (remaining > spin) {
+		remaining -= spin;
+		struct timespec t = { remaining / 1000000000, remaining % 1000000000 };
+		nanosleep(&t, NULL);
+	}
+
+	while (the_time() < deadline) {}
+}
+
+static double ticks_per_ns = 0.0;
+
+the_ticks
+the_ticks_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (the_ticks)the_time();
+#endif
+}
+
+void
+the_ticks_calibrate(void)
+{
+	the_chrono t0 = the_time();
+	the_ticks c0 = the_ticks_now();
+	the_sleep_until(t0 + 10000000);
+	the_ticks c1 = the_ticks_now();
+	the_chrono t1 = the_time();
+	ticks_per_ns = (double)(c1 - c0) / (double)(t1 - t0);
+}
+
+the_chrono
+the_ticks_ns(the_ticks ticks)
+{
+	if (ticks_per_ns == 0.0) {
+		the_ticks_calibrate();
+	}
+	return (the_chrono)((double)ticks / ticks_per_ns);
+}
+
+void
+the_pacer_set_fps(struct the_pacer *pacer, float target_fps)
+{
+	pacer->frame_time = target_fps > 0.0f ? (the_chrono)(1000000000.0 / target_fps) : 0;
+	pacer->deadline = pacer->frame_start + pacer->frame_time;
+}
+
+void
+the_pacer_init(struct the_pacer *pacer, float target_fps)
+{
+	pacer->frame_start = the_time();
+	pacer->raw_delta = 0;
+	pacer->delta = target_fps > 0.0f ? 1.0f / target_fps : 1.0f / 60.0f;
+	pacer->smoothing = 0.8f;
+	pacer->frames = 0;
+	pacer->missed = 0;
+	the_pacer_set_fps(pacer, target_fps);
+}
+
+float
+the_pacer_frame(struct the_pacer *pacer)
+{
+	if (pacer->frame_time) {
+		if (the_time() > pacer->deadline) {
+			pacer->missed++;
+		} else {
+			the_sleep_until(pacer->deadline);
+		}
+	}
+
+	the_chrono now = the_time();
+	pacer->raw_delta = now - pacer->frame_start;
+	pacer->frame_start = now;
+	pacer->frames++;
+
+	/* Aligned to the previous deadline unless it was missed, then resync from now. */
+	if (pacer->frame_time) {
+		pacer->deadline += pacer->frame_time;
+		if (pacer->deadline <= now) {
+			pacer->deadline = now + pacer->frame_time;
+		}
+	}
+
+	/* Clamp long stalls (breakpoints, window drags) so they don't turn into huge steps. */
+	float raw = the_time_sec(pacer->raw_delta);
+	raw = raw > 0.25f ? 0.25f : raw;
+	pacer->delta = pacer->delta * pacer->smoothing + raw * (1.0f - pacer->smoothing);
+	return pacer->delta;
+}
+
+int
+the_file_map(const char *path, struct the_file_map *map)
+{
+	map->data = NULL;
+	map->size = 0;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		THE_LOG_ERR("File open failed for %s.", path);
+		return THE_ERR_FILE;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= 0) {
+		THE_LOG_ERR("Empty or unreadable file %s.", path);
+		close(fd);
+		return THE_ERR_FILE;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps its own reference.
+	if (data == MAP_FAILED) {
+		THE_LOG_ERR("Mapping failed for %s.", path);
+		return THE_ERR_FILE;
+	}
+
+	map->data = data;
+	map->size = st.st_size;
+	the_prefetch_record(path, 0, map->size);
+	return THE_OK;
+}
+
+void
+the_file_unmap(struct the_file_map *map)
+{
+	if (map->data) {
+		munmap(map->data, map->size);
+	}
+	map->data = NULL;
+	map->size = 0;
+}
@@ -2,42 +2,54 @@
 #define THE_CORE_IO_H
 
 #include "common.h"
+#include "log.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 
-#define THE_PRINT printf
-#define THE__LOG_LOC THE_PRINT("%s(%u)", __FILE__, __LINE__)
-
-#define THE_LOG(...)        \
-	THE_PRINT("The [Log] ");   \
-	THE__LOG_LOC;           \
-	THE_PRINT(":\n\t");     \
-	THE_PRINT(__VA_ARGS__); \
-	THE_PRINT("\n")
-
-#define THE_LOG_WARN(...)     \
-	THE_PRINT("The [Warning] "); \
-	THE__LOG_LOC;             \
-	THE_PRINT(":\n\t");       \
-	THE_PRINT(__VA_ARGS__);   \
-	THE_PRINT("\n")
-
-#define THE_LOG_ERR(...)    \
-	THE_PRINT("The [Error] "); \
-	THE__LOG_LOC;           \
-	THE_PRINT(":\n\t");     \
-	THE_PRINT(__VA_ARGS__); \
-	THE_PRINT("\n")
-
 #define the_elapsed(CHRONO) (the_time() - (CHRONO))
 #define the_time_sec(CHRONO) ((CHRONO) / 1000000000.0f)
 #define the_time_milli(CHRONO) ((CHRONO) / 1000000)
 #define the_time_micro(CHRONO) ((CHRONO) / 1000)
 #define the_time_nano(CHRONO) (CHRONO)
 
+/* Nanoseconds of wall-clock time (CLOCK_MONOTONIC_RAW, not affected by NTP slewing). */
 typedef int64_t the_chrono;
 the_chrono the_time(void);
+void the_sleep_until(the_chrono deadline);
+
+/*
+ * Raw cycle counter for profiling hot paths (rdtsc on x86, the_time elsewhere).
+ * the_ticks_calibrate measures the tick rate against the_time once (~10ms), after
+ * that the_ticks_ns converts tick intervals to nanoseconds.
+ */
+typedef uint64_t the_ticks;
+the_ticks the_ticks_now(void);
+void the_ticks_calibrate(void);
+the_chrono the_ticks_ns(the_ticks ticks);
+
+/*
+ * Frame pacer.
+ * - target_fps <= 0 disables the limiter (pacing is left to vsync), deltas are still measured.
+ * - the_pacer_frame sleeps until the current frame deadline, then starts the next frame and
+ *     returns its smoothed delta time in seconds.
+ * - A deadline is missed when the frame ends after it, the pacer then resyncs instead of
+ *     trying to catch up.
+ */
+struct the_pacer {
+	the_chrono frame_time; /* Target frame duration (0: unlimited) */
+	the_chrono deadline;
+	the_chrono frame_start;
+	the_chrono raw_delta; /* Last measured frame duration */
+	float delta; /* Smoothed delta time in seconds */
+	float smoothing; /* Weight of the previous delta [0, 1) */
+	int64_t frames;
+	int64_t missed;
+};
+
+void the_pacer_init(struct the_pacer *pacer, float target_fps);
+void the_pacer_set_fps(struct the_pacer *pacer, float target_fps);
+float the_pacer_frame(struct the_pacer *pacer);
 
 typedef int8_t the_keystate;
 enum the_keystate {
@@ -196,9 +208,46 @@ struct the_io {
 
 extern struct the_io *the_io;
 
+/* With THE_HEADLESS there is no window, window_size is the offscreen framebuffer size. */
 bool the_io_init(const char *title, struct the_point window_size);
 void the_io_poll(void);
 void the_window_swap(void);
+
+/*
+ * Present modes. THE_PRESENT_ADAPTIVE swaps immediately (tearing) when a frame misses
+ * the vblank instead of waiting a whole refresh; falls back to vsync if unsupported.
+ * THE_PRESENT_OFF does not wait at all, limit the frame rate with a the_pacer.
+ * Returns the mode applied.
+ */
+enum the_present_mode { THE_PRESENT_VSYNC, THE_PRESENT_ADAPTIVE, THE_PRESENT_OFF };
+enum the_present_mode the_present_set(enum the_present_mode mode);
+
+/*
+ * Late latch: re-samples mouse_pos right before submission. Keys, buttons and scroll
+ * keep the state of the last the_io_poll (no input edge is lost or doubled).
+ */
+void the_io_latch(void);
+
+/*
+ * Redraw on demand. the_io_wait returns true when a frame has to be built: the_invalidate
+ * was called (also done when resources are modified or async loads finish), a key or
+ * button is held, or an event arrived while blocked. Otherwise it blocks in
+ * glfwWaitEventsTimeout for up to `timeout` seconds and returns false, so the caller can
+ * skip the frame. timeout <= 0 disables the throttling. the_invalidate is thread safe.
+ */
+void the_invalidate(void);
+bool the_io_wait(double timeout);
 int the_file_read(const char *path, char **dst, size_t *size);
 
+/*
+ * Whole file mapped in memory, copy on write: the data can be patched in place and the
+ * changes stay private to the process. Returns THE_OK or THE_ERR_FILE.
+ */
+struct the_file_map {
+	char *data;
+	size_t size;
+};
+int the_file_map(const char *path, struct the_file_map *map);
+void the_file_unmap(struct the_file_map *map);
+
 #endif // THE_CORE_IO_H
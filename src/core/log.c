@@ -0,0 +1,212 @@
+#include "log.h"
+#include "io.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RECORD_COUNT 1024 // Power of two
+#define LOG_RECORD_MASK (LOG_RECORD_COUNT - 1)
+#define LOG_MSG_SIZE 224
+#define LOG_LONG_COUNT 16
+#define LOG_LONG_SIZE 4096
+
+struct the_log_record {
+	uint64_t seq; // Slot sequence: pos when free, pos + 1 when published.
+	the_chrono time;
+	const char *file;
+	int32_t line;
+	int32_t thread;
+	int32_t level;
+	int32_t long_msg; // Overflow buffer with the whole message, or -1.
+	char msg[LOG_MSG_SIZE];
+};
+
+static struct the_log_record ring[LOG_RECORD_COUNT];
+static uint64_t head = 0; // Next record to reserve (producers).
+static uint64_t tail = 0; // Next record to print (drain thread).
+static pthread_t drain_thread;
+static int running = 0; // Atomic.
+static int writers = 0; // Producers between the running check and publishing (atomic).
+static char long_buf[LOG_LONG_COUNT][LOG_LONG_SIZE];
+static int long_used[LOG_LONG_COUNT]; // Atomic.
+static the_chrono start_time = 0;
+
+static const char *level_names[] = { "Log", "Warning", "Error" };
+
+static int32_t
+the__thread_id(void)
+{
+	static __thread int32_t tid = 0;
+	if (!tid) {
+		tid = (int32_t)syscall(SYS_gettid);
+	}
+	return tid;
+}
+
+static void
+the__log_print(struct the_log_record *r)
+{
+	/* One stdio call per message (the stream is locked) so threads never interleave. */
+	fprintf(stdout, "The [%s] %.6f T%d %s(%d):\n\t%s\n", level_names[r->level],
+	        (r->time - start_time) / 1000000000.0, r->thread, r->file, r->line,
+	        r->long_msg >= 0 ? long_buf[r->long_msg] : r->msg);
+	if (r->long_msg >= 0) {
+		__atomic_store_n(&long_used[r->long_msg], 0, __ATOMIC_RELEASE);
+		r->long_msg = -1;
+	}
+}
+
+/*
+ * Formats into the record. Messages longer than it (e.g. shader compile logs) are formatted
+ * again into a free overflow buffer, and are cut to LOG_LONG_SIZE, or to the record if
+ * every overflow buffer is in use.
+ */
+static void
+the__log_format(struct the_log_record *r, const char *fmt, va_list args)
+{
+	va_list again;
+	va_copy(again, args);
+	int len = vsnprintf(r->msg, LOG_MSG_SIZE, fmt, args);
+	r->long_msg = -1;
+	for (int i = 0; len >= LOG_MSG_SIZE && i < LOG_LONG_COUNT; ++i) {
+		if (!__atomic_exchange_n(&long_used[i], 1, __ATOMIC_ACQUIRE)) {
+			vsnprintf(long_buf[i], LOG_LONG_SIZE, fmt, again);
+			r->long_msg = i;
+			break;
+		}
+	}
+	va_end(again);
+}
+
+static int
+the__log_drain(void)
+{
+	int printed = 0;
+	for (;;) {
+		struct the_log_record *r = &ring[tail & LOG_RECORD_MASK];
+		if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+			break;
+		}
+		the__log_print(r);
+		__atomic_store_n(&r->seq, tail + LOG_RECORD_COUNT, __ATOMIC_RELEASE);
+		__atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+		++printed;
+	}
+
+	if (printed) {
+		fflush(stdout);
+	}
+	return printed;
+}
+
+static void *
+the__log_worker(void *data)
+{
+	(void)data;
+	/* Keeps going after shutdown until every reserved record is published. */
+	while (__atomic_load_n(&running, __ATOMIC_SEQ_CST) ||
+	       __atomic_load_n(&writers, __ATOMIC_SEQ_CST)) {
+		if (!the__log_drain()) {
+			nanosleep((const struct timespec[]){ { 0, 1000000L } }, NULL);
+		}
+	}
+	the__log_drain();
+	return NULL;
+}
+
+int
+the_log_init(void)
+{
+	if (__atomic_load_n(&running, __ATOMIC_SEQ_CST)) {
+		return THE_OK;
+	}
+
+	for (uint64_t i = 0; i < LOG_RECORD_COUNT; ++i) {
+		ring[i].seq = head + i;
+	}
+	tail = head;
+	if (!start_time) {
+		start_time = the_time();
+	}
+	__atomic_store_n(&running, 1, __ATOMIC_SEQ_CST);
+	if (pthread_create(&drain_thread, NULL, the__log_worker, NULL)) {
+		__atomic_store_n(&running, 0, __ATOMIC_SEQ_CST);
+		return THE_ERR_THREAD;
+	}
+	return THE_OK;
+}
+
+void
+the_log_flush(void)
+{
+	uint64_t pos = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+	while (__atomic_load_n(&running, __ATOMIC_SEQ_CST) &&
+	       __atomic_load_n(&tail, __ATOMIC_ACQUIRE) < pos) {
+		sched_yield();
+	}
+}
+
+void
+the_log_shutdown(void)
+{
+	if (!__atomic_load_n(&running, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+	the_log_flush();
+	__atomic_store_n(&running, 0, __ATOMIC_SEQ_CST);
+	pthread_join(drain_thread, NULL);
+}
+
+void
+the_log_write(enum the_log_level level, const char *file, int line, const char *fmt, ...)
+{
+	va_list args;
+	/* Counted as a writer first, so the drain thread cannot exit under a reserved record. */
+	__atomic_add_fetch(&writers, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&running, __ATOMIC_SEQ_CST)) {
+		__atomic_sub_fetch(&writers, 1, __ATOMIC_SEQ_CST);
+		if (!start_time) {
+			start_time = the_time();
+		}
+		struct the_log_record r = {
+			.time = the_time(), .file = file, .line = line, .thread = the__thread_id(),
+			.level = level
+		};
+		va_start(args, fmt);
+		the__log_format(&r, fmt, args);
+		va_end(args);
+		the__log_print(&r);
+		return;
+	}
+
+	uint64_t pos = __atomic_fetch_add(&head, 1, __ATOMIC_ACQ_REL);
+	struct the_log_record *r = &ring[pos & LOG_RECORD_MASK];
+
+	/* Ring full: wait for the drain thread to free the slot. */
+	while (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != pos) {
+		sched_yield();
+	}
+
+	r->time = the_time();
+	r->file = file;
+	r->line = line;
+	r->thread = the__thread_id();
+	r->level = level;
+	va_start(args, fmt);
+	the__log_format(r, fmt, args);
+	va_end(args);
+	__atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+
+	if (level >= THE_LOG_LEVEL_ERR) {
+		while (__atomic_load_n(&tail, __ATOMIC_ACQUIRE) <= pos) {
+			sched_yield();
+		}
+	}
+	__atomic_sub_fetch(&writers, 1, __ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,58 @@
+#ifndef THE_CORE_LOG_H
+#define THE_CORE_LOG_H
+
+#include <stdint.h>
+
+enum the_log_level {
+	THE_LOG_LEVEL_LOG = 0,
+	THE_LOG_LEVEL_WARN = 1,
+	THE_LOG_LEVEL_ERR = 2,
+	THE_LOG_LEVEL_NONE = 3
+};
+
+/* Messages below this level are compiled out (e.g. -DTHE_LOG_LEVEL=2 keeps errors only). */
+#ifndef THE_LOG_LEVEL
+#define THE_LOG_LEVEL THE_LOG_LEVEL_LOG
+#endif
+
+#define THE__LOG(LEVEL, ...) the_log_write((LEVEL), __FILE__, __LINE__, __VA_ARGS__)
+
+#if THE_LOG_LEVEL <= THE_LOG_LEVEL_LOG
+#define THE_LOG(...) THE__LOG(THE_LOG_LEVEL_LOG, __VA_ARGS__)
+#else
+#define THE_LOG(...) ((void)0)
+#endif
+
+#if THE_LOG_LEVEL <= THE_LOG_LEVEL_WARN
+#define THE_LOG_WARN(...) THE__LOG(THE_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define THE_LOG_WARN(...) ((void)0)
+#endif
+
+#if THE_LOG_LEVEL <= THE_LOG_LEVEL_ERR
+#define THE_LOG_ERR(...) THE__LOG(THE_LOG_LEVEL_ERR, __VA_ARGS__)
+#else
+#define THE_LOG_ERR(...) ((void)0)
+#endif
+
+/*
+ * Asynchronous logger.
+ * - Producers reserve a fixed size record of a ring buffer with a single atomic add,
+ *     format the message into it and publish it. A background thread prints the records.
+ *     Longer messages than a record holds go to one of a few fixed overflow buffers
+ *     (cut at 4KB, or at the record size when all of them are in use).
+ * - Records carry timestamp (the_time), thread id and source location.
+ * - Errors wait until they are printed, so they are not lost if an assert follows.
+ * - Before the_log_init (or after the_log_shutdown) messages are printed synchronously.
+ *     Shutdown prints every record reserved before it.
+ */
+int the_log_init(void);
+void the_log_flush(void);
+void the_log_shutdown(void);
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 4, 5)))
+#endif
+void the_log_write(enum the_log_level level, const char *file, int line, const char *fmt, ...);
+
+#endif // THE_CORE_LOG_H
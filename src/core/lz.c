@@ -0,0 +1,383 @@
+#include "lz.h"
+
+#include "common.h"
+#include "io.h"
+#include "mem.h"
+#include "sched.h"
+
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5 // The last bytes of a block are always literals.
+#define LZ_MATCH_LIMIT 12 // No match starts in the last bytes of a block.
+#define LZ_HASH_LOG 14
+#define LZ_SKIP_TRIGGER 6 // Search step grows every 2^N misses on incompressible data.
+
+static inline uint32_t
+the__lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t
+the__lz_hash(uint32_t seq)
+{
+	return (seq * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+static uint8_t *
+the__lz_write_len(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+static uint8_t *
+the__lz_sequence(uint8_t *op, const uint8_t *lit, size_t lit_len, size_t offset, size_t match_len)
+{
+	uint8_t *token = op++;
+	*token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+	if (lit_len >= 15) {
+		op = the__lz_write_len(op, lit_len - 15);
+	}
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+
+	if (match_len) {
+		*op++ = (uint8_t)offset;
+		*op++ = (uint8_t)(offset >> 8);
+		match_len -= LZ_MIN_MATCH;
+		*token |= (uint8_t)(match_len < 15 ? match_len : 15);
+		if (match_len >= 15) {
+			op = the__lz_write_len(op, match_len - 15);
+		}
+	}
+	return op;
+}
+
+size_t
+the_lz_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t
+the_lz_compress(const void *src, size_t size, void *dst, size_t cap)
+{
+	if (cap < the_lz_bound(size)) {
+		return 0;
+	}
+
+	const uint8_t *in = src;
+	uint8_t *op = dst;
+	size_t anchor = 0;
+	uint32_t table[1 << LZ_HASH_LOG] = { 0 };
+
+	if (size > LZ_MATCH_LIMIT) {
+		size_t limit = size - LZ_MATCH_LIMIT;
+		size_t ip = 1;
+		uint32_t misses = 1 << LZ_SKIP_TRIGGER;
+		while (ip < limit) {
+			uint32_t seq = the__lz_read32(in + ip);
+			uint32_t h = the__lz_hash(seq);
+			size_t ref = table[h];
+			table[h] = (uint32_t)ip;
+			if (ip - ref > LZ_MAX_OFFSET || the__lz_read32(in + ref) != seq) {
+				ip += misses++ >> LZ_SKIP_TRIGGER;
+				continue;
+			}
+
+			/* Extend backwards over pending literals, then forwards. */
+			while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+				--ip;
+				--ref;
+			}
+
+			size_t len = LZ_MIN_MATCH;
+			size_t max = size - LZ_LAST_LITERALS - ip;
+			while (len < max && in[ref + len] == in[ip + len]) {
+				++len;
+			}
+
+			op = the__lz_sequence(op, in + anchor, ip - anchor, ip - ref, len);
+			ip += len;
+			anchor = ip;
+			misses = 1 << LZ_SKIP_TRIGGER;
+			if (ip < limit) {
+				table[the__lz_hash(the__lz_read32(in + ip - 2))] = (uint32_t)(ip - 2);
+			}
+		}
+	}
+
+	op = the__lz_sequence(op, in + anchor, size - anchor, 0, 0);
+	return op - (uint8_t *)dst;
+}
+
+size_t
+the_lz_decompress(const void *src, size_t size, void *dst, size_t cap)
+{
+	const uint8_t *ip = src;
+	const uint8_t *iend = ip + size;
+	uint8_t *op = dst;
+	uint8_t *oend = op + cap;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t lit = token >> 4;
+		if (lit == 15) {
+			uint8_t b;
+			do {
+				if (ip >= iend) {
+					return 0;
+				}
+				b = *ip++;
+				lit += b;
+			} while (b == 255);
+		}
+
+		if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) {
+			return 0;
+		}
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+		if (ip == iend) {
+			break; // Last sequence has no match.
+		}
+
+		if (iend - ip < 2) {
+			return 0;
+		}
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (!offset || offset > (size_t)(op - (uint8_t *)dst)) {
+			return 0;
+		}
+
+		size_t len = token & 15;
+		if (len == 15) {
+			uint8_t b;
+			do {
+				if (ip >= iend) {
+					return 0;
+				}
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += LZ_MIN_MATCH;
+		if (len > (size_t)(oend - op)) {
+			return 0;
+		}
+
+		const uint8_t *match = op - offset;
+		if (offset >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			while (len--) {
+				*op++ = *match++;
+			}
+		}
+	}
+	return op - (uint8_t *)dst;
+}
+
+bool
+the_lz_is_packed(const void *data, size_t size)
+{
+	return data && size >= sizeof(struct the_lz_header) && !memcmp(data, THE_LZ_MAGIC, 4);
+}
+
+size_t
+the_lz_raw_size(const void *packed)
+{
+	struct the_lz_header hdr;
+	memcpy(&hdr, packed, sizeof(hdr));
+	return hdr.raw_size;
+}
+
+struct the__lz_job {
+	const uint8_t *src;
+	uint8_t *dst;
+	size_t raw_size;
+	size_t block_size;
+	uint32_t *sizes;
+	const size_t *offsets; // Compressed block offsets (unpack).
+	uint8_t *scratch; // the_lz_bound(block_size) bytes per block (pack).
+	int failed;
+};
+
+static void
+the__lz_pack_range(void *args, int begin, int end)
+{
+	struct the__lz_job *j = args;
+	size_t bound = the_lz_bound(j->block_size);
+	for (int b = begin; b < end; ++b) {
+		size_t raw = (size_t)b * j->block_size;
+		size_t len = raw + j->block_size < j->raw_size ? j->block_size : j->raw_size - raw;
+		uint8_t *out = j->scratch + (size_t)b * bound;
+		size_t csize = the_lz_compress(j->src + raw, len, out, bound);
+		if (!csize || csize >= len) {
+			memcpy(out, j->src + raw, len);
+			j->sizes[b] = (uint32_t)len | THE_LZ_RAW_BLOCK;
+		} else {
+			j->sizes[b] = (uint32_t)csize;
+		}
+	}
+}
+
+static void
+the__lz_unpack_range(void *args, int begin, int end)
+{
+	struct the__lz_job *j = args;
+	for (int b = begin; b < end; ++b) {
+		size_t raw = (size_t)b * j->block_size;
+		size_t len = raw + j->block_size < j->raw_size ? j->block_size : j->raw_size - raw;
+		size_t csize = j->sizes[b] & ~THE_LZ_RAW_BLOCK;
+		if (j->sizes[b] & THE_LZ_RAW_BLOCK) {
+			if (csize != len) {
+				j->failed = 1;
+				continue;
+			}
+			memcpy(j->dst + raw, j->src + j->offsets[b], len);
+		} else if (the_lz_decompress(j->src + j->offsets[b], csize, j->dst + raw, len) != len) {
+			j->failed = 1;
+		}
+	}
+}
+
+void *
+the_lz_pack(const void *src, size_t size, size_t block_size, size_t *packed_size)
+{
+	block_size = block_size ? block_size : THE_LZ_DEFAULT_BLOCK_SIZE;
+	if (block_size & THE_LZ_RAW_BLOCK) {
+		THE_LOG_ERR("LZ block size too big (%lu).", block_size);
+		return NULL;
+	}
+
+	uint32_t count = (uint32_t)((size + block_size - 1) / block_size);
+	size_t bound = the_lz_bound(block_size);
+	uint32_t *sizes = THE_ALLOC(count * sizeof(uint32_t) + 1);
+	uint8_t *scratch = THE_ALLOC(count * bound + 1);
+	if (!sizes || !scratch) {
+		THE_FREE(sizes);
+		THE_FREE(scratch);
+		return NULL;
+	}
+
+	struct the__lz_job job = { .src = src, .raw_size = size, .block_size = block_size,
+		.sizes = sizes, .scratch = scratch };
+	the_sched_for(the_sched_shared(), count, 1, the__lz_pack_range, &job);
+
+	size_t total = sizeof(struct the_lz_header) + count * sizeof(uint32_t);
+	for (uint32_t b = 0; b < count; ++b) {
+		total += sizes[b] & ~THE_LZ_RAW_BLOCK;
+	}
+
+	uint8_t *out = THE_ALLOC(total);
+	if (out) {
+		struct the_lz_header hdr = { .block_size = (uint32_t)block_size, .raw_size = size,
+			.block_count = count, .reserved = 0 };
+		memcpy(hdr.magic, THE_LZ_MAGIC, 4);
+		memcpy(out, &hdr, sizeof(hdr));
+		memcpy(out + sizeof(hdr), sizes, count * sizeof(uint32_t));
+		uint8_t *op = out + sizeof(hdr) + count * sizeof(uint32_t);
+		for (uint32_t b = 0; b < count; ++b) {
+			size_t csize = sizes[b] & ~THE_LZ_RAW_BLOCK;
+			memcpy(op, scratch + b * bound, csize);
+			op += csize;
+		}
+		*packed_size = total;
+	}
+
+	THE_FREE(sizes);
+	THE_FREE(scratch);
+	return out;
+}
+
+int
+the_lz_unpack(const void *packed, size_t packed_size, void *dst, size_t cap)
+{
+	if (!the_lz_is_packed(packed, packed_size)) {
+		return THE_INVALID;
+	}
+
+	struct the_lz_header hdr;
+	memcpy(&hdr, packed, sizeof(hdr));
+	size_t table_end = sizeof(hdr) + (size_t)hdr.block_count * sizeof(uint32_t);
+	if (hdr.raw_size > cap || !hdr.block_size || table_end > packed_size ||
+	    (hdr.raw_size + hdr.block_size - 1) / hdr.block_size != hdr.block_count) {
+		THE_LOG_ERR("Invalid LZ header.");
+		return THE_INVALID;
+	}
+
+	uint32_t *sizes = THE_ALLOC(hdr.block_count * sizeof(uint32_t) + 1);
+	size_t *offsets = THE_ALLOC(hdr.block_count * sizeof(size_t) + 1);
+	if (!sizes || !offsets) {
+		THE_FREE(sizes);
+		THE_FREE(offsets);
+		return THE_ERR_ALLOC;
+	}
+
+	memcpy(sizes, (const uint8_t *)packed + sizeof(hdr), hdr.block_count * sizeof(uint32_t));
+
+	size_t offset = table_end;
+	for (uint32_t b = 0; b < hdr.block_count; ++b) {
+		offsets[b] = offset;
+		offset += sizes[b] & ~THE_LZ_RAW_BLOCK;
+	}
+
+	if (offset > packed_size) {
+		THE_LOG_ERR("Truncated LZ data.");
+		THE_FREE(sizes);
+		THE_FREE(offsets);
+		return THE_INVALID;
+	}
+
+	struct the__lz_job job = { .src = packed, .dst = dst, .raw_size = hdr.raw_size,
+		.block_size = hdr.block_size, .sizes = sizes, .offsets = offsets, .failed = 0 };
+	the_sched_for(the_sched_shared(), hdr.block_count, 1, the__lz_unpack_range, &job);
+	THE_FREE(sizes);
+	THE_FREE(offsets);
+	return job.failed ? THE_INVALID : THE_OK;
+}
+
+int
+the_lz_file_read(const char *path, char **dst, size_t *size)
+{
+	int ret = the_file_read(path, dst, size);
+	if (ret != THE_OK || !the_lz_is_packed(*dst, *size - 1)) {
+		return ret;
+	}
+
+	char *packed = *dst;
+	size_t raw_size = the_lz_raw_size(packed);
+	char *raw = the_alloc(raw_size + 1);
+	if (!raw) {
+		THE_LOG_ERR("Alloc (%lu bytes) failed.", raw_size + 1);
+		the_free(packed);
+		return THE_ERR_ALLOC;
+	}
+
+	ret = the_lz_unpack(packed, *size - 1, raw, raw_size);
+	the_free(packed);
+	if (ret != THE_OK) {
+		THE_LOG_ERR("Corrupted compressed file %s.", path);
+		the_free(raw);
+		*dst = NULL;
+		return ret;
+	}
+
+	raw[raw_size] = '\0';
+	*dst = raw;
+	*size = raw_size + 1;
+	return THE_OK;
+}
@@ -0,0 +1,50 @@
+#ifndef THE_CORE_LZ_H
+#define THE_CORE_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * LZ block compression (LZ4-like byte oriented format, 64KB window).
+ * Packed files are split in independently compressed blocks so they can be
+ * decompressed in parallel. Layout:
+ *   struct the_lz_header
+ *   uint32_t block_sizes[block_count] (THE_LZ_RAW_BLOCK bit: block stored uncompressed)
+ *   blocks
+ */
+#define THE_LZ_MAGIC "THLZ"
+#define THE_LZ_RAW_BLOCK 0x80000000u
+#define THE_LZ_DEFAULT_BLOCK_SIZE (256 * 1024)
+
+struct the_lz_header {
+	char magic[4];
+	uint32_t block_size;
+	uint64_t raw_size;
+	uint32_t block_count;
+	uint32_t reserved;
+};
+
+/* Single block codec. Return the written size or 0 on error (or if it does not fit). */
+size_t the_lz_bound(size_t size);
+size_t the_lz_compress(const void *src, size_t size, void *dst, size_t cap);
+size_t the_lz_decompress(const void *src, size_t size, void *dst, size_t cap);
+
+bool the_lz_is_packed(const void *data, size_t size);
+size_t the_lz_raw_size(const void *packed);
+
+/*
+ * Whole buffer packing. Blocks are processed in parallel on an internal scheduler.
+ * - the_lz_pack returns an the_alloc'd buffer with the packed data (or NULL).
+ * - the_lz_unpack decompresses into dst (the_lz_raw_size bytes). Returns THE_OK or error.
+ */
+void *the_lz_pack(const void *src, size_t size, size_t block_size, size_t *packed_size);
+int the_lz_unpack(const void *packed, size_t packed_size, void *dst, size_t cap);
+
+/*
+ * Same contract as the_file_read (size includes a trailing '\0'), packed files are
+ * detected by their magic and returned decompressed.
+ */
+int the_lz_file_read(const char *path, char **dst, size_t *size);
+
+#endif // THE_CORE_LZ_H
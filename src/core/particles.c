@@ -0,0 +1,140 @@
+#include "particles.h"
+
+#include "common.h"
+#include "mem.h"
+
+#include <math.h>
+#include <string.h>
+
+#define PARTICLE_GRAIN 16384 // Particles per scheduler job, a multiple of 4.
+#define PARTICLE_STREAMS 8
+
+static inline float
+the__rand(uint32_t *seed)
+{
+	/* xorshift32, uniform in [0, 1). */
+	uint32_t x = *seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*seed = x;
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline float
+the__rand_signed(uint32_t *seed)
+{
+	return the__rand(seed) * 2.0f - 1.0f;
+}
+
+void
+the_emitter_init(struct the_emitter *e, const struct the_emitter_desc *desc, int cap)
+{
+	memset(e, 0, sizeof(*e));
+	e->desc = *desc;
+	e->cap = cap;
+	e->seed = 0x9E3779B9u;
+
+	/* Streams padded to a multiple of 4 and zeroed, so the padding lanes stay finite. */
+	int padded = (cap + 3) & ~3;
+	float *streams = the_calloc((size_t)padded * PARTICLE_STREAMS, sizeof(float));
+	float **s[PARTICLE_STREAMS] = {
+		&e->p.px, &e->p.py, &e->p.pz, &e->p.vx, &e->p.vy, &e->p.vz, &e->p.age, &e->p.rate
+	};
+	for (int i = 0; i < PARTICLE_STREAMS; ++i) {
+		*s[i] = streams + (size_t)i * padded;
+	}
+	e->instances = the_calloc(padded, sizeof(*e->instances));
+	e->batch_bounds = the_calloc((size_t)2 * ((cap + PARTICLE_GRAIN - 1) / PARTICLE_GRAIN), sizeof(struct the_vec3));
+}
+
+void
+the_emitter_release(struct the_emitter *e)
+{
+	the_free(e->p.px); // First stream, start of the block.
+	the_free(e->instances);
+	the_free(e->batch_bounds);
+	memset(e, 0, sizeof(*e));
+}
+
+/* Dead particles are replaced by the last live one. */
+static void
+the__emitter_kill(struct the_emitter *e, float dt)
+{
+	struct the_particle_streams *p = &e->p;
+	int i = 0;
+	while (i < e->count) {
+		if (p->age[i] + p->rate[i] * dt < 1.0f) {
+			++i;
+			continue;
+		}
+		int last = --e->count;
+		p->px[i] = p->px[last], p->py[i] = p->py[last], p->pz[i] = p->pz[last];
+		p->vx[i] = p->vx[last], p->vy[i] = p->vy[last], p->vz[i] = p->vz[last];
+		p->age[i] = p->age[last], p->rate[i] = p->rate[last];
+	}
+}
+
+static void
+the__emitter_spawn(struct the_emitter *e, float dt)
+{
+	const struct the_emitter_desc *d = &e->desc;
+	e->spawn += d->rate * dt;
+	int n = (int)e->spawn;
+	e->spawn -= (float)n;
+	if (n > e->cap - e->count) {
+		n = e->cap - e->count;
+	}
+
+	struct the_particle_streams *p = &e->p;
+	for (int i = e->count; i < e->count + n; ++i) {
+		p->px[i] = d->pos.x + the__rand_signed(&e->seed) * d->radius;
+		p->py[i] = d->pos.y + the__rand_signed(&e->seed) * d->radius;
+		p->pz[i] = d->pos.z + the__rand_signed(&e->seed) * d->radius;
+		p->vx[i] = d->vel.x + the__rand_signed(&e->seed) * d->vel_jitter;
+		p->vy[i] = d->vel.y + the__rand_signed(&e->seed) * d->vel_jitter;
+		p->vz[i] = d->vel.z + the__rand_signed(&e->seed) * d->vel_jitter;
+		p->age[i] = 0.0f;
+		p->rate[i] = 1.0f / (d->life + the__rand(&e->seed) * d->life_jitter);
+	}
+	e->count += n;
+}
+
+struct the__emitter_step {
+	struct the_emitter *e;
+	float dt;
+};
+
+static void
+the__emitter_run(void *args, int begin, int end)
+{
+	struct the__emitter_step *s = args;
+	const struct the_emitter_desc *d = &s->e->desc;
+	struct the_vec3 *bounds = &s->e->batch_bounds[2 * (begin / PARTICLE_GRAIN)];
+	the_particles_step(&s->e->p, begin, end, d->gravity, d->drag, s->dt, s->e->instances, bounds);
+}
+
+int
+the_emitter_update(struct the_emitter *e, float dt, thesched *sched)
+{
+	THE_ASSERT(e->desc.life + e->desc.life_jitter > 0.0f && "Particles need a lifetime");
+	the__emitter_kill(e, dt);
+	the__emitter_spawn(e, dt);
+
+	struct the__emitter_step s = { .e = e, .dt = dt };
+	if (sched && e->count > PARTICLE_GRAIN) {
+		the_sched_for(sched, e->count, PARTICLE_GRAIN, the__emitter_run, &s);
+	} else if (e->count) {
+		the__emitter_run(&s, 0, e->count);
+	}
+
+	e->lo = (struct the_vec3){ INFINITY, INFINITY, INFINITY };
+	e->hi = (struct the_vec3){ -INFINITY, -INFINITY, -INFINITY };
+	for (int b = 0; b < (e->count + PARTICLE_GRAIN - 1) / PARTICLE_GRAIN; ++b) {
+		const struct the_vec3 *lo = &e->batch_bounds[2 * b];
+		const struct the_vec3 *hi = lo + 1;
+		e->lo = (struct the_vec3){ fminf(e->lo.x, lo->x), fminf(e->lo.y, lo->y), fminf(e->lo.z, lo->z) };
+		e->hi = (struct the_vec3){ fmaxf(e->hi.x, hi->x), fmaxf(e->hi.y, hi->y), fmaxf(e->hi.z, hi->z) };
+	}
+	return e->count;
+}
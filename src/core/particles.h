@@ -0,0 +1,53 @@
+#ifndef THE_CORE_PARTICLES_H
+#define THE_CORE_PARTICLES_H
+
+#include "sched.h"
+#include "simd.h"
+
+#include <stdint.h>
+
+/*
+ * Particle emitters. Particles are kept in structure of arrays (the_particle_streams) and
+ * integrated with the_particles_step, in batches split across the scheduler workers.
+ * - Live particles are packed at the front of the streams: dead ones are replaced by the
+ *     last one, so order is not preserved.
+ * - the_emitter_update also writes one xyzw record per live particle (position, normalized
+ *     age) to `instances`, ready to be streamed as per instance data of a billboard draw.
+ * - lo and hi bound the live particle positions after the update, reduced from the
+ *     per batch bounds of the_particles_step.
+ */
+struct the_emitter_desc {
+	struct the_vec3 pos; // Spawn center.
+	float radius; // Particles spawn inside a box of this half size around pos.
+	struct the_vec3 vel; // Initial velocity.
+	float vel_jitter; // Random velocity added on every axis, in [-vel_jitter, vel_jitter].
+	struct the_vec3 gravity;
+	float drag; // Fraction of the velocity lost per second.
+	float rate; // Particles spawned per second.
+	float life; // Seconds.
+	float life_jitter; // Random lifetime added, in [0, life_jitter].
+};
+
+struct the_emitter {
+	struct the_emitter_desc desc;
+	struct the_particle_streams p;
+	struct the_vec4 *instances;
+	struct the_vec3 lo, hi;
+	struct the_vec3 *batch_bounds; // Min and max of every batch of the last update.
+	int count; // Live particles.
+	int cap;
+	float spawn; // Particles owed to the next update (fraction of one).
+	uint32_t seed;
+};
+
+/* Room for cap particles. Allocates the streams, the instance records and the batch bounds. */
+void the_emitter_init(struct the_emitter *e, const struct the_emitter_desc *desc, int cap);
+void the_emitter_release(struct the_emitter *e);
+
+/*
+ * Kills the particles that reach the end of their life, spawns new ones (up to cap) and
+ * integrates all of them over dt, on sched (NULL: inline). Returns the live count.
+ */
+int the_emitter_update(struct the_emitter *e, float dt, thesched *sched);
+
+#endif // THE_CORE_PARTICLES_H
@@ -0,0 +1,154 @@
+#include "prefetch.h"
+
+#include "common.h"
+#include "io.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PREFETCH_PATH_MAX 256
+
+struct the_prefetch_entry {
+	char path[PREFETCH_PATH_MAX];
+	size_t offset;
+	size_t size;
+};
+
+typedef struct the_prefetch_entry theprefetch;
+THE_DECL_ARR(theprefetch);
+THE_IMPL_ARR(theprefetch);
+
+static struct thearr_theprefetch *replay = NULL; // Previous run, read by the thread.
+static struct thearr_theprefetch *record = NULL; // This run, in first access order.
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static int thread_running = 0;
+static int recording = 0;
+static char log_file[PREFETCH_PATH_MAX];
+
+static void *
+the__prefetch_worker(void *data)
+{
+	(void)data;
+	for (int i = 0; i < replay->count; ++i) {
+		struct the_prefetch_entry *e = &replay->at[i];
+		int fd = open(e->path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			continue; // Stale entry, the log is rewritten at the end of this run.
+		}
+		posix_fadvise(fd, (off_t)e->offset, (off_t)e->size, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+	return NULL;
+}
+
+static void
+the__prefetch_load(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		return; // First run.
+	}
+
+	struct the_prefetch_entry e;
+	while (fscanf(f, "%zu %zu %255[^\n]\n", &e.offset, &e.size, e.path) == 3) {
+		thearr_theprefetch_push_value(&replay, e);
+	}
+	fclose(f);
+}
+
+int
+the_prefetch_begin(const char *log_path)
+{
+	if (recording) {
+		return THE_OK;
+	}
+
+	if (strlen(log_path) >= PREFETCH_PATH_MAX) {
+		THE_LOG_ERR("Prefetch log path too long: %s", log_path);
+		return THE_ERR;
+	}
+
+	strcpy(log_file, log_path);
+	the__prefetch_load(log_file);
+	recording = 1;
+	if (replay && replay->count) {
+		if (pthread_create(&thread, NULL, the__prefetch_worker, NULL)) {
+			THE_LOG_WARN("Prefetch thread creation error, starting cold.");
+		} else {
+			thread_running = 1;
+		}
+	}
+	return THE_OK;
+}
+
+void
+the_prefetch_record(const char *path, size_t offset, size_t size)
+{
+	if (!recording || strlen(path) >= PREFETCH_PATH_MAX) {
+		return;
+	}
+
+	pthread_mutex_lock(&mtx);
+	for (int i = 0; record && i < record->count; ++i) {
+		struct the_prefetch_entry *e = &record->at[i];
+		if (strcmp(e->path, path)) {
+			continue;
+		}
+
+		/* Same file: grow the range to cover both reads. */
+		if (!e->size || !size) {
+			e->offset = e->offset < offset ? e->offset : offset;
+			e->size = 0;
+		} else {
+			size_t end = e->offset + e->size > offset + size ? e->offset + e->size : offset + size;
+			e->offset = e->offset < offset ? e->offset : offset;
+			e->size = end - e->offset;
+		}
+		pthread_mutex_unlock(&mtx);
+		return;
+	}
+
+	struct the_prefetch_entry *e = thearr_theprefetch_push(&record);
+	strcpy(e->path, path);
+	e->offset = offset;
+	e->size = size;
+	pthread_mutex_unlock(&mtx);
+}
+
+void
+the_prefetch_end(void)
+{
+	if (!recording) {
+		return;
+	}
+
+	pthread_mutex_lock(&mtx);
+	recording = 0;
+	pthread_mutex_unlock(&mtx);
+
+	if (thread_running) {
+		pthread_join(thread, NULL);
+		thread_running = 0;
+	}
+
+	FILE *f = fopen(log_file, "w");
+	if (!f) {
+		THE_LOG_WARN("Could not write the prefetch log %s.", log_file);
+	} else {
+		for (int i = 0; record && i < record->count; ++i) {
+			struct the_prefetch_entry *e = &record->at[i];
+			fprintf(f, "%zu %zu %s\n", e->offset, e->size, e->path);
+		}
+		fclose(f);
+	}
+
+	thearr_theprefetch_release(replay);
+	thearr_theprefetch_release(record);
+	replay = NULL;
+	record = NULL;
+}
@@ -0,0 +1,19 @@
+#ifndef THE_CORE_PREFETCH_H
+#define THE_CORE_PREFETCH_H
+
+#include <stddef.h>
+
+/*
+ * Startup access log. Between the_prefetch_begin and the_prefetch_end every file read
+ * through the engine (the_file_read, image loads) is recorded with its byte range.
+ * the_prefetch_end writes the log, and the next the_prefetch_begin replays it from a
+ * background thread with posix_fadvise(WILLNEED) so the page cache is warm by the
+ * time the loaders get there.
+ * - the_prefetch_record is thread safe and does nothing outside of a recording.
+ * - size 0 means until the end of the file.
+ */
+int the_prefetch_begin(const char *log_path);
+void the_prefetch_record(const char *path, size_t offset, size_t size);
+void the_prefetch_end(void);
+
+#endif // THE_CORE_PREFETCH_H
@@ -1,7 +1,12 @@
 #include "io.h"
+#include "log.h"
+#include "mem.h"
 #include "scene.h"
+#include "simd.h"
 #include <mathc.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define VEC3_UP ((float[3]){ 0.0f, 1.0f, 0.0f })
 
@@ -9,6 +14,7 @@ THE_IMPL_ARR(theent);
 THE_IMPL_POOL(theent);
 
 struct thepool_theent entity_pool = {.buf = NULL, .next = 0, .count = 0};
+struct the_graph scene_graph = { .count = 0, .handles = 0, .free = THE_NODE_NONE, .cap = 0 };
 struct the_cam camera;
 
 static inline struct the_vec3
@@ -38,9 +44,7 @@ the_camera_init_default(struct the_cam *cam)
 struct the_vec3
 the_camera_eye(struct the_cam *cam)
 {
-	the_mat4 inv;
-	mat4_inverse(inv, cam->view);
-	return (struct the_vec3){ inv[12], inv[13], inv[14] };
+	return the_mat4_view_eye((const union the_mat4 *)cam->view);
 }
 
 float *
@@ -54,19 +58,16 @@ the_camera_static_vp(struct the_cam *cam, the_mat4 out)
 	out[13] = 0.0f;
 	out[14] = 0.0f;
 	out[15] = 0.0f;
-	return mat4_multiply(out, cam->proj, out);
+	the_mat4_mul((union the_mat4 *)out, (const union the_mat4 *)cam->proj, (const union the_mat4 *)out);
+	return out;
 }
 
-void
-the_camera_control(struct the_cam *cam, struct the_control_config cfg)
-{
-	struct the_vec3 eye = the_camera_eye(cam);
-	struct the_vec3 fwd = the_camera_fwd(cam);
-	vec3_negative((float*)&fwd, vec3_normalize((float*)&fwd, (float*)&fwd));
-	static struct the_vec2 mouse_down_pos = { 0.0f, 0.0f };
-	float speed = cfg.speed * cfg.deltatime;
+static struct the_vec2 mouse_down_pos = { 0.0f, 0.0f };
 
-	// Rotation
+// Mouse look, applies the mouse movement since the last call.
+static void
+the__camera_rotate(struct the_vec3 *fwd, float sensitivity)
+{
 	if (the_io->mouse_button[THE_MOUSE_RIGHT] == THE_KEYSTATE_DOWN) {
 		mouse_down_pos = the_io->mouse_pos;
 	}
@@ -75,16 +76,30 @@ the_camera_control(struct the_cam *cam, struct the_control_config cfg)
 	if (the_io->mouse_button[THE_MOUSE_RIGHT] == THE_KEYSTATE_PRESSED) {
 		struct the_vec2 curr_pos = the_io->mouse_pos;
 		struct the_vec2 offset = {
-			(curr_pos.x - mouse_down_pos.x) * cfg.sensitivity,
-			(mouse_down_pos.y - curr_pos.y) * cfg.sensitivity
+			(curr_pos.x - mouse_down_pos.x) * sensitivity,
+			(mouse_down_pos.y - curr_pos.y) * sensitivity
 		};
 
-		vec3_add((float*)&fwd, (float*)&fwd,
-		         vec3_multiply_f(tmp_vec, vec3_cross(tmp_vec, VEC3_UP, (float*)&fwd), -offset.x));
-		vec3_add((float*)&fwd, (float*)&fwd, vec3_multiply_f(tmp_vec, VEC3_UP, offset.y));
+		vec3_add((float*)fwd, (float*)fwd,
+		         vec3_multiply_f(tmp_vec, vec3_cross(tmp_vec, VEC3_UP, (float*)fwd), -offset.x));
+		vec3_add((float*)fwd, (float*)fwd, vec3_multiply_f(tmp_vec, VEC3_UP, offset.y));
 
 		mouse_down_pos = curr_pos;
 	}
+}
+
+void
+the_camera_control(struct the_cam *cam, struct the_control_config cfg)
+{
+	struct the_vec3 eye = the_camera_eye(cam);
+	struct the_vec3 fwd = the_camera_fwd(cam);
+	vec3_negative((float*)&fwd, vec3_normalize((float*)&fwd, (float*)&fwd));
+	float speed = cfg.speed * cfg.deltatime;
+
+	// Rotation
+	the__camera_rotate(&fwd, cfg.sensitivity);
+
+	float tmp_vec[3];
 
 	// Position
 	if (the_io->keys[THE_KEY_W] == THE_KEYSTATE_PRESSED) {
@@ -122,3 +137,819 @@ the_camera_control(struct the_cam *cam, struct the_control_config cfg)
 		  (float)the_io->window_size.x / (float)the_io->window_size.y, 0.1f, cam->far);
 	}
 }
+
+void
+the_camera_latch(struct the_cam *cam, struct the_control_config cfg)
+{
+	the_io_latch();
+	struct the_vec3 eye = the_camera_eye(cam);
+	struct the_vec3 fwd = the_camera_fwd(cam);
+	vec3_negative((float*)&fwd, vec3_normalize((float*)&fwd, (float*)&fwd));
+	the__camera_rotate(&fwd, cfg.sensitivity);
+
+	float tmp_vec[3];
+	mat4_look_at(cam->view, (float*)&eye, vec3_add(tmp_vec, (float*)&eye, (float*)&fwd), VEC3_UP);
+}
+
+#define GRAPH_PARALLEL_GRAIN 1024 // Nodes per job, smaller levels are updated inline.
+#define GRAPH_BATCH 64 // Dirty nodes whose local matrices are built in one the_trs_matrix_batch.
+#define LOD_BATCH 64 // Entities whose bounding spheres are transformed in one batch.
+
+static const struct the_trs identity_trs = {
+	.pos = { 0.0f, 0.0f, 0.0f }, .rot = { 0.0f, 0.0f, 0.0f, 1.0f }, .scale = { 1.0f, 1.0f, 1.0f }
+};
+
+void
+the_graph_init(struct the_graph *g)
+{
+	memset(g, 0, sizeof(*g));
+	g->free = THE_NODE_NONE;
+}
+
+void
+the_graph_release(struct the_graph *g)
+{
+	the_free(g->local);
+	the_free(g->world);
+	the_free(g->parent);
+	the_free(g->node);
+	the_free(g->dirty);
+	the_free(g->slot);
+	the_free(g->up);
+	the_free(g->moved);
+	the_free(g->level);
+	the_graph_init(g);
+}
+
+static void
+the__graph_grow(struct the_graph *g)
+{
+	int cap = g->cap ? g->cap * 2 : 64;
+	g->local = the_realloc(g->local, cap * sizeof(*g->local));
+	g->world = the_realloc(g->world, cap * sizeof(*g->world));
+	g->parent = the_realloc(g->parent, cap * sizeof(*g->parent));
+	g->node = the_realloc(g->node, cap * sizeof(*g->node));
+	g->dirty = the_realloc(g->dirty, cap * sizeof(*g->dirty));
+	g->slot = the_realloc(g->slot, cap * sizeof(*g->slot));
+	g->up = the_realloc(g->up, cap * sizeof(*g->up));
+	g->moved = the_realloc(g->moved, cap * sizeof(*g->moved));
+	g->level = the_realloc(g->level, (cap + 1) * sizeof(*g->level));
+	g->cap = cap;
+}
+
+the_node
+the_graph_add(struct the_graph *g, the_node parent)
+{
+	THE_ASSERT((parent == THE_NODE_NONE || g->slot[parent] >= 0) && "Invalid parent node");
+	the_node n = g->free;
+	if (n != THE_NODE_NONE) {
+		g->free = g->up[n];
+	} else {
+		if (g->handles == g->cap) {
+			the__graph_grow(g);
+		}
+		n = g->handles++;
+	}
+
+	/* Appended out of order, the next update sorts it. */
+	int slot = g->count++;
+	g->slot[n] = slot;
+	g->up[n] = parent;
+	g->node[slot] = n;
+	g->local[slot] = identity_trs;
+	g->dirty[slot] = 1;
+	g->moved[n] = 0;
+	g->reorder = true;
+	return n;
+}
+
+static bool
+the__graph_in_subtree(const struct the_graph *g, the_node n, the_node root)
+{
+	for (; n != THE_NODE_NONE; n = g->up[n]) {
+		if (n == root) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+the_graph_remove(struct the_graph *g, the_node node)
+{
+	THE_ASSERT(g->slot[node] >= 0 && "Invalid node");
+
+	/* Compact the slots of the live nodes outside of the subtree. */
+	int count = 0;
+	for (int s = 0; s < g->count; ++s) {
+		the_node n = g->node[s];
+		if (the__graph_in_subtree(g, n, node)) {
+			g->slot[n] = -2; // Freed after the pass, up[] is still walked.
+			continue;
+		}
+		g->node[count] = n;
+		g->local[count] = g->local[s];
+		memcpy(g->world[count], g->world[s], sizeof(*g->world));
+		g->dirty[count] = g->dirty[s];
+		g->slot[n] = count++;
+	}
+
+	for (int n = 0; n < g->handles; ++n) {
+		if (g->slot[n] == -2) {
+			g->slot[n] = -1;
+			g->up[n] = g->free;
+			g->free = n;
+		}
+	}
+	g->count = count;
+	g->reorder = true;
+}
+
+void
+the_graph_set_parent(struct the_graph *g, the_node node, the_node parent)
+{
+	THE_ASSERT(g->slot[node] >= 0 && "Invalid node");
+	THE_ASSERT((parent == THE_NODE_NONE || !the__graph_in_subtree(g, parent, node)) &&
+	           "A node can not be parented to its own subtree");
+	g->up[node] = parent;
+	g->dirty[g->slot[node]] = 1;
+	g->reorder = true;
+}
+
+struct the_trs *
+the_graph_local(struct the_graph *g, the_node node)
+{
+	int slot = g->slot[node];
+	g->dirty[slot] = 1;
+	return &g->local[slot];
+}
+
+const float *
+the_graph_world(const struct the_graph *g, the_node node)
+{
+	return g->world[g->slot[node]];
+}
+
+/* Counting sort of the live nodes by depth, keeping the previous relative order. */
+static void
+the__graph_reorder(struct the_graph *g)
+{
+	int *depth = the_alloc((g->handles + 1) * sizeof(int));
+	for (int n = 0; n < g->handles; ++n) {
+		depth[n] = -1;
+	}
+
+	int max_depth = -1;
+	for (int s = 0; s < g->count; ++s) {
+		the_node n = g->node[s];
+		int d = 0;
+		the_node a = g->up[n];
+		while (a != THE_NODE_NONE && depth[a] < 0) {
+			++d;
+			a = g->up[a];
+		}
+		d += a == THE_NODE_NONE ? 0 : depth[a] + 1;
+		/* Fill the walked ancestors too. */
+		for (the_node b = n; b != a; b = g->up[b], --d) {
+			depth[b] = d;
+		}
+		max_depth = depth[n] > max_depth ? depth[n] : max_depth;
+	}
+
+	g->level_count = max_depth + 1;
+	memset(g->level, 0, (g->level_count + 1) * sizeof(int));
+	for (int s = 0; s < g->count; ++s) {
+		g->level[depth[g->node[s]] + 1]++;
+	}
+	for (int d = 0; d < g->level_count; ++d) {
+		g->level[d + 1] += g->level[d];
+	}
+
+	struct the_trs *local = the_alloc(g->cap * sizeof(*local));
+	float(*world)[16] = the_alloc(g->cap * sizeof(*world));
+	the_node *node = the_alloc(g->cap * sizeof(*node));
+	uint8_t *dirty = the_alloc(g->cap * sizeof(*dirty));
+	int *next = the_alloc((g->level_count + 1) * sizeof(int));
+	memcpy(next, g->level, (g->level_count + 1) * sizeof(int));
+
+	for (int s = 0; s < g->count; ++s) {
+		the_node n = g->node[s];
+		int dst = next[depth[n]]++;
+		local[dst] = g->local[s];
+		memcpy(world[dst], g->world[s], sizeof(*world));
+		dirty[dst] = g->dirty[s];
+		node[dst] = n;
+	}
+
+	the_free(g->local);
+	the_free(g->world);
+	the_free(g->node);
+	the_free(g->dirty);
+	g->local = local;
+	g->world = world;
+	g->node = node;
+	g->dirty = dirty;
+
+	for (int s = 0; s < g->count; ++s) {
+		g->slot[g->node[s]] = s;
+	}
+	for (int s = 0; s < g->count; ++s) {
+		the_node up = g->up[g->node[s]];
+		g->parent[s] = up == THE_NODE_NONE ? -1 : g->slot[up];
+	}
+
+	the_free(next);
+	the_free(depth);
+	g->reorder = false;
+}
+
+float *
+the_trs_matrix(float *out, const struct the_trs *trs)
+{
+	the_trs_matrix_batch((union the_mat4 *)out, trs, 1);
+	return out;
+}
+
+struct the__graph_level {
+	struct the_graph *g;
+	int begin;
+};
+
+static void
+the__graph_update_range(void *args, int begin, int end)
+{
+	struct the__graph_level *l = args;
+	struct the_graph *g = l->g;
+	int slot[GRAPH_BATCH];
+	struct the_trs trs[GRAPH_BATCH];
+	union the_mat4 local[GRAPH_BATCH];
+	union the_mat4 parent[GRAPH_BATCH];
+	union the_mat4 world[GRAPH_BATCH];
+	for (int s = l->begin + begin; s < l->begin + end;) {
+		/* Dirty slots of the range in batches, their local matrices built together. */
+		int n = 0;
+		for (; s < l->begin + end && n < GRAPH_BATCH; ++s) {
+			int p = g->parent[s];
+			if (g->dirty[s] || (p >= 0 && g->dirty[p])) {
+				g->dirty[s] = 1; // Propagates to the children on the next level.
+				slot[n] = s;
+				trs[n++] = g->local[s];
+			}
+		}
+		the_trs_matrix_batch(local, trs, n);
+
+		/* Roots take their local matrix, children are packed and multiplied in one batch. */
+		int children = 0;
+		for (int i = 0; i < n; ++i) {
+			int p = g->parent[slot[i]];
+			if (p < 0) {
+				memcpy(g->world[slot[i]], local[i].v, sizeof(local[i]));
+				continue;
+			}
+			memcpy(parent[children].v, g->world[p], sizeof(parent[children]));
+			local[children] = local[i];
+			slot[children++] = slot[i];
+		}
+		the_mat4_mul_pairs(world, parent, local, children);
+		for (int i = 0; i < children; ++i) {
+			memcpy(g->world[slot[i]], world[i].v, sizeof(world[i]));
+		}
+	}
+}
+
+void
+the_graph_update(struct the_graph *g, thesched *sched)
+{
+	if (g->reorder) {
+		the__graph_reorder(g);
+	}
+
+	memset(g->moved, 0, g->handles);
+	bool parent_dirty = false;
+	for (int d = 0; d < g->level_count; ++d) {
+		int begin = g->level[d];
+		int count = g->level[d + 1] - begin;
+		if (!parent_dirty && !memchr(g->dirty + begin, 1, count)) {
+			continue; // Clean level under a clean level.
+		}
+
+		struct the__graph_level l = { .g = g, .begin = begin };
+		if (sched && count > GRAPH_PARALLEL_GRAIN) {
+			the_sched_for(sched, count, GRAPH_PARALLEL_GRAIN, the__graph_update_range, &l);
+		} else {
+			the__graph_update_range(&l, 0, count);
+		}
+		parent_dirty = memchr(g->dirty + begin, 1, count) != NULL;
+	}
+
+	for (int s = 0; s < g->count; ++s) {
+		g->moved[g->node[s]] |= g->dirty[s];
+	}
+	memset(g->dirty, 0, g->count);
+}
+
+#define BVH_MARGIN 0.1f // World units a leaf box can move before its ancestors are refit.
+
+struct the_bvh scene_bvh = { .free = -1, .root = -1, .margin = BVH_MARGIN };
+static struct the_aabb *entity_local; // Mesh bounds each scene_bvh box was computed from.
+static int entity_local_cap;
+
+/* World box of a local box: transformed center plus the extents through |M|. */
+static struct the_aabb
+the__aabb_transform(const float *m, struct the_aabb b)
+{
+	float c[3] = { (b.min.x + b.max.x) * 0.5f, (b.min.y + b.max.y) * 0.5f, (b.min.z + b.max.z) * 0.5f };
+	float e[3] = { (b.max.x - b.min.x) * 0.5f, (b.max.y - b.min.y) * 0.5f, (b.max.z - b.min.z) * 0.5f };
+	float wc[3], we[3];
+	for (int i = 0; i < 3; ++i) {
+		wc[i] = m[12 + i] + m[i] * c[0] + m[4 + i] * c[1] + m[8 + i] * c[2];
+		we[i] = fabsf(m[i]) * e[0] + fabsf(m[4 + i]) * e[1] + fabsf(m[8 + i]) * e[2];
+	}
+	return (struct the_aabb){
+		{ wc[0] - we[0], wc[1] - we[1], wc[2] - we[2] },
+		{ wc[0] + we[0], wc[1] + we[1], wc[2] + we[2] },
+	};
+}
+
+void
+the_entity_bvh_update(void)
+{
+	int count = entity_pool.count;
+	if (entity_local_cap < count) {
+		entity_local_cap = count * 2;
+		entity_local = the_realloc(entity_local, entity_local_cap * sizeof(*entity_local));
+	}
+
+	for (int i = 0; i < count; ++i) {
+		const struct the_entity *e = &entity_pool.buf->at[i];
+		struct the_bounds mb = the_mesh_bounds(e->mesh);
+		struct the_aabb local = { mb.min, mb.max };
+		bool known = the_bvh_contains(&scene_bvh, i);
+		if (known && !scene_graph.moved[e->node] && !memcmp(&local, &entity_local[i], sizeof(local))) {
+			continue;
+		}
+		entity_local[i] = local;
+		the_bvh_update(&scene_bvh, i, the__aabb_transform(the_graph_world(&scene_graph, e->node), local));
+	}
+
+	/* Entities beyond the pool count were removed. */
+	for (int i = count; i < scene_bvh.item_cap; ++i) {
+		the_bvh_remove(&scene_bvh, i);
+	}
+	the_bvh_maintain(&scene_bvh);
+}
+
+int
+the_entity_cull(const union the_mat4 *vp, uint8_t *visible)
+{
+	struct the_frustum frustum;
+	the_frustum_from_vp(&frustum, vp);
+	memset(visible, 0, entity_pool.count);
+	return the_bvh_frustum(&scene_bvh, &frustum, visible);
+}
+
+int
+the_entity_remove(the_node node)
+{
+	/* The last entity fills every hole, its scene_bvh entry is rebuilt by the next update. */
+	int removed = 0;
+	for (int i = 0; i < entity_pool.count;) {
+		if (!the__graph_in_subtree(&scene_graph, entity_pool.buf->at[i].node, node)) {
+			++i;
+			continue;
+		}
+		int last = entity_pool.count - 1;
+		entity_pool.buf->at[i] = entity_pool.buf->at[last];
+		thepool_theent_rm(&entity_pool, last);
+		the_bvh_remove(&scene_bvh, i);
+		++removed;
+	}
+	the_graph_remove(&scene_graph, node);
+	return removed;
+}
+
+int
+the_entity_cull_views(const union the_mat4 *vps, int view_count, uint32_t *masks)
+{
+	struct the_frustum frustums[THE_BVH_MAX_VIEWS];
+	THE_ASSERT(view_count > 0 && view_count <= THE_BVH_MAX_VIEWS && "Invalid view count");
+	for (int v = 0; v < view_count; ++v) {
+		the_frustum_from_vp(&frustums[v], &vps[v]);
+	}
+	memset(masks, 0, entity_pool.count * sizeof(*masks));
+	return the_bvh_frustums(&scene_bvh, frustums, view_count, masks);
+}
+
+int
+the_entity_pick(struct the_cam *cam, struct the_vec2 pos, float *t)
+{
+	/* Unproject the cursor on the near and far planes. */
+	float vp[16], inv[16];
+	mat4_multiply(vp, cam->proj, cam->view);
+	mat4_inverse(inv, vp);
+	float ndc_x = 2.0f * pos.x / (float)the_io->window_size.x - 1.0f;
+	float ndc_y = 1.0f - 2.0f * pos.y / (float)the_io->window_size.y;
+	float near[4], far[4];
+	vec4_multiply_mat4(near, (float[4]){ ndc_x, ndc_y, -1.0f, 1.0f }, inv);
+	vec4_multiply_mat4(far, (float[4]){ ndc_x, ndc_y, 1.0f, 1.0f }, inv);
+	vec3_divide_f(near, near, near[3]);
+	vec3_divide_f(far, far, far[3]);
+
+	float dir[3];
+	vec3_subtract(dir, far, near);
+	float len = vec3_length(dir);
+	vec3_divide_f(dir, dir, len);
+	return the_bvh_raycast(
+	  &scene_bvh, (struct the_vec3){ near[0], near[1], near[2] },
+	  (struct the_vec3){ dir[0], dir[1], dir[2] }, len, t);
+}
+
+int
+the_entity_lod(struct the_cam *cam, float viewport_h, const struct the_lod_config *cfg, const uint8_t *visible)
+{
+	struct the_vec3 eye = the_camera_eye(cam);
+	/* Pixels covered by one world unit at distance 1, proj[5] is cot(fov / 2). */
+	float ppu = cam->proj[5] * viewport_h * 0.5f / (cfg->bias > 0.0f ? cfg->bias : 1.0f);
+	float refine = cfg->pixel_error * (1.0f + cfg->hysteresis);
+	float coarsen = cfg->pixel_error * (1.0f - cfg->hysteresis);
+
+	/*
+	 * Visible entities in batches: bounding sphere centers go to world space together, with
+	 * a unit radius so w comes back as the biggest axis scale.
+	 */
+	int tris = 0;
+	int index[LOD_BATCH];
+	union the_mat4 world[LOD_BATCH];
+	struct the_vec4 sphere[LOD_BATCH];
+	struct the_vec4 world_sphere[LOD_BATCH];
+	float radius[LOD_BATCH];
+	for (int i = 0; i < entity_pool.count;) {
+		int n = 0;
+		for (; i < entity_pool.count && n < LOD_BATCH; ++i) {
+			if (visible && !visible[i]) {
+				continue;
+			}
+			const struct the_entity *e = &entity_pool.buf->at[i];
+			struct the_bounds b = the_mesh_bounds(e->mesh);
+			memcpy(world[n].v, the_graph_world(&scene_graph, e->node), sizeof(world[n]));
+			sphere[n] = (struct the_vec4){ b.sphere.x, b.sphere.y, b.sphere.z, 1.0f };
+			radius[n] = b.sphere.w;
+			index[n++] = i;
+		}
+		the_sphere_transform_batch(world_sphere, world, sphere, n);
+
+		for (int k = 0; k < n; ++k) {
+			struct the_entity *e = &entity_pool.buf->at[index[k]];
+			struct the_mesh_lod lods[THE_MESH_MAX_LODS];
+			int count = the_mesh_lods(e->mesh, lods);
+
+			/* Nearest point of the world bounding sphere. */
+			const struct the_vec4 *ws = &world_sphere[k];
+			float scale = ws->w;
+			float d[3] = { ws->x - eye.x, ws->y - eye.y, ws->z - eye.z };
+			float dist = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) - radius[k] * scale;
+			float pixels = scale * ppu / (dist > 1e-4f ? dist : 1e-4f); // Per object space unit.
+
+			int lod = e->lod < count ? e->lod : count - 1;
+			while (lod > 0 && lods[lod].error * pixels > refine) {
+				--lod;
+			}
+			while (lod + 1 < count && lods[lod + 1].error * pixels <= coarsen) {
+				++lod;
+			}
+			e->lod = lod;
+			tris += lods[lod].count / 3;
+		}
+	}
+	return tris;
+}
+
+#define SCENE_MAGIC "TSCN"
+#define SCENE_NO_NAME UINT32_MAX // Empty texture slot.
+#define SCENE_ALIGN 8
+
+/* Offsets are from the start of the file, every section starts SCENE_ALIGN aligned. */
+struct the__scene_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t entity_count;
+	uint32_t name_count;
+	uint64_t names; // name_count offsets (uint32_t) of '\0' terminated strings.
+	uint64_t entities; // struct the__scene_entity[entity_count].
+	uint64_t materials; // Material blocks, their texture slots hold name indices.
+	uint64_t size; // Whole file.
+};
+
+struct the__scene_entity {
+	struct the_trs local;
+	int32_t parent; // Index of an earlier entity of the file, -1: the load root.
+	uint32_t mesh; // Name indices.
+	uint32_t shader;
+	uint32_t material; // Offset of the material block from the material section.
+	uint32_t material_size; // Bytes, has to match the_mat_size of the shader.
+};
+
+static inline uint64_t
+the__scene_align(uint64_t offset)
+{
+	return (offset + SCENE_ALIGN - 1) & ~(uint64_t)(SCENE_ALIGN - 1);
+}
+
+static int
+the__scene_find(const struct the_scene_ref *refs, int count, const char *name)
+{
+	for (int i = 0; i < count; ++i) {
+		if (!strcmp(refs[i].name, name)) {
+			return refs[i].handle;
+		}
+	}
+	return THE_NONE;
+}
+
+static bool
+the__scene_header_valid(const struct the_file_map *map)
+{
+	const struct the__scene_header *h = (const struct the__scene_header *)map->data;
+	if (map->size < sizeof(*h) || memcmp(h->magic, SCENE_MAGIC, 4) ||
+	    h->version != THE_SCENE_VERSION || h->size != map->size) {
+		return false;
+	}
+	if (h->names % SCENE_ALIGN || h->entities % SCENE_ALIGN || h->materials % SCENE_ALIGN) {
+		return false;
+	}
+	return h->names + (uint64_t)h->name_count * sizeof(uint32_t) <= h->size &&
+	       h->entities + (uint64_t)h->entity_count * sizeof(struct the__scene_entity) <= h->size &&
+	       h->materials <= h->size;
+}
+
+int
+the_scene_load(struct the_scene *scene, const char *path, the_node root, const struct the_scene_refs *refs)
+{
+	memset(scene, 0, sizeof(*scene));
+	struct the_file_map map;
+	if (the_file_map(path, &map) != THE_OK) {
+		return THE_ERR_FILE;
+	}
+	if (!the__scene_header_valid(&map)) {
+		THE_LOG_ERR("%s: not a valid version %d scene file", path, THE_SCENE_VERSION);
+		the_file_unmap(&map);
+		return THE_ERR;
+	}
+
+	const struct the__scene_header *h = (const struct the__scene_header *)map.data;
+	struct the__scene_entity *ents = (struct the__scene_entity *)(map.data + h->entities);
+	char *materials = map.data + h->materials;
+	uint64_t materials_size = h->size - h->materials;
+
+	/* Every name resolved once: mesh, texture and shader handle (THE_NONE if unknown). */
+	int *mesh_of = the_alloc(((size_t)h->name_count * 3 + 1) * sizeof(int));
+	int *tex_of = mesh_of + h->name_count;
+	int *shader_of = tex_of + h->name_count;
+	const uint32_t *name_offsets = (const uint32_t *)(map.data + h->names);
+	int ret = THE_OK;
+	for (uint32_t i = 0; i < h->name_count && ret == THE_OK; ++i) {
+		const char *name = map.data + name_offsets[i];
+		if (name_offsets[i] >= h->size || !memchr(name, '\0', h->size - name_offsets[i])) {
+			THE_LOG_ERR("%s: name %u out of the file", path, i);
+			ret = THE_ERR;
+			break;
+		}
+		mesh_of[i] = the__scene_find(refs->meshes, refs->mesh_count, name);
+		tex_of[i] = the__scene_find(refs->texs, refs->tex_count, name);
+		shader_of[i] = the_shader_find(name);
+	}
+
+	/* Everything checked before the first entity is added. */
+	for (uint32_t i = 0; i < h->entity_count && ret == THE_OK; ++i) {
+		const struct the__scene_entity *se = &ents[i];
+		if (se->parent >= (int32_t)i || se->parent < -1 || se->mesh >= h->name_count ||
+		    se->shader >= h->name_count || se->material % sizeof(float) ||
+		    (uint64_t)se->material + se->material_size > materials_size) {
+			THE_LOG_ERR("%s: entity %u is corrupt", path, i);
+			ret = THE_ERR;
+			break;
+		}
+		const char *mesh_name = map.data + name_offsets[se->mesh];
+		const char *shader_name = map.data + name_offsets[se->shader];
+		if (mesh_of[se->mesh] == THE_NONE || shader_of[se->shader] == THE_NONE) {
+			THE_LOG_ERR("%s: entity %u uses unknown mesh %s or shader %s", path, i, mesh_name, shader_name);
+			ret = THE_ERR;
+			break;
+		}
+		if (se->material_size != the_mat_size(shader_of[se->shader])) {
+			THE_LOG_ERR("%s: entity %u material does not match shader %s", path, i, shader_name);
+			ret = THE_ERR;
+			break;
+		}
+		the_mat mat = { .ptr = materials + se->material, .shader = shader_of[se->shader] };
+		const uint32_t *slot = (const uint32_t *)the_mat_tex(mat);
+		const uint32_t *end = (const uint32_t *)(materials + se->material + se->material_size);
+		for (; slot < end; ++slot) {
+			if (*slot != SCENE_NO_NAME && (*slot >= h->name_count || tex_of[*slot] == THE_NONE)) {
+				THE_LOG_ERR("%s: entity %u uses an unknown texture", path, i);
+				ret = THE_ERR;
+				break;
+			}
+		}
+	}
+
+	if (ret != THE_OK) {
+		the_free(mesh_of);
+		the_file_unmap(&map);
+		return ret;
+	}
+
+	/* File entity index to pool index, reusing the parent field once an entity is added. */
+	for (uint32_t i = 0; i < h->entity_count; ++i) {
+		struct the__scene_entity *se = &ents[i];
+		the_node parent = se->parent < 0 ? root : entity_pool.buf->at[ents[se->parent].parent].node;
+		int eidx = thepool_theent_add(&entity_pool);
+		struct the_entity *e = &entity_pool.buf->at[eidx];
+		e->node = the_graph_add(&scene_graph, parent);
+		*the_graph_local(&scene_graph, e->node) = se->local;
+		e->mesh = mesh_of[se->mesh];
+		e->mat = (the_mat){ .ptr = materials + se->material, .shader = shader_of[se->shader] };
+		e->lod = 0;
+
+		uint32_t *slot = (uint32_t *)the_mat_tex(e->mat);
+		uint32_t *end = (uint32_t *)(materials + se->material + se->material_size);
+		for (; slot < end; ++slot) {
+			*(the_tex *)slot = *slot == SCENE_NO_NAME ? THE_NONE : tex_of[*slot];
+		}
+		se->parent = eidx;
+	}
+
+	the_free(mesh_of);
+	scene->map = map;
+	scene->entity_count = h->entity_count;
+	return THE_OK;
+}
+
+void
+the_scene_release(struct the_scene *scene)
+{
+	the_file_unmap(&scene->map);
+	scene->entity_count = 0;
+}
+
+/* Index of a name in the table being written, appended if new. */
+static uint32_t
+the__scene_name(const char ***names, uint32_t *count, const char *name)
+{
+	for (uint32_t i = 0; i < *count; ++i) {
+		if (!strcmp((*names)[i], name)) {
+			return i;
+		}
+	}
+	if (!(*count & (*count - 1))) { // Grows at powers of two.
+		*names = the_realloc(*names, (*count ? *count * 2 : 1) * sizeof(**names));
+	}
+	(*names)[*count] = name;
+	return (*count)++;
+}
+
+static const char *
+the__scene_ref_name(const struct the_scene_ref *refs, int count, int handle)
+{
+	for (int i = 0; i < count; ++i) {
+		if (refs[i].handle == handle) {
+			return refs[i].name;
+		}
+	}
+	return NULL;
+}
+
+int
+the_scene_save(const char *path, const struct the_scene_refs *refs)
+{
+	int count = entity_pool.count;
+	int *ent_of_node = the_alloc(((size_t)scene_graph.handles + count * 3 + 1) * sizeof(int));
+	int *depth = ent_of_node + scene_graph.handles;
+	int *order = depth + count;
+	int *file_index = order + count;
+	for (int i = 0; i < scene_graph.handles; ++i) {
+		ent_of_node[i] = -1;
+	}
+	for (int i = 0; i < count; ++i) {
+		ent_of_node[entity_pool.buf->at[i].node] = i;
+	}
+
+	/* Entities sorted by depth in the entity hierarchy, so parents are written first. */
+	int max_depth = 0;
+	for (int i = 0; i < count; ++i) {
+		depth[i] = 0;
+		for (the_node n = scene_graph.up[entity_pool.buf->at[i].node]; n != THE_NODE_NONE && ent_of_node[n] >= 0;
+		     n = scene_graph.up[n]) {
+			depth[i]++;
+		}
+		max_depth = depth[i] > max_depth ? depth[i] : max_depth;
+	}
+	int n = 0;
+	for (int d = 0; d <= max_depth; ++d) {
+		for (int i = 0; i < count; ++i) {
+			if (depth[i] == d) {
+				file_index[i] = n;
+				order[n++] = i;
+			}
+		}
+	}
+
+	/* Names and section sizes. */
+	const char **names = NULL;
+	uint32_t name_count = 0;
+	uint64_t materials_size = 0;
+	int ret = THE_OK;
+	for (int i = 0; i < count && ret == THE_OK; ++i) {
+		const struct the_entity *e = &entity_pool.buf->at[i];
+		const char *mesh_name = the__scene_ref_name(refs->meshes, refs->mesh_count, e->mesh);
+		if (!mesh_name) {
+			THE_LOG_ERR("%s: the mesh of entity %d is not in the references", path, i);
+			ret = THE_ERR;
+			break;
+		}
+		the__scene_name(&names, &name_count, mesh_name);
+		the__scene_name(&names, &name_count, the_shader_name(e->mat.shader));
+		const the_tex *slot = the_mat_tex(e->mat);
+		const the_tex *end = (const the_tex *)((const char *)e->mat.ptr + the_mat_size(e->mat.shader));
+		for (; slot < end; ++slot) {
+			const char *tex_name = the__scene_ref_name(refs->texs, refs->tex_count, *slot);
+			if (*slot != THE_NONE && !tex_name) {
+				THE_LOG_ERR("%s: a texture of entity %d is not in the references", path, i);
+				ret = THE_ERR;
+				break;
+			}
+			if (tex_name) {
+				the__scene_name(&names, &name_count, tex_name);
+			}
+		}
+		materials_size += the_mat_size(e->mat.shader);
+	}
+	if (ret != THE_OK) {
+		the_free(names);
+		the_free(ent_of_node);
+		return ret;
+	}
+
+	struct the__scene_header h = {
+		.magic = SCENE_MAGIC, .version = THE_SCENE_VERSION, .entity_count = count, .name_count = name_count
+	};
+	h.names = the__scene_align(sizeof(h));
+	uint64_t strings = h.names + name_count * sizeof(uint32_t);
+	uint64_t strings_size = 0;
+	for (uint32_t i = 0; i < name_count; ++i) {
+		strings_size += strlen(names[i]) + 1;
+	}
+	h.entities = the__scene_align(strings + strings_size);
+	h.materials = the__scene_align(h.entities + count * sizeof(struct the__scene_entity));
+	h.size = h.materials + materials_size;
+
+	char *file = the_calloc(h.size, 1);
+	memcpy(file, &h, sizeof(h));
+	uint32_t *name_offsets = (uint32_t *)(file + h.names);
+	uint64_t at = strings;
+	for (uint32_t i = 0; i < name_count; ++i) {
+		name_offsets[i] = (uint32_t)at;
+		size_t len = strlen(names[i]) + 1;
+		memcpy(file + at, names[i], len);
+		at += len;
+	}
+
+	struct the__scene_entity *ents = (struct the__scene_entity *)(file + h.entities);
+	uint32_t material = 0;
+	for (int f = 0; f < count; ++f) {
+		const struct the_entity *e = &entity_pool.buf->at[order[f]];
+		the_node up = scene_graph.up[e->node];
+		int parent = up != THE_NODE_NONE ? ent_of_node[up] : -1;
+		size_t size = the_mat_size(e->mat.shader);
+		ents[f] = (struct the__scene_entity){
+			.local = scene_graph.local[scene_graph.slot[e->node]],
+			.parent = parent >= 0 ? file_index[parent] : -1,
+			.mesh = the__scene_name(&names, &name_count, the__scene_ref_name(refs->meshes, refs->mesh_count, e->mesh)),
+			.shader = the__scene_name(&names, &name_count, the_shader_name(e->mat.shader)),
+			.material = material,
+			.material_size = size,
+		};
+
+		char *block = file + h.materials + material;
+		memcpy(block, e->mat.ptr, size);
+		uint32_t *slot = (uint32_t *)(block + ((char *)the_mat_tex(e->mat) - (char *)e->mat.ptr));
+		for (; (char *)slot < block + size; ++slot) {
+			const char *tex_name = the__scene_ref_name(refs->texs, refs->tex_count, *(the_tex *)slot);
+			*slot = tex_name ? the__scene_name(&names, &name_count, tex_name) : SCENE_NO_NAME;
+		}
+		material += size;
+	}
+
+	FILE *out = fopen(path, "wb");
+	if (!out || fwrite(file, h.size, 1, out) != 1) {
+		THE_LOG_ERR("%s: write failed", path);
+		ret = THE_ERR_FILE;
+	}
+	if (out) {
+		fclose(out);
+	}
+	the_free(file);
+	the_free(names);
+	the_free(ent_of_node);
+	return ret;
+}
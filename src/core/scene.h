@@ -1,8 +1,13 @@
 #ifndef THE_SCENE_H
 #define THE_SCENE_H
 
+#include "core/bvh.h"
+#include "core/io.h"
+#include "core/sched.h"
 #include "render/pixels.h"
 
+#include <stdint.h>
+
 struct the_cam {
 	float view[16];
 	float proj[16];
@@ -17,10 +22,59 @@ struct the_control_config {
 	float deltatime;
 };
 
+/*
+ * Scene graph. Nodes are stored breadth first in structure of arrays: parents always come
+ * before their children and every depth level is contiguous, so a level can be updated
+ * in parallel once the previous one is done.
+ * - Node handles are stable, slots (positions in the arrays) change when the hierarchy
+ *     changes. Structural changes are applied lazily by the next the_graph_update.
+ * - the_graph_local returns the local transform of the node and marks it dirty. The
+ *     pointer is valid until the next add, remove, reparent or update.
+ * - the_graph_update recomputes the world matrices of the dirty nodes and their
+ *     descendants only. With a scheduler, big levels are split across its workers.
+ */
+typedef int the_node;
+#define THE_NODE_NONE (-1)
+
+struct the_graph {
+	int count; // Live nodes (used slots).
+	int handles; // Handles created, live or free.
+	the_node free; // Free handles list, chained through up[].
+	int cap;
+	int level_count;
+	bool reorder; // The breadth first order has to be rebuilt.
+
+	// Per slot.
+	struct the_trs *local;
+	float (*world)[16];
+	int *parent; // Parent slot or -1.
+	the_node *node;
+	uint8_t *dirty;
+
+	// Per node handle.
+	int *slot; // -1 if the handle is free.
+	the_node *up; // Parent node.
+	uint8_t *moved; // World matrix recomputed by the last update.
+
+	int *level; // Slots of depth d: [level[d], level[d + 1]).
+};
+
+void the_graph_init(struct the_graph *g);
+void the_graph_release(struct the_graph *g);
+the_node the_graph_add(struct the_graph *g, the_node parent);
+void the_graph_remove(struct the_graph *g, the_node node); // Removes the subtree.
+void the_graph_set_parent(struct the_graph *g, the_node node, the_node parent);
+struct the_trs *the_graph_local(struct the_graph *g, the_node node);
+const float *the_graph_world(const struct the_graph *g, the_node node);
+void the_graph_update(struct the_graph *g, thesched *sched);
+
+float *the_trs_matrix(float *out, const struct the_trs *trs);
+
 struct the_entity {
-	float transform[16];
+	the_node node; // Node of scene_graph, its world matrix is the entity transform.
 	the_mesh mesh;
 	the_mat mat;
+	uint8_t lod; // Level of detail of the mesh picked by the last the_entity_lod.
 };
 
 typedef struct the_entity theent;
@@ -28,12 +82,113 @@ THE_DECL_ARR(theent);
 THE_DECL_POOL(theent);
 
 extern struct thepool_theent entity_pool;
+extern struct the_graph scene_graph;
+extern struct the_bvh scene_bvh; // World bounds of entity_pool, items are entity indices.
 extern struct the_cam camera;
 
+/*
+ * Brings scene_bvh up to date: refits the entities moved by the last the_graph_update
+ * or whose mesh bounds changed, inserts new ones and rebuilds the tree when it degraded.
+ * Call it after the_graph_update and before the entity queries below.
+ */
+void the_entity_bvh_update(void);
+
+/*
+ * Removes the entities whose node is in the subtree of node, then the subtree itself.
+ * entity_pool stays packed: the last entities move into the freed slots, so entity
+ * indices change. Returns the removed count.
+ */
+int the_entity_remove(the_node node);
+
+/*
+ * Frustum culling of entity_pool against view projection vp through scene_bvh. visible[i]
+ * is set for the entities whose world bounds touch the frustum, cleared for the rest.
+ * Returns the visible count.
+ */
+int the_entity_cull(const union the_mat4 *vp, uint8_t *visible);
+
+/*
+ * Culls entity_pool against view_count (up to THE_BVH_MAX_VIEWS) view projections at once,
+ * e.g. the six faces of a cubemap or the cascades of a shadow map: bit v of masks[i] is
+ * set if entity i touches view v. One pass over scene_bvh for all the views. Returns the
+ * entities visible in at least one view.
+ */
+int the_entity_cull_views(const union the_mat4 *vps, int view_count, uint32_t *masks);
+
+/*
+ * Entity under a window position (pixels, origin at the top left) or -1. Tests the ray
+ * against the entity world boxes, t is the distance to the hit along the ray.
+ */
+int the_entity_pick(struct the_cam *cam, struct the_vec2 pos, float *t);
+
+struct the_lod_config {
+	float pixel_error; // Biggest screen space error allowed, in pixels.
+	float bias; // Multiplies the distance: above 1 favours coarser levels.
+	float hysteresis; // Fraction of pixel_error a level has to cross to be left, in [0, 1).
+};
+
+/*
+ * Picks the level of detail of the entities: the coarsest level of their mesh whose error,
+ * projected at the distance of the entity bounds on a viewport viewport_h pixels tall,
+ * stays under cfg->pixel_error. The previous level is kept until the error crosses the
+ * threshold by the hysteresis margin, so entities at a boundary do not flicker. Skips
+ * the entities not set in visible (NULL: all). Returns the triangles of the picked levels.
+ */
+int the_entity_lod(struct the_cam *cam, float viewport_h, const struct the_lod_config *cfg, const uint8_t *visible);
+
+/*
+ * Binary scene files: entities with their local transform, parent, mesh, shader and
+ * material block. Version THE_SCENE_VERSION, native byte order.
+ * - Meshes, textures and shaders are referenced by name. Shaders by the name of their
+ *     desc, meshes and textures through the tables given to load and save (the asset
+ *     paths, for instance).
+ * - the_scene_load maps the file once and patches it in place: material pointers of the
+ *     new entities point into the mapping, texture names are replaced by handles. No
+ *     memory is allocated per entity besides its slot in entity_pool and scene_graph.
+ * - Only entities are saved. The ones whose parent node is not an entity are attached
+ *     to `root` on load, keeping their local transform.
+ */
+#define THE_SCENE_VERSION 1
+
+/* Name of a mesh or texture referenced by scene files. */
+struct the_scene_ref {
+	const char *name;
+	the_resource_handle handle;
+};
+
+struct the_scene_refs {
+	const struct the_scene_ref *meshes;
+	int mesh_count;
+	const struct the_scene_ref *texs; // Textures and cubemaps.
+	int tex_count;
+};
+
+/* A loaded scene file. The mapping backs the materials of its entities. */
+struct the_scene {
+	struct the_file_map map;
+	int entity_count;
+};
+
+/*
+ * Appends the entities of the file to entity_pool and scene_graph. Nothing is added if
+ * the file is invalid, of another version or references unknown resources. Returns THE_OK
+ * or an error.
+ */
+int the_scene_load(struct the_scene *scene, const char *path, the_node root, const struct the_scene_refs *refs);
+/* Unmaps the file, the entities loaded from it must have been removed. */
+void the_scene_release(struct the_scene *scene);
+/* Writes the entities of entity_pool. Returns THE_OK or an error. */
+int the_scene_save(const char *path, const struct the_scene_refs *refs);
+
 void the_camera_init_default(struct the_cam *cam);
 void the_camera_init(struct the_cam *cam, struct the_vec3 pos, struct the_vec3 target);
 struct the_vec3 the_camera_eye(struct the_cam *cam);
 void the_camera_control(struct the_cam *cam, struct the_control_config cfg);
+/*
+ * Late latch: re-samples the mouse (the_io_latch) and applies the rotation since the last
+ * the_camera_control / the_camera_latch. Movement and zoom stay as they were.
+ */
+void the_camera_latch(struct the_cam *cam, struct the_control_config cfg);
 
 // Matrix with zeroed translation i.e. projection * vec4(vec3(view)). For skybox.
 float *the_camera_static_vp(struct the_cam *cam, the_mat4 out);
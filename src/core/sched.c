@@ -2,8 +2,10 @@
 #include "core/io.h"
 #include "core/mem.h"
 #include "sched.h"
+#include <sched.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <unistd.h>
 
 typedef struct the_job job;
 THE_DECL_ARR(job);
@@ -165,3 +167,89 @@ the_sched_destroy(thesched *s)
 	THE_FREE(s);
 	return THE_OK;
 }
+
+static thesched *shared = NULL;
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+
+static void
+the__sched_shared_create(void)
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	shared = the_sched_create(cores > 1 ? (int)cores - 1 : 1);
+}
+
+thesched *
+the_sched_shared(void)
+{
+	pthread_once(&shared_once, the__sched_shared_create);
+	return shared;
+}
+
+struct the__sched_range {
+	the_sched_range_fn fn;
+	void *args;
+	int count;
+	int grain;
+	int chunks;
+	int next; // Next chunk to claim.
+	int done; // Chunks finished.
+	int refs; // Caller + queued helpers, the last one frees it.
+};
+
+static void
+the__sched_range_release(struct the__sched_range *r)
+{
+	if (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		THE_FREE(r);
+	}
+}
+
+static void
+the__sched_range_run(struct the__sched_range *r)
+{
+	int chunk;
+	while ((chunk = __atomic_fetch_add(&r->next, 1, __ATOMIC_ACQ_REL)) < r->chunks) {
+		int begin = chunk * r->grain;
+		int end = begin + r->grain < r->count ? begin + r->grain : r->count;
+		r->fn(r->args, begin, end);
+		__atomic_add_fetch(&r->done, 1, __ATOMIC_ACQ_REL);
+	}
+}
+
+static void
+the__sched_range_job(void *args)
+{
+	the__sched_range_run(args);
+	the__sched_range_release(args);
+}
+
+void
+the_sched_for(thesched *s, int count, int grain, the_sched_range_fn fn, void *args)
+{
+	if (count <= 0) {
+		return;
+	}
+
+	grain = grain > 0 ? grain : 1;
+	int chunks = (count + grain - 1) / grain;
+	int helpers = (s && s->threads) ? s->threads->count : 0;
+	helpers = helpers < chunks - 1 ? helpers : chunks - 1;
+	if (helpers <= 0) {
+		fn(args, 0, count);
+		return;
+	}
+
+	struct the__sched_range *r = THE_ALLOC(sizeof(*r));
+	*r = (struct the__sched_range){ .fn = fn, .args = args, .count = count, .grain = grain,
+		.chunks = chunks, .next = 0, .done = 0, .refs = helpers + 1 };
+
+	for (int i = 0; i < helpers; ++i) {
+		the_sched_do(s, (struct the_job){ .job = the__sched_range_job, .args = r });
+	}
+
+	the__sched_range_run(r);
+	while (__atomic_load_n(&r->done, __ATOMIC_ACQUIRE) < chunks) {
+		sched_yield();
+	}
+	the__sched_range_release(r);
+}
@@ -13,4 +13,15 @@ void the_sched_do(thesched *s, struct the_job job);
 void the_sched_wait(thesched *s);
 int the_sched_destroy(thesched *s);
 
+/* Engine wide scheduler (one thread per extra core), created on first use. */
+thesched *the_sched_shared(void);
+
+/*
+ * Parallel for: splits [0, count) in chunks of `grain` items and runs fn(args, begin, end)
+ * on them from the scheduler workers and the calling thread. Returns when all chunks are
+ * done. Safe to call from a worker of the same scheduler.
+ */
+typedef void (*the_sched_range_fn)(void *args, int begin, int end);
+void the_sched_for(thesched *s, int count, int grain, the_sched_range_fn fn, void *args);
+
 #endif // THE_SCHEDULER_H
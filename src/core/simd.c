@@ -0,0 +1,570 @@
+#include "simd.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+/* 4 wide helpers, every kernel below is written once on top of them. */
+#if defined(THE_SIMD_AVX2) || defined(THE_SIMD_SSE)
+#include <immintrin.h>
+
+typedef __m128 v4;
+
+static inline v4 v4_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void v4_store(float *p, v4 v) { _mm_storeu_ps(p, v); }
+static inline v4 v4_splat(float f) { return _mm_set1_ps(f); }
+static inline v4 v4_add(v4 a, v4 b) { return _mm_add_ps(a, b); }
+static inline v4 v4_sub(v4 a, v4 b) { return _mm_sub_ps(a, b); }
+static inline v4 v4_mul(v4 a, v4 b) { return _mm_mul_ps(a, b); }
+static inline v4 v4_min(v4 a, v4 b) { return _mm_min_ps(a, b); }
+static inline v4 v4_max(v4 a, v4 b) { return _mm_max_ps(a, b); }
+#ifdef THE_SIMD_AVX2
+static inline v4 v4_madd(v4 a, v4 b, v4 c) { return _mm_fmadd_ps(a, b, c); }
+#else
+static inline v4 v4_madd(v4 a, v4 b, v4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+#endif
+
+/* Four xyzw records to x, y, z and w registers. */
+static inline void
+v4_load_soa(const float *p, v4 *o)
+{
+	o[0] = _mm_loadu_ps(p);
+	o[1] = _mm_loadu_ps(p + 4);
+	o[2] = _mm_loadu_ps(p + 8);
+	o[3] = _mm_loadu_ps(p + 12);
+	_MM_TRANSPOSE4_PS(o[0], o[1], o[2], o[3]);
+}
+
+/* x, y, z and w registers to four xyzw records. */
+static inline void
+v4_store_aos(float *p, v4 x, v4 y, v4 z, v4 w)
+{
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+	_mm_storeu_ps(p, x);
+	_mm_storeu_ps(p + 4, y);
+	_mm_storeu_ps(p + 8, z);
+	_mm_storeu_ps(p + 12, w);
+}
+
+#elif defined(THE_SIMD_NEON)
+#include <arm_neon.h>
+
+typedef float32x4_t v4;
+
+static inline v4 v4_load(const float *p) { return vld1q_f32(p); }
+static inline void v4_store(float *p, v4 v) { vst1q_f32(p, v); }
+static inline v4 v4_splat(float f) { return vdupq_n_f32(f); }
+static inline v4 v4_add(v4 a, v4 b) { return vaddq_f32(a, b); }
+static inline v4 v4_sub(v4 a, v4 b) { return vsubq_f32(a, b); }
+static inline v4 v4_mul(v4 a, v4 b) { return vmulq_f32(a, b); }
+static inline v4 v4_min(v4 a, v4 b) { return vminq_f32(a, b); }
+static inline v4 v4_max(v4 a, v4 b) { return vmaxq_f32(a, b); }
+static inline v4 v4_madd(v4 a, v4 b, v4 c) { return vmlaq_f32(c, a, b); }
+
+static inline void
+v4_load_soa(const float *p, v4 *o)
+{
+	float32x4x4_t t = vld4q_f32(p);
+	o[0] = t.val[0], o[1] = t.val[1], o[2] = t.val[2], o[3] = t.val[3];
+}
+
+static inline void
+v4_store_aos(float *p, v4 x, v4 y, v4 z, v4 w)
+{
+	float32x4x4_t t = { { x, y, z, w } };
+	vst4q_f32(p, t);
+}
+
+#else
+typedef struct {
+	float v[4];
+} v4;
+
+static inline v4 v4_load(const float *p) { return (v4){ { p[0], p[1], p[2], p[3] } }; }
+static inline void v4_store(float *p, v4 v) { p[0] = v.v[0], p[1] = v.v[1], p[2] = v.v[2], p[3] = v.v[3]; }
+static inline v4 v4_splat(float f) { return (v4){ { f, f, f, f } }; }
+
+static inline v4
+v4_add(v4 a, v4 b)
+{
+	return (v4){ { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] } };
+}
+
+static inline v4
+v4_sub(v4 a, v4 b)
+{
+	return (v4){ { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] } };
+}
+
+static inline v4
+v4_mul(v4 a, v4 b)
+{
+	return (v4){ { a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3] } };
+}
+
+static inline v4
+v4_min(v4 a, v4 b)
+{
+	for (int i = 0; i < 4; ++i) {
+		a.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i];
+	}
+	return a;
+}
+
+static inline v4
+v4_max(v4 a, v4 b)
+{
+	for (int i = 0; i < 4; ++i) {
+		a.v[i] = b.v[i] > a.v[i] ? b.v[i] : a.v[i];
+	}
+	return a;
+}
+
+static inline void
+v4_load_soa(const float *p, v4 *o)
+{
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			o[j].v[i] = p[i * 4 + j];
+		}
+	}
+}
+
+static inline void
+v4_store_aos(float *p, v4 x, v4 y, v4 z, v4 w)
+{
+	for (int i = 0; i < 4; ++i) {
+		p[i * 4 + 0] = x.v[i];
+		p[i * 4 + 1] = y.v[i];
+		p[i * 4 + 2] = z.v[i];
+		p[i * 4 + 3] = w.v[i];
+	}
+}
+
+static inline v4
+v4_madd(v4 a, v4 b, v4 c)
+{
+	for (int i = 0; i < 4; ++i) {
+		c.v[i] += a.v[i] * b.v[i];
+	}
+	return c;
+}
+#endif
+
+/* Columns of a are preloaded: the batch kernels reuse them for every matrix. */
+struct the__cols {
+	v4 c0, c1, c2, c3;
+};
+
+static inline struct the__cols
+the__load_cols(const float *a)
+{
+	return (struct the__cols){ v4_load(a), v4_load(a + 4), v4_load(a + 8), v4_load(a + 12) };
+}
+
+static inline v4
+the__transform(const struct the__cols *a, const float *v)
+{
+	v4 r = v4_mul(a->c0, v4_splat(v[0]));
+	r = v4_madd(a->c1, v4_splat(v[1]), r);
+	r = v4_madd(a->c2, v4_splat(v[2]), r);
+	return v4_madd(a->c3, v4_splat(v[3]), r);
+}
+
+static inline void
+the__mul(float *out, const struct the__cols *a, const float *b)
+{
+#ifdef THE_SIMD_AVX2
+	/* Two columns per 256 bit register, in lane splats pick b[col][k]. */
+	__m256 a0 = _mm256_set_m128(a->c0, a->c0);
+	__m256 a1 = _mm256_set_m128(a->c1, a->c1);
+	__m256 a2 = _mm256_set_m128(a->c2, a->c2);
+	__m256 a3 = _mm256_set_m128(a->c3, a->c3);
+	for (int p = 0; p < 16; p += 8) {
+		__m256 bb = _mm256_loadu_ps(b + p);
+		__m256 r = _mm256_mul_ps(a0, _mm256_permute_ps(bb, 0x00));
+		r = _mm256_fmadd_ps(a1, _mm256_permute_ps(bb, 0x55), r);
+		r = _mm256_fmadd_ps(a2, _mm256_permute_ps(bb, 0xAA), r);
+		r = _mm256_fmadd_ps(a3, _mm256_permute_ps(bb, 0xFF), r);
+		_mm256_storeu_ps(out + p, r);
+	}
+#else
+	/* Column c is fully read before it is written, out can be b. */
+	for (int c = 0; c < 16; c += 4) {
+		v4_store(out + c, the__transform(a, b + c));
+	}
+#endif
+}
+
+void
+the_mat4_mul(union the_mat4 *out, const union the_mat4 *a, const union the_mat4 *b)
+{
+	struct the__cols ca = the__load_cols(a->v);
+	the__mul(out->v, &ca, b->v);
+}
+
+void
+the_mat4_mul_pairs(union the_mat4 *out, const union the_mat4 *a, const union the_mat4 *b, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		struct the__cols ca = the__load_cols(a[i].v);
+		the__mul(out[i].v, &ca, b[i].v);
+	}
+}
+
+void
+the_mat4_inverse_affine(union the_mat4 *out, const union the_mat4 *m)
+{
+	const float *a = m->v;
+	float c00 = a[5] * a[10] - a[6] * a[9];
+	float c01 = a[2] * a[9] - a[1] * a[10];
+	float c02 = a[1] * a[6] - a[2] * a[5];
+	float c10 = a[6] * a[8] - a[4] * a[10];
+	float c11 = a[0] * a[10] - a[2] * a[8];
+	float c12 = a[2] * a[4] - a[0] * a[6];
+	float c20 = a[4] * a[9] - a[5] * a[8];
+	float c21 = a[1] * a[8] - a[0] * a[9];
+	float c22 = a[0] * a[5] - a[1] * a[4];
+	float det = a[0] * c00 + a[4] * c01 + a[8] * c02;
+	float inv = det != 0.0f ? 1.0f / det : 0.0f;
+	float tx = a[12], ty = a[13], tz = a[14];
+
+	float *o = out->v;
+	o[0] = c00 * inv, o[1] = c01 * inv, o[2] = c02 * inv, o[3] = 0.0f;
+	o[4] = c10 * inv, o[5] = c11 * inv, o[6] = c12 * inv, o[7] = 0.0f;
+	o[8] = c20 * inv, o[9] = c21 * inv, o[10] = c22 * inv, o[11] = 0.0f;
+	o[12] = -(o[0] * tx + o[4] * ty + o[8] * tz);
+	o[13] = -(o[1] * tx + o[5] * ty + o[9] * tz);
+	o[14] = -(o[2] * tx + o[6] * ty + o[10] * tz);
+	o[15] = 1.0f;
+}
+
+struct the_vec3
+the_mat4_view_eye(const union the_mat4 *view)
+{
+	/* Rotation rows are the columns of the inverse, eye = -R^T * t. */
+	const float *v = view->v;
+	return (struct the_vec3){
+		-(v[0] * v[12] + v[1] * v[13] + v[2] * v[14]),
+		-(v[4] * v[12] + v[5] * v[13] + v[6] * v[14]),
+		-(v[8] * v[12] + v[9] * v[13] + v[10] * v[14]),
+	};
+}
+
+void
+the_sphere_transform_batch(struct the_vec4 *out, const union the_mat4 *m, const struct the_vec4 *spheres, int count)
+{
+	for (int i = 0; i < count; ++i) {
+		struct the__cols cm = the__load_cols(m[i].v);
+		const float *s = &spheres[i].x;
+		v4 center = v4_madd(cm.c0, v4_splat(s[0]), cm.c3);
+		center = v4_madd(cm.c1, v4_splat(s[1]), center);
+		center = v4_madd(cm.c2, v4_splat(s[2]), center);
+
+		/* Biggest squared axis length, lanes 0..2 only (affine matrices). */
+		union the4f l;
+		v4_store(l.v, v4_mul(cm.c0, cm.c0));
+		float len2 = l.v[0] + l.v[1] + l.v[2];
+		v4_store(l.v, v4_mul(cm.c1, cm.c1));
+		len2 = fmaxf(len2, l.v[0] + l.v[1] + l.v[2]);
+		v4_store(l.v, v4_mul(cm.c2, cm.c2));
+		len2 = fmaxf(len2, l.v[0] + l.v[1] + l.v[2]);
+
+		union the4f r;
+		v4_store(r.v, center);
+		r.v[3] = s[3] * sqrtf(len2);
+		out[i] = r.p;
+	}
+}
+
+/* Matrices of n <= 4 transforms, lane i of every register works on trs[i]. */
+static inline void
+the__trs4(union the_mat4 *out, const struct the_trs *trs, int n)
+{
+	float rot[16] = { 0.0f };
+	float pos[3][4] = { { 0.0f } };
+	float scale[3][4] = { { 0.0f } };
+	for (int i = 0; i < n; ++i) {
+		memcpy(rot + i * 4, &trs[i].rot, sizeof(trs[i].rot));
+		pos[0][i] = trs[i].pos.x, pos[1][i] = trs[i].pos.y, pos[2][i] = trs[i].pos.z;
+		scale[0][i] = trs[i].scale.x, scale[1][i] = trs[i].scale.y, scale[2][i] = trs[i].scale.z;
+	}
+
+	v4 q[4];
+	v4_load_soa(rot, q);
+	v4 two = v4_splat(2.0f), one = v4_splat(1.0f);
+	v4 x2 = v4_mul(q[0], two), y2 = v4_mul(q[1], two), z2 = v4_mul(q[2], two);
+	v4 xx = v4_mul(q[0], x2), yy = v4_mul(q[1], y2), zz = v4_mul(q[2], z2);
+	v4 xy = v4_mul(q[0], y2), xz = v4_mul(q[0], z2), yz = v4_mul(q[1], z2);
+	v4 wx = v4_mul(q[3], x2), wy = v4_mul(q[3], y2), wz = v4_mul(q[3], z2);
+	v4 sx = v4_load(scale[0]), sy = v4_load(scale[1]), sz = v4_load(scale[2]);
+
+	/* Upper 3x3, element e of the column major matrix in m[e]. */
+	float m[12][4];
+	v4_store(m[0], v4_mul(v4_sub(one, v4_add(yy, zz)), sx));
+	v4_store(m[1], v4_mul(v4_add(xy, wz), sx));
+	v4_store(m[2], v4_mul(v4_sub(xz, wy), sx));
+	v4_store(m[4], v4_mul(v4_sub(xy, wz), sy));
+	v4_store(m[5], v4_mul(v4_sub(one, v4_add(xx, zz)), sy));
+	v4_store(m[6], v4_mul(v4_add(yz, wx), sy));
+	v4_store(m[8], v4_mul(v4_add(xz, wy), sz));
+	v4_store(m[9], v4_mul(v4_sub(yz, wx), sz));
+	v4_store(m[10], v4_mul(v4_sub(one, v4_add(xx, yy)), sz));
+
+	for (int i = 0; i < n; ++i) {
+		float *o = out[i].v;
+		o[0] = m[0][i], o[1] = m[1][i], o[2] = m[2][i], o[3] = 0.0f;
+		o[4] = m[4][i], o[5] = m[5][i], o[6] = m[6][i], o[7] = 0.0f;
+		o[8] = m[8][i], o[9] = m[9][i], o[10] = m[10][i], o[11] = 0.0f;
+		o[12] = pos[0][i], o[13] = pos[1][i], o[14] = pos[2][i], o[15] = 1.0f;
+	}
+}
+
+void
+the_trs_matrix_batch(union the_mat4 *out, const struct the_trs *trs, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		the__trs4(out + i, trs + i, 4);
+	}
+	if (i < count) {
+		the__trs4(out + i, trs + i, count - i);
+	}
+}
+
+/* Blend of n <= 4 transforms, gathered in structure of arrays like the__trs4. */
+static inline void
+the__blend4(struct the_trs *out, const struct the_trs *a, const struct the_trs *b, float t, int n)
+{
+	float ra[16] = { 0.0f }, rb[16] = { 0.0f };
+	float va[6][4] = { { 0.0f } }, vb[6][4] = { { 0.0f } }; // pos xyz, scale xyz.
+	for (int i = 0; i < n; ++i) {
+		memcpy(ra + i * 4, &a[i].rot, sizeof(a[i].rot));
+		memcpy(rb + i * 4, &b[i].rot, sizeof(b[i].rot));
+		va[0][i] = a[i].pos.x, va[1][i] = a[i].pos.y, va[2][i] = a[i].pos.z;
+		va[3][i] = a[i].scale.x, va[4][i] = a[i].scale.y, va[5][i] = a[i].scale.z;
+		vb[0][i] = b[i].pos.x, vb[1][i] = b[i].pos.y, vb[2][i] = b[i].pos.z;
+		vb[3][i] = b[i].scale.x, vb[4][i] = b[i].scale.y, vb[5][i] = b[i].scale.z;
+	}
+
+	v4 wt = v4_splat(t);
+	float v[6][4];
+	for (int k = 0; k < 6; ++k) {
+		v4 x = v4_load(va[k]);
+		v4_store(v[k], v4_madd(v4_sub(v4_load(vb[k]), x), wt, x));
+	}
+
+	/* b is negated where the quaternions are more than 90 degrees apart. */
+	v4 qa[4], qb[4];
+	v4_load_soa(ra, qa);
+	v4_load_soa(rb, qb);
+	v4 dot = v4_mul(qa[0], qb[0]);
+	for (int k = 1; k < 4; ++k) {
+		dot = v4_madd(qa[k], qb[k], dot);
+	}
+	float d[4], tb[4];
+	v4_store(d, dot);
+	for (int i = 0; i < 4; ++i) {
+		tb[i] = d[i] < 0.0f ? -t : t;
+	}
+	v4 wa = v4_splat(1.0f - t), wb = v4_load(tb);
+	v4 q[4];
+	v4 len2 = v4_splat(0.0f);
+	for (int k = 0; k < 4; ++k) {
+		q[k] = v4_madd(qb[k], wb, v4_mul(qa[k], wa));
+		len2 = v4_madd(q[k], q[k], len2);
+	}
+	float l[4], r[4][4];
+	v4_store(l, len2);
+	for (int k = 0; k < 4; ++k) {
+		v4_store(r[k], q[k]);
+	}
+
+	for (int i = 0; i < n; ++i) {
+		float inv = l[i] > 0.0f ? 1.0f / sqrtf(l[i]) : 0.0f;
+		out[i] = (struct the_trs){
+			.pos = { v[0][i], v[1][i], v[2][i] },
+			.rot = { r[0][i] * inv, r[1][i] * inv, r[2][i] * inv, r[3][i] * inv },
+			.scale = { v[3][i], v[4][i], v[5][i] },
+		};
+	}
+}
+
+void
+the_trs_blend_batch(struct the_trs *out, const struct the_trs *a, const struct the_trs *b, float t, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		the__blend4(out + i, a + i, b + i, t, 4);
+	}
+	if (i < count) {
+		the__blend4(out + i, a + i, b + i, t, count - i);
+	}
+}
+
+void
+the_particles_step(const struct the_particle_streams *p, int begin, int end, struct the_vec3 gravity, float drag, float dt, struct the_vec4 *out, struct the_vec3 *bounds)
+{
+	THE_ASSERT(!(begin & 3) && "Particle batches start on a multiple of 4");
+	float keep = 1.0f - drag * dt;
+	v4 damp = v4_splat(keep > 0.0f ? keep : 0.0f);
+	v4 wdt = v4_splat(dt);
+	v4 gx = v4_splat(gravity.x * dt), gy = v4_splat(gravity.y * dt), gz = v4_splat(gravity.z * dt);
+	v4 lox = v4_splat(INFINITY), loy = lox, loz = lox;
+	v4 hix = v4_splat(-INFINITY), hiy = hix, hiz = hix;
+	for (int i = begin; i < end; i += 4) {
+		v4 vx = v4_madd(v4_load(p->vx + i), damp, gx);
+		v4 vy = v4_madd(v4_load(p->vy + i), damp, gy);
+		v4 vz = v4_madd(v4_load(p->vz + i), damp, gz);
+		v4 px = v4_madd(vx, wdt, v4_load(p->px + i));
+		v4 py = v4_madd(vy, wdt, v4_load(p->py + i));
+		v4 pz = v4_madd(vz, wdt, v4_load(p->pz + i));
+		v4 age = v4_madd(v4_load(p->rate + i), wdt, v4_load(p->age + i));
+		v4_store(p->vx + i, vx);
+		v4_store(p->vy + i, vy);
+		v4_store(p->vz + i, vz);
+		v4_store(p->px + i, px);
+		v4_store(p->py + i, py);
+		v4_store(p->pz + i, pz);
+		v4_store(p->age + i, age);
+		v4_store_aos(&out[i].x, px, py, pz, age);
+		if (i + 4 > end) {
+			/* Last partial step: padding lanes take lane 0, so they stay out of the bounds. */
+			int n = end - i;
+			float lx[4], ly[4], lz[4];
+			v4_store(lx, px), v4_store(ly, py), v4_store(lz, pz);
+			for (int l = n; l < 4; ++l) {
+				lx[l] = lx[0], ly[l] = ly[0], lz[l] = lz[0];
+			}
+			px = v4_load(lx), py = v4_load(ly), pz = v4_load(lz);
+		}
+		lox = v4_min(lox, px), loy = v4_min(loy, py), loz = v4_min(loz, pz);
+		hix = v4_max(hix, px), hiy = v4_max(hiy, py), hiz = v4_max(hiz, pz);
+	}
+
+	float l[3][4], h[3][4];
+	v4_store(l[0], lox), v4_store(l[1], loy), v4_store(l[2], loz);
+	v4_store(h[0], hix), v4_store(h[1], hiy), v4_store(h[2], hiz);
+	float lo[3], hi[3];
+	for (int c = 0; c < 3; ++c) {
+		lo[c] = fminf(fminf(l[c][0], l[c][1]), fminf(l[c][2], l[c][3]));
+		hi[c] = fmaxf(fmaxf(h[c][0], h[c][1]), fmaxf(h[c][2], h[c][3]));
+	}
+	bounds[0] = (struct the_vec3){ lo[0], lo[1], lo[2] };
+	bounds[1] = (struct the_vec3){ hi[0], hi[1], hi[2] };
+}
+
+void
+the_frustum_from_vp(struct the_frustum *f, const union the_mat4 *vp)
+{
+	const float *m = vp->v;
+	for (int i = 0; i < 6; ++i) {
+		int row = i / 2;
+		float sign = (i & 1) ? -1.0f : 1.0f;
+		float p[4];
+		for (int c = 0; c < 4; ++c) {
+			p[c] = m[c * 4 + 3] + sign * m[c * 4 + row];
+		}
+		float len = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		float inv = len > 0.0f ? 1.0f / len : 0.0f;
+		f->planes[i] = (struct the_vec4){ p[0] * inv, p[1] * inv, p[2] * inv, p[3] * inv };
+	}
+}
+
+static inline int
+the__cull4(const struct the_frustum *f, const float *spheres, uint8_t *visible, int n)
+{
+	v4 s[4];
+	v4_load_soa(spheres, s);
+
+	/* Smallest signed distance plus radius over the planes, outside if negative. */
+	v4 inside = v4_splat(FLT_MAX);
+	for (int p = 0; p < 6; ++p) {
+		const struct the_vec4 *pl = &f->planes[p];
+		v4 d = v4_add(s[3], v4_splat(pl->w));
+		d = v4_madd(s[0], v4_splat(pl->x), d);
+		d = v4_madd(s[1], v4_splat(pl->y), d);
+		d = v4_madd(s[2], v4_splat(pl->z), d);
+		inside = v4_min(inside, d);
+	}
+
+	float dist[4];
+	v4_store(dist, inside);
+	int count = 0;
+	for (int i = 0; i < n; ++i) {
+		visible[i] = dist[i] >= 0.0f;
+		count += visible[i];
+	}
+	return count;
+}
+
+int
+the_frustum_cull_spheres(const struct the_frustum *f, const struct the_vec4 *spheres, int count, uint8_t *visible)
+{
+	int visible_count = 0;
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		visible_count += the__cull4(f, &spheres[i].x, visible + i, 4);
+	}
+
+	if (i < count) {
+		struct the_vec4 tail[4] = { { 0 } };
+		memcpy(tail, spheres + i, (count - i) * sizeof(*tail));
+		visible_count += the__cull4(f, &tail[0].x, visible + i, count - i);
+	}
+	return visible_count;
+}
+
+void
+the_frustum4_set(struct the_frustum4 *f4, const struct the_frustum *f, int count)
+{
+	THE_ASSERT(count > 0 && count <= 4 && "Four frusta at most");
+	memset(f4, 0, sizeof(*f4));
+	for (int v = 0; v < count; ++v) {
+		for (int p = 0; p < 6; ++p) {
+			const struct the_vec4 *pl = &f[v].planes[p];
+			f4->planes[p][0][v] = pl->x;
+			f4->planes[p][1][v] = pl->y;
+			f4->planes[p][2][v] = pl->z;
+			f4->planes[p][3][v] = pl->w;
+			f4->abs_normal[p][0][v] = fabsf(pl->x);
+			f4->abs_normal[p][1][v] = fabsf(pl->y);
+			f4->abs_normal[p][2][v] = fabsf(pl->z);
+		}
+	}
+	f4->lanes = (1u << count) - 1u;
+}
+
+uint32_t
+the_frustum4_box(const struct the_frustum4 *f4, struct the_vec3 center, struct the_vec3 extent, uint32_t *inside)
+{
+	v4 cx = v4_splat(center.x), cy = v4_splat(center.y), cz = v4_splat(center.z);
+	v4 ex = v4_splat(extent.x), ey = v4_splat(extent.y), ez = v4_splat(extent.z);
+
+	/* Per view: smallest distance of the farthest corner (culled if negative) and of the nearest one. */
+	v4 far = v4_splat(FLT_MAX);
+	v4 near = v4_splat(FLT_MAX);
+	for (int p = 0; p < 6; ++p) {
+		v4 d = v4_load(f4->planes[p][3]);
+		d = v4_madd(cx, v4_load(f4->planes[p][0]), d);
+		d = v4_madd(cy, v4_load(f4->planes[p][1]), d);
+		d = v4_madd(cz, v4_load(f4->planes[p][2]), d);
+		v4 r = v4_mul(ex, v4_load(f4->abs_normal[p][0]));
+		r = v4_madd(ey, v4_load(f4->abs_normal[p][1]), r);
+		r = v4_madd(ez, v4_load(f4->abs_normal[p][2]), r);
+		far = v4_min(far, v4_add(d, r));
+		near = v4_min(near, v4_sub(d, r));
+	}
+
+	float fd[4], nd[4];
+	v4_store(fd, far);
+	v4_store(nd, near);
+	uint32_t touch = 0;
+	uint32_t in = 0;
+	for (int v = 0; v < 4; ++v) {
+		touch |= (uint32_t)(fd[v] >= 0.0f) << v;
+		in |= (uint32_t)(nd[v] >= 0.0f) << v;
+	}
+	*inside = in & touch & f4->lanes;
+	return touch & f4->lanes;
+}
@@ -0,0 +1,112 @@
+#ifndef THE_CORE_SIMD_H
+#define THE_CORE_SIMD_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * Vectorized 4x4 matrix kernels on union the_mat4 (column major, same layout as mathc).
+ * Backend picked at compile time: AVX2+FMA (THE_AVX2 build option), SSE, NEON or scalar.
+ * Pointers do not need any special alignment. Output may alias the inputs only in the
+ * single matrix functions.
+ */
+#if defined(__AVX2__) && defined(__FMA__)
+#define THE_SIMD_AVX2
+#define THE_SIMD_NAME "AVX2"
+#elif defined(__SSE__) || defined(_M_X64)
+#define THE_SIMD_SSE
+#define THE_SIMD_NAME "SSE"
+#elif defined(__ARM_NEON)
+#define THE_SIMD_NEON
+#define THE_SIMD_NAME "NEON"
+#else
+#define THE_SIMD_NAME "scalar"
+#endif
+
+void the_mat4_mul(union the_mat4 *out, const union the_mat4 *a, const union the_mat4 *b);
+
+/*
+ * Inverse of an affine matrix (last row 0 0 0 1): inverts the upper 3x3 and the
+ * translation, much cheaper than a general inverse. For views use the_mat4_view_eye.
+ */
+void the_mat4_inverse_affine(union the_mat4 *out, const union the_mat4 *m);
+
+/* Camera position of a rigid view matrix: -R^T * t. */
+struct the_vec3 the_mat4_view_eye(const union the_mat4 *view);
+
+/* out[i] = a[i] * b[i], e.g. parent world by child local, or model by inverse bind. */
+void the_mat4_mul_pairs(union the_mat4 *out, const union the_mat4 *a, const union the_mat4 *b, int count);
+
+/*
+ * Bounding spheres (xyz center, w radius) to world space: out[i] center = m[i] * center,
+ * radius scaled by the biggest axis scale of m[i].
+ */
+void the_sphere_transform_batch(struct the_vec4 *out, const union the_mat4 *m, const struct the_vec4 *spheres, int count);
+
+/* Translation, rotation and scale: 40 bytes against the 64 of the matrix it stands for. */
+struct the_trs {
+	struct the_vec3 pos;
+	struct the_vec4 rot; // Quaternion (x, y, z, w), unit length.
+	struct the_vec3 scale;
+};
+
+/* out[i] = T * R * S of trs[i]. Four transforms per iteration, in structure of arrays. */
+void the_trs_matrix_batch(union the_mat4 *out, const struct the_trs *trs, int count);
+
+/*
+ * out[i] = a[i] * (1 - t) + b[i] * t: position and scale lerped, rotation normalized
+ * lerp along the shortest arc. out may be a or b.
+ */
+void the_trs_blend_batch(struct the_trs *out, const struct the_trs *a, const struct the_trs *b, float t, int count);
+
+/* Particle state, one stream of floats per component (structure of arrays). */
+struct the_particle_streams {
+	float *px, *py, *pz;
+	float *vx, *vy, *vz;
+	float *age; // Normalized: 0 at birth, dies at 1.
+	float *rate; // Age increment per second, 1 / lifetime.
+};
+
+/*
+ * Integrates particles [begin, end), four per step: v = v * (1 - drag * dt) + gravity * dt,
+ * p += v * dt, age += rate * dt. Writes xyz position and age of particle i to out[i].
+ * begin is a multiple of 4 and the streams and out are padded to a multiple of 4, the
+ * padding lanes are integrated and written too. bounds[0] and bounds[1] get the min and max
+ * of the new positions in [begin, end), padding excluded.
+ */
+void the_particles_step(const struct the_particle_streams *p, int begin, int end, struct the_vec3 gravity, float drag, float dt, struct the_vec4 *out, struct the_vec3 *bounds);
+
+/* Planes (xyz normal pointing inwards, w offset), normalized. Order: left right bottom top near far. */
+struct the_frustum {
+	struct the_vec4 planes[6];
+};
+
+/* Frustum of a view projection matrix (OpenGL clip space, z in [-w, w]). */
+void the_frustum_from_vp(struct the_frustum *f, const union the_mat4 *vp);
+
+/*
+ * visible[i] = 1 if world space sphere i touches the frustum, 0 otherwise.
+ * Spheres are tested four at a time. Returns the number of visible spheres.
+ */
+int the_frustum_cull_spheres(const struct the_frustum *f, const struct the_vec4 *spheres, int count, uint8_t *visible);
+
+/*
+ * Four frusta side by side for the multi view tests: every plane component holds one
+ * view per lane. Lanes past the count given to the_frustum4_set are never reported.
+ */
+struct the_frustum4 {
+	float planes[6][4][4]; // Plane, component (x y z w), view.
+	float abs_normal[6][3][4]; // Absolute normal components, to project box extents.
+	uint32_t lanes; // Bits of the views set.
+};
+
+void the_frustum4_set(struct the_frustum4 *f4, const struct the_frustum *f, int count);
+
+/*
+ * Box (center, half extent) against the four frusta at once. Returns the bits of the views
+ * it touches and sets in *inside the bits of the views that fully contain it.
+ */
+uint32_t the_frustum4_box(const struct the_frustum4 *f4, struct the_vec3 center, struct the_vec3 extent, uint32_t *inside);
+
+#endif // THE_CORE_SIMD_H
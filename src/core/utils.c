@@ -1,7 +1,9 @@
 #include "utils.h"
 
 #include "core/io.h"
+#include "core/lz.h"
 #include "core/mem.h"
+#include "core/prefetch.h"
 #include "render/pixels_internal.h"
 
 #include <string.h>
@@ -15,9 +17,19 @@ the_mesh THE_UTILS_QUAD;
 typedef struct the_job job;
 THE_DECL_ARR(job);
 
+/* Async assets know how to load themselves blocking (load) or progressively (stream). */
+struct tut_asset {
+	struct the_job load;
+	void (*stream)(void *args);
+};
+
+typedef struct tut_asset tutasset;
+THE_DECL_ARR(tutasset);
+THE_IMPL_ARR(tutasset);
+
 struct tut_asset_loader {
 	struct thearr_job *seq;
-	struct thearr_job *async;
+	struct thearr_tutasset *async;
 };
 
 static void
@@ -27,6 +39,13 @@ load_tex(void *arg)
 	the_tex_load(a->tex, &a->desc, a->path);
 }
 
+static void
+stream_tex(void *arg)
+{
+	struct tut_tex_ldargs *a = arg;
+	the_tex_load_async(a->tex, &a->desc, a->path);
+}
+
 static void
 load_mesh(void *arg)
 {
@@ -35,6 +54,15 @@ load_mesh(void *arg)
 	                                         // order to avoid concurrent writes in mesh_pool
 }
 
+static void
+stream_mesh(void *arg)
+{
+	struct tut_mesh_ldargs *a = arg;
+	*a->mesh = the_mesh_create();
+	tut_mesh_set_geometry(*a->mesh, THE_CUBE); // Placeholder.
+	the_mesh_load_async(*a->mesh, a->path);
+}
+
 static void
 load_shader(void *arg)
 {
@@ -50,6 +78,13 @@ load_env(void *args)
 	tut_env_load(ea->path, ea->lut, ea->sky, ea->irr, ea->pref);
 }
 
+static void
+stream_env(void *args)
+{
+	struct tut_env_ldargs *ea = args;
+	tut_env_load_async(ea->path, ea->lut, ea->sky, ea->irr, ea->pref);
+}
+
 struct tut_asset_loader *
 tut_assets_create(void)
 {
@@ -59,20 +94,24 @@ tut_assets_create(void)
 	return l;
 }
 
+static void
+tut_assets_add(struct tut_asset_loader *l, void (*load)(void *), void (*stream)(void *), void *args)
+{
+	struct tut_asset *a = thearr_tutasset_push(&l->async);
+	a->load = (struct the_job){ .job = load, .args = args };
+	a->stream = stream;
+}
+
 void
 tut_assets_add_mesh(struct tut_asset_loader *l, struct tut_mesh_ldargs *args)
 {
-	job *job = thearr_job_push(&l->async);
-	job->job = load_mesh;
-	job->args = args;
+	tut_assets_add(l, load_mesh, stream_mesh, args);
 }
 
 void
 tut_assets_add_tex(struct tut_asset_loader *l, struct tut_tex_ldargs *args)
 {
-	job *job = thearr_job_push(&l->async);
-	job->job = load_tex;
-	job->args = args;
+	tut_assets_add(l, load_tex, stream_tex, args);
 }
 
 void
@@ -86,21 +125,29 @@ tut_assets_add_shader(struct tut_asset_loader *l, struct tut_shad_ldargs *args)
 void
 tut_assets_add_env(struct tut_asset_loader *l, struct tut_env_ldargs *args)
 {
-	job *job = thearr_job_push(&l->async);
-	job->job = load_env;
-	job->args = args;
+	tut_assets_add(l, load_env, stream_env, args);
 }
 
 void
 tut_assets_add_job(struct tut_asset_loader *l, struct the_job j, bool async)
 {
 	if (async) {
-		thearr_job_push_value(&l->async, j);
+		tut_assets_add(l, j.job, NULL, j.args);
 	} else {
 		thearr_job_push_value(&l->seq, j);
 	}
 }
 
+static void
+tut_assets_run_seq(struct tut_asset_loader *l)
+{
+	if (l->seq) {
+		for (int i = 0; i < l->seq->count; ++i) {
+			(*l->seq->at[i].job)(l->seq->at[i].args);
+		}
+	}
+}
+
 void
 tut_assets_load(struct tut_asset_loader *l, int threads)
 {
@@ -108,15 +155,11 @@ tut_assets_load(struct tut_asset_loader *l, int threads)
 	if (l->async) {
 		load_sched = the_sched_create(threads);
 		for (int i = 0; i < l->async->count; ++i) {
-			the_sched_do(load_sched, l->async->at[i]);
+			the_sched_do(load_sched, l->async->at[i].load);
 		}
 	}
 
-	if (l->seq) {
-		for (int i = 0; i < l->seq->count; ++i) {
-			(*l->seq->at[i].job)(l->seq->at[i].args);
-		}
-	}
+	tut_assets_run_seq(l);
 
 	if (l->async) {
 		the_sched_wait(load_sched); // TODO(Check): sched_destroy waits?
@@ -127,6 +170,23 @@ tut_assets_load(struct tut_asset_loader *l, int threads)
 	free(l);
 }
 
+void
+tut_assets_stream(struct tut_asset_loader *l)
+{
+	tut_assets_run_seq(l);
+	for (int i = 0; l->async && i < l->async->count; ++i) {
+		struct tut_asset *a = &l->async->at[i];
+		if (a->stream) {
+			a->stream(a->load.args);
+		} else {
+			the_load_async(a->load.job, NULL, a->load.args);
+		}
+	}
+	free(l->seq);
+	free(l->async);
+	free(l);
+}
+
 static void
 the__mesh_set_cube(mesh *mesh)
 {
@@ -265,147 +325,304 @@ tut_mesh_set_geometry(the_mesh msh, enum tut_geometry geo)
 	case THE_CUBE: the__mesh_set_cube(m); break;
 	case THE_SPHERE: the__mesh_set_sphere(m, 32, 32); break;
 	}
+	m->lod_count = 0;
+	the_mesh_calc_bounds(m);
 	m->res.flags |= THE_IRF_DIRTY;
+	the_invalidate();
 }
 
-void
-tut_env_load(const char *path, the_tex *lut, the_tex *sky, the_tex *irr, the_tex *pref)
+/*
+ * .env sections are read straight into the images: from the file if it is unpacked, else
+ * from the packed data, ENV_BATCH_BLOCKS LZ blocks at a time decoded in parallel on the
+ * shared scheduler. The raw file is never held whole.
+ */
+#define ENV_BATCH_BLOCKS 16
+
+struct env_reader {
+	FILE *f;
+	char *packed;
+	size_t packed_size;
+	struct the_lz_header hdr;
+	size_t *offsets; // Packed offset of each block.
+	uint32_t block; // First block of the next batch.
+	char *blk; // Decoded batch, blk_len bytes, consumed up to blk_pos.
+	size_t blk_len;
+	size_t blk_pos;
+	int failed;
+};
+
+static bool
+env_open(struct env_reader *r, const char *path)
+{
+	memset(r, 0, sizeof(*r));
+	r->f = fopen(path, "rb");
+	if (!r->f) {
+		return false;
+	}
+	char magic[4];
+	if (fread(magic, sizeof(magic), 1, r->f) != 1 || memcmp(magic, THE_LZ_MAGIC, 4)) {
+		rewind(r->f);
+		the_prefetch_record(path, 0, 0);
+		return true;
+	}
+
+	fclose(r->f);
+	r->f = NULL;
+	if (the_file_read(path, &r->packed, &r->packed_size) != THE_OK) {
+		return false;
+	}
+	--r->packed_size; // the_file_read adds a '\0'.
+	if (r->packed_size < sizeof(r->hdr)) {
+		return false;
+	}
+	memcpy(&r->hdr, r->packed, sizeof(r->hdr));
+	size_t offset = sizeof(r->hdr) + (size_t)r->hdr.block_count * sizeof(uint32_t);
+	if (!r->hdr.block_size || (r->hdr.block_size & THE_LZ_RAW_BLOCK) ||
+	    (r->hdr.raw_size + r->hdr.block_size - 1) / r->hdr.block_size != r->hdr.block_count ||
+	    offset > r->packed_size) {
+		return false;
+	}
+
+	r->offsets = the_alloc(r->hdr.block_count * sizeof(size_t) + 1);
+	r->blk = the_alloc((size_t)ENV_BATCH_BLOCKS * r->hdr.block_size + 1);
+	if (!r->offsets || !r->blk) {
+		return false;
+	}
+	for (uint32_t b = 0; b < r->hdr.block_count; ++b) {
+		uint32_t size;
+		memcpy(&size, r->packed + sizeof(r->hdr) + b * sizeof(uint32_t), sizeof(size));
+		r->offsets[b] = offset;
+		offset += size & ~THE_LZ_RAW_BLOCK;
+	}
+	return offset <= r->packed_size;
+}
+
+static void
+env_close(struct env_reader *r)
+{
+	if (r->f) {
+		fclose(r->f);
+	}
+	the_free(r->packed);
+	the_free(r->offsets);
+	the_free(r->blk);
+}
+
+static void
+env_decode_range(void *args, int begin, int end)
+{
+	struct env_reader *r = args;
+	for (int i = begin; i < end; ++i) {
+		uint32_t b = r->block + i;
+		uint32_t size;
+		memcpy(&size, r->packed + sizeof(r->hdr) + b * sizeof(uint32_t), sizeof(size));
+		size_t raw = (size_t)b * r->hdr.block_size;
+		size_t len = raw + r->hdr.block_size < r->hdr.raw_size ? r->hdr.block_size : r->hdr.raw_size - raw;
+		size_t csize = size & ~THE_LZ_RAW_BLOCK;
+		char *dst = r->blk + (size_t)i * r->hdr.block_size;
+		if (size & THE_LZ_RAW_BLOCK) {
+			if (csize != len) {
+				r->failed = 1;
+				continue;
+			}
+			memcpy(dst, r->packed + r->offsets[b], len);
+		} else if (the_lz_decompress(r->packed + r->offsets[b], csize, dst, len) != len) {
+			r->failed = 1;
+		}
+	}
+}
+
+// Blocks of a batch are consecutive in the raw data, so the batch is one contiguous span.
+static bool
+env_next_block(struct env_reader *r)
+{
+	if (r->block >= r->hdr.block_count) {
+		return false;
+	}
+	uint32_t count = r->hdr.block_count - r->block;
+	count = count < ENV_BATCH_BLOCKS ? count : ENV_BATCH_BLOCKS;
+	the_sched_for(the_sched_shared(), count, 1, env_decode_range, r);
+	if (r->failed) {
+		return false;
+	}
+	size_t raw = (size_t)r->block * r->hdr.block_size;
+	size_t len = (size_t)count * r->hdr.block_size;
+	r->blk_len = raw + len < r->hdr.raw_size ? len : r->hdr.raw_size - raw;
+	r->blk_pos = 0;
+	r->block += count;
+	return true;
+}
+
+static bool
+env_read(struct env_reader *r, void *dst, size_t size)
+{
+	if (r->f) {
+		return fread(dst, size, 1, r->f) == 1;
+	}
+	char *out = dst;
+	while (size) {
+		if (r->blk_pos == r->blk_len && !env_next_block(r)) {
+			return false;
+		}
+		size_t n = r->blk_len - r->blk_pos < size ? r->blk_len - r->blk_pos : size;
+		memcpy(out, r->blk + r->blk_pos, n);
+		r->blk_pos += n;
+		out += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Textures in file order.
+enum { ENV_SKY, ENV_IRR, ENV_PREF, ENV_LUT, ENV_COUNT };
+
+static struct the_texture_desc
+env_desc(int tex)
+{
+	struct the_texture_desc d;
+	switch (tex) {
+	case ENV_SKY:
+	case ENV_IRR: d = tut_texture_desc_default(THE_TEX_CUBEMAP, THE_TEX_FMT_RGB16F, 1024, 1024); break;
+	case ENV_PREF:
+		d = tut_texture_desc_default(THE_TEX_CUBEMAP, THE_TEX_FMT_RGB16F, 256, 256);
+		d.min_filter = THE_TEX_FLTR_LINEAR_MIPMAP_LINEAR;
+		break;
+	default: d = tut_texture_desc_default(THE_TEX_2D, THE_TEX_FMT_RG16F, 512, 512); break;
+	}
+	d.wrap_s = THE_TEX_WRAP_CLAMP;
+	d.wrap_t = THE_TEX_WRAP_CLAMP;
+	d.wrap_r = THE_TEX_WRAP_CLAMP;
+	return d;
+}
+
+static void
+env_free(struct thearr_theteximg **img)
 {
-	FILE *f = fopen(path, "r");
-	if (!f) {
+	for (int i = 0; i < ENV_COUNT; ++i) {
+		for (int j = 0; img[i] && j < img[i]->count; ++j) {
+			the_free(img[i]->at[j].pix);
+		}
+		thearr_theteximg_release(img[i]);
+		img[i] = NULL;
+	}
+}
+
+/* Decodes the images of every environment texture. Does not touch the texture pool. */
+static bool
+env_decode(const char *path, struct thearr_theteximg **img)
+{
+	struct env_reader f;
+	if (!env_open(&f, path)) {
 		THE_LOG_ERR("Failed to open file %s", path);
-		return;
+		env_close(&f);
+		return false;
 	}
+
 	char hdr[9];
-	if (fread(hdr, 8, 1, f) != 1) {
+	if (!env_read(&f, hdr, 8)) {
 		THE_LOG_ERR("Header of .env file is invalid. Aborting load_env of %s.", path);
-		fclose(f);
-		return;
+		env_close(&f);
+		return false;
 	}
 
 	hdr[8] = '\0';
 	if (strncmp("NYAS_ENV", hdr, 9) != 0) {
 		THE_LOG_ERR("Header of .env file is invalid. Aborting load_env of %s.", path);
-		fclose(f);
-		return;
+		env_close(&f);
+		return false;
 	}
 
-	*sky = the_tex_create();
-	tex *t = &tex_pool.buf->at[*sky];
-	t->res.id = 0;
-	t->res.flags = THE_IRF_DIRTY;
-	t->data.type = THE_TEX_CUBEMAP;
-	t->data.fmt = THE_TEX_FMT_RGB16F;
-	t->data.width = 1024;
-	t->data.height = 1024;
-	t->data.mag_filter = THE_TEX_FLTR_LINEAR;
-	t->data.min_filter = THE_TEX_FLTR_LINEAR;
-	t->data.wrap_s = THE_TEX_WRAP_CLAMP;
-	t->data.wrap_t = THE_TEX_WRAP_CLAMP;
-	t->data.wrap_r = THE_TEX_WRAP_CLAMP;
-	t->img = NULL;
-
-	size_t size = 1024 * 1024 * 3 * 2; // size * nchannels * sizeof(channel)
-	for (int i = 0; i < 6; ++i) {
-		struct the_texture_image *img = thearr_theteximg_push(&t->img);
-		img->lod = 0;
-		img->face = i;
-		img->pix = the_alloc(size);
-		if (fread(img->pix, size, 1, f) != 1) {
-			THE_LOG_ERR("Error reading .env file. Aborting %s.", path);
-			fclose(f);
-			return;
+	for (int t = 0; t < ENV_COUNT; ++t) {
+		struct the_texture_desc d = env_desc(t);
+		int channels = d.fmt == THE_TEX_FMT_RG16F ? 2 : 3;
+		size_t size = d.width * d.height * channels * 2; // size * nchannels * sizeof(channel)
+		int lods = t == ENV_PREF ? 9 : 1;
+		int faces = d.type == THE_TEX_CUBEMAP ? 6 : 1;
+		img[t] = NULL;
+		for (int lod = 0; lod < lods; ++lod) {
+			for (int face = 0; face < faces; ++face) {
+				struct the_texture_image *im = thearr_theteximg_push(&img[t]);
+				im->lod = lod;
+				im->face = face;
+				im->pix = the_alloc(size);
+				if (!im->pix || !env_read(&f, im->pix, size)) {
+					THE_LOG_ERR("Error reading .env file. Aborting %s.", path);
+					env_free(img);
+					env_close(&f);
+					return false;
+				}
+			}
+			size /= 4;
 		}
+	}
 
-		THE_ASSERT(img->pix && "The image couldn't be loaded");
-	}
-
-	*irr = the_tex_create();
-	t = &tex_pool.buf->at[*irr];
-	t->res.id = 0;
-	t->res.flags = THE_IRF_DIRTY;
-	t->data.type = THE_TEX_CUBEMAP;
-	t->data.fmt = THE_TEX_FMT_RGB16F;
-	t->data.width = 1024;
-	t->data.height = 1024;
-	t->data.mag_filter = THE_TEX_FLTR_LINEAR;
-	t->data.min_filter = THE_TEX_FLTR_LINEAR;
-	t->data.wrap_s = THE_TEX_WRAP_CLAMP;
-	t->data.wrap_t = THE_TEX_WRAP_CLAMP;
-	t->data.wrap_r = THE_TEX_WRAP_CLAMP;
-	t->img = NULL;
-
-	for (int i = 0; i < 6; ++i) {
-		struct the_texture_image *img = thearr_theteximg_push(&t->img);
-		img->lod = 0;
-		img->face = i;
-		img->pix = the_alloc(size);
-		if (fread(img->pix, size, 1, f) != 1) {
-			THE_LOG_ERR("Error reading .env file. Aborting %s.", path);
-			fclose(f);
-			return;
-		}
+	env_close(&f);
+	return true;
+}
 
-		THE_ASSERT(img->pix && "The image couldn't be loaded");
-	}
-
-	*pref = the_tex_create();
-	t = &tex_pool.buf->at[*pref];
-	t->res.id = 0;
-	t->res.flags = THE_IRF_DIRTY;
-	t->data.type = THE_TEX_CUBEMAP;
-	t->data.fmt = THE_TEX_FMT_RGB16F;
-	t->data.width = 256;
-	t->data.height = 256;
-	t->data.mag_filter = THE_TEX_FLTR_LINEAR;
-	t->data.min_filter = THE_TEX_FLTR_LINEAR_MIPMAP_LINEAR;
-	t->data.wrap_s = THE_TEX_WRAP_CLAMP;
-	t->data.wrap_t = THE_TEX_WRAP_CLAMP;
-	t->data.wrap_r = THE_TEX_WRAP_CLAMP;
-	t->img = NULL;
-
-	size = 256 * 256 * 3 * 2;
-	for (int lod = 0; lod < 9; ++lod) {
-		for (int face = 0; face < 6; ++face) {
-			struct the_texture_image *img = thearr_theteximg_push(&t->img);
-			img->lod = lod;
-			img->face = face;
-			img->pix = the_alloc(size);
-			if (fread(img->pix, size, 1, f) != 1) {
-				THE_LOG_ERR("Error reading .env file. Aborting %s.", path);
-				fclose(f);
-				return;
-			}
-			THE_ASSERT(img->pix && "The image couldn't be loaded");
-		}
-		size /= 4;
-	}
-
-	*lut = the_tex_create();
-	t = &tex_pool.buf->at[*lut];
-	t->res.id = 0;
-	t->res.flags = THE_IRF_DIRTY;
-	t->data.type = THE_TEX_2D;
-	t->data.fmt = THE_TEX_FMT_RG16F;
-	t->data.width = 512;
-	t->data.height = 512;
-	t->data.mag_filter = THE_TEX_FLTR_LINEAR;
-	t->data.min_filter = THE_TEX_FLTR_LINEAR;
-	t->data.wrap_s = THE_TEX_WRAP_CLAMP;
-	t->data.wrap_t = THE_TEX_WRAP_CLAMP;
-	t->data.wrap_r = THE_TEX_WRAP_CLAMP;
-	t->img = NULL;
-
-	size = 512 * 512 * 2 * 2;
-	struct the_texture_image *img = thearr_theteximg_push(&t->img);
-
-	img->lod = 0;
-	img->pix = the_alloc(size);
-	if (fread(img->pix, size, 1, f) != 1) {
-		THE_LOG_ERR("Error reading .env file. Aborting %s.", path);
-		fclose(f);
+static void
+env_apply(the_tex texture, int which, struct thearr_theteximg *img)
+{
+	tex *t = &tex_pool.buf->at[texture];
+	for (int i = 0; t->img && i < t->img->count; ++i) {
+		the_free(t->img->at[i].pix);
+	}
+	thearr_theteximg_release(t->img);
+	t->img = img;
+	t->data = env_desc(which);
+	t->res.flags |= THE_IRF_DIRTY;
+}
+
+void
+tut_env_load(const char *path, the_tex *lut, the_tex *sky, the_tex *irr, the_tex *pref)
+{
+	struct thearr_theteximg *img[ENV_COUNT] = { NULL };
+	if (!env_decode(path, img)) {
 		return;
 	}
-	THE_ASSERT(img->pix && "The image couldn't be loaded");
-	fclose(f);
+
+	the_tex *out[ENV_COUNT] = { sky, irr, pref, lut };
+	for (int i = 0; i < ENV_COUNT; ++i) {
+		*out[i] = the_tex_create();
+		env_apply(*out[i], i, img[i]);
+	}
+}
+
+struct env_stream {
+	char path[256];
+	the_tex tex[ENV_COUNT];
+	struct thearr_theteximg *img[ENV_COUNT];
+	bool ok;
+};
+
+static void
+env_stream_load(void *args)
+{
+	struct env_stream *s = args;
+	s->ok = env_decode(s->path, s->img);
+}
+
+static void
+env_stream_done(void *args)
+{
+	struct env_stream *s = args;
+	for (int i = 0; s->ok && i < ENV_COUNT; ++i) {
+		env_apply(s->tex[i], i, s->img[i]);
+	}
+	the_free(s);
+}
+
+void
+tut_env_load_async(const char *path, the_tex *lut, the_tex *sky, the_tex *irr, the_tex *pref)
+{
+	struct env_stream *s = the_calloc(1, sizeof(*s));
+	snprintf(s->path, sizeof(s->path), "%s", path);
+	the_tex *out[ENV_COUNT] = { sky, irr, pref, lut };
+	for (int i = 0; i < ENV_COUNT; ++i) {
+		struct the_texture_desc desc = env_desc(i);
+		s->tex[i] = the_tex_create();
+		the_tex_placeholder(s->tex[i], &desc);
+		*out[i] = s->tex[i];
+	}
+	the_load_async(env_stream_load, env_stream_done, s);
 }
@@ -80,6 +80,13 @@ void tut_assets_add_shader(tut_assetldr *l, struct tut_shad_ldargs *args);
 void tut_assets_add_env(tut_assetldr *l, struct tut_env_ldargs *args);
 void tut_assets_add_job(tut_assetldr *l, struct the_job j, bool async);
 void tut_assets_load(tut_assetldr *l, int threads);
+/*
+ * Progressive alternative to tut_assets_load: shaders and sync jobs run now, meshes and
+ * textures get placeholders (unit cube, 1x1 white) and are swapped when their async load
+ * lands in the_hotreload_poll. Handles are valid on return, the ldargs are not kept
+ * (custom async jobs keep their args until they run).
+ */
+void tut_assets_stream(tut_assetldr *l);
 
 // Geometry
 enum tut_geometry { THE_QUAD, THE_CUBE, THE_SPHERE };
@@ -93,5 +100,6 @@ void tut_mesh_set_geometry(the_mesh mesh, enum tut_geometry geo);
 
 // Environment maps
 void tut_env_load(const char *path, the_tex *lut, the_tex *sky, the_tex *irr, the_tex *pref);
+void tut_env_load_async(const char *path, the_tex *lut, the_tex *sky, the_tex *irr, the_tex *pref);
 
 #endif // THE_UTILS_H
@@ -0,0 +1,220 @@
+#include "watch.h"
+
+#include "common.h"
+#include "io.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_PATH_MAX 256
+
+struct the_watch_entry {
+	char path[WATCH_PATH_MAX];
+	int name; // Offset of the file name inside path.
+	int dir;
+	the_watch_fn fn;
+	int handle;
+	int pending;
+};
+
+struct the_watch_dir {
+	char path[WATCH_PATH_MAX];
+	int wd;
+};
+
+typedef struct the_watch_entry thewatch;
+THE_DECL_ARR(thewatch);
+THE_IMPL_ARR(thewatch);
+
+typedef struct the_watch_dir thewatchdir;
+THE_DECL_ARR(thewatchdir);
+THE_IMPL_ARR(thewatchdir);
+
+static struct thearr_thewatch *entries = NULL;
+static struct thearr_thewatchdir *dirs = NULL;
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static volatile int running = 0;
+static int fd = -1;
+
+static void
+the__watch_dir(struct the_watch_dir *d)
+{
+	d->wd = inotify_add_watch(fd, d->path, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (d->wd < 0) {
+		THE_LOG_WARN("Could not watch directory %s.", d->path);
+	}
+}
+
+static void *
+the__watch_worker(void *data)
+{
+	(void)data;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	while (running) {
+		if (poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+
+		ssize_t len = read(fd, buf, sizeof(buf));
+		for (char *p = buf; len > 0 && p < buf + len;) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			p += sizeof(struct inotify_event) + ev->len;
+			if (!ev->len) {
+				continue;
+			}
+
+			pthread_mutex_lock(&mtx);
+			for (int i = 0; entries && i < entries->count; ++i) {
+				struct the_watch_entry *e = &entries->at[i];
+				if (dirs->at[e->dir].wd == ev->wd && !strcmp(e->path + e->name, ev->name)) {
+					e->pending = 1;
+					the_invalidate();
+				}
+			}
+			pthread_mutex_unlock(&mtx);
+		}
+	}
+	return NULL;
+}
+
+int
+the_watch_init(void)
+{
+	if (running) {
+		return THE_OK;
+	}
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		THE_LOG_ERR("inotify init failed.");
+		return THE_ERR;
+	}
+
+	pthread_mutex_lock(&mtx);
+	for (int i = 0; dirs && i < dirs->count; ++i) {
+		the__watch_dir(&dirs->at[i]);
+	}
+	pthread_mutex_unlock(&mtx);
+
+	running = 1;
+	if (pthread_create(&thread, NULL, the__watch_worker, NULL)) {
+		THE_LOG_ERR("Thread creation error.");
+		running = 0;
+		close(fd);
+		fd = -1;
+		return THE_ERR_THREAD;
+	}
+	return THE_OK;
+}
+
+int
+the_watch_add(const char *path, the_watch_fn fn, int handle)
+{
+	if (strlen(path) >= WATCH_PATH_MAX) {
+		THE_LOG_WARN("Path too long to be watched: %s", path);
+		return THE_ERR;
+	}
+
+	const char *slash = strrchr(path, '/');
+	int name = slash ? (int)(slash - path) + 1 : 0;
+
+	pthread_mutex_lock(&mtx);
+	for (int i = 0; entries && i < entries->count; ++i) {
+		struct the_watch_entry *e = &entries->at[i];
+		if (e->fn == fn && e->handle == handle && !strcmp(e->path, path)) {
+			pthread_mutex_unlock(&mtx);
+			return THE_OK;
+		}
+	}
+
+	char dir[WATCH_PATH_MAX] = ".";
+	if (name) {
+		memcpy(dir, path, name - 1);
+		dir[name - 1] = '\0';
+	}
+
+	int d = 0;
+	while (dirs && d < dirs->count && strcmp(dirs->at[d].path, dir)) {
+		++d;
+	}
+
+	if (!dirs || d == dirs->count) {
+		struct the_watch_dir *nd = thearr_thewatchdir_push(&dirs);
+		strcpy(nd->path, dir);
+		nd->wd = -1;
+		if (running) {
+			the__watch_dir(nd);
+		}
+	}
+
+	struct the_watch_entry *e = thearr_thewatch_push(&entries);
+	strcpy(e->path, path);
+	e->name = name;
+	e->dir = d;
+	e->fn = fn;
+	e->handle = handle;
+	e->pending = 0;
+	pthread_mutex_unlock(&mtx);
+	return THE_OK;
+}
+
+void
+the_watch_remove(the_watch_fn fn, int handle)
+{
+	pthread_mutex_lock(&mtx);
+	for (int i = 0; entries && i < entries->count;) {
+		if (entries->at[i].fn == fn && entries->at[i].handle == handle) {
+			entries->at[i] = entries->at[--entries->count];
+		} else {
+			++i;
+		}
+	}
+	pthread_mutex_unlock(&mtx);
+}
+
+void
+the_watch_poll(void)
+{
+	if (!running) {
+		return;
+	}
+
+	/* Callbacks run unlocked (they are allowed to add watches). */
+	for (int i = 0;; ++i) {
+		pthread_mutex_lock(&mtx);
+		while (entries && i < entries->count && !entries->at[i].pending) {
+			++i;
+		}
+
+		if (!entries || i >= entries->count) {
+			pthread_mutex_unlock(&mtx);
+			break;
+		}
+
+		struct the_watch_entry e = entries->at[i];
+		entries->at[i].pending = 0;
+		pthread_mutex_unlock(&mtx);
+		e.fn(e.path, e.handle);
+	}
+}
+
+void
+the_watch_shutdown(void)
+{
+	if (!running) {
+		return;
+	}
+	running = 0;
+	pthread_join(thread, NULL);
+	close(fd);
+	fd = -1;
+	for (int i = 0; dirs && i < dirs->count; ++i) {
+		dirs->at[i].wd = -1;
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef THE_CORE_WATCH_H
+#define THE_CORE_WATCH_H
+
+/*
+ * File change notifications (inotify).
+ * - the_watch_add maps a file to a callback + handle. Thread safe, can be called before
+ *     the_watch_init (the file is watched once the watcher starts).
+ * - The watcher thread only flags changed entries, callbacks run inside the_watch_poll
+ *     on the calling thread. Several writes between polls trigger a single callback.
+ */
+typedef void (*the_watch_fn)(const char *path, int handle);
+
+int the_watch_init(void);
+int the_watch_add(const char *path, the_watch_fn fn, int handle);
+/* Stops every watch of fn + handle, e.g. before the handle is released and reused. */
+void the_watch_remove(the_watch_fn fn, int handle);
+void the_watch_poll(void);
+void the_watch_shutdown(void);
+
+#endif // THE_CORE_WATCH_H
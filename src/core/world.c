@@ -0,0 +1,318 @@
+#include "world.h"
+
+#include "common.h"
+#include "log.h"
+#include "mem.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct the__world_candidate {
+	float dist;
+	int cell;
+};
+
+static int
+the__world_candidate_cmp(const void *a, const void *b)
+{
+	float da = ((const struct the__world_candidate *)a)->dist;
+	float db = ((const struct the__world_candidate *)b)->dist;
+	return (da > db) - (da < db);
+}
+
+static float
+the__world_dist(const struct the_world *w, int cell, struct the_vec3 eye)
+{
+	const struct the_world_desc *d = &w->desc;
+	float cx = d->origin.x + ((float)(cell % d->cells_x) + 0.5f) * d->cell_size;
+	float cz = d->origin.z + ((float)(cell / d->cells_x) + 0.5f) * d->cell_size;
+	return sqrtf((cx - eye.x) * (cx - eye.x) + (cz - eye.z) * (cz - eye.z));
+}
+
+void
+the_world_init(struct the_world *w, const struct the_world_desc *desc, the_node root)
+{
+	THE_ASSERT(desc->cells_x > 0 && desc->cells_z > 0 && desc->cell_size > 0.0f && "Empty world");
+	THE_ASSERT(desc->unload_radius >= desc->load_radius && "Unload radius inside the load radius");
+	memset(w, 0, sizeof(*w));
+	w->desc = *desc;
+	w->root = root;
+	int count = desc->cells_x * desc->cells_z;
+	w->cells = the_calloc(count, sizeof(*w->cells));
+	w->active = the_alloc(count * sizeof(*w->active));
+}
+
+int
+the_world_asset(struct the_world *w, enum the_world_asset_type type, const char *path, const struct the_texture_desc *desc, size_t bytes)
+{
+	THE_ASSERT((type == THE_WORLD_MESH || desc) && "Textures need a desc");
+	if (w->asset_count == w->asset_cap) {
+		w->asset_cap = w->asset_cap ? w->asset_cap * 2 : 16;
+		w->assets = the_realloc(w->assets, w->asset_cap * sizeof(*w->assets));
+	}
+	struct the_world_asset *a = &w->assets[w->asset_count];
+	memset(a, 0, sizeof(*a));
+	a->path = path;
+	a->type = type;
+	if (desc) {
+		a->desc = *desc;
+	}
+	if (!bytes) {
+		bytes = type == THE_WORLD_MESH ? the_mesh_file_bytes(path) : the_tex_file_bytes(path, desc);
+	}
+	a->bytes = bytes;
+	a->handle = THE_NONE;
+	return w->asset_count++;
+}
+
+void
+the_world_cell(struct the_world *w, int x, int z, const char *scene, const int *assets, int asset_count)
+{
+	THE_ASSERT(x >= 0 && x < w->desc.cells_x && z >= 0 && z < w->desc.cells_z && "Cell out of the grid");
+	struct the_world_cell *c = &w->cells[z * w->desc.cells_x + x];
+	THE_ASSERT(c->state == THE_CELL_UNLOADED && "Cell in use");
+	the_free(c->assets);
+	c->scene = scene;
+	c->assets = the_alloc((asset_count ? asset_count : 1) * sizeof(*c->assets));
+	memcpy(c->assets, assets, asset_count * sizeof(*assets));
+	c->asset_count = asset_count;
+	for (int i = 0; i < asset_count; ++i) {
+		THE_ASSERT(assets[i] >= 0 && assets[i] < w->asset_count && "Unknown asset");
+	}
+}
+
+static void
+the__world_asset_acquire(struct the_world *w, int index)
+{
+	struct the_world_asset *a = &w->assets[index];
+	if (a->users++) {
+		return;
+	}
+	w->resident[a->type] += a->bytes;
+	if (a->type == THE_WORLD_MESH) {
+		a->handle = the_mesh_create();
+		the_mesh_load_async(a->handle, a->path);
+	} else {
+		a->handle = the_tex_create();
+		the_tex_load_async(a->handle, &a->desc, a->path);
+	}
+}
+
+static void
+the__world_asset_drop(struct the_world *w, int index)
+{
+	struct the_world_asset *a = &w->assets[index];
+	THE_ASSERT(a->users > 0 && "Asset not in use");
+	if (--a->users) {
+		return;
+	}
+	w->resident[a->type] -= a->bytes;
+	if (a->type == THE_WORLD_MESH) {
+		the_mesh_release(a->handle);
+	} else {
+		the_tex_release(a->handle);
+	}
+	a->handle = THE_NONE;
+}
+
+/* Bytes of the assets of a cell that are not resident yet, by type. */
+static void
+the__world_cell_cost(const struct the_world *w, const struct the_world_cell *c, size_t cost[THE_WORLD_ASSET_TYPES])
+{
+	memset(cost, 0, THE_WORLD_ASSET_TYPES * sizeof(*cost));
+	for (int i = 0; i < c->asset_count; ++i) {
+		const struct the_world_asset *a = &w->assets[c->assets[i]];
+		if (!a->users) {
+			cost[a->type] += a->bytes;
+		}
+	}
+}
+
+static bool
+the__world_fits(const struct the_world *w, const size_t cost[THE_WORLD_ASSET_TYPES])
+{
+	for (int t = 0; t < THE_WORLD_ASSET_TYPES; ++t) {
+		if (w->desc.budget[t] && w->resident[t] + cost[t] > w->desc.budget[t]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+the__world_unload(struct the_world *w, int cell)
+{
+	struct the_world_cell *c = &w->cells[cell];
+	if (c->state == THE_CELL_LOADED) {
+		the_entity_remove(c->root);
+		the_scene_release(&c->file);
+	}
+	for (int i = 0; i < c->asset_count; ++i) {
+		the__world_asset_drop(w, c->assets[i]);
+	}
+	c->state = THE_CELL_UNLOADED;
+	for (int i = 0; i < w->active_count; ++i) {
+		if (w->active[i] == cell) {
+			w->active[i] = w->active[--w->active_count];
+			break;
+		}
+	}
+}
+
+/* Adds the entities of a cell whose assets landed. Returns false if it is still waiting. */
+static bool
+the__world_finish(struct the_world *w, int cell)
+{
+	struct the_world_cell *c = &w->cells[cell];
+	for (int i = 0; i < c->asset_count; ++i) {
+		const struct the_world_asset *a = &w->assets[c->assets[i]];
+		if (a->type == THE_WORLD_MESH ? !the_mesh_ready(a->handle) : !the_tex_ready(a->handle)) {
+			return false;
+		}
+	}
+
+	/* Measured sizes replace the estimates in the resident counts. */
+	int mesh_count = 0;
+	for (int i = 0; i < c->asset_count; ++i) {
+		struct the_world_asset *a = &w->assets[c->assets[i]];
+		mesh_count += a->type == THE_WORLD_MESH;
+		if (!a->measured) {
+			size_t bytes = a->type == THE_WORLD_MESH ? the_mesh_bytes(a->handle) : the_tex_bytes(a->handle);
+			w->resident[a->type] += bytes - a->bytes;
+			a->bytes = bytes;
+			a->measured = true;
+		}
+	}
+
+	struct the_scene_ref *refs = the_alloc((c->asset_count ? c->asset_count : 1) * sizeof(*refs));
+	struct the_scene_refs r = { .meshes = refs, .texs = refs + mesh_count };
+	int broken = 0;
+	for (int i = 0; i < c->asset_count; ++i) {
+		const struct the_world_asset *a = &w->assets[c->assets[i]];
+		struct the_scene_ref ref = { a->path, a->handle };
+		if (a->type == THE_WORLD_MESH) {
+			broken += !a->bytes; // Failed to load, drawing it would assert.
+			refs[r.mesh_count++] = ref;
+		} else {
+			refs[mesh_count + r.tex_count++] = ref;
+		}
+	}
+
+	c->root = the_graph_add(&scene_graph, w->root);
+	struct the_trs *local = the_graph_local(&scene_graph, c->root);
+	local->pos = (struct the_vec3){
+		w->desc.origin.x + (float)(cell % w->desc.cells_x) * w->desc.cell_size,
+		w->desc.origin.y,
+		w->desc.origin.z + (float)(cell / w->desc.cells_x) * w->desc.cell_size,
+	};
+	if (broken || the_scene_load(&c->file, c->scene, c->root, &r) != THE_OK) {
+		THE_LOG_ERR("World cell %d (%s) failed to load", cell, c->scene);
+		the_graph_remove(&scene_graph, c->root);
+		the__world_unload(w, cell);
+		c->state = THE_CELL_FAILED;
+	} else {
+		c->state = THE_CELL_LOADED;
+	}
+	the_free(refs);
+	return true;
+}
+
+void
+the_world_update(struct the_world *w, struct the_vec3 eye)
+{
+	const struct the_world_desc *d = &w->desc;
+
+	/* Out of range first, their memory is then available to the new cells. */
+	for (int i = 0; i < w->active_count;) {
+		int cell = w->active[i];
+		if (the__world_dist(w, cell, eye) > d->unload_radius) {
+			the__world_unload(w, cell); // Moves the last active cell to i.
+			continue;
+		}
+		if (w->cells[cell].state == THE_CELL_LOADING && the__world_finish(w, cell) &&
+		    w->cells[cell].state == THE_CELL_FAILED) {
+			continue; // Removed from the active list.
+		}
+		++i;
+	}
+
+	/* Unloaded cells whose center is in range, nearest first. */
+	int x0 = (int)floorf((eye.x - d->origin.x - d->load_radius) / d->cell_size);
+	int x1 = (int)floorf((eye.x - d->origin.x + d->load_radius) / d->cell_size);
+	int z0 = (int)floorf((eye.z - d->origin.z - d->load_radius) / d->cell_size);
+	int z1 = (int)floorf((eye.z - d->origin.z + d->load_radius) / d->cell_size);
+	x0 = x0 < 0 ? 0 : x0;
+	z0 = z0 < 0 ? 0 : z0;
+	x1 = x1 >= d->cells_x ? d->cells_x - 1 : x1;
+	z1 = z1 >= d->cells_z ? d->cells_z - 1 : z1;
+	if (x0 > x1 || z0 > z1) {
+		return;
+	}
+
+	struct the__world_candidate *cand = the_alloc((size_t)(x1 - x0 + 1) * (z1 - z0 + 1) * sizeof(*cand));
+	int cand_count = 0;
+	for (int z = z0; z <= z1; ++z) {
+		for (int x = x0; x <= x1; ++x) {
+			int cell = z * d->cells_x + x;
+			const struct the_world_cell *c = &w->cells[cell];
+			float dist = the__world_dist(w, cell, eye);
+			if (c->scene && c->state == THE_CELL_UNLOADED && dist < d->load_radius) {
+				cand[cand_count++] = (struct the__world_candidate){ dist, cell };
+			}
+		}
+	}
+	qsort(cand, cand_count, sizeof(*cand), the__world_candidate_cmp);
+
+	int started = 0;
+	for (int i = 0; i < cand_count && (!d->max_loads || started < d->max_loads); ++i) {
+		struct the_world_cell *c = &w->cells[cand[i].cell];
+		size_t cost[THE_WORLD_ASSET_TYPES];
+		the__world_cell_cost(w, c, cost);
+
+		/* Over budget: give up the farthest cells kept by the hysteresis, one at a time. */
+		while (!the__world_fits(w, cost)) {
+			int far = -1;
+			float far_dist = d->load_radius;
+			for (int a = 0; a < w->active_count; ++a) {
+				float dist = the__world_dist(w, w->active[a], eye);
+				if (dist >= far_dist) {
+					far = w->active[a];
+					far_dist = dist;
+				}
+			}
+			if (far < 0) {
+				break;
+			}
+			the__world_unload(w, far);
+			the__world_cell_cost(w, c, cost); // Shared assets may have gone too.
+		}
+		if (!the__world_fits(w, cost)) {
+			continue; // A smaller cell further away may still fit.
+		}
+
+		for (int a = 0; a < c->asset_count; ++a) {
+			the__world_asset_acquire(w, c->assets[a]);
+		}
+		c->state = THE_CELL_LOADING;
+		w->active[w->active_count++] = cand[i].cell;
+		++started;
+	}
+	the_free(cand);
+}
+
+void
+the_world_release(struct the_world *w)
+{
+	while (w->active_count) {
+		the__world_unload(w, w->active[0]);
+	}
+	int count = w->desc.cells_x * w->desc.cells_z;
+	for (int i = 0; i < count; ++i) {
+		the_free(w->cells[i].assets);
+	}
+	the_free(w->cells);
+	the_free(w->active);
+	the_free(w->assets);
+	memset(w, 0, sizeof(*w));
+}
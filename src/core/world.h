@@ -0,0 +1,95 @@
+#ifndef THE_CORE_WORLD_H
+#define THE_CORE_WORLD_H
+
+#include "scene.h"
+
+#include <stddef.h>
+
+/*
+ * World partition: a grid of square cells on the xz plane, each one a scene file
+ * (the_scene_load) and the meshes and textures it references, streamed around a point.
+ * - Cells closer than load_radius (from the eye to the cell center, on the xz plane) are
+ *     loaded, nearest first, and unloaded once farther than unload_radius. In between they
+ *     keep their state, so a camera moving along a border does not reload them.
+ * - Assets are shared by the cells that list them and loaded once, through the async
+ *     path (the_tex_load_async, the_mesh_load_async). The entities of a cell are added
+ *     when all of its assets have landed, under a node placed at the cell corner.
+ * - Resident bytes are tracked per asset type against a budget: a cell is not started if
+ *     its new assets do not fit, after unloading the loaded cells farther than load_radius.
+ *     Asset sizes are the given estimates until they land, then the measured ones.
+ * - Unloading removes the entities, unmaps the scene file and releases the assets no other
+ *     cell uses (the_tex_release, the_mesh_release): CPU and GPU memory go back.
+ */
+enum the_world_asset_type { THE_WORLD_MESH = 0, THE_WORLD_TEX, THE_WORLD_ASSET_TYPES };
+
+enum the_world_cell_state {
+	THE_CELL_UNLOADED = 0,
+	THE_CELL_LOADING, // Waiting for its assets.
+	THE_CELL_LOADED,
+	THE_CELL_FAILED, // Not retried.
+};
+
+struct the_world_desc {
+	struct the_vec3 origin; // Corner of cell (0, 0), cells extend along +x and +z.
+	float cell_size;
+	int cells_x;
+	int cells_z;
+	float load_radius;
+	float unload_radius; // Bigger than load_radius.
+	size_t budget[THE_WORLD_ASSET_TYPES]; // Resident bytes by asset type, 0: no limit.
+	int max_loads; // Cells started per update, 0: no limit.
+};
+
+struct the_world_asset {
+	const char *path; // Also its name in the scene files.
+	enum the_world_asset_type type;
+	struct the_texture_desc desc; // Textures.
+	size_t bytes; // Estimate until loaded, then measured.
+	the_resource_handle handle; // THE_NONE while not resident.
+	int users; // Cells loading or loaded that list it.
+	bool measured;
+};
+
+struct the_world_cell {
+	const char *scene; // NULL: empty cell.
+	int *assets; // Indices in the_world.assets.
+	int asset_count;
+	enum the_world_cell_state state;
+	the_node root; // Parent of the cell entities while loaded.
+	struct the_scene file;
+};
+
+struct the_world {
+	struct the_world_desc desc;
+	struct the_world_cell *cells; // cells_x * cells_z, row major along x.
+	struct the_world_asset *assets;
+	int asset_count;
+	int asset_cap;
+	int *active; // Cells loading or loaded.
+	int active_count;
+	size_t resident[THE_WORLD_ASSET_TYPES]; // Bytes of the assets in use.
+	the_node root;
+};
+
+/* Empty grid, cell roots are added under root (a scene_graph node or THE_NODE_NONE). */
+void the_world_init(struct the_world *w, const struct the_world_desc *desc, the_node root);
+/* Unloads every cell and frees the grid. */
+void the_world_release(struct the_world *w);
+
+/*
+ * Registers an asset and returns its index. path is kept, not copied. desc is only read
+ * for textures (NULL for meshes). bytes is the size estimate used before it loads, 0 reads
+ * it from the file (header of images, size of meshes).
+ */
+int the_world_asset(struct the_world *w, enum the_world_asset_type type, const char *path, const struct the_texture_desc *desc, size_t bytes);
+/* Scene file and assets of cell (x, z). The scene path is kept, the asset list copied. */
+void the_world_cell(struct the_world *w, int x, int z, const char *scene, const int *assets, int asset_count);
+
+/*
+ * Streams the cells around eye: finishes the loads whose assets landed, unloads the cells
+ * out of unload_radius and starts the ones in load_radius that fit the budgets. Call it
+ * once per frame after the_hotreload_poll and before the_entity_bvh_update.
+ */
+void the_world_update(struct the_world *w, struct the_vec3 eye);
+
+#endif // THE_CORE_WORLD_H
@@ -1,10 +1,16 @@
 #include "pixels.h"
 
 #include "core/io.h"
+#include "core/lz.h"
 #include "core/mem.h"
+#include "core/prefetch.h"
+#include "core/sched.h"
+#include "core/watch.h"
 #include "render/pixels_internal.h"
 
+#include <float.h>
 #include <mathc.h>
+#include <pthread.h>
 
 #ifndef STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
@@ -62,6 +68,14 @@ struct thepool_fb framebuffer_pool = { .buf = NULL, .count = 0, .next = 0 };
 
 static struct the_mem *circbuf = NULL;
 
+static const char *shader_uniforms[] = {
+	"u_data", "u_tex", "u_cube", "u_shared_data", "u_common_tex", "u_common_cube"
+};
+
+static void the__tex_changed(const char *path, int tex);
+static void the__mesh_changed(const char *path, int mesh);
+static void the__shader_changed(const char *path, int shader);
+
 void
 the_falloc_set_buffer(void *buffer, ptrdiff_t size)
 {
@@ -130,6 +144,7 @@ static int
 the__tex_channels(the_texture_format fmt)
 {
 	switch (fmt) {
+	case THE_TEX_FMT_RGBA32F:
 	case THE_TEX_FMT_RGBA16F:
 	case THE_TEX_FMT_RGBA8: return 4;
 	case THE_TEX_FMT_RGB16F:
@@ -162,6 +177,19 @@ the__tex_is_float(the_texture_format fmt)
 	case THE_TEX_FMT_RGBA16F:
 	case THE_TEX_FMT_RGB16F:
 	case THE_TEX_FMT_RGB32F:
+	case THE_TEX_FMT_RGBA32F:
+	case THE_TEX_FMT_RG16F:
+	case THE_TEX_FMT_R16F: return true;
+	default: return false;
+	}
+}
+
+static bool
+the__tex_is_half(the_texture_format fmt)
+{
+	switch (fmt) {
+	case THE_TEX_FMT_RGBA16F:
+	case THE_TEX_FMT_RGB16F:
 	case THE_TEX_FMT_RG16F:
 	case THE_TEX_FMT_R16F: return true;
 	default: return false;
@@ -187,20 +215,17 @@ the_tex_create(void)
 		.border_color = { 1.0f, 1.0f, 1.0f, 1.0f }
 	};
 	tex_pool.buf->at[tex].img = NULL;
+	tex_pool.buf->at[tex].loading = 0;
 	return tex;
 }
 
-void
-the_tex_load(the_tex texture, struct the_texture_desc *desc, const char *path)
+/* Decodes path into t->img, only reads t->data (format, flags and type). */
+static void
+the__tex_decode(tex *t, const char *path)
 {
-	THE_ASSERT(*path != '\0' && "For empty textures use the_tex_set");
-	tex *t = &tex_pool.buf->at[texture];
-	t->res.id = 0;
-	t->res.flags = THE_IRF_DIRTY;
-	t->data = *desc;
-
 	int fmt_ch = the__tex_channels(t->data.fmt);
-	stbi_set_flip_vertically_on_load(t->data.flags & THE_TEX_FLAG_FLIP_VERTICALLY_ON_LOAD);
+	/* Per thread: decodes run on the loader workers at the same time. */
+	stbi_set_flip_vertically_on_load_thread(t->data.flags & THE_TEX_FLAG_FLIP_VERTICALLY_ON_LOAD);
 
 	int channels = 0;
 	int face_count = the__tex_faces(t->data.type);
@@ -217,17 +242,42 @@ the_tex_load(the_tex texture, struct the_texture_desc *desc, const char *path)
 
 		if (!img->pix) {
 			THE_LOG_ERR("The image '%s' couldn't be loaded", p);
+		} else {
+			the_prefetch_record(p, 0, 0);
 		}
 	}
 }
 
+void
+the_tex_load(the_tex texture, struct the_texture_desc *desc, const char *path)
+{
+	THE_ASSERT(*path != '\0' && "For empty textures use the_tex_set");
+	tex *t = &tex_pool.buf->at[texture];
+	t->res.id = 0;
+	t->res.flags = THE_IRF_DIRTY;
+	t->data = *desc;
+	the__tex_decode(t, path);
+	the_invalidate();
+	if (the__tex_faces(t->data.type) == 1) {
+		the_watch_add(path, the__tex_changed, texture);
+	}
+}
+
 void
 the_tex_set(the_tex texture, struct the_texture_desc *desc)
 {
 	THE_ASSERT(desc->width > 0 && desc->height > 0 && "Incorrect dimensions");
 	tex *t = &tex_pool.buf->at[texture];
 	t->res.flags |= THE_IRF_DIRTY;
+	if (t->img && (t->data.width != desc->width || t->data.height != desc->height ||
+	               t->data.fmt != desc->fmt)) {
+		for (int i = 0; i < t->img->count; ++i) { // Sized for the old desc.
+			the_free(t->img->at[i].pix);
+			t->img->at[i].pix = NULL;
+		}
+	}
 	t->data = *desc;
+	the_invalidate();
 	if (!t->img) {
 		int face_count = the__tex_faces(t->data.type);
 		for (int i = 0; i < face_count; ++i) {
@@ -247,6 +297,70 @@ the_tex_size(the_tex tex)
 	};
 }
 
+size_t
+the_tex_bytes(the_tex texture)
+{
+	thepx__check_handle(texture, &tex_pool);
+	const tex *t = &tex_pool.buf->at[texture];
+	size_t texel = the__tex_channels(t->data.fmt) * (the__tex_is_float(t->data.fmt) ? sizeof(float) : 1);
+	return (size_t)t->data.width * t->data.height * texel * the__tex_faces(t->data.type);
+}
+
+size_t
+the_tex_file_bytes(const char *path, const struct the_texture_desc *desc)
+{
+	int w, h, comp;
+	if (!stbi_info(path, &w, &h, &comp)) {
+		return 0;
+	}
+	int channels = the__tex_channels(desc->fmt);
+	size_t texel = (channels ? channels : comp) * (the__tex_is_float(desc->fmt) ? sizeof(float) : 1);
+	return (size_t)w * h * texel * the__tex_faces(desc->type);
+}
+
+bool
+the_tex_ready(the_tex texture)
+{
+	thepx__check_handle(texture, &tex_pool);
+	return !tex_pool.buf->at[texture].loading;
+}
+
+void
+the_tex_release(the_tex texture)
+{
+	thepx__check_handle(texture, &tex_pool);
+	tex *t = &tex_pool.buf->at[texture];
+	THE_ASSERT(!(t->res.flags & THE_IRF_RELEASED) && "Texture released twice");
+	the_watch_remove(the__tex_changed, texture);
+	for (int i = 0; t->img && i < t->img->count; ++i) {
+		the_free(t->img->at[i].pix);
+	}
+	thearr_theteximg_release(t->img);
+	t->img = NULL;
+	if (t->res.flags & THE_IRF_CREATED) {
+		thepx_tex_release(&t->res.id);
+	}
+	t->res.flags = THE_IRF_RELEASED;
+	if (!t->loading) {
+		thepool_tex_rm(&tex_pool, texture);
+	}
+}
+
+void *
+the_tex_map(the_tex texture)
+{
+	thepx__check_handle(texture, &tex_pool);
+	tex *t = &tex_pool.buf->at[texture];
+	THE_ASSERT(t->img && t->img->count == 1 && "Only 2D textures set with the_tex_set can be mapped");
+	struct the_texture_image *img = &t->img->at[0];
+	if (!img->pix) {
+		size_t texel = the__tex_channels(t->data.fmt) * (the__tex_is_float(t->data.fmt) ? sizeof(float) : 1);
+		img->pix = the_alloc(t->data.width * t->data.height * texel);
+	}
+	t->res.flags |= THE_IRF_DIRTY;
+	return img->pix;
+}
+
 the_shader
 the_shader_create(const struct the_shader_desc *desc)
 {
@@ -260,12 +374,59 @@ the_shader_create(const struct the_shader_desc *desc)
 	shader_pool.buf->at[ret].count[1].data = desc->shared_data_count;
 	shader_pool.buf->at[ret].count[1].tex = desc->common_tex_count;
 	shader_pool.buf->at[ret].count[1].cubemap = desc->common_cubemap_count;
+	shader_pool.buf->at[ret].instanced = THE_NONE;
 	shader_pool.buf->at[ret].common = the_alloc(
 	  (desc->shared_data_count + desc->common_tex_count + desc->common_cubemap_count) *
 	  sizeof(float));
+
+	char (*src)[256] = shader_pool.buf->at[ret].src_path;
+	if (desc->vert_path) {
+		snprintf(src[0], sizeof(src[0]), "%s", desc->vert_path);
+	} else {
+		snprintf(src[0], sizeof(src[0]), "assets/shaders/%s-vert.glsl", desc->name);
+	}
+	if (desc->frag_path) {
+		snprintf(src[1], sizeof(src[1]), "%s", desc->frag_path);
+	} else {
+		snprintf(src[1], sizeof(src[1]), "assets/shaders/%s-frag.glsl", desc->name);
+	}
+	the_watch_add(src[0], the__shader_changed, ret);
+	the_watch_add(src[1], the__shader_changed, ret);
 	return ret;
 }
 
+const char *
+the_shader_name(the_shader shader)
+{
+	thepx__check_handle(shader, &shader_pool);
+	return shader_pool.buf->at[shader].name;
+}
+
+the_shader
+the_shader_find(const char *name)
+{
+	for (int i = 0; shader_pool.buf && i < shader_pool.buf->count; ++i) {
+		const char *n = shader_pool.buf->at[i].name;
+		if (n && !strcmp(n, name)) {
+			return i;
+		}
+	}
+	return THE_NONE;
+}
+
+void
+the_shader_instanced(the_shader shader, the_shader variant)
+{
+	thepx__check_handle(shader, &shader_pool);
+	thepx__check_handle(variant, &shader_pool);
+	shad *s = &shader_pool.buf->at[shader];
+	THE_ASSERT(!memcmp(s->count, shader_pool.buf->at[variant].count, sizeof(s->count)) &&
+	           "Variant of another layout");
+	THE_ASSERT(s->count[0].data % 4 == 0 && s->count[0].data <= THE_INSTANCE_MAX_FLOATS &&
+	           "Unit data does not fit the instance attributes");
+	s->instanced = variant;
+}
+
 void *
 the_shader_data(the_shader shader)
 {
@@ -290,6 +451,7 @@ void
 the_shader_reload(the_shader shader)
 {
 	shader_pool.buf->at[shader].res.flags |= THE_IRF_DIRTY;
+	the_invalidate();
 }
 
 static the_idx
@@ -306,6 +468,128 @@ check_vertex(const float *v, const float *end, const float *newvtx)
 	return i;
 }
 
+static const struct the_bounds the__bounds_infinite = {
+	.min = { -FLT_MAX, -FLT_MAX, -FLT_MAX },
+	.max = { FLT_MAX, FLT_MAX, FLT_MAX },
+	.sphere = { 0.0f, 0.0f, 0.0f, FLT_MAX },
+};
+
+void
+the_mesh_calc_bounds(struct the_mesh_internal *mesh)
+{
+	static const int attrib_floats[THE_VA_COUNT] = { 3, 3, 3, 3, 2, 4, 4 };
+	int stride = 0;
+	for (int i = 0; i < THE_VA_COUNT; ++i) {
+		if (mesh->attrib & (1 << i)) {
+			stride += attrib_floats[i];
+		}
+	}
+
+	if (!mesh->vtx || !mesh->idx || !mesh->elem_count || !(mesh->attrib & (1 << THE_VA_POS))) {
+		mesh->bounds = the__bounds_infinite;
+		return;
+	}
+
+	/* Through the indices: the obj loader over-allocates the vertex buffer. */
+	float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int64_t i = 0; i < mesh->elem_count; ++i) {
+		const float *p = mesh->vtx + mesh->idx[i] * stride;
+		for (int j = 0; j < 3; ++j) {
+			min[j] = p[j] < min[j] ? p[j] : min[j];
+			max[j] = p[j] > max[j] ? p[j] : max[j];
+		}
+	}
+
+	/* Sphere around the box center, radius from the farthest vertex (tighter than the box). */
+	float c[3] = { (min[0] + max[0]) * 0.5f, (min[1] + max[1]) * 0.5f, (min[2] + max[2]) * 0.5f };
+	float r2 = 0.0f;
+	for (int64_t i = 0; i < mesh->elem_count; ++i) {
+		const float *p = mesh->vtx + mesh->idx[i] * stride;
+		float d[3] = { p[0] - c[0], p[1] - c[1], p[2] - c[2] };
+		float l2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+		r2 = l2 > r2 ? l2 : r2;
+	}
+
+	mesh->bounds.min = (struct the_vec3){ min[0], min[1], min[2] };
+	mesh->bounds.max = (struct the_vec3){ max[0], max[1], max[2] };
+	mesh->bounds.sphere = (struct the_vec4){ c[0], c[1], c[2], sqrtf(r2) };
+}
+
+struct the_bounds
+the_mesh_bounds(the_mesh msh)
+{
+	thepx__check_handle(msh, &mesh_pool);
+	return mesh_pool.buf->at[msh].bounds;
+}
+
+int
+the_mesh_lods(the_mesh msh, struct the_mesh_lod lods[THE_MESH_MAX_LODS])
+{
+	thepx__check_handle(msh, &mesh_pool);
+	const mesh *m = &mesh_pool.buf->at[msh];
+	if (!m->lod_count) {
+		lods[0] = (struct the_mesh_lod){ .first = 0, .count = m->elem_count, .error = 0.0f };
+		return 1;
+	}
+	memcpy(lods, m->lods, m->lod_count * sizeof(*lods));
+	return m->lod_count;
+}
+
+size_t
+the_mesh_bytes(the_mesh msh)
+{
+	thepx__check_handle(msh, &mesh_pool);
+	const mesh *m = &mesh_pool.buf->at[msh];
+	return m->vtx_size + m->elem_count * sizeof(the_idx);
+}
+
+size_t
+the_mesh_file_bytes(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return 0;
+	}
+	struct the_lz_header hdr;
+	size_t read = fread(&hdr, 1, sizeof(hdr), f);
+	long size = fseek(f, 0, SEEK_END) ? 0 : ftell(f);
+	fclose(f);
+	if (the_lz_is_packed(&hdr, read)) {
+		return hdr.raw_size;
+	}
+	return size > 0 ? (size_t)size : 0;
+}
+
+bool
+the_mesh_ready(the_mesh msh)
+{
+	thepx__check_handle(msh, &mesh_pool);
+	return !mesh_pool.buf->at[msh].loading;
+}
+
+void
+the_mesh_release(the_mesh msh)
+{
+	thepx__check_handle(msh, &mesh_pool);
+	mesh *m = &mesh_pool.buf->at[msh];
+	THE_ASSERT(!(m->res.flags & THE_IRF_RELEASED) && "Mesh released twice");
+	the_watch_remove(the__mesh_changed, msh);
+	the_free(m->vtx);
+	the_free(m->idx);
+	m->vtx = NULL;
+	m->idx = NULL;
+	m->vtx_size = 0;
+	m->elem_count = 0;
+	if (m->res.flags & THE_IRF_CREATED) {
+		thepx_mesh_release(&m->res.id, &m->res_vb.id, &m->res_ib.id);
+	}
+	m->res.flags = THE_IRF_RELEASED;
+	if (!m->loading) {
+		thepool_mesh_rm(&mesh_pool, msh);
+	}
+}
+
 static void
 the__mesh_set_obj(mesh *mesh, const char *path)
 {
@@ -440,6 +724,8 @@ the__mesh_set_obj(mesh *mesh, const char *path)
 	tinyobj_attrib_free(&attrib);
 	tinyobj_shapes_free(shapes, shape_count);
 	tinyobj_materials_free(mats, mats_count);
+	mesh->lod_count = 0;
+	the_mesh_calc_bounds(mesh);
 }
 
 static void
@@ -447,8 +733,7 @@ the__mesh_set_msh(mesh *mesh, const char *path)
 {
 	char *data;
 	size_t sz;
-	the__file_reader(NULL, path, 0, NULL, &data, &sz);
-	if (!data || !sz) {
+	if (the_lz_file_read(path, &data, &sz) != THE_OK || sz <= 2 * sizeof(size_t)) {
 		THE_LOG_ERR("Problem reading file %s", path);
 		return;
 	}
@@ -456,29 +741,74 @@ the__mesh_set_msh(mesh *mesh, const char *path)
 	the_free(mesh->vtx);
 	the_free(mesh->idx);
 
+	const char *p = data;
 	mesh->attrib = (1 << THE_VA_POS) | (1 << THE_VA_NORMAL) | (1 << THE_VA_TAN) |
 	  (1 << THE_VA_BITAN) | (1 << THE_VA_UV);
-	mesh->vtx_size = *(size_t *)data; // *(((size_t *)data)++)
-	data += sizeof(size_t);
+	size_t vtx_size;
+	memcpy(&vtx_size, p, sizeof(size_t));
+	mesh->vtx_size = vtx_size;
+	p += sizeof(size_t);
 	mesh->vtx = the_alloc(mesh->vtx_size);
-	memcpy(mesh->vtx, data, mesh->vtx_size);
-	data += mesh->vtx_size;
+	memcpy(mesh->vtx, p, mesh->vtx_size);
+	p += mesh->vtx_size;
 
-	mesh->elem_count = (*(size_t *)data) / sizeof(the_idx); // *(((size_t *)data)++)
-	data += sizeof(size_t);
+	size_t idx_size;
+	memcpy(&idx_size, p, sizeof(size_t));
+	p += sizeof(size_t);
+	mesh->elem_count = idx_size / sizeof(the_idx);
 	mesh->idx = the_alloc(mesh->elem_count * sizeof(the_idx));
-	memcpy(mesh->idx, data, mesh->elem_count * sizeof(the_idx));
+	memcpy(mesh->idx, p, mesh->elem_count * sizeof(the_idx));
+	p += idx_size;
+
+	/*
+	 * Optional tagged blocks after the indices (tools/tomesh):
+	 * - "TLOD", uint32 count and {uint32 first, uint32 count, float error} per level of
+	 *     detail, ranges of the index block (every level shares the vertices).
+	 * - "TATR", uint32 vertex attribute mask, for vertices other than the default 14 floats.
+	 */
+	mesh->lod_count = 0;
+	const char *end = data + sz - 1; // the_lz_file_read appends a '\0'.
+	while (end - p >= 8) {
+		uint32_t value;
+		memcpy(&value, p + 4, sizeof(uint32_t));
+		if (!memcmp(p, "TATR", 4)) {
+			mesh->attrib = value;
+			p += 8;
+		} else if (!memcmp(p, "TLOD", 4)) {
+			p += 8;
+			if (value > THE_MESH_MAX_LODS || (size_t)(end - p) < value * 12) {
+				THE_LOG_WARN("Invalid LOD table in %s, ignored.", path);
+				break;
+			}
+			uint32_t lod_count = value;
+			for (uint32_t i = 0; i < lod_count; ++i, p += 12) {
+				struct the_mesh_lod *lod = &mesh->lods[i];
+				memcpy(&lod->first, p, sizeof(uint32_t));
+				memcpy(&lod->count, p + 4, sizeof(uint32_t));
+				memcpy(&lod->error, p + 8, sizeof(float));
+				if ((int64_t)lod->first + lod->count > mesh->elem_count || !lod->count) {
+					THE_LOG_WARN("Invalid LOD table in %s, ignored.", path);
+					lod_count = 0;
+				}
+			}
+			mesh->lod_count = lod_count;
+		} else {
+			THE_LOG_WARN("Unknown block in %s, ignored.", path);
+			break;
+		}
+	}
 
-	the_free(data - mesh->vtx_size - (2 * sizeof(size_t)));
+	the_mesh_calc_bounds(mesh);
+
+	the_free(data);
 }
 
 void
-the_mesh_reload_file(the_mesh msh, const char *path)
+the_mesh_decode(mesh *m, const char *path)
 {
-	mesh *m = &mesh_pool.buf->at[msh];
 	size_t len = strlen(path);
 	const char *extension = path + len;
-	while (*--extension != '.') {}
+	while (extension > path && *--extension != '.') {}
 	extension++;
 	if (!strcmp(extension, "obj")) {
 		the__mesh_set_obj(m, path);
@@ -487,8 +817,16 @@ the_mesh_reload_file(the_mesh msh, const char *path)
 	} else {
 		THE_LOG_ERR("Extension (%s) of file %s not recognised.", extension, path);
 	}
+}
 
+void
+the_mesh_reload_file(the_mesh msh, const char *path)
+{
+	mesh *m = &mesh_pool.buf->at[msh];
+	the_mesh_decode(m, path);
 	m->res.flags |= THE_IRF_DIRTY;
+	the_invalidate();
+	the_watch_add(path, the__mesh_changed, msh);
 }
 
 static the_mesh
@@ -502,6 +840,9 @@ the__mesh_create(void)
 	mesh_pool.buf->at[mesh_handle].idx = NULL;
 	mesh_pool.buf->at[mesh_handle].vtx_size = 0;
 	mesh_pool.buf->at[mesh_handle].elem_count = 0;
+	mesh_pool.buf->at[mesh_handle].bounds = the__bounds_infinite;
+	mesh_pool.buf->at[mesh_handle].lod_count = 0;
+	mesh_pool.buf->at[mesh_handle].loading = 0;
 	mesh_pool.buf->at[mesh_handle].res_vb.id = 0;
 	mesh_pool.buf->at[mesh_handle].res_vb.flags = THE_IRF_DIRTY;
 	mesh_pool.buf->at[mesh_handle].res_ib.id = 0;
@@ -541,6 +882,7 @@ the_fb_set_target(the_framebuffer framebuffer, int index, struct the_texture_tar
 {
 	framebuffer_pool.buf->at[framebuffer].res.flags |= THE_IRF_DIRTY;
 	framebuffer_pool.buf->at[framebuffer].target[index] = target;
+	the_invalidate();
 }
 
 the_mat
@@ -585,6 +927,14 @@ the_mat_copy_shader(the_shader shader)
 	return ret;
 }
 
+size_t
+the_mat_size(the_shader shader)
+{
+	thepx__check_handle(shader, &shader_pool);
+	shad *s = &shader_pool.buf->at[shader];
+	return (s->count[0].data + s->count[0].tex + s->count[0].cubemap) * sizeof(float);
+}
+
 the_tex *
 the_mat_tex(the_mat mat)
 {
@@ -646,11 +996,13 @@ the__set_shader_data(shad *s, void *srcdata, int common)
 		return;
 	}
 
-	// change texture handle for texture internal id
+	// texture handles to internal ids, on the side: the same data may be set on several programs
 	the_tex *data_tex = (the_tex *)srcdata + dc;
+	int tex_id[THE_TEXUNIT_OFFSET_FOR_COMMON_SHADER_DATA];
+	THE_ASSERT(tc + cc <= THE_TEXUNIT_OFFSET_FOR_COMMON_SHADER_DATA && "Too many textures");
 	for (int i = 0; i < tc + cc; ++i) {
 		tex *itx = the__sync_gpu_tex(data_tex[i]);
-		data_tex[i] = (int)itx->res.id;
+		tex_id[i] = (int)itx->res.id;
 	}
 
 	// set opengl uniforms
@@ -659,21 +1011,17 @@ the__set_shader_data(shad *s, void *srcdata, int common)
 	}
 
 	if (tc) {
-		thepx_shader_set_tex(tl, data_tex, tc, tex_unit);
+		thepx_shader_set_tex(tl, tex_id, tc, tex_unit);
 	}
 
 	if (cc) {
-		thepx_shader_set_cube(cl, data_tex + tc, cc, tex_unit + tc);
+		thepx_shader_set_cube(cl, tex_id + tc, cc, tex_unit + tc);
 	}
 }
 
 void
 the__sync_shader(shad *s)
 {
-	static const char *uniforms[] = {
-		"u_data", "u_tex", "u_cube", "u_shared_data", "u_common_tex", "u_common_cube"
-	};
-
 	if (!(s->res.flags & THE_IRF_CREATED)) {
 		thepx_shader_create(&s->res.id);
 		s->res.flags |= THE_IRF_CREATED;
@@ -681,8 +1029,8 @@ the__sync_shader(shad *s)
 
 	if (s->res.flags & THE_IRF_DIRTY) {
 		THE_ASSERT(s->name && *s->name && "Shader name needed.");
-		thepx_shader_compile(s->res.id, s->name);
-		thepx_shader_loc(s->res.id, &s->loc[0].data, &uniforms[0], 6);
+		thepx_shader_compile(s->res.id, s->name, s->src_path[0], s->src_path[1]);
+		thepx_shader_loc(s->res.id, &s->loc[0].data, &shader_uniforms[0], 6);
 		s->res.flags &= ~THE_IRF_DIRTY;
 	}
 }
@@ -707,6 +1055,505 @@ the__fb_sync(the_framebuffer framebuffer)
 	}
 }
 
+/*
+ * Hot reload
+ * Watch callbacks run on the render thread (the_hotreload_poll) and schedule the decoding
+ * on the reload workers. Decoded data is queued back and swapped into the pools by the
+ * render thread, so workers never touch the resource pools.
+ */
+enum the__reload_type { THE__RELOAD_MESH, THE__RELOAD_TEX, THE__RELOAD_SHADER, THE__RELOAD_JOB };
+
+struct the__reload {
+	enum the__reload_type type;
+	int handle;
+	uint32_t program; // Shaders: new program being linked.
+	char path[256];
+	union {
+		mesh m;
+		tex t;
+		struct {
+			char *vert;
+			char *frag;
+			char frag_path[256]; // path holds the vertex source.
+		} src;
+		struct {
+			void (*load)(void *);
+			void (*done)(void *);
+			void *args;
+		} job;
+	} as;
+};
+
+typedef struct the__reload *thereload;
+THE_DECL_ARR(thereload);
+THE_IMPL_ARR(thereload);
+
+static thesched *reload_sched = NULL;
+static pthread_mutex_t reload_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct thearr_thereload *reload_done = NULL; // Decoded, waiting to be applied.
+static struct thearr_thereload *reload_link = NULL; // Shader programs waiting to link.
+static int reload_pending = 0; // Scheduled and not yet applied.
+
+static void
+the__reload_decode(void *arg)
+{
+	struct the__reload *r = arg;
+	size_t size;
+	switch (r->type) {
+	case THE__RELOAD_MESH: the_mesh_decode(&r->as.m, r->path); break;
+	case THE__RELOAD_TEX: the__tex_decode(&r->as.t, r->path); break;
+	case THE__RELOAD_SHADER:
+		if (the_file_read(r->path, &r->as.src.vert, &size) != THE_OK) {
+			r->as.src.vert = NULL;
+		}
+		if (the_file_read(r->as.src.frag_path, &r->as.src.frag, &size) != THE_OK) {
+			r->as.src.frag = NULL;
+		}
+		break;
+	case THE__RELOAD_JOB: r->as.job.load(r->as.job.args); break;
+	}
+
+	pthread_mutex_lock(&reload_mtx);
+	thearr_thereload_push_value(&reload_done, r);
+	pthread_mutex_unlock(&reload_mtx);
+	the_invalidate(); // Wake up an idle main loop to apply it.
+}
+
+static void
+the__reload_schedule(enum the__reload_type type, const char *path, int handle)
+{
+	if (!reload_sched) {
+		return;
+	}
+
+	struct the__reload *r = the_calloc(1, sizeof(*r));
+	r->type = type;
+	r->handle = handle;
+	snprintf(r->path, sizeof(r->path), "%s", path);
+	if (type == THE__RELOAD_TEX) {
+		r->as.t.data = tex_pool.buf->at[handle].data;
+		tex_pool.buf->at[handle].loading++;
+	} else if (type == THE__RELOAD_MESH) {
+		mesh_pool.buf->at[handle].loading++;
+	} else if (type == THE__RELOAD_SHADER) {
+		const shad *s = &shader_pool.buf->at[handle];
+		snprintf(r->path, sizeof(r->path), "%s", s->src_path[0]);
+		snprintf(r->as.src.frag_path, sizeof(r->as.src.frag_path), "%s", s->src_path[1]);
+	}
+	++reload_pending;
+	the_sched_do(reload_sched, (struct the_job){ .job = the__reload_decode, .args = r });
+}
+
+static void
+the__tex_changed(const char *path, int tex)
+{
+	the__reload_schedule(THE__RELOAD_TEX, path, tex);
+}
+
+static void
+the__mesh_changed(const char *path, int mesh)
+{
+	the__reload_schedule(THE__RELOAD_MESH, path, mesh);
+}
+
+static void
+the__shader_changed(const char *path, int shader)
+{
+	the__reload_schedule(THE__RELOAD_SHADER, path, shader);
+}
+
+static void
+the__reload_apply(struct the__reload *r)
+{
+	--reload_pending;
+	switch (r->type) {
+	case THE__RELOAD_MESH: {
+		mesh *m = &mesh_pool.buf->at[r->handle];
+		m->loading--;
+		if (m->res.flags & THE_IRF_RELEASED) {
+			the_free(r->as.m.vtx);
+			the_free(r->as.m.idx);
+			if (!m->loading) {
+				thepool_mesh_rm(&mesh_pool, r->handle);
+			}
+			break;
+		}
+		if (!r->as.m.vtx || !r->as.m.idx) {
+			THE_LOG_WARN("Loading %s failed, keeping the previous mesh.", r->path);
+			the_free(r->as.m.vtx);
+			the_free(r->as.m.idx);
+			break;
+		}
+		the_free(m->vtx);
+		the_free(m->idx);
+		m->vtx = r->as.m.vtx;
+		m->idx = r->as.m.idx;
+		m->elem_count = r->as.m.elem_count;
+		m->vtx_size = r->as.m.vtx_size;
+		m->attrib = r->as.m.attrib;
+		m->bounds = r->as.m.bounds;
+		memcpy(m->lods, r->as.m.lods, sizeof(m->lods));
+		m->lod_count = r->as.m.lod_count;
+		m->res.flags |= THE_IRF_DIRTY;
+		break;
+	}
+
+	case THE__RELOAD_TEX: {
+		tex *t = &tex_pool.buf->at[r->handle];
+		t->loading--;
+		bool released = t->res.flags & THE_IRF_RELEASED;
+		bool ok = r->as.t.img != NULL && !released;
+		for (int i = 0; ok && i < r->as.t.img->count; ++i) {
+			ok = r->as.t.img->at[i].pix != NULL;
+		}
+
+		struct thearr_theteximg *old = ok ? t->img : r->as.t.img;
+		if (ok) {
+			t->img = r->as.t.img;
+			t->data = r->as.t.data;
+			t->res.flags |= THE_IRF_DIRTY;
+		} else if (!released) {
+			THE_LOG_WARN("Loading %s failed, keeping the previous texture.", r->path);
+		}
+
+		for (int i = 0; old && i < old->count; ++i) {
+			the_free(old->at[i].pix);
+		}
+		thearr_theteximg_release(old);
+		if (released && !t->loading) {
+			thepool_tex_rm(&tex_pool, r->handle);
+		}
+		break;
+	}
+
+	case THE__RELOAD_SHADER: {
+		shad *s = &shader_pool.buf->at[r->handle];
+		if (r->as.src.vert && r->as.src.frag && (s->res.flags & THE_IRF_CREATED)) {
+			r->program = thepx_shader_build(r->as.src.vert, r->as.src.frag);
+		}
+		the_free(r->as.src.vert);
+		the_free(r->as.src.frag);
+		if (r->program) {
+			/* Keep using the current program until the new one has linked. */
+			thearr_thereload_push_value(&reload_link, r);
+			return;
+		}
+		break;
+	}
+
+	case THE__RELOAD_JOB:
+		if (r->as.job.done) {
+			r->as.job.done(r->as.job.args);
+		}
+		break;
+	}
+
+	the_free(r);
+}
+
+static void
+the__reload_link(void)
+{
+	if (!reload_link) {
+		return;
+	}
+
+	int pending = 0;
+	for (int i = 0; i < reload_link->count; ++i) {
+		struct the__reload *r = reload_link->at[i];
+		if (!thepx_shader_ready(r->program)) {
+			reload_link->at[pending++] = r;
+			continue;
+		}
+
+		shad *s = &shader_pool.buf->at[r->handle];
+		if (thepx_shader_linked(r->program, s->name)) {
+			thepx_shader_release(s->res.id);
+			s->res.id = r->program;
+			thepx_shader_loc(s->res.id, &s->loc[0].data, &shader_uniforms[0], 6);
+			THE_LOG("Shader %s reloaded.", s->name);
+		} else {
+			thepx_shader_release(r->program);
+		}
+		the_free(r);
+	}
+	reload_link->count = pending;
+}
+
+void
+the_tex_placeholder(the_tex texture, struct the_texture_desc *desc)
+{
+	tex *t = &tex_pool.buf->at[texture];
+	for (int i = 0; t->img && i < t->img->count; ++i) {
+		the_free(t->img->at[i].pix);
+	}
+	thearr_theteximg_release(t->img);
+	t->img = NULL;
+
+	t->data = *desc;
+	t->data.width = 1;
+	t->data.height = 1;
+	bool is_half = the__tex_is_half(t->data.fmt);
+	bool is_float = the__tex_is_float(t->data.fmt);
+	int face_count = the__tex_faces(t->data.type);
+	for (int i = 0; i < face_count; ++i) {
+		struct the_texture_image *img = thearr_theteximg_push(&t->img);
+		img->lod = 0;
+		img->face = i;
+		img->pix = the_alloc(4 * sizeof(float));
+		for (int c = 0; c < 4; ++c) {
+			if (is_half) {
+				((uint16_t *)img->pix)[c] = 0x3C00; // 1.0 as half.
+			} else if (is_float) {
+				((float *)img->pix)[c] = 1.0f;
+			} else {
+				((uint8_t *)img->pix)[c] = 0xFF;
+			}
+		}
+	}
+	t->res.flags |= THE_IRF_DIRTY;
+}
+
+void
+the_tex_load_async(the_tex texture, struct the_texture_desc *desc, const char *path)
+{
+	if (!reload_sched) {
+		the_tex_load(texture, desc, path);
+		return;
+	}
+
+	the_tex_placeholder(texture, desc);
+	the__reload_schedule(THE__RELOAD_TEX, path, texture); // Decoding sets the real size.
+	if (the__tex_faces(desc->type) == 1) {
+		the_watch_add(path, the__tex_changed, texture);
+	}
+}
+
+void
+the_mesh_load_async(the_mesh msh, const char *path)
+{
+	if (!reload_sched) {
+		the_mesh_reload_file(msh, path);
+		return;
+	}
+
+	the__reload_schedule(THE__RELOAD_MESH, path, msh);
+	the_watch_add(path, the__mesh_changed, msh);
+}
+
+void
+the_load_async(void (*load)(void *), void (*done)(void *), void *args)
+{
+	if (!reload_sched) {
+		load(args);
+		if (done) {
+			done(args);
+		}
+		return;
+	}
+
+	struct the__reload *r = the_calloc(1, sizeof(*r));
+	r->type = THE__RELOAD_JOB;
+	r->as.job.load = load;
+	r->as.job.done = done;
+	r->as.job.args = args;
+	++reload_pending;
+	the_sched_do(reload_sched, (struct the_job){ .job = the__reload_decode, .args = r });
+}
+
+int
+the_load_pending(void)
+{
+	return reload_pending;
+}
+
+void
+the_hotreload_init(int threads)
+{
+	if (reload_sched) {
+		return;
+	}
+	reload_sched = the_sched_create(threads > 0 ? threads : 1);
+	the_watch_init();
+}
+
+static void
+the__reload_flush(void)
+{
+	pthread_mutex_lock(&reload_mtx);
+	struct thearr_thereload *done = reload_done;
+	reload_done = NULL;
+	pthread_mutex_unlock(&reload_mtx);
+
+	for (int i = 0; done && i < done->count; ++i) {
+		the__reload_apply(done->at[i]);
+	}
+	if (done || (reload_link && reload_link->count)) {
+		the_invalidate();
+	}
+	thearr_thereload_release(done);
+	the__reload_link();
+}
+
+void
+the_hotreload_poll(void)
+{
+	if (reload_sched) {
+		the_watch_poll();
+		the__reload_flush();
+	}
+}
+
+void
+the_hotreload_shutdown(void)
+{
+	if (!reload_sched) {
+		return;
+	}
+	the_watch_shutdown();
+	the_sched_wait(reload_sched);
+	the_sched_destroy(reload_sched);
+	reload_sched = NULL;
+	the__reload_flush();
+}
+
+/* Consecutive commands from first that one instanced draw can issue. */
+static int
+the__draw_run(const struct thearr_thedrawcmd *cmds, int first, const shad *s)
+{
+	const struct the_draw_cmd *a = &cmds->at[first];
+	int dc = s->count[0].data;
+	size_t tex_size = (s->count[0].tex + s->count[0].cubemap) * sizeof(the_tex);
+	int run = 1;
+	while (first + run < cmds->count) {
+		const struct the_draw_cmd *b = &cmds->at[first + run];
+		if (b->mesh != a->mesh || b->lod != a->lod || b->material.shader != a->material.shader ||
+		    b->instance_count ||
+		    memcmp((float *)b->material.ptr + dc, (float *)a->material.ptr + dc, tex_size)) {
+			break;
+		}
+		++run;
+	}
+	return run;
+}
+
+/* Unit data of the materials of a run, one instance each. Grows, never shrinks. */
+static float *instance_scratch = NULL;
+static int instance_scratch_cap = 0;
+
+static void
+the__draw_instanced_run(const struct thearr_thedrawcmd *cmds, int first, int run, int elem_first,
+                        int elem_count, shad *s, the_mat pipe)
+{
+	int dc = s->count[0].data;
+	if (run * dc > instance_scratch_cap) {
+		instance_scratch_cap = run * dc * 2;
+		instance_scratch = the_realloc(instance_scratch, instance_scratch_cap * sizeof(float));
+	}
+	for (int i = 0; i < run; ++i) {
+		memcpy(instance_scratch + i * dc, cmds->at[first + i].material.ptr, dc * sizeof(float));
+	}
+
+	/* The variant takes the common data of the list and the textures shared by the run. */
+	shad *v = &shader_pool.buf->at[s->instanced];
+	the__sync_shader(v);
+	thepx_shader_use(v->res.id);
+	the__set_shader_data(v, pipe.ptr, true);
+	the__set_shader_data(v, cmds->at[first].material.ptr, false);
+	thepx_mesh_use(&mesh_pool.buf->at[cmds->at[first].mesh], v);
+	thepx_draw_instanced(elem_first, elem_count, sizeof(the_idx) == 4, instance_scratch, run, dc);
+	thepx_shader_use(s->res.id);
+}
+
+uint64_t
+the_draw_key(int pass, the_mat mat, the_mesh mesh, float depth, bool blended)
+{
+	thepx__check_handle(mat.shader, &shader_pool);
+	const shad *s = &shader_pool.buf->at[mat.shader];
+	const uint8_t *tex = (const uint8_t *)the_mat_tex(mat);
+	size_t tex_size = (s->count[0].tex + s->count[0].cubemap) * sizeof(the_tex);
+	uint32_t hash = 2166136261u; // FNV-1a of the texture handles.
+	for (size_t i = 0; i < tex_size; ++i) {
+		hash = (hash ^ tex[i]) * 16777619u;
+	}
+
+	/* The bits of a positive float grow with it: the top ones are a log scale quantization. */
+	union {
+		float f;
+		uint32_t u;
+	} d = { .f = depth > 0.0f ? depth : 0.0f };
+	uint64_t z = (d.u >> 11) & 0xFFFFF;
+	uint64_t state = ((uint64_t)(mat.shader & 0xFFF) << 28) | ((uint64_t)((hash ^ (hash >> 16)) & 0xFFFF) << 12) |
+	                 (uint64_t)(mesh & 0xFFF);
+	uint64_t key = (uint64_t)(pass & 0xF) << 60;
+	return blended ? key | ((0xFFFFF - z) << 40) | state : key | (state << 20) | z;
+}
+
+/* Stable LSD radix sort of the commands by key, one pass per byte the keys differ in. */
+static struct the_draw_cmd *sort_cmds = NULL;
+static uint64_t *sort_keys = NULL;
+static int *sort_order = NULL;
+static int sort_cap = 0;
+
+static void
+the__draw_sort(struct thearr_thedrawcmd *cmds)
+{
+	int n = cmds->count;
+	if (n > sort_cap) {
+		sort_cap = n * 2;
+		sort_cmds = the_realloc(sort_cmds, sort_cap * sizeof(*sort_cmds));
+		sort_keys = the_realloc(sort_keys, sort_cap * 2 * sizeof(*sort_keys));
+		sort_order = the_realloc(sort_order, sort_cap * 2 * sizeof(*sort_order));
+	}
+
+	/* Keys and command indices ping-pong between the two halves of the scratch arrays. */
+	uint64_t *src = sort_keys;
+	uint64_t *dst = sort_keys + sort_cap;
+	int *order = sort_order;
+	int *order_dst = sort_order + sort_cap;
+	int hist[8][256] = { { 0 } };
+	for (int i = 0; i < n; ++i) {
+		uint64_t k = cmds->at[i].key;
+		for (int b = 0; b < 8; ++b) {
+			++hist[b][(k >> (b * 8)) & 0xFF];
+		}
+		src[i] = k;
+		order[i] = i;
+	}
+	bool moved = false;
+	for (int b = 0; b < 8; ++b) {
+		int shift = b * 8;
+		if (hist[b][(src[0] >> shift) & 0xFF] == n) {
+			continue; // Same byte in every key.
+		}
+		int offset = 0;
+		for (int i = 0; i < 256; ++i) {
+			int c = hist[b][i];
+			hist[b][i] = offset;
+			offset += c;
+		}
+		for (int i = 0; i < n; ++i) {
+			int at = hist[b][(src[i] >> shift) & 0xFF]++;
+			dst[at] = src[i];
+			order_dst[at] = order[i];
+		}
+		uint64_t *tk = src;
+		src = dst;
+		dst = tk;
+		int *to = order;
+		order = order_dst;
+		order_dst = to;
+		moved = true;
+	}
+
+	if (moved) {
+		for (int i = 0; i < n; ++i) {
+			sort_cmds[i] = cmds->at[order[i]];
+		}
+		memcpy(cmds->at, sort_cmds, n * sizeof(*sort_cmds));
+	}
+}
+
 void
 the_draw(struct the_draw *dl)
 {
@@ -736,12 +1583,6 @@ the_draw(struct the_draw *dl)
 
 	{ // ops
 		const struct the_draw_ops *ops = &dl->state.ops;
-		struct the_color bg = dl->state.target.bgcolor;
-		thepx_clear_color(bg.r, bg.g, bg.b, bg.a);
-		thepx_clear(
-		  ops->enable & (1 << THE_DRAW_CLEAR_COLOR), ops->enable & (1 << THE_DRAW_CLEAR_DEPTH),
-		  ops->enable & (1 << THE_DRAW_CLEAR_STENCIL));
-
 		thepx_viewport(ops->viewport);
 		thepx_scissor(ops->scissor);
 
@@ -790,9 +1631,20 @@ the_draw(struct the_draw *dl)
 		thepx_depth_set(ops->depth_fun);
 		thepx_blend_set(ops->blend_src, ops->blend_dst);
 		thepx_cull_set(ops->cull_face);
+
+		/* Last: clears obey the write masks, a previous list may have left them off. */
+		struct the_color bg = dl->state.target.bgcolor;
+		thepx_clear_color(bg.r, bg.g, bg.b, bg.a);
+		thepx_clear(
+		  ops->enable & (1 << THE_DRAW_CLEAR_COLOR), ops->enable & (1 << THE_DRAW_CLEAR_DEPTH),
+		  ops->enable & (1 << THE_DRAW_CLEAR_STENCIL));
 	}
 
 	// commands
+	if ((dl->state.ops.enable & (1 << THE_DRAW_SORT)) && dl->cmds && dl->cmds->count > 1) {
+		the__draw_sort(dl->cmds);
+	}
+	the_mat pipe = dl->state.pipeline.shader_mat;
 	for (int cmd = 0; cmd < dl->cmds->count; ++cmd) {
 		the_mesh msh = dl->cmds->at[cmd].mesh;
 		the_mat mat = dl->cmds->at[cmd].material;
@@ -804,10 +1656,37 @@ the_draw(struct the_draw *dl)
 			the__sync_gpu_mesh(msh, mat.shader);
 		}
 
+		int first = 0;
+		int count = imsh->elem_count;
+		if (imsh->lod_count) {
+			int lod = dl->cmds->at[cmd].lod;
+			lod = lod < 0 ? 0 : (lod < imsh->lod_count ? lod : imsh->lod_count - 1);
+			first = imsh->lods[lod].first;
+			count = imsh->lods[lod].count;
+		}
+		const struct the_draw_cmd *c = &dl->cmds->at[cmd];
 		shad *s = &shader_pool.buf->at[mat.shader];
+
+		int run = 1;
+		if (s->instanced != THE_NONE && mat.shader == pipe.shader && !c->instance_count) {
+			run = the__draw_run(dl->cmds, cmd, s);
+		}
+		if (run > 1) {
+			the__draw_instanced_run(dl->cmds, cmd, run, first, count, s, pipe);
+			cmd += run - 1;
+			continue;
+		}
+
 		the__set_shader_data(s, mat.ptr, false);
 		thepx_mesh_use(imsh, s);
-		thepx_draw(imsh->elem_count, sizeof(the_idx) == 4);
+		if (c->instance_count > 0) {
+			THE_ASSERT(c->instances && c->instance_floats > 0 &&
+			           c->instance_floats <= THE_INSTANCE_MAX_FLOATS && "Invalid instance data");
+			thepx_draw_instanced(first, count, sizeof(the_idx) == 4, c->instances,
+			                     c->instance_count, c->instance_floats);
+		} else {
+			thepx_draw(first, count, sizeof(the_idx) == 4);
+		}
 	}
 }
 
@@ -26,9 +26,19 @@ enum the_vertex_attrib {
 	THE_VA_TAN,
 	THE_VA_BITAN,
 	THE_VA_UV,
+	THE_VA_JOINTS, // Four joint indices (as floats) of a skinned vertex.
+	THE_VA_WEIGHTS, // Their weights, summing 1.
 	THE_VA_COUNT
 };
 
+/*
+ * Per instance data of instanced draws: vec4 attributes at consecutive locations from
+ * THE_VA_INSTANCE_LOC (layout(location = 8) in vec4 a_instance0...), up to
+ * THE_INSTANCE_MAX_FLOATS floats per instance (locations 8 to 15, the GL minimum).
+ */
+#define THE_VA_INSTANCE_LOC 8
+#define THE_INSTANCE_MAX_FLOATS 32
+
 typedef int the_blend_func;
 enum the_blend_func {
 	THE_BLEND_CURRENT = 0,
@@ -115,6 +125,7 @@ enum the_texture_format {
 	THE_TEX_FMT_RGB16F,
 	THE_TEX_FMT_RGBA16F,
 	THE_TEX_FMT_RGB32F,
+	THE_TEX_FMT_RGBA32F,
 	THE_TEX_FMT_COUNT
 };
 
@@ -169,6 +180,9 @@ struct the_shader_desc {
 	int shared_data_count;
 	int common_tex_count;
 	int common_cubemap_count;
+	/* Sources, watched for hot reload. NULL: assets/shaders/<name>-vert.glsl and -frag.glsl. */
+	const char *vert_path;
+	const char *frag_path;
 };
 
 typedef struct the_mat {
@@ -188,6 +202,7 @@ enum the_draw_flags {
 	THE_DRAW_BLEND,
 	THE_DRAW_CULL,
 	THE_DRAW_SCISSOR,
+	THE_DRAW_SORT, // Enable only: the_draw orders the commands of the list by key first.
 	THE_DRAW_FLAGS_COUNT
 };
 
@@ -212,9 +227,34 @@ struct the_draw_ops {
 	uint8_t depth_fun;
 };
 
+/* Axis aligned box and bounding sphere (xyz center, w radius). */
+struct the_bounds {
+	struct the_vec3 min;
+	struct the_vec3 max;
+	struct the_vec4 sphere;
+};
+
+#define THE_MESH_MAX_LODS 4
+
+/* Index range of a level of detail and its geometric error, in object space units. */
+struct the_mesh_lod {
+	uint32_t first;
+	uint32_t count;
+	float error;
+};
+
 struct the_draw_cmd {
 	the_mesh mesh;
 	the_mat material;
+	int lod; // Level of detail, clamped to the levels of the mesh.
+	/*
+	 * Instanced draw if instance_count > 0: instance_count records of instance_floats floats,
+	 * streamed to the GPU by the_draw. The data must stay alive until then.
+	 */
+	int instance_count;
+	int instance_floats;
+	const float *instances;
+	uint64_t key; // Read only by lists with THE_DRAW_SORT enabled, see the_draw_key.
 };
 
 struct the_render_state {
@@ -237,7 +277,26 @@ void *the_falloc(ptrdiff_t size);
 the_tex the_tex_create(void);
 void the_tex_set(the_tex tex, struct the_texture_desc *desc);
 void the_tex_load(the_tex tex, struct the_texture_desc *desc, const char *path);
+/* desc with a 1x1 white image, fallback until the real data is set. */
+void the_tex_placeholder(the_tex tex, struct the_texture_desc *desc);
 struct the_point the_tex_size(the_tex tex);
+/*
+ * Pixels of a 2D texture created with the_tex_set (8 bit or 32 bit float formats), allocated
+ * on the first call. The whole image is uploaded again on the next use of the texture:
+ * map it once per frame and fill it, e.g. with data produced on the CPU every frame.
+ */
+void *the_tex_map(the_tex tex);
+/* Bytes of the texture data at its current size (all faces, base level). */
+size_t the_tex_bytes(the_tex tex);
+/* Estimate of the_tex_bytes for an image file loaded with desc, from its header. 0: unreadable. */
+size_t the_tex_file_bytes(const char *path, const struct the_texture_desc *desc);
+/* False while an async load or reload of the texture is in flight. */
+bool the_tex_ready(the_tex tex);
+/*
+ * Frees the pixels and the GPU texture, stops watching its file and returns the handle to
+ * the pool. With loads in flight the handle is recycled once they land, their data dropped.
+ */
+void the_tex_release(the_tex tex);
 
 the_framebuffer the_fb_create(void);
 void the_fb_set_target(the_framebuffer fb, int index, struct the_texture_target target);
@@ -246,8 +305,33 @@ void the_fb_set_target(the_framebuffer fb, int index, struct the_texture_target
 the_mesh the_mesh_create(void);
 the_mesh the_mesh_load_file(const char *path);
 void the_mesh_reload_file(the_mesh mesh, const char *path);
+/* Object space bounds. Meshes without geometry yet get an infinite sphere (never culled). */
+struct the_bounds the_mesh_bounds(the_mesh mesh);
+/*
+ * Levels of detail, finest first (.msh files written by tools/tomesh). Meshes without
+ * them have one level: the whole index buffer with error 0. Returns the level count.
+ */
+int the_mesh_lods(the_mesh mesh, struct the_mesh_lod lods[THE_MESH_MAX_LODS]);
+/* Bytes of the vertex and index data. */
+size_t the_mesh_bytes(the_mesh mesh);
+/* Estimate of the_mesh_bytes for a mesh file: its (unpacked) size. 0: unreadable. */
+size_t the_mesh_file_bytes(const char *path);
+/* False while an async load or reload of the mesh is in flight. */
+bool the_mesh_ready(the_mesh mesh);
+/* Like the_tex_release: frees the geometry, CPU and GPU side, and recycles the handle. */
+void the_mesh_release(the_mesh mesh);
 
 the_shader the_shader_create(const struct the_shader_desc *desc);
+const char *the_shader_name(the_shader shader);
+/* First shader created with that desc name, or THE_NONE. */
+the_shader the_shader_find(const char *name);
+/*
+ * Instanced variant of a shader, same desc counts. the_draw issues runs of consecutive
+ * commands of a list drawn with shader (same mesh, level of detail and textures) as one
+ * instanced draw of the variant: the unit data of every material becomes one instance,
+ * read from vec4 attributes at THE_VA_INSTANCE_LOC instead of u_data.
+ */
+void the_shader_instanced(the_shader shader, the_shader variant);
 void *the_shader_data(the_shader shader);
 void the_shader_reload(the_shader shader);
 the_tex *the_shader_tex(the_shader shader);
@@ -260,7 +344,42 @@ the_mat the_mat_tmp(the_shader shader);
 the_mat the_mat_copy(the_mat mat);
 the_mat the_mat_copy_shader(the_shader shader);
 the_tex *the_mat_tex(the_mat mat); // Ptr to first texture.
-
+/* Bytes of the materials of a shader: unit data, then its texture and cubemap handles. */
+size_t the_mat_size(the_shader shader);
+
+/*
+ * Sort key of a command, lowest drawn first. Opaque keys group the commands by pass, shader,
+ * textures and mesh, then front to back; blended ones go back to front within their pass:
+ * - opaque:  pass 4 | shader 12 | textures hash 16 | mesh 12 | depth 20
+ * - blended: pass 4 | inverted depth 20 | shader 12 | textures hash 16 | mesh 12
+ * depth is any distance >= 0 from the viewer (e.g. view space z), quantized with a relative
+ * precision of 1/2048. Handles past the field sizes wrap: those commands only group less.
+ */
+uint64_t the_draw_key(int pass, the_mat mat, the_mesh mesh, float depth, bool blended);
+/* Draws a list. With THE_DRAW_SORT its commands are stable sorted by key in place first. */
 void the_draw(struct the_draw *dl);
 
+/*
+ * Hot reload of the files textures, meshes and shaders were loaded from.
+ * - Changed assets are decoded again on `threads` workers and re-uploaded when applied.
+ * - the_hotreload_poll applies finished reloads, call it once per frame from the render
+ *     thread. New shader programs replace the old ones only after they link successfully.
+ *
+ * Asynchronous loads go through the same workers and are applied by the_hotreload_poll.
+ * - the_tex_load_async binds a 1x1 white placeholder (the_tex_placeholder) and
+ *     the_mesh_load_async keeps the current mesh data until the file is decoded.
+ *     The handles are usable immediately.
+ * - the_load_async runs load(args) on a worker and done(args) on the polling thread.
+ * - the_load_pending counts loads and reloads not applied yet.
+ * - Without the_hotreload_init they are synchronous.
+ */
+void the_tex_load_async(the_tex tex, struct the_texture_desc *desc, const char *path);
+void the_mesh_load_async(the_mesh mesh, const char *path);
+void the_load_async(void (*load)(void *), void (*done)(void *), void *args);
+int the_load_pending(void);
+
+void the_hotreload_init(int threads);
+void the_hotreload_poll(void);
+void the_hotreload_shutdown(void);
+
 #endif // THE_PIXELS_H
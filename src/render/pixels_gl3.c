@@ -3,12 +3,12 @@
 #include "core/io.h"
 #include "core/mem.h" // free --shader source buffer
 
-#include <string.h> // shader path manipulation
+#include <string.h>
 #include <glad/glad.h>
 
-static const GLint attrib_sizes[THE_VA_COUNT] = { 3, 3, 3, 3, 2 };
+static const GLint attrib_sizes[THE_VA_COUNT] = { 3, 3, 3, 3, 2, 4, 4 };
 static const char *attrib_names[THE_VA_COUNT] = {
-	"a_position", "a_normal", "a_tangent", "a_bitangent", "a_uv"
+	"a_position", "a_normal", "a_tangent", "a_bitangent", "a_uv", "a_joints", "a_weights"
 };
 
 typedef struct gl_tdesc_t {
@@ -95,6 +95,7 @@ gltfmt(the_texture_format fmt)
 	case THE_TEX_FMT_RGB16F: return (struct gltfmt_result){ GL_RGB16F, GL_RGB, GL_HALF_FLOAT };
 	case THE_TEX_FMT_RGBA16F: return (struct gltfmt_result){ GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT };
 	case THE_TEX_FMT_RGB32F: return (struct gltfmt_result){ GL_RGB32F, GL_RGB, GL_FLOAT };
+	case THE_TEX_FMT_RGBA32F: return (struct gltfmt_result){ GL_RGBA32F, GL_RGBA, GL_FLOAT };
 	case THE_TEX_FMT_DEPTH:
 		return (struct gltfmt_result){ GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT, GL_FLOAT };
 	default:
@@ -236,7 +237,7 @@ thepx_shader_create(uint32_t *id)
 }
 
 void
-thepx_shader_compile(uint32_t id, const char *name)
+thepx_shader_compile(uint32_t id, const char *name, const char *vert_path, const char *frag_path)
 {
 	// For shader hot-recompilations
 	GLuint shaders[8];
@@ -248,13 +249,6 @@ thepx_shader_compile(uint32_t id, const char *name)
 
 	size_t shsrc_size; // Shader source size in bytes
 	char *shsrc;
-	char vert_path[256] = { '\0' };
-	char frag_path[256] = { '\0' };
-	strcpy(frag_path, "assets/shaders/");
-	strcat(frag_path, name);
-	strcpy(vert_path, frag_path);
-	strcat(vert_path, "-vert.glsl");
-	strcat(frag_path, "-frag.glsl");
 
 	GLint err;
 	GLchar output_log[1024];
@@ -301,6 +295,74 @@ thepx_shader_compile(uint32_t id, const char *name)
 	glDeleteShader(frag);
 }
 
+uint32_t
+thepx_shader_build(const char *vert_src, const char *frag_src)
+{
+	GLuint id = glCreateProgram();
+	GLuint vert = glCreateShader(GL_VERTEX_SHADER);
+	GLuint frag = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(vert, 1, &vert_src, NULL);
+	glShaderSource(frag, 1, &frag_src, NULL);
+	glCompileShader(vert);
+	glCompileShader(frag);
+	glAttachShader(id, vert);
+	glAttachShader(id, frag);
+	glLinkProgram(id);
+	return id;
+}
+
+#define THEPX_GL_COMPLETION_STATUS_KHR 0x91B1
+
+bool
+thepx_shader_ready(uint32_t id)
+{
+	/* With KHR_parallel_shader_compile the driver links in the background, poll it. */
+	static int parallel = -1;
+	if (parallel < 0) {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		parallel = 0;
+		for (GLint i = 0; i < count && !parallel; ++i) {
+			const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+			parallel = ext && !strcmp(ext, "GL_KHR_parallel_shader_compile");
+		}
+	}
+
+	if (!parallel) {
+		return true;
+	}
+
+	GLint done = GL_FALSE;
+	glGetProgramiv(id, THEPX_GL_COMPLETION_STATUS_KHR, &done);
+	return done;
+}
+
+bool
+thepx_shader_linked(uint32_t id, const char *name)
+{
+	GLint ok;
+	GLchar output_log[1024];
+	GLuint shaders[2];
+	GLsizei count = 0;
+	glGetAttachedShaders(id, 2, &count, shaders);
+	for (int i = 0; i < count; ++i) {
+		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &ok);
+		if (!ok) {
+			glGetShaderInfoLog(shaders[i], 1024, NULL, output_log);
+			THE_LOG_ERR("%s %s:\n%s\n", name, i ? "frag" : "vert", output_log);
+		}
+		glDetachShader(id, shaders[i]);
+		glDeleteShader(shaders[i]);
+	}
+
+	glGetProgramiv(id, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		glGetProgramInfoLog(id, 1024, NULL, output_log);
+		THE_LOG_ERR("%s program:\n%s\n", name, output_log);
+	}
+	return ok;
+}
+
 void
 thepx_shader_loc(uint32_t id, int *o_loc, const char **i_unif, int count)
 {
@@ -403,9 +465,83 @@ thepx_clear(bool color, bool depth, bool stencil)
 }
 
 void
-thepx_draw(int elem_count, int index_type)
+thepx_draw(int first, int elem_count, int index_type)
 {
-	glDrawElements(GL_TRIANGLES, elem_count, index_type ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT, 0);
+	glDrawElements(GL_TRIANGLES, elem_count, index_type ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT,
+	               (const void *)(first * (index_type ? sizeof(uint32_t) : sizeof(uint16_t))));
+}
+
+/*
+ * Instance data goes through one streaming buffer shared by every draw: written at
+ * increasing offsets without synchronization and orphaned when full, so the driver
+ * hands out fresh storage instead of waiting for the draws still reading the old one.
+ */
+#define THEPX_STREAM_MIN_SIZE (4 * 1024 * 1024)
+#define THEPX_STREAM_ALIGN 256
+
+static struct {
+	GLuint vbo;
+	GLsizeiptr size;
+	GLsizeiptr offset;
+} thepx__stream;
+
+static GLsizeiptr
+thepx__stream_write(const void *data, GLsizeiptr bytes)
+{
+	if (!thepx__stream.vbo) {
+		glGenBuffers(1, &thepx__stream.vbo);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, thepx__stream.vbo);
+	if (bytes > thepx__stream.size) {
+		GLsizeiptr size = thepx__stream.size ? thepx__stream.size : THEPX_STREAM_MIN_SIZE;
+		while (size < bytes) {
+			size *= 2;
+		}
+		thepx__stream.size = size;
+		thepx__stream.offset = thepx__stream.size; // Orphan below.
+	}
+	if (thepx__stream.offset + bytes > thepx__stream.size) {
+		glBufferData(GL_ARRAY_BUFFER, thepx__stream.size, NULL, GL_STREAM_DRAW);
+		thepx__stream.offset = 0;
+	}
+
+	GLsizeiptr offset = thepx__stream.offset;
+	void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, bytes,
+	                             GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	/* A failed map, or a store lost while mapped (unmap false), goes through a plain upload. */
+	if (dst) {
+		memcpy(dst, data, bytes);
+	}
+	if (!dst || glUnmapBuffer(GL_ARRAY_BUFFER) == GL_FALSE) {
+		glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+	}
+	thepx__stream.offset = (offset + bytes + THEPX_STREAM_ALIGN - 1) & ~(GLsizeiptr)(THEPX_STREAM_ALIGN - 1);
+	return offset;
+}
+
+void
+thepx_draw_instanced(int first, int elem_count, int index_type, const float *instances, int instance_count, int instance_floats)
+{
+	GLsizei stride = instance_floats * sizeof(float);
+	GLsizeiptr offset = thepx__stream_write(instances, (GLsizeiptr)stride * instance_count);
+
+	/* Attributes on the bound mesh vertex array, disabled again after the draw. */
+	int attribs = (instance_floats + 3) / 4;
+	for (int i = 0; i < attribs; ++i) {
+		GLint size = instance_floats - i * 4 < 4 ? instance_floats - i * 4 : 4;
+		glEnableVertexAttribArray(THE_VA_INSTANCE_LOC + i);
+		glVertexAttribPointer(THE_VA_INSTANCE_LOC + i, size, GL_FLOAT, GL_FALSE, stride,
+		                      (const void *)(offset + i * 4 * sizeof(float)));
+		glVertexAttribDivisor(THE_VA_INSTANCE_LOC + i, 1);
+	}
+	glDrawElementsInstanced(GL_TRIANGLES, elem_count, index_type ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT,
+	                        (const void *)(first * (index_type ? sizeof(uint32_t) : sizeof(uint16_t))),
+	                        instance_count);
+	for (int i = 0; i < attribs; ++i) {
+		glVertexAttribDivisor(THE_VA_INSTANCE_LOC + i, 0);
+		glDisableVertexAttribArray(THE_VA_INSTANCE_LOC + i);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void
@@ -235,7 +235,7 @@ thepx_shader_create(uint32_t *id)
 }
 
 void
-thepx_shader_compile(uint32_t id, const char *name)
+thepx_shader_compile(uint32_t id, const char *name, const char *vert_path, const char *frag_path)
 {
 	// For shader hot-recompilations
 	GLuint shaders[8];
@@ -247,13 +247,6 @@ thepx_shader_compile(uint32_t id, const char *name)
 
 	size_t shsrc_size; // Shader source size in bytes
 	char *shsrc;
-	char vert_path[256] = { '\0' };
-	char frag_path[256] = { '\0' };
-	strcpy(frag_path, "assets/shaders/");
-	strcat(frag_path, name);
-	strcpy(vert_path, frag_path);
-	strcat(vert_path, "-vert.glsl");
-	strcat(frag_path, "-frag.glsl");
 
 	GLint err;
 	GLchar output_log[1024];
@@ -403,10 +396,18 @@ thepx_clear(int color, int depth, int stencil)
 }
 
 void
-thepx_draw(int elem_count, int index_type)
+thepx_draw(int first, int elem_count, int index_type)
 {
 	glDrawElements(GL_TRIANGLES, elem_count,
-	               index_type ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT, 0);
+	               index_type ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT,
+	               (const void *)(first * (index_type ? sizeof(uint32_t) : sizeof(uint16_t))));
+}
+
+void
+thepx_draw_instanced(int first, int elem_count, int index_type, const float *instances, int instance_count, int instance_floats)
+{
+	(void)first, (void)elem_count, (void)index_type, (void)instances, (void)instance_count, (void)instance_floats;
+	THE_ASSERT(!"Instanced draws need the GL3 backend");
 }
 
 void
@@ -14,6 +14,7 @@ enum the_resource_flags {
 	THE_IRF_CREATED = 1U << 4,
 	THE_IRF_RELEASE_APP_STORAGE = 1U << 5,
 	THE_IRF_MAPPED = 1U << 7,
+	THE_IRF_RELEASED = 1U << 8, // Released with loads in flight, freed when the last one lands.
 };
 
 struct the_resource_internal {
@@ -30,8 +31,17 @@ struct the_mesh_internal {
 	int64_t elem_count;
 	uint32_t vtx_size;
 	the_vertex_attrib attrib;
+	struct the_bounds bounds; // Object space, set whenever the geometry changes.
+	struct the_mesh_lod lods[THE_MESH_MAX_LODS];
+	int lod_count; // 0: a single level, the whole index buffer.
+	int loading; // Async loads and reloads not applied yet.
 };
 
+/* Recomputes mesh->bounds from the positions of the indexed vertices. */
+void the_mesh_calc_bounds(struct the_mesh_internal *mesh);
+/* Reads a .obj or .msh file into a zeroed mesh. No pool or GPU access, any thread can call it. */
+void the_mesh_decode(struct the_mesh_internal *mesh, const char *path);
+
 struct the_texture_image {
 	void *pix;
 	the_texture_face face;
@@ -45,15 +55,18 @@ struct the_texture_internal {
 	struct the_resource_internal res;
 	struct the_texture_desc data;
 	struct thearr_theteximg *img;
+	int loading; // Async loads and reloads not applied yet.
 };
 
 struct the_shader_internal {
 	struct the_resource_internal res;
 	const char *name;
+	char src_path[2][256]; // Vertex and fragment sources.
 	struct {
 		int data, tex, cubemap;
 	} loc[2], count[2]; // 0: unit, 1: common
 	void *common;
+	int instanced; // Instanced variant, THE_NONE if none.
 };
 
 struct the_framebuffer_internal {
@@ -71,9 +84,13 @@ void thepx_mesh_set(struct the_mesh_internal *mesh, uint32_t shader_id);
 void thepx_mesh_release(uint32_t *id, uint32_t *vid, uint32_t *iid);
 
 void thepx_shader_create(uint32_t *id);
-void thepx_shader_compile(uint32_t id, const char *name);
+void thepx_shader_compile(uint32_t id, const char *name, const char *vert_path, const char *frag_path);
 void thepx_shader_use(uint32_t id);
 void thepx_shader_release(uint32_t id);
+/* Hot reload: issues compilation and link of a new program without waiting for the result. */
+uint32_t thepx_shader_build(const char *vert_src, const char *frag_src);
+bool thepx_shader_ready(uint32_t id);
+bool thepx_shader_linked(uint32_t id, const char *name);
 void thepx_shader_loc(uint32_t id, int *o_loc, const char **i_unif, int count);
 void thepx_shader_set_data(int loc, float *data, int v4count);
 void thepx_shader_set_tex(int loc, int *tex, int count, int texunit_offset);
@@ -85,7 +102,9 @@ void thepx_fb_use(uint32_t id);
 void thepx_fb_release(struct the_framebuffer_internal *fb);
 
 void thepx_clear(bool color, bool depth, bool stencil);
-void thepx_draw(int elem_count, int index_type);
+void thepx_draw(int first, int elem_count, int index_type);
+/* Streams the instance records to the GPU and draws them, see the_draw_cmd. */
+void thepx_draw_instanced(int first, int elem_count, int index_type, const float *instances, int instance_count, int instance_floats);
 void thepx_clear_color(float r, float g, float b, float a);
 void thepx_scissor_enable(void);
 void thepx_scissor_disable(void);
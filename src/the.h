@@ -2,16 +2,26 @@
  * TODO:
  *  - Better hash map
  *  - Strings
- *  - Scene graph
  *  - Memory tracking
  *  - Load shaders source from logic thread
  *  - Simplify render API
- *  - Data as relational tables
  */
 
+#include "core/anim.h"
+#include "core/batch.h"
+#include "core/bvh.h"
+#include "core/ecs.h"
+#include "core/impostor.h"
 #include "core/io.h"
+#include "core/log.h"
+#include "core/lz.h"
 #include "core/utils.h"
 #include "core/mem.h"
+#include "core/particles.h"
+#include "core/prefetch.h"
 #include "core/scene.h"
 #include "core/sched.h"
+#include "core/simd.h"
+#include "core/watch.h"
+#include "core/world.h"
 #include "render/pixels.h"
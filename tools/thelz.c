@@ -0,0 +1,58 @@
+#include "core/io.h"
+#include "core/lz.h"
+#include "core/mem.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Packs (or unpacks with -d) asset files: thelz [-d] input output */
+int
+main(int argc, char **argv)
+{
+	int unpack = argc == 4 && !strcmp(argv[1], "-d");
+	if (argc != 3 + unpack) {
+		printf("Usage: %s [-d] input output\n", argv[0]);
+		return 1;
+	}
+
+	const char *in_path = argv[1 + unpack];
+	const char *out_path = argv[2 + unpack];
+	char *data;
+	size_t size;
+	if (the_file_read(in_path, &data, &size) != THE_OK) {
+		return 1;
+	}
+	size -= 1; // the_file_read null terminator.
+
+	void *out = NULL;
+	size_t out_size = 0;
+	if (unpack) {
+		if (!the_lz_is_packed(data, size)) {
+			printf("%s is not packed.\n", in_path);
+			return 1;
+		}
+		out_size = the_lz_raw_size(data);
+		out = the_alloc(out_size + 1);
+		if (the_lz_unpack(data, size, out, out_size) != THE_OK) {
+			printf("%s is corrupted.\n", in_path);
+			return 1;
+		}
+	} else {
+		out = the_lz_pack(data, size, THE_LZ_DEFAULT_BLOCK_SIZE, &out_size);
+		if (!out) {
+			return 1;
+		}
+		printf("%zu -> %zu bytes (%.1f%%).\n", size, out_size, 100.0 * out_size / size);
+	}
+
+	FILE *f = fopen(out_path, "wb");
+	if (!f || fwrite(out, out_size, 1, f) != 1) {
+		printf("Could not write %s.\n", out_path);
+		return 1;
+	}
+
+	fclose(f);
+	the_free(out);
+	the_free(data);
+	return 0;
+}
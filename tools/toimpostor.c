@@ -0,0 +1,83 @@
+#include "core/impostor.h"
+#include "core/mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Uncompressed 32 bit TGA, first row at the top: loads with the rows in atlas order. */
+static int
+WriteTga(const char *path, const uint8_t *rgba, int size)
+{
+	uint8_t hdr[18] = { 0 };
+	hdr[2] = 2;
+	hdr[12] = size & 0xFF, hdr[13] = size >> 8;
+	hdr[14] = size & 0xFF, hdr[15] = size >> 8;
+	hdr[16] = 32;
+	hdr[17] = 0x28; // 8 alpha bits, top left origin.
+	FILE *f = fopen(path, "wb");
+	if (!f || fwrite(hdr, sizeof(hdr), 1, f) != 1) {
+		printf("Could not write %s.\n", path);
+		return 1;
+	}
+
+	uint8_t *bgra = the_alloc((size_t)size * size * 4);
+	for (size_t i = 0; i < (size_t)size * size; ++i) {
+		bgra[i * 4 + 0] = rgba[i * 4 + 2];
+		bgra[i * 4 + 1] = rgba[i * 4 + 1];
+		bgra[i * 4 + 2] = rgba[i * 4 + 0];
+		bgra[i * 4 + 3] = rgba[i * 4 + 3];
+	}
+	int err = fwrite(bgra, (size_t)size * size * 4, 1, f) != 1;
+	the_free(bgra);
+	fclose(f);
+	if (err) {
+		printf("Could not write %s.\n", path);
+	}
+	return err;
+}
+
+/*
+ * Bakes the octahedral impostor atlases of a mesh (core/impostor.h):
+ * toimpostor mesh output [frames frame_size [albedo [tiling]]]
+ * Writes output_A.tga (albedo, coverage) and output_N.tga (normal, depth).
+ */
+int
+main(int argc, char **argv)
+{
+	if (argc < 3 || argc == 4 || argc > 7) {
+		printf("Usage: %s mesh output [frames frame_size [albedo [tiling]]]\n", argv[0]);
+		return 1;
+	}
+
+	struct the_impostor_bake desc = {
+		.frames = argc > 4 ? atoi(argv[3]) : 8,
+		.frame_size = argc > 4 ? atoi(argv[4]) : 128,
+		.albedo = argc > 5 ? argv[5] : NULL,
+		.tiling = { 1.0f, 1.0f },
+		.color = { 1.0f, 1.0f, 1.0f },
+	};
+	if (argc > 6) {
+		desc.tiling[0] = desc.tiling[1] = (float)atof(argv[6]);
+	}
+	if (desc.frames <= 0 || desc.frame_size <= 0 || desc.frames * desc.frame_size > 16384) {
+		printf("Invalid atlas size.\n");
+		return 1;
+	}
+
+	struct the_impostor_atlas atlas;
+	if (the_impostor_bake(argv[1], &desc, &atlas) != THE_OK) {
+		return 1;
+	}
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s_A.tga", argv[2]);
+	int err = WriteTga(path, atlas.albedo, atlas.size);
+	snprintf(path, sizeof(path), "%s_N.tga", argv[2]);
+	err = err || WriteTga(path, atlas.normal, atlas.size);
+	if (!err) {
+		printf("%dx%d views of %d pixels, sphere (%g %g %g) radius %g.\n", desc.frames, desc.frames,
+		       desc.frame_size, atlas.sphere.x, atlas.sphere.y, atlas.sphere.z, atlas.sphere.w);
+	}
+	the_impostor_atlas_release(&atlas);
+	return err;
+}
@@ -1,6 +1,10 @@
 #include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define STSVCO_IDX_T unsigned short
 #define STS_VERTEX_CACHE_OPTIMIZER_STATIC
@@ -11,11 +15,32 @@
 
 typedef STSVCO_IDX_T index_t;
 
+#define LOD_MAX 4 // THE_MESH_MAX_LODS
+#define LOD_RATIO 0.5f // Index count of a level relative to the previous one.
+#define LOD_MIN_TRIS 32
+#define FLIP_COS2 0.25 // Squared cosine of the biggest normal rotation of a collapse (60 degrees).
+
+typedef struct lod_t {
+	uint32_t first;
+	uint32_t count;
+	float error;
+} lod_t;
+
+#define ATTR_DEFAULT 0x1F // Position, normal, tangent, bitangent and uv (the_vertex_attrib bits).
+#define ATTR_SKIN 0x60 // Joint indices and weights.
+#define SKIN_MAX_JOINTS 64 // THE_ANIM_MAX_JOINTS
+
+static const int attr_floats[7] = { 3, 3, 3, 3, 2, 4, 4 };
+
 typedef struct obj_t {
 	float *vert;
 	size_t vsz;
-	index_t *indices;
+	int stride; // Floats per vertex.
+	uint32_t attrib;
+	index_t *indices; // Every level, one after the other.
 	size_t isz;
+	lod_t lods[LOD_MAX];
+	int lod_count;
 } obj_t;
 
 static void
@@ -252,6 +277,491 @@ Load(const char *path, obj_t *obj)
 		}
 	}
 	obj->vsz = vit - obj->vert;
+	obj->stride = 14;
+	obj->attrib = ATTR_DEFAULT;
+}
+
+/* Reads the finest level of a .msh file, to add levels of detail to existing meshes. */
+static int
+LoadMsh(const char *path, obj_t *obj)
+{
+	char *data = NULL;
+	size_t size = 0;
+	ReadFile(NULL, path, 0, NULL, &data, &size);
+	if (!data || size < 2 * sizeof(size_t)) {
+		free(data);
+		return 0;
+	}
+
+	const char *p = data;
+	size_t vsz, isz;
+	memcpy(&vsz, p, sizeof(size_t));
+	p += sizeof(size_t);
+	obj->vsz = vsz / sizeof(float);
+	obj->vert = malloc(vsz);
+	memcpy(obj->vert, p, vsz);
+	p += vsz;
+	memcpy(&isz, p, sizeof(size_t));
+	p += sizeof(size_t);
+	obj->isz = isz / sizeof(index_t);
+
+	obj->attrib = ATTR_DEFAULT;
+	for (const char *b = p + isz; b + 8 <= data + size; b += 8) {
+		uint32_t value;
+		memcpy(&value, b + 4, sizeof(uint32_t));
+		if (!memcmp(b, "TATR", 4)) {
+			obj->attrib = value;
+		} else if (!memcmp(b, "TLOD", 4) && b + 8 + 12 <= data + size) {
+			memcpy(&value, b + 8 + 4, sizeof(uint32_t)); // Index count of the first level.
+			obj->isz = value;
+			break; // Last block.
+		} else {
+			break;
+		}
+	}
+	obj->stride = 0;
+	for (int i = 0; i < 7; ++i) {
+		obj->stride += (obj->attrib & (1 << i)) ? attr_floats[i] : 0;
+	}
+	obj->indices = malloc(obj->isz * sizeof(index_t));
+	memcpy(obj->indices, p, obj->isz * sizeof(index_t));
+	free(data);
+	return 1;
+}
+
+/*
+ * Level of detail simplification: edge collapses ordered by quadric error (Garland and
+ * Heckbert). Vertices collapse onto one of their neighbours, so every level indexes the
+ * same vertex buffer. Vertices on UV or normal seams (positions shared by several
+ * vertices) and on open borders never move, which keeps the attributes and the silhouette
+ * of holes intact at the cost of some reduction.
+ */
+typedef struct quadric_t {
+	double q[10]; // xx xy xz xw yy yz yw zz zw ww of the symmetric 4x4 matrix.
+	double area;
+} quadric_t;
+
+typedef struct collapse_t {
+	index_t from;
+	index_t to;
+	double cost;
+} collapse_t;
+
+static void
+QuadricAddPlane(quadric_t *q, const double *n, double d, double area)
+{
+	const double p[4] = { n[0], n[1], n[2], d };
+	int k = 0;
+	for (int i = 0; i < 4; ++i) {
+		for (int j = i; j < 4; ++j) {
+			q->q[k++] += p[i] * p[j] * area;
+		}
+	}
+	q->area += area;
+}
+
+static void
+QuadricAdd(quadric_t *q, const quadric_t *o)
+{
+	for (int i = 0; i < 10; ++i) {
+		q->q[i] += o->q[i];
+	}
+	q->area += o->area;
+}
+
+/* Sum of the area weighted squared distances from v to the planes of the quadric. */
+static double
+QuadricError(const quadric_t *q, const float *v)
+{
+	const double x = v[0], y = v[1], z = v[2];
+	const double *m = q->q;
+	double e = m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x +
+	  m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y + m[7] * z * z + 2.0 * m[8] * z + m[9];
+	return e > 0.0 ? e : 0.0;
+}
+
+static void
+TriNormal(double *n, const float *a, const float *b, const float *c)
+{
+	double e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	double e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+	n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+	n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+	n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+}
+
+static const float *sort_vert; // qsort has no user pointer.
+static int sort_stride;
+
+static int
+ComparePos(const void *a, const void *b)
+{
+	const float *pa = sort_vert + *(const index_t *)a * sort_stride;
+	const float *pb = sort_vert + *(const index_t *)b * sort_stride;
+	for (int i = 0; i < 3; ++i) {
+		if (pa[i] != pb[i]) {
+			return pa[i] < pb[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+static int
+CompareEdge(const void *a, const void *b)
+{
+	const uint32_t *ea = a, *eb = b;
+	if (ea[0] != eb[0]) {
+		return ea[0] < eb[0] ? -1 : 1;
+	}
+	return ea[1] < eb[1] ? -1 : (ea[1] > eb[1]);
+}
+
+static int
+CompareCollapse(const void *a, const void *b)
+{
+	double ca = ((const collapse_t *)a)->cost, cb = ((const collapse_t *)b)->cost;
+	return ca < cb ? -1 : (ca > cb);
+}
+
+/* Position id of every vertex (equal positions, equal id) and seam and border locks. */
+static void
+FindLocked(const obj_t *obj, const index_t *idx, size_t isz, uint32_t *pos_id, char *locked)
+{
+	size_t vcount = obj->vsz / obj->stride;
+	index_t *order = malloc(vcount * sizeof(index_t));
+	uint32_t *shared = calloc(vcount, sizeof(uint32_t)); // Vertices per position id.
+	char *border = calloc(vcount, 1); // By position id.
+	for (size_t i = 0; i < vcount; ++i) {
+		order[i] = i;
+	}
+	sort_vert = obj->vert;
+	sort_stride = obj->stride;
+	qsort(order, vcount, sizeof(index_t), ComparePos);
+	uint32_t id = 0;
+	for (size_t i = 0; i < vcount; ++i) {
+		if (i && ComparePos(&order[i - 1], &order[i])) {
+			++id;
+		}
+		pos_id[order[i]] = id;
+		shared[id]++;
+	}
+
+	/* Edges of a single triangle (by position, seams are not borders) are borders. */
+	uint32_t(*edges)[2] = malloc(isz * sizeof(*edges));
+	for (size_t t = 0; t < isz; t += 3) {
+		for (int k = 0; k < 3; ++k) {
+			uint32_t a = pos_id[idx[t + k]], b = pos_id[idx[t + (k + 1) % 3]];
+			edges[t + k][0] = a < b ? a : b;
+			edges[t + k][1] = a < b ? b : a;
+		}
+	}
+	qsort(edges, isz, sizeof(*edges), CompareEdge);
+	for (size_t i = 0; i < isz;) {
+		size_t j = i + 1;
+		while (j < isz && !CompareEdge(edges[i], edges[j])) {
+			++j;
+		}
+		if (j - i == 1) {
+			border[edges[i][0]] = border[edges[i][1]] = 1;
+		}
+		i = j;
+	}
+
+	for (size_t i = 0; i < vcount; ++i) {
+		locked[i] = shared[pos_id[i]] > 1 || border[pos_id[i]];
+	}
+	free(edges);
+	free(border);
+	free(shared);
+	free(order);
+}
+
+/*
+ * Simplifies the triangles of idx into dst until at most target indices are left or no
+ * collapse is possible. Returns the index count, *error gets the biggest collapse error
+ * as a distance (root of the area weighted mean of the squared plane distances).
+ */
+static size_t
+Simplify(const obj_t *obj, const index_t *idx, size_t isz, index_t *dst, size_t target, float *error)
+{
+	size_t vcount = obj->vsz / obj->stride;
+	const int stride = obj->stride;
+	const float *vert = obj->vert;
+	uint32_t *pos_id = malloc(vcount * sizeof(uint32_t));
+	char *locked = malloc(vcount);
+	char *dirty = malloc(vcount);
+	quadric_t *quadrics = calloc(vcount, sizeof(quadric_t));
+	uint32_t *adj_first = malloc((vcount + 1) * sizeof(uint32_t));
+	uint32_t *adj = malloc(isz * sizeof(uint32_t));
+	collapse_t *collapses = malloc(isz * sizeof(collapse_t));
+	FindLocked(obj, idx, isz, pos_id, locked);
+
+	memcpy(dst, idx, isz * sizeof(index_t));
+	for (size_t t = 0; t < isz; t += 3) {
+		const float *a = vert + dst[t] * stride, *b = vert + dst[t + 1] * stride, *c = vert + dst[t + 2] * stride;
+		double n[3];
+		TriNormal(n, a, b, c);
+		double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (len == 0.0) {
+			continue;
+		}
+		n[0] /= len;
+		n[1] /= len;
+		n[2] /= len;
+		double d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+		for (int k = 0; k < 3; ++k) {
+			QuadricAddPlane(&quadrics[dst[t + k]], n, d, len * 0.5);
+		}
+	}
+
+	double max_error = 0.0;
+	while (isz > target) {
+		/* Triangles around each vertex. */
+		memset(adj_first, 0, (vcount + 1) * sizeof(uint32_t));
+		for (size_t i = 0; i < isz; ++i) {
+			adj_first[dst[i] + 1]++;
+		}
+		for (size_t v = 0; v < vcount; ++v) {
+			adj_first[v + 1] += adj_first[v];
+		}
+		for (size_t i = 0; i < isz; ++i) {
+			adj[adj_first[dst[i]]++] = i / 3;
+		}
+		for (size_t v = vcount; v > 0; --v) {
+			adj_first[v] = adj_first[v - 1];
+		}
+		adj_first[0] = 0;
+
+		/* Cheapest direction of every edge. */
+		size_t collapse_count = 0;
+		for (size_t t = 0; t < isz; t += 3) {
+			for (int k = 0; k < 3; ++k) {
+				index_t a = dst[t + k], b = dst[t + (k + 1) % 3];
+				if (a > b && !locked[a] && !locked[b]) {
+					continue; // Both directions seen from the other triangle.
+				}
+				collapse_t best = { .cost = DBL_MAX };
+				for (int dir = 0; dir < 2; ++dir) {
+					index_t from = dir ? b : a, to = dir ? a : b;
+					if (locked[from]) {
+						continue;
+					}
+					quadric_t q = quadrics[from];
+					QuadricAdd(&q, &quadrics[to]);
+					double cost = QuadricError(&q, vert + to * stride);
+					if (cost < best.cost) {
+						best = (collapse_t){ from, to, cost };
+					}
+				}
+				if (best.cost < DBL_MAX) {
+					collapses[collapse_count++] = best;
+				}
+			}
+		}
+		qsort(collapses, collapse_count, sizeof(collapse_t), CompareCollapse);
+
+		/*
+		 * Greedy pass: a collapse touches the triangles around `from`, so its neighbours
+		 * wait for the next pass, when the adjacency is rebuilt.
+		 */
+		memset(dirty, 0, vcount);
+		size_t removed = 0;
+		for (size_t c = 0; c < collapse_count && isz - removed > target; ++c) {
+			index_t from = collapses[c].from, to = collapses[c].to;
+			if (dirty[from] || dirty[to]) {
+				continue;
+			}
+
+			/* Reject collapses flipping or folding a triangle that survives. */
+			int flips = 0;
+			for (uint32_t a = adj_first[from]; a < adj_first[from + 1] && !flips; ++a) {
+				index_t *tri = dst + adj[a] * 3;
+				if (tri[0] == to || tri[1] == to || tri[2] == to) {
+					continue;
+				}
+				const float *p[3], *q[3];
+				for (int k = 0; k < 3; ++k) {
+					p[k] = vert + tri[k] * stride;
+					q[k] = vert + (tri[k] == from ? to : tri[k]) * stride;
+				}
+				double n0[3], n1[3];
+				TriNormal(n0, p[0], p[1], p[2]);
+				TriNormal(n1, q[0], q[1], q[2]);
+				double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+				double len2 = (n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2]) *
+				  (n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2]);
+				flips = dot <= 0.0 || dot * dot < FLIP_COS2 * len2;
+			}
+			if (flips) {
+				continue;
+			}
+
+			for (uint32_t a = adj_first[from]; a < adj_first[from + 1]; ++a) {
+				index_t *tri = dst + adj[a] * 3;
+				int degenerate = tri[0] == to || tri[1] == to || tri[2] == to;
+				for (int k = 0; k < 3; ++k) {
+					dirty[tri[k]] = 1;
+					tri[k] = tri[k] == from ? to : tri[k];
+				}
+				if (degenerate) {
+					tri[0] = tri[1] = tri[2] = to;
+					removed += 3;
+				}
+			}
+			QuadricAdd(&quadrics[to], &quadrics[from]);
+			double e = QuadricError(&quadrics[to], vert + to * stride) / quadrics[to].area;
+			max_error = e > max_error ? e : max_error;
+		}
+		if (!removed) {
+			break;
+		}
+
+		size_t n = 0;
+		for (size_t t = 0; t < isz; t += 3) {
+			if (dst[t] != dst[t + 1] || dst[t] != dst[t + 2]) {
+				dst[n++] = dst[t];
+				dst[n++] = dst[t + 1];
+				dst[n++] = dst[t + 2];
+			}
+		}
+		isz = n;
+	}
+
+	*error = sqrt(max_error);
+	free(collapses);
+	free(adj);
+	free(adj_first);
+	free(quadrics);
+	free(dirty);
+	free(locked);
+	free(pos_id);
+	return isz;
+}
+
+/* Appends coarser levels to obj->indices until one stops shrinking or gets too small. */
+static void
+BuildLods(obj_t *obj)
+{
+	size_t base = obj->isz;
+	obj->lods[0] = (lod_t){ 0, base, 0.0f };
+	obj->lod_count = 1;
+	obj->indices = realloc(obj->indices, base * LOD_MAX * sizeof(index_t));
+	while (obj->lod_count < LOD_MAX) {
+		const lod_t *prev = &obj->lods[obj->lod_count - 1];
+		size_t target = (size_t)(prev->count * LOD_RATIO) / 3 * 3;
+		if (target < LOD_MIN_TRIS * 3) {
+			break;
+		}
+		lod_t *lod = &obj->lods[obj->lod_count];
+		lod->first = obj->isz;
+		lod->count = Simplify(obj, obj->indices, base, obj->indices + obj->isz, target, &lod->error);
+		if (lod->count > prev->count * 0.8f) {
+			break; // Mostly locked vertices, not worth a level.
+		}
+		stsvco_optimize(obj->indices + lod->first, lod->count, obj->vsz / obj->stride, 64);
+		printf("LOD %d: %u indices, error %g.\n", obj->lod_count, lod->count, lod->error);
+		obj->isz += lod->count;
+		obj->lod_count++;
+	}
+}
+
+/*
+ * Skinning weights from a skeleton (the text format of the_skeleton_load). Every bone, from
+ * a joint to one of its children, pulls the vertices around it for the parent joint, end
+ * joints pull with their position alone. Vertices keep the 4 joints closest to them,
+ * weighted by inverse squared distance.
+ */
+static int
+Skin(const char *path, obj_t *obj)
+{
+	char *text = NULL;
+	size_t size = 0;
+	ReadFile(NULL, path, 0, NULL, &text, &size);
+	if (!text) {
+		printf("Error loading skeleton %s.\n", path);
+		return 0;
+	}
+	text[size] = '\0';
+
+	float joint[SKIN_MAX_JOINTS][3];
+	int parent[SKIN_MAX_JOINTS];
+	int has_child[SKIN_MAX_JOINTS] = { 0 };
+	int joint_count = 0;
+	for (char *l = strtok(text, "\n"); l; l = strtok(NULL, "\n")) {
+		char name[32];
+		if (*l == '#' || *l == '\r' || joint_count == SKIN_MAX_JOINTS ||
+		    sscanf(l, "%31s %d %f %f %f", name, &parent[joint_count], &joint[joint_count][0],
+		           &joint[joint_count][1], &joint[joint_count][2]) != 5) {
+			continue;
+		}
+		if (parent[joint_count] >= 0) {
+			has_child[parent[joint_count]] = 1;
+		}
+		joint_count++;
+	}
+	free(text);
+	printf("%d joints.\n", joint_count);
+
+	int base = obj->stride - ((obj->attrib & ATTR_SKIN) ? 8 : 0);
+	size_t vcount = obj->vsz / obj->stride;
+	float *vert = malloc(vcount * (base + 8) * sizeof(float));
+	for (size_t v = 0; v < vcount; ++v) {
+		const float *src = obj->vert + v * obj->stride;
+		float *dst = vert + v * (base + 8);
+		memcpy(dst, src, base * sizeof(float));
+
+		/* Squared distance from the vertex to the bones of each joint. */
+		float dist[SKIN_MAX_JOINTS];
+		for (int j = 0; j < joint_count; ++j) {
+			dist[j] = FLT_MAX;
+		}
+		for (int j = 0; j < joint_count; ++j) {
+			int owner = parent[j] >= 0 ? parent[j] : j;
+			const float *a = parent[j] >= 0 ? joint[parent[j]] : joint[j];
+			const float *b = joint[j];
+			for (int end = 0; end < 1 + !has_child[j]; ++end) {
+				if (end) { // End joints: the bone tip pulls for the joint itself.
+					owner = j;
+					a = joint[j];
+				}
+				float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+				float ap[3] = { src[0] - a[0], src[1] - a[1], src[2] - a[2] };
+				float len2 = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+				float t = len2 > 0.0f ? (ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2]) / len2 : 0.0f;
+				t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+				float d[3] = { ap[0] - ab[0] * t, ap[1] - ab[1] * t, ap[2] - ab[2] * t };
+				float d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+				dist[owner] = d2 < dist[owner] ? d2 : dist[owner];
+			}
+		}
+
+		float *joints = dst + base, *weights = dst + base + 4;
+		float sum = 0.0f;
+		for (int k = 0; k < 4; ++k) {
+			int best = -1;
+			for (int j = 0; j < joint_count; ++j) {
+				if (dist[j] < FLT_MAX && (best < 0 || dist[j] < dist[best])) {
+					best = j;
+				}
+			}
+			joints[k] = best >= 0 ? best : 0;
+			weights[k] = best >= 0 ? 1.0f / ((dist[best] + 1e-4f) * (dist[best] + 1e-4f)) : 0.0f;
+			sum += weights[k];
+			if (best >= 0) {
+				dist[best] = FLT_MAX;
+			}
+		}
+		for (int k = 0; k < 4; ++k) {
+			weights[k] = sum > 0.0f ? weights[k] / sum : (k == 0);
+		}
+	}
+
+	free(obj->vert);
+	obj->vert = vert;
+	obj->vsz = vcount * (base + 8);
+	obj->stride = base + 8;
+	obj->attrib |= ATTR_SKIN;
+	return 1;
 }
 
 static void Export(const char *path, obj_t *obj)
@@ -270,21 +780,56 @@ static void Export(const char *path, obj_t *obj)
 	fwrite(&isz, sizeof(size_t), 1, f);
 	fwrite(obj->indices, isz, 1, f);
 
+	// Vertex attributes, when they are not the default ones
+	if (obj->attrib != ATTR_DEFAULT) {
+		fwrite("TATR", 4, 1, f);
+		fwrite(&obj->attrib, sizeof(uint32_t), 1, f);
+	}
+
+	// LOD table: ranges of the index block
+	uint32_t lod_count = obj->lod_count;
+	fwrite("TLOD", 4, 1, f);
+	fwrite(&lod_count, sizeof(uint32_t), 1, f);
+	for (int i = 0; i < obj->lod_count; ++i) {
+		fwrite(&obj->lods[i].first, sizeof(uint32_t), 1, f);
+		fwrite(&obj->lods[i].count, sizeof(uint32_t), 1, f);
+		fwrite(&obj->lods[i].error, sizeof(float), 1, f);
+	}
+
 	fclose(f);
 }
 
 int
 main(int argc, char **argv)
 {
+	if (argc < 3) {
+		printf("Usage: tomesh <in.obj|in.msh> <out.msh> [skeleton.skl]\n");
+		return 1;
+	}
+
 	obj_t obj;
-	Load(argv[1], &obj);
+	size_t len = strlen(argv[1]);
+	if (len > 4 && !strcmp(argv[1] + len - 4, ".msh")) {
+		if (!LoadMsh(argv[1], &obj)) {
+			printf("Error loading msh %s.\n", argv[1]);
+			return 1;
+		}
+	} else {
+		Load(argv[1], &obj);
+	}
 	float acmr = stsvco_compute_ACMR(obj.indices, obj.isz, 64);
 	printf("ACMR before: %f\n", acmr);
-	stsvco_optimize(obj.indices, obj.isz, obj.vsz, 64);
+	stsvco_optimize(obj.indices, obj.isz, obj.vsz / obj.stride, 64);
 	acmr = stsvco_compute_ACMR(obj.indices, obj.isz, 64);
 	printf("ACMR after: %f\n", acmr);
 
-	printf("%zu vtcs, %zu indices.\n", obj.vsz / 14, obj.isz);
+	printf("%zu vtcs, %zu indices.\n", obj.vsz / obj.stride, obj.isz);
+
+	if (argc > 3 && !Skin(argv[3], &obj)) {
+		return 1;
+	}
+
+	BuildLods(&obj);
 
 	Export(argv[2], &obj);
 	return 0;